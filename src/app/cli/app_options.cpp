@@ -37,6 +37,7 @@ AppOptions::AppOptions(int argc, const char* argv[])
   , m_scale(m_po.add("scale").requiresValue("<factor>").description("Resize all previously opened sprites"))
   , m_ditheringAlgorithm(m_po.add("dithering-algorithm").requiresValue("<algorithm>").description("Dithering algorithm used in --color-mode\nto convert images from RGB to Indexed\n  none\n  ordered\n  old"))
   , m_ditheringMatrix(m_po.add("dithering-matrix").requiresValue("<id>").description("Matrix used in ordered dithering algorithm\n  bayer2x2\n  bayer4x4\n  bayer8x8\n  filename.png"))
+  , m_quantizationAlgorithm(m_po.add("quantization-algorithm").requiresValue("<algorithm>").description("Create a new palette for each sprite\nconverted to indexed in --color-mode\n  median-cut\n  kmeans"))
   , m_colorMode(m_po.add("color-mode").requiresValue("<mode>").description("Change color mode of all previously\nopened sprites:\n  rgb\n  grayscale\n  indexed"))
   , m_shrinkTo(m_po.add("shrink-to").requiresValue("width,height").description("Shrink each sprite if it is\nlarger than width or height"))
   , m_data(m_po.add("data").requiresValue("<filename.json>").description("File to store the sprite sheet metadata"))
@@ -51,6 +51,7 @@ public:
   const Option& scale() const { return m_scale; }
   const Option& ditheringAlgorithm() const { return m_ditheringAlgorithm; }
   const Option& ditheringMatrix() const { return m_ditheringMatrix; }
+  const Option& quantizationAlgorithm() const { return m_quantizationAlgorithm; }
   const Option& colorMode() const { return m_colorMode; }
   const Option& shrinkTo() const { return m_shrinkTo; }
   const Option& data() const { return m_data; }
@@ -115,6 +116,7 @@ private:
   Option& m_scale;
   Option& m_ditheringAlgorithm;
   Option& m_ditheringMatrix;
+  Option& m_quantizationAlgorithm;
   Option& m_colorMode;
   Option& m_shrinkTo;
   Option& m_data;
@@ -30,6 +30,7 @@
 #include "doc/selected_frames.h"
 #include "doc/selected_layers.h"
 #include "doc/slice.h"
+#include "doc/sprite.h"
 #include "doc/tag.h"
 #include "doc/tags.h"
 #include "render/dithering_algorithm.h"
@@ -199,6 +200,7 @@ int CliProcessor::process(Context* ctx)
     Doc* lastDoc = nullptr;
     render::DitheringAlgorithm ditheringAlgorithm = render::DitheringAlgorithm::None;
     std::string ditheringMatrix;
+    std::string quantizationAlgorithm;
 
     for (const auto& value : m_options.values()) {
       const AppOptions::Option* opt = value.option();
@@ -455,6 +457,16 @@ int CliProcessor::process(Context* ctx)
         else if (opt == &m_options.ditheringMatrix()) {
           ditheringMatrix = value.value();
         }
+        // --quantization-algorithm <algorithm>
+        else if (opt == &m_options.quantizationAlgorithm()) {
+          if (value.value() == "median-cut" ||
+              value.value() == "kmeans")
+            quantizationAlgorithm = value.value();
+          else
+            throw std::runtime_error("--quantization-algorithm needs a valid algorithm name\n"
+                                     "Usage: --quantization-algorithm <algorithm>\n"
+                                     "Where <algorithm> can be median-cut or kmeans");
+        }
         // --color-mode <mode>
         else if (opt == &m_options.colorMode()) {
           Command* command = Commands::instance()->byId(CommandId::ChangePixelFormat());
@@ -495,6 +507,19 @@ int CliProcessor::process(Context* ctx)
 
           for (auto doc : ctx->documents()) {
             ctx->setActiveDocument(doc);
+
+            // Create a new palette for RGB sprites
+            if (!quantizationAlgorithm.empty() &&
+                value.value() == "indexed" &&
+                doc->sprite()->pixelFormat() == doc::IMAGE_RGB) {
+              Params quantizationParams;
+              quantizationParams.set("ui", "false");
+              quantizationParams.set("algorithm", quantizationAlgorithm.c_str());
+              ctx->executeCommand(
+                Commands::instance()->byId(CommandId::ColorQuantization()),
+                quantizationParams);
+            }
+
             ctx->executeCommand(command, params);
           }
         }
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -89,6 +90,11 @@ size_t Cmd::memSize() const
   return onMemSize();
 }
 
+void Cmd::setUndoBufferCounter(UndoBufferCounter* counter)
+{
+  onSetUndoBufferCounter(counter);
+}
+
 void Cmd::onExecute()
 {
   // Do nothing
@@ -119,4 +125,9 @@ size_t Cmd::onMemSize() const {
   return sizeof(*this);
 }
 
+void Cmd::onSetUndoBufferCounter(UndoBufferCounter* counter)
+{
+  // Do nothing
+}
+
 } // namespace app
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -16,6 +17,7 @@
 namespace app {
 
   class Context;
+  class UndoBufferCounter;
 
   class Cmd : public undo::UndoCommand {
   public:
@@ -32,6 +34,10 @@ namespace app {
     std::string label() const;
     size_t memSize() const;
 
+    // Sets the counter of the memory used by the undo buffers of
+    // this command (see UndoBuffer).
+    void setUndoBufferCounter(UndoBufferCounter* counter);
+
     Context* context() const { return m_ctx; }
 
   protected:
@@ -41,6 +47,7 @@ namespace app {
     virtual void onFireNotifications();
     virtual std::string onLabel() const;
     virtual size_t onMemSize() const;
+    virtual void onSetUndoBufferCounter(UndoBufferCounter* counter);
 
   private:
     Context* m_ctx;
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -90,11 +91,13 @@ void ClearMask::clear()
   Mask* mask = doc->mask();
 
   doc::algorithm::fill_selection(image, m_offset, mask, m_bgcolor);
+  image->incrementVersion();
 }
 
 void ClearMask::restore()
 {
   copy_image(m_dstImage->image(), m_copy.get(), m_boundsX, m_boundsY);
+  m_dstImage->image()->incrementVersion();
 }
 
 } // namespace cmd
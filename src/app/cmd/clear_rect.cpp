@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -77,11 +78,13 @@ void ClearRect::clear()
             m_offsetX + m_copy->width() - 1,
             m_offsetY + m_copy->height() - 1,
             m_bgcolor);
+  m_dstImage->image()->incrementVersion();
 }
 
 void ClearRect::restore()
 {
   copy_image(m_dstImage->image(), m_copy.get(), m_offsetX, m_offsetY);
+  m_dstImage->image()->incrementVersion();
 }
 
 } // namespace cmd
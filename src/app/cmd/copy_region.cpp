@@ -39,7 +39,8 @@ CopyRegion::CopyRegion(Image* dst, const Image* src,
     m_region.createUnion(m_region, gfx::Region(clip.dstBounds()));
   }
 
-  save_image_region_in_buffer(m_region, src, dstPos, m_buffer);
+  UndoBuffer::Lock lock(m_buffer);
+  save_image_region_in_buffer(m_region, src, dstPos, lock.data());
 }
 
 void CopyRegion::onExecute()
@@ -63,7 +64,8 @@ void CopyRegion::swap()
   Image* image = this->image();
   ASSERT(image);
 
-  swap_image_region_with_buffer(m_region, image, m_buffer);
+  UndoBuffer::Lock lock(m_buffer);
+  swap_image_region_with_buffer(m_region, image, lock.data());
   image->incrementVersion();
 }
 
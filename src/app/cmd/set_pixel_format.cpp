@@ -22,10 +22,15 @@
 #include "doc/document.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
+#include "doc/rgbmap.h"
 #include "doc/sprite.h"
 #include "render/quantization.h"
 #include "render/task_delegate.h"
 
+#include <algorithm>
+#include <memory>
+#include <vector>
+
 namespace app {
 namespace cmd {
 
@@ -35,16 +40,16 @@ namespace {
 
 class SuperDelegate : public render::TaskDelegate {
 public:
-  SuperDelegate(int ncels, render::TaskDelegate* delegate)
-    : m_ncels(ncels)
-    , m_curCel(0)
+  SuperDelegate(int nsteps, render::TaskDelegate* delegate)
+    : m_nsteps(nsteps)
+    , m_curStep(0)
     , m_delegate(delegate) {
   }
 
   void notifyTaskProgress(double progress) override {
     if (m_delegate)
       m_delegate->notifyTaskProgress(
-        (progress + m_curCel) / m_ncels);
+        (progress + m_curStep) / m_nsteps);
   }
 
   bool continueTask() override {
@@ -54,13 +59,13 @@ public:
       return true;
   }
 
-  void nextCel() {
-    ++m_curCel;
+  void nextStep() {
+    ++m_curStep;
   }
 
 private:
-  int m_ncels;
-  int m_curCel;
+  int m_nsteps;
+  int m_curStep;
   TaskDelegate* m_delegate;
 };
 
@@ -77,22 +82,59 @@ SetPixelFormat::SetPixelFormat(Sprite* sprite,
   if (sprite->pixelFormat() == newFormat)
     return;
 
-  SuperDelegate superDel(sprite->uniqueCels().size(), delegate);
-
+  // Group cels by palette, so we need just one RgbMap for each group
+  // of cels converted in parallel.
+  std::vector<std::pair<Palette*, CelList> > groups;
   for (Cel* cel : sprite->uniqueCels()) {
-    ImageRef old_image = cel->imageRef();
-    ImageRef new_image(
-      render::convert_pixel_format
-      (old_image.get(), nullptr, newFormat,
-       dithering,
-       sprite->rgbMap(cel->frame()),
-       sprite->palette(cel->frame()),
-       cel->layer()->isBackground(),
-       old_image->maskColor(),
-       &superDel));
-
-    m_seq.add(new cmd::ReplaceImage(sprite, old_image, new_image));
-    superDel.nextCel();
+    Palette* palette = sprite->palette(cel->frame());
+    auto it = std::find_if(
+      groups.begin(), groups.end(),
+      [palette](const std::pair<Palette*, CelList>& group) {
+        return group.first == palette;
+      });
+    if (it == groups.end()) {
+      groups.push_back(std::make_pair(palette, CelList()));
+      it = groups.end()-1;
+    }
+    it->second.push_back(cel);
+  }
+
+  // Same mask index used in Sprite::rgbMap()
+  const int maskIndex =
+    (sprite->backgroundLayer() ? -1: sprite->transparentColor());
+
+  SuperDelegate superDel(int(groups.size()), delegate);
+
+  for (const auto& group : groups) {
+    Palette* palette = group.first;
+
+    // A precomputed RgbMap can be used from several threads
+    std::unique_ptr<RgbMap> rgbmap;
+    if (newFormat == IMAGE_INDEXED) {
+      rgbmap.reset(new RgbMap(RgbMap::Mode::Precomputed));
+      rgbmap->regenerate(palette, maskIndex);
+    }
+
+    std::vector<render::PixelFormatJob> jobs;
+    for (Cel* cel : group.second) {
+      render::PixelFormatJob job;
+      job.src = cel->image();
+      job.rgbmap = rgbmap.get();
+      job.palette = palette;
+      job.isBackground = cel->layer()->isBackground();
+      job.newMaskColor = cel->image()->maskColor();
+      jobs.push_back(job);
+    }
+
+    if (!render::convert_pixel_format_batch(jobs, newFormat,
+                                            dithering, &superDel))
+      return;                   // Canceled
+
+    for (int i=0; i<int(jobs.size()); ++i)
+      m_seq.add(new cmd::ReplaceImage(sprite,
+                                      group.second[i]->imageRef(),
+                                      jobs[i].dst));
+    superDel.nextStep();
   }
 
   // Set all cels opacity to 100% if we are converting to indexed.
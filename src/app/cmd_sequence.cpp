@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -55,6 +56,12 @@ size_t CmdSequence::onMemSize() const
   return size;
 }
 
+void CmdSequence::onSetUndoBufferCounter(UndoBufferCounter* counter)
+{
+  for (auto it = m_cmds.begin(), end=m_cmds.end(); it!=end; ++it)
+    (*it)->setUndoBufferCounter(counter);
+}
+
 void CmdSequence::executeAndAdd(Cmd* cmd)
 {
   cmd->execute(context());
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -26,6 +27,7 @@ namespace app {
     void onUndo() override;
     void onRedo() override;
     size_t onMemSize() const override;
+    void onSetUndoBufferCounter(UndoBufferCounter* counter) override;
 
     // Helper to create a CmdSequence in the same onExecute() member
     // function.
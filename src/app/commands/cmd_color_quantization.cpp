@@ -24,6 +24,7 @@
 #include "doc/palette.h"
 #include "doc/sprite.h"
 #include "render/quantization.h"
+#include "render/quantization_algorithm.h"
 
 #include "palette_from_sprite.xml.h"
 
@@ -36,6 +37,7 @@ struct ColorQuantizationParams : public NewParams {
   Param<bool> withAlpha { this, true, "withAlpha" };
   Param<int> maxColors { this, 256, "maxColors" };
   Param<bool> useRange { this, false, "useRange" };
+  Param<render::QuantizationAlgorithm> algorithm { this, render::QuantizationAlgorithm::MedianCut, "algorithm" };
 };
 
 class ColorQuantizationCommand : public CommandWithNewParams<ColorQuantizationParams> {
@@ -67,6 +69,7 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
 
   bool withAlpha = params().withAlpha();
   int maxColors = params().maxColors();
+  render::QuantizationAlgorithm algorithm = params().algorithm();
   bool createPal;
 
   Site site = ctx->activeSite();
@@ -81,9 +84,12 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
 
       if (!params().withAlpha.isSet())
         withAlpha = App::instance()->preferences().quantization.withAlpha();
+      if (!params().algorithm.isSet())
+        algorithm = App::instance()->preferences().quantization.algorithm();
 
       window.newPalette()->setSelected(true);
       window.alphaChannel()->setSelected(withAlpha);
+      window.algorithm()->setSelectedItemIndex(int(algorithm));
       window.ncolors()->setTextf("%d", maxColors);
 
       if (entries.picks() > 1) {
@@ -107,7 +113,9 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
 
     maxColors = window.ncolors()->textInt();
     withAlpha = window.alphaChannel()->isSelected();
+    algorithm = (render::QuantizationAlgorithm)window.algorithm()->getSelectedItemIndex();
     App::instance()->preferences().quantization.withAlpha(withAlpha);
+    App::instance()->preferences().quantization.algorithm(algorithm);
 
     if (window.newPalette()->isSelected()) {
       createPal = true;
@@ -141,12 +149,13 @@ void ColorQuantizationCommand::onExecute(Context* ctx)
     SpriteJob job(reader, "Color Quantization");
     const bool newBlend = Preferences::instance().experimental.newBlend();
     job.startJobWithCallback(
-      [sprite, withAlpha, &tmpPalette, &job, newBlend]{
+      [sprite, withAlpha, &tmpPalette, &job, newBlend, algorithm]{
         render::create_palette_from_sprite(
           sprite, 0, sprite->lastFrame(),
           withAlpha, &tmpPalette,
-          &job,
-          newBlend);     // SpriteJob is a render::TaskDelegate
+          &job,          // SpriteJob is a render::TaskDelegate
+          newBlend,
+          algorithm);
       });
     job.waitJob();
     if (job.isCanceled())
@@ -20,6 +20,7 @@
 #include "app/doc.h"
 #include "app/ini_file.h"
 #include "app/modules/palettes.h"
+#include "app/pref/preferences.h"
 #include "app/site.h"
 #include "app/transaction.h"
 #include "app/ui/color_bar.h"
@@ -40,15 +41,118 @@
 #include "ui/view.h"
 #include "ui/widget.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstdlib>
 #include <cstring>
+#include <exception>
+#include <mutex>
 #include <set>
+#include <thread>
+#include <vector>
 
 namespace app {
 
 using namespace std;
 using namespace ui;
 
+namespace {
+
+// Number of rows that a worker thread processes in each step when the
+// filter is applied in parallel.
+const int kRowsPerBand = 16;
+
+// Maximum memory used by cels being filtered in parallel (source and
+// destination images) that are not yet added to the transaction.
+const std::size_t kMaxMemoryForCelsInFlight = 512*1024*1024;
+
+} // anonymous namespace
+
+class FilterManagerImpl::RowBand : public FilterManager {
+public:
+  RowBand(FilterManagerImpl* mgr,
+          const doc::Image* src,
+          doc::Image* dst,
+          const Target target)
+    : m_mgr(mgr)
+    , m_src(src)
+    , m_dst(dst)
+    , m_target(target)
+    , m_row(0) {
+  }
+
+  // Applies the filter to the given row (relative to m_bounds). It's
+  // the same code as FilterManagerImpl::applyStep() but with a
+  // separated state for each thread.
+  bool applyRow(int row) {
+    const gfx::Rect& bounds = m_mgr->m_bounds;
+    const doc::Mask* mask = m_mgr->m_mask;
+
+    m_row = row;
+
+    if (mask && mask->bitmap()) {
+      int x = bounds.x - mask->bounds().x;
+      int y = bounds.y - mask->bounds().y + m_row;
+      if ((x >= bounds.w) ||
+          (y >= bounds.h))
+        return false;
+
+      m_maskBits = mask->bitmap()
+        ->lockBits<BitmapTraits>(Image::ReadLock,
+          gfx::Rect(x, y, bounds.w - x, bounds.h - y));
+
+      m_maskIterator = m_maskBits.begin();
+    }
+
+    switch (m_mgr->pixelFormat()) {
+      case IMAGE_RGB:       m_mgr->m_filter->applyToRgba(this); break;
+      case IMAGE_GRAYSCALE: m_mgr->m_filter->applyToGrayscale(this); break;
+      case IMAGE_INDEXED:   m_mgr->m_filter->applyToIndexed(this); break;
+    }
+
+    m_maskBits.unlock();
+    return true;
+  }
+
+  // FilterManager implementation
+  doc::PixelFormat pixelFormat() const override { return m_mgr->pixelFormat(); }
+  const void* getSourceAddress() override {
+    return m_src->getPixelAddress(m_mgr->m_bounds.x,
+                                  m_mgr->m_bounds.y+m_row);
+  }
+  void* getDestinationAddress() override {
+    return m_dst->getPixelAddress(m_mgr->m_bounds.x,
+                                  m_mgr->m_bounds.y+m_row);
+  }
+  int getWidth() override { return m_mgr->m_bounds.w; }
+  Target getTarget() override { return m_target; }
+  FilterIndexedData* getIndexedData() override { return m_mgr; }
+  bool skipPixel() override {
+    bool skip = false;
+    if ((m_mgr->m_mask) && (m_mgr->m_mask->bitmap())) {
+      if (!*m_maskIterator)
+        skip = true;
+      ++m_maskIterator;
+    }
+    return skip;
+  }
+  const doc::Image* getSourceImage() override { return m_src; }
+  int x() const override { return m_mgr->m_bounds.x; }
+  int y() const override { return m_mgr->m_bounds.y+m_row; }
+  bool isFirstRow() const override { return m_row == 0; }
+  bool isMaskActive() const override { return m_mgr->isMaskActive(); }
+
+private:
+  FilterManagerImpl* m_mgr;
+  const doc::Image* m_src;
+  doc::Image* m_dst;
+  Target m_target;
+  int m_row;
+  doc::ImageBits<doc::BitmapTraits> m_maskBits;
+  doc::ImageBits<doc::BitmapTraits>::iterator m_maskIterator;
+};
+
 FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   : m_reader(context)
   , m_site(*const_cast<Site*>(m_reader.site()))
@@ -62,6 +166,7 @@ FilterManagerImpl::FilterManagerImpl(Context* context, Filter* filter)
   , m_targetOrig(TARGET_ALL_CHANNELS)
   , m_target(TARGET_ALL_CHANNELS)
   , m_celsTarget(CelsTarget::Selected)
+  , m_multithreading(Preferences::instance().filters.multithreading())
   , m_oldPalette(nullptr)
   , m_progressDelegate(NULL)
 {
@@ -114,6 +219,11 @@ void FilterManagerImpl::setCelsTarget(CelsTarget celsTarget)
   m_celsTarget = celsTarget;
 }
 
+void FilterManagerImpl::setMultithreading(bool state)
+{
+  m_multithreading = state;
+}
+
 void FilterManagerImpl::begin()
 {
   Doc* document = m_site.document();
@@ -208,13 +318,18 @@ void FilterManagerImpl::apply()
   bool cancelled = false;
 
   begin();
-  while (!cancelled && applyStep()) {
-    if (m_progressDelegate) {
-      // Report progress.
-      m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_bounds.h);
+  if (canApplyInParallel()) {
+    cancelled = !applyInParallel();
+  }
+  else {
+    while (!cancelled && applyStep()) {
+      if (m_progressDelegate) {
+        // Report progress.
+        m_progressDelegate->reportProgress(m_progressBase + m_progressWidth * (m_row+1) / m_bounds.h);
 
-      // Does the user cancelled the whole process?
-      cancelled = m_progressDelegate->isCancelled();
+        // Does the user cancelled the whole process?
+        cancelled = m_progressDelegate->isCancelled();
+      }
     }
   }
 
@@ -222,24 +337,256 @@ void FilterManagerImpl::apply()
     gfx::Rect output;
     if (algorithm::shrink_bounds2(m_src.get(), m_dst.get(),
                                   m_bounds, output)) {
-      if (m_cel->layer()->isBackground()) {
-        (*m_tx)(
-          new cmd::CopyRegion(
-            m_cel->image(),
-            m_dst.get(),
-            gfx::Region(output),
-            position()));
+      patchCel(m_cel, m_dst.get(), output);
+    }
+  }
+}
+
+void FilterManagerImpl::patchCel(doc::Cel* cel,
+                                 doc::Image* dst,
+                                 const gfx::Rect& output)
+{
+  if (cel->layer()->isBackground()) {
+    (*m_tx)(
+      new cmd::CopyRegion(
+        cel->image(),
+        dst,
+        gfx::Region(output),
+        position()));
+  }
+  else {
+    // Patch "cel"
+    (*m_tx)(
+      new cmd::PatchCel(
+        cel, dst,
+        gfx::Region(output),
+        position()));
+  }
+}
+
+bool FilterManagerImpl::canApplyInParallel() const
+{
+  return
+    (m_multithreading &&
+     // RgbMap entries are calculated lazily (it's not safe to use
+     // the same RgbMap from several threads).
+     m_site.sprite()->pixelFormat() != IMAGE_INDEXED &&
+     m_bounds.h >= 2*kRowsPerBand &&
+     std::thread::hardware_concurrency() >= 2);
+}
+
+// Applies the filter to bands of kRowsPerBand rows using all the
+// available cores. The current thread works as one more worker, and
+// it's the only one that reports the progress and asks to the
+// IProgressDelegate if the process was cancelled (the delegate is not
+// thread-safe). Returns false if the process was cancelled.
+bool FilterManagerImpl::applyInParallel()
+{
+  ASSERT(m_row == 0);
+
+  // The palette is modified only once before the first row.
+  applyToPaletteIfNeeded();
+
+  const int nbands = (m_bounds.h + kRowsPerBand - 1) / kRowsPerBand;
+  const int nthreads =
+    std::min<int>(std::thread::hardware_concurrency(), nbands);
+
+  std::atomic<int> nextBand(0);
+  std::atomic<int> rowsDone(0);
+  std::atomic<bool> stop(false);
+
+  auto worker =
+    [this, nbands, &nextBand, &rowsDone, &stop](bool reportProgress) {
+      RowBand band(this, m_src.get(), m_dst.get(), m_target);
+      int band_i;
+      while (!stop && (band_i = nextBand++) < nbands) {
+        const int row1 = band_i * kRowsPerBand;
+        const int row2 = std::min(row1 + kRowsPerBand, m_bounds.h);
+        for (int row=row1; row<row2; ++row) {
+          if (!band.applyRow(row))
+            break;
+        }
+        rowsDone += row2 - row1;
+
+        if (reportProgress && m_progressDelegate) {
+          m_progressDelegate->reportProgress(
+            m_progressBase + m_progressWidth * rowsDone / m_bounds.h);
+
+          if (m_progressDelegate->isCancelled())
+            stop = true;
+        }
+      }
+    };
+
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.push_back(std::thread([&worker]{ worker(false); }));
+
+  worker(true);
+
+  for (auto& thread : threads)
+    thread.join();
+
+  m_row = m_bounds.h;
+  return !stop;
+}
+
+bool FilterManagerImpl::canApplyToCelsInParallel(const CelList& cels) const
+{
+  return
+    (m_multithreading &&
+     // Same restriction as canApplyInParallel()
+     m_site.sprite()->pixelFormat() != IMAGE_INDEXED &&
+     cels.size() >= 2 &&
+     std::thread::hardware_concurrency() >= 2);
+}
+
+// Applies the filter to several cels at the same time. Each worker
+// thread filters a whole cel (row by row), and the current thread
+// adds the cmd::PatchCel/CopyRegion commands to the transaction in
+// the same order of the given "cels" list (so the undo history is
+// exactly the same as applying the filter cel by cel).
+//
+// To limit the memory usage there is a maximum number of cels that
+// can be filtered and waiting to be added to the transaction (each
+// one needs a copy of the source and destination images).
+//
+// Returns false if the process was cancelled.
+bool FilterManagerImpl::applyToCelsInParallel(const CelList& cels)
+{
+  struct CelJob {
+    Cel* cel;
+    ImageRef dst;
+    gfx::Rect output;
+    std::exception_ptr error;
+    bool done;
+    CelJob(Cel* cel) : cel(cel), done(false) { }
+  };
+
+  begin();
+  if (m_bounds.isEmpty())
+    throw InvalidAreaException();
+
+  const int njobs = int(cels.size());
+  const gfx::Rect spriteBounds = m_site.sprite()->bounds();
+  const std::size_t bytesPerCel =
+    2 * std::size_t(cels.front()->image()->getRowStrideSize(spriteBounds.w))
+      * spriteBounds.h;
+  const int maxCelsInFlight =
+    std::max(1, int(kMaxMemoryForCelsInFlight / std::max<std::size_t>(1, bytesPerCel)));
+  const int nthreads =
+    std::min(std::min<int>(std::thread::hardware_concurrency(), njobs),
+             maxCelsInFlight);
+
+  std::vector<CelJob> jobs(cels.begin(), cels.end());
+  std::mutex mutex;
+  std::condition_variable cv;
+  int nextJob = 0;
+  int committed = 0;
+  std::atomic<bool> stop(false);
+
+  auto worker =
+    [this, njobs, maxCelsInFlight, &spriteBounds,
+     &jobs, &mutex, &cv, &nextJob, &committed, &stop]() {
+      while (true) {
+        int i;
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          cv.wait(lock, [&]{
+              return (stop ||
+                      nextJob >= njobs ||
+                      nextJob < committed + maxCelsInFlight);
+            });
+          if (stop || nextJob >= njobs)
+            return;
+          i = nextJob++;
+        }
+
+        CelJob& job = jobs[i];
+        try {
+          Cel* cel = job.cel;
+          ImageRef src(
+            crop_image(cel->image(),
+                       gfx::Rect(spriteBounds).offset(-cel->position()), 0));
+          ImageRef dst(Image::createCopy(src.get()));
+
+          Target target = m_targetOrig;
+          if (cel->layer()->isBackground())
+            target &= ~TARGET_ALPHA_CHANNEL;
+
+          RowBand band(this, src.get(), dst.get(), target);
+          for (int row=0; row<m_bounds.h && !stop; ++row) {
+            if (!band.applyRow(row))
+              break;
+          }
+
+          if (algorithm::shrink_bounds2(src.get(), dst.get(),
+                                        m_bounds, job.output))
+            job.dst = dst;
+        }
+        catch (...) {
+          job.error = std::current_exception();
+        }
+
+        std::unique_lock<std::mutex> lock(mutex);
+        job.done = true;
+        cv.notify_all();
       }
-      else {
-        // Patch "m_cel"
-        (*m_tx)(
-          new cmd::PatchCel(
-            m_cel, m_dst.get(),
-            gfx::Region(output),
-            position()));
+    };
+
+  std::vector<std::thread> threads;
+  for (int i=0; i<nthreads; ++i)
+    threads.push_back(std::thread(worker));
+
+  std::exception_ptr error;
+
+  // Add the filtered cels to the transaction in order. If
+  // patchCel() throws (e.g. bad_alloc), the workers are stopped and
+  // joined before rethrowing the exception.
+  try {
+    while (committed < njobs && !stop) {
+      CelJob& job = jobs[committed];
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&job]{ return job.done; });
+      }
+
+      if (job.error) {
+        error = job.error;
+      }
+      else if (job.dst) {
+        patchCel(job.cel, job.dst.get(), job.output);
+        job.dst.reset();
+      }
+
+      bool cancelled = (error != nullptr);
+      if (m_progressDelegate) {
+        m_progressDelegate->reportProgress(float(committed+1) / njobs);
+        if (m_progressDelegate->isCancelled())
+          cancelled = true;
       }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      ++committed;
+      if (cancelled)
+        stop = true;
+      cv.notify_all();
     }
   }
+  catch (...) {
+    error = std::current_exception();
+    std::unique_lock<std::mutex> lock(mutex);
+    stop = true;
+    cv.notify_all();
+  }
+
+  for (auto& thread : threads)
+    thread.join();
+
+  if (error)
+    std::rethrow_exception(error);
+
+  return (committed == njobs);
 }
 
 void FilterManagerImpl::applyToTarget()
@@ -300,24 +647,35 @@ void FilterManagerImpl::applyToTarget()
                           m_site.frame(), &newPalette));
   }
 
-  // For each target image
-  for (auto it = cels.begin();
-       it != cels.end() && !cancelled;
-       ++it) {
-    Image* image = (*it)->image();
-
+  if (canApplyToCelsInParallel(cels)) {
     // Avoid applying the filter two times to the same image
-    if (visited.find(image->id()) == visited.end()) {
-      visited.insert(image->id());
-      applyToCel(*it);
+    CelList uniqueCels;
+    for (Cel* cel : cels) {
+      if (visited.insert(cel->image()->id()).second)
+        uniqueCels.push_back(cel);
     }
+    applyToCelsInParallel(uniqueCels);
+  }
+  else {
+    // For each target image
+    for (auto it = cels.begin();
+         it != cels.end() && !cancelled;
+         ++it) {
+      Image* image = (*it)->image();
+
+      // Avoid applying the filter two times to the same image
+      if (visited.find(image->id()) == visited.end()) {
+        visited.insert(image->id());
+        applyToCel(*it);
+      }
 
-    // Is there a delegate to know if the process was cancelled by the user?
-    if (m_progressDelegate)
-      cancelled = m_progressDelegate->isCancelled();
+      // Is there a delegate to know if the process was cancelled by the user?
+      if (m_progressDelegate)
+        cancelled = m_progressDelegate->isCancelled();
 
-    // Make progress
-    m_progressBase += m_progressWidth;
+      // Make progress
+      m_progressBase += m_progressWidth;
+    }
   }
 
   // Reset m_oldPalette to avoid restoring the color palette
@@ -15,6 +15,7 @@
 #include "app/tx.h"
 #include "base/exception.h"
 #include "doc/image_impl.h"
+#include "doc/cel_list.h"
 #include "doc/image_ref.h"
 #include "doc/pixel_format.h"
 #include "filters/filter_indexed_data.h"
@@ -81,6 +82,12 @@ namespace app {
     void setTarget(Target target);
     void setCelsTarget(CelsTarget celsTarget);
 
+    // Enables/disables applying the filter to several bands of rows
+    // at the same time (using all available CPU cores) in
+    // applyToTarget(). The result is the same as applying the filter
+    // row by row.
+    void setMultithreading(bool state);
+
     void begin();
 #ifdef ENABLE_UI
     void beginForPreview();
@@ -127,8 +134,17 @@ namespace app {
     doc::PalettePicks getPalettePicks() override;
 
   private:
+    // FilterManager used by each worker thread to apply the filter
+    // to its own band of rows (or to its own cel).
+    class RowBand;
+
     void init(doc::Cel* cel);
     void apply();
+    bool canApplyInParallel() const;
+    bool applyInParallel();
+    bool canApplyToCelsInParallel(const doc::CelList& cels) const;
+    bool applyToCelsInParallel(const doc::CelList& cels);
+    void patchCel(doc::Cel* cel, doc::Image* dst, const gfx::Rect& output);
     void applyToCel(doc::Cel* cel);
     bool updateBounds(doc::Mask* mask);
 
@@ -161,6 +177,7 @@ namespace app {
     Target m_targetOrig;          // Original targets
     Target m_target;              // Filtered targets
     CelsTarget m_celsTarget;
+    bool m_multithreading;
     std::unique_ptr<doc::Palette> m_oldPalette;
     std::unique_ptr<Tx> m_tx;
 
@@ -22,6 +22,7 @@
 #include "filters/hue_saturation_filter.h"
 #include "filters/outline_filter.h"
 #include "filters/tiled_mode.h"
+#include "render/quantization_algorithm.h"
 
 #ifdef ENABLE_SCRIPTING
 #include "app/script/engine.h"
@@ -164,6 +165,16 @@ void Param<filters::HueSaturationFilter::Mode>::fromString(const std::string& va
     setValue(filters::HueSaturationFilter::Mode::HSL);
 }
 
+template<>
+void Param<render::QuantizationAlgorithm>::fromString(const std::string& value)
+{
+  if (base::utf8_icmp(value, "kmeans") == 0 ||
+      base::utf8_icmp(value, "k-means") == 0)
+    setValue(render::QuantizationAlgorithm::KMeans);
+  else
+    setValue(render::QuantizationAlgorithm::MedianCut);
+}
+
 template<>
 void Param<filters::ColorCurve>::fromString(const std::string& value)
 {
@@ -290,6 +301,15 @@ void Param<filters::HueSaturationFilter::Mode>::fromLua(lua_State* L, int index)
     setValue((filters::HueSaturationFilter::Mode)lua_tointeger(L, index));
 }
 
+template<>
+void Param<render::QuantizationAlgorithm>::fromLua(lua_State* L, int index)
+{
+  if (lua_type(L, index) == LUA_TSTRING)
+    fromString(lua_tostring(L, index));
+  else
+    setValue((render::QuantizationAlgorithm)lua_tointeger(L, index));
+}
+
 template<>
 void Param<filters::ColorCurve>::fromLua(lua_State* L, int index)
 {
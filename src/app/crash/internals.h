@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2015  David Capello
 //
 // This program is distributed under the terms of
@@ -19,6 +20,10 @@ namespace crash {
 
   const uint32_t MAGIC_NUMBER = 0x454E4946; // 'FINE' in ASCII
 
+  // First value of an "img" file that contains only the modified
+  // tiles of a previous (full) version of the image.
+  const uint32_t IMAGE_DELTA_MAGIC_NUMBER = 0x544C4544; // 'DELT' in ASCII
+
   class ObjVersions {
   public:
     ObjVersions() {
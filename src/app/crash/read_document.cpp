@@ -25,6 +25,7 @@
 #include "doc/cel_io.h"
 #include "doc/cels_range.h"
 #include "doc/frame.h"
+#include "doc/image.h"
 #include "doc/image_io.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
@@ -37,9 +38,13 @@
 #include "doc/tag.h"
 #include "doc/tag_io.h"
 #include "fixmath/fixmath.h"
+#include "zlib.h"
 
+#include <algorithm>
 #include <fstream>
 #include <map>
+#include <memory>
+#include <vector>
 
 namespace app {
 namespace crash {
@@ -50,6 +55,84 @@ using namespace doc;
 
 namespace {
 
+// Reads an image saved with only the modified tiles of a previous
+// full version of the same image (see Writer::writeImageDelta()).
+Image* read_image_delta(std::istream& s, const std::string& dir)
+{
+  ObjectId id = read32(s);
+  ObjectVersion baseVer = read32(s);
+  int pixelFormat = read8(s);
+  int width = read16(s);
+  int height = read16(s);
+  color_t maskColor = read32(s);
+  int tileSize = read16(s);
+  int ntiles = read32(s);
+
+  std::string fn = "img-";
+  fn += base::convert_to<std::string>(id);
+  fn.push_back('.');
+  fn += base::convert_to<std::string>(baseVer);
+
+  std::ifstream bs(FSTREAM_PATH(base::join_path(dir, fn)), std::ifstream::binary);
+  if (!bs || read32(bs) != MAGIC_NUMBER) {
+    TRACE("RECO: Base img #%d v%d not found\n", id, baseVer);
+    return nullptr;
+  }
+
+  std::unique_ptr<Image> image(read_image(bs, false));
+  if (!image ||
+      image->pixelFormat() != pixelFormat ||
+      image->width() != width ||
+      image->height() != height ||
+      tileSize < 1)
+    return nullptr;
+
+  const int cols = (width + tileSize - 1) / tileSize;
+  const int rows = (height + tileSize - 1) / tileSize;
+  std::vector<uint8_t> raw, compressed;
+  for (int i=0; i<ntiles; ++i) {
+    int tileIndex = read32(s);
+    uLong compressedSize = read32(s);
+    if (tileIndex < 0 || tileIndex >= cols*rows || !compressedSize)
+      return nullptr;
+
+    const gfx::Rect rc =
+      gfx::Rect((tileIndex % cols) * tileSize,
+                (tileIndex / cols) * tileSize,
+                tileSize, tileSize).createIntersection(image->bounds());
+    const int rowBytes = image->getRowStrideSize(rc.w);
+
+    compressed.resize(compressedSize);
+    if (s.read((char*)&compressed[0], compressedSize).fail())
+      return nullptr;
+
+    raw.resize(rowBytes * rc.h);
+    uLongf rawSize = raw.size();
+    if (uncompress(&raw[0], &rawSize,
+                   &compressed[0], compressedSize) != Z_OK ||
+        rawSize != raw.size())
+      return nullptr;
+
+    for (int y=0; y<rc.h; ++y)
+      std::copy(&raw[y*rowBytes], &raw[y*rowBytes] + rowBytes,
+                image->getPixelAddress(rc.x, rc.y+y));
+  }
+
+  image->setMaskColor(maskColor);
+  return image.release();
+}
+
+// Reads a full image or the modified tiles of an image
+Image* read_backup_image(std::istream& s, const std::string& dir)
+{
+  const std::istream::pos_type pos = s.tellg();
+  if (read32(s) == IMAGE_DELTA_MAGIC_NUMBER)
+    return read_image_delta(s, dir);
+
+  s.seekg(pos);
+  return read_image(s, false);
+}
+
 class Reader : public SubObjectsIO {
 public:
   Reader(const std::string& dir,
@@ -430,7 +513,7 @@ private:
   }
 
   Image* readImage(std::ifstream& s) {
-    return read_image(s, false);
+    return read_backup_image(s, m_dir);
   }
 
   Palette* readPalette(std::ifstream& s) {
@@ -540,7 +623,7 @@ Doc* read_document_with_raw_images(const std::string& dir,
 
     ImageRef img;
     if (read32(s) == MAGIC_NUMBER)
-      img.reset(read_image(s, false));
+      img.reset(read_backup_image(s, dir));
 
     if (img) {
       lay->addCel(new Cel(frame, img));
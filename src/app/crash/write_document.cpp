@@ -14,6 +14,7 @@
 #include "app/crash/internals.h"
 #include "app/doc.h"
 #include "base/convert_to.h"
+#include "base/exception.h"
 #include "base/fs.h"
 #include "base/fstream_path.h"
 #include "base/serialization.h"
@@ -24,10 +25,12 @@
 #include "doc/cel_io.h"
 #include "doc/cels_range.h"
 #include "doc/frame.h"
+#include "doc/image.h"
 #include "doc/image_io.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/palette_io.h"
+#include "doc/primitives.h"
 #include "doc/slice.h"
 #include "doc/slice_io.h"
 #include "doc/sprite.h"
@@ -35,9 +38,12 @@
 #include "doc/tag.h"
 #include "doc/tag_io.h"
 #include "fixmath/fixmath.h"
+#include "zlib.h"
 
+#include <algorithm>
 #include <fstream>
 #include <map>
+#include <vector>
 
 namespace app {
 namespace crash {
@@ -48,15 +54,42 @@ using namespace doc;
 
 namespace {
 
+// Images are divided in tiles of this size to save only the
+// modified parts of them in each backup.
+const int kImageTileSize = 64;
+
+// Last full version of an image saved in the backup, all following
+// versions are saved as the tiles that are different from this one.
+struct ImageBase {
+  ObjectVersion version = 0;
+  PixelFormat pixelFormat = IMAGE_RGB;
+  int width = 0;
+  int height = 0;
+  std::vector<uint64_t> tileHashes;
+};
+
+typedef std::map<ObjectId, ImageBase> ImageBasesMap;
+
 static std::map<ObjectId, ObjVersionsMap> g_docVersions;
+static std::map<ObjectId, ImageBasesMap> g_docImageBases;
 static std::map<ObjectId, base::paths> g_deleteFiles;
 
+gfx::Rect image_tile_bounds(const Image* img, int tileIndex)
+{
+  const int cols = (img->width() + kImageTileSize - 1) / kImageTileSize;
+  return gfx::Rect((tileIndex % cols) * kImageTileSize,
+                   (tileIndex / cols) * kImageTileSize,
+                   kImageTileSize, kImageTileSize)
+    .createIntersection(img->bounds());
+}
+
 class Writer {
 public:
   Writer(const std::string& dir, Doc* doc, doc::CancelIO* cancel)
     : m_dir(dir)
     , m_doc(doc)
     , m_objVersions(g_docVersions[doc->id()])
+    , m_imageBases(g_docImageBases[doc->id()])
     , m_deleteFiles(g_deleteFiles[doc->id()])
     , m_cancel(cancel) {
   }
@@ -91,7 +124,7 @@ public:
         if (cel->link())        // Skip link
           continue;
 
-        if (!saveObject("img", cel->image(), &Writer::writeImage))
+        if (!saveImage(cel->image()))
           return false;
 
         if (!saveObject("celdata", cel->data(), &Writer::writeCelData))
@@ -250,8 +283,119 @@ private:
     return true;
   }
 
+  // Saves a new version of the image, the previous base version of
+  // the image is kept until a new full version is saved.
+  bool saveImage(Image* img) {
+    const ObjectVersion oldBase = m_imageBases[img->id()].version;
+    const ObjVersions& versions = m_objVersions[img->id()];
+    bool oldBaseInVersions = false;
+    for (size_t i=0; i<versions.size(); ++i)
+      if (versions[i] == oldBase)
+        oldBaseInVersions = true;
+
+    if (!saveObject("img", img, &Writer::writeImage))
+      return false;
+
+    // The old base was kept only because the latest versions
+    // depended on it, but now we've a new full version of the image.
+    if (oldBase &&
+        oldBase != m_imageBases[img->id()].version &&
+        !oldBaseInVersions) {
+      std::string fn = base::join_path(
+        m_dir, "img-" + base::convert_to<std::string>(img->id()) +
+               "." + base::convert_to<std::string>(oldBase));
+      if (base::is_file(fn))
+        m_deleteFiles.push_back(fn);
+    }
+    return true;
+  }
+
   bool writeImage(std::ofstream& s, Image* img) {
-    return write_image(s, img, m_cancel);
+    // Bitmaps are not used in cels and their rows cannot be split in
+    // tiles (each pixel is a bit)
+    if (img->pixelFormat() == IMAGE_BITMAP)
+      return write_image(s, img, m_cancel);
+
+    const int cols = (img->width() + kImageTileSize - 1) / kImageTileSize;
+    const int rows = (img->height() + kImageTileSize - 1) / kImageTileSize;
+    std::vector<uint64_t> hashes(cols*rows);
+    for (int i=0; i<int(hashes.size()); ++i)
+      hashes[i] = calculate_image_raw_hash(img, image_tile_bounds(img, i));
+
+    ImageBase& base = m_imageBases[img->id()];
+    if (base.version &&
+        base.pixelFormat == img->pixelFormat() &&
+        base.width == img->width() &&
+        base.height == img->height()) {
+      std::vector<int> tiles;
+      for (int i=0; i<int(hashes.size()); ++i)
+        if (hashes[i] != base.tileHashes[i])
+          tiles.push_back(i);
+
+      // Save the modified tiles only if they are less than the half
+      // of the image, in other case we save a new full version of
+      // the image (so each delta is never too big, and we never
+      // need more than one delta to restore the image).
+      if (2*tiles.size() <= hashes.size())
+        return writeImageDelta(s, img, base, tiles);
+    }
+
+    if (!write_image(s, img, m_cancel))
+      return false;
+
+    base.version = img->version();
+    base.pixelFormat = img->pixelFormat();
+    base.width = img->width();
+    base.height = img->height();
+    base.tileHashes = std::move(hashes);
+    return true;
+  }
+
+  // Writes the tiles of "img" that are different from its base
+  // version. Each tile is compressed independently with the fastest
+  // zlib level as these files are written frequently.
+  bool writeImageDelta(std::ofstream& s, Image* img,
+                       const ImageBase& base,
+                       const std::vector<int>& tiles) {
+    write32(s, IMAGE_DELTA_MAGIC_NUMBER);
+    write32(s, img->id());
+    write32(s, base.version);
+    write8(s, img->pixelFormat());
+    write16(s, img->width());
+    write16(s, img->height());
+    write32(s, img->maskColor());
+    write16(s, kImageTileSize);
+    write32(s, tiles.size());
+
+    std::vector<uint8_t> raw, compressed;
+    for (int i : tiles) {
+      if (isCanceled())
+        return false;
+
+      const gfx::Rect rc = image_tile_bounds(img, i);
+      const int rowBytes = img->getRowStrideSize(rc.w);
+      raw.resize(rowBytes * rc.h);
+      for (int y=0; y<rc.h; ++y)
+        std::copy(img->getPixelAddress(rc.x, rc.y+y),
+                  img->getPixelAddress(rc.x, rc.y+y) + rowBytes,
+                  &raw[y*rowBytes]);
+
+      uLongf compressedSize = compressBound(raw.size());
+      compressed.resize(compressedSize);
+      int err = compress2(&compressed[0], &compressedSize,
+                          &raw[0], raw.size(), Z_BEST_SPEED);
+      if (err != Z_OK)
+        throw base::Exception("ZLib error %d in compress2().", err);
+
+      write32(s, i);
+      write32(s, compressedSize);
+      if (s.write((const char*)&compressed[0], compressedSize).fail())
+        throw base::Exception("Error writing compressed image tile.\n");
+    }
+
+    TRACE(" - Saved %d modified tiles of img #%d v%d (base v%d)\n",
+          int(tiles.size()), img->id(), img->version(), base.version);
+    return true;
   }
 
   bool writePalette(std::ofstream& s, Palette* pal) {
@@ -302,8 +446,11 @@ private:
     s.seekp(0);
     write32(s, MAGIC_NUMBER);
 
-    // Remove the older version
-    if (versions.older() && base::is_file(oldfn))
+    // Remove the older version (if it's not the base of the newer
+    // versions of an image)
+    if (versions.older() &&
+        !isImageBase(obj->id(), versions.older()) &&
+        base::is_file(oldfn))
       m_deleteFiles.push_back(oldfn);
 
     // Rotate versions and add the latest one
@@ -313,6 +460,12 @@ private:
     return true;
   }
 
+  bool isImageBase(ObjectId id, ObjectVersion version) const {
+    auto it = m_imageBases.find(id);
+    return (it != m_imageBases.end() &&
+            it->second.version == version);
+  }
+
   void deleteOldVersions() {
     while (!m_deleteFiles.empty() && !isCanceled()) {
       std::string file = m_deleteFiles.back();
@@ -331,6 +484,7 @@ private:
   std::string m_dir;
   Doc* m_doc;
   ObjVersionsMap& m_objVersions;
+  ImageBasesMap& m_imageBases;
   base::paths& m_deleteFiles;
   doc::CancelIO* m_cancel;
 };
@@ -359,6 +513,11 @@ void delete_document_internals(Doc* doc)
     if (it != g_docVersions.end())
       g_docVersions.erase(it);
   }
+  {
+    auto it = g_docImageBases.find(doc->id());
+    if (it != g_docImageBases.end())
+      g_docImageBases.erase(it);
+  }
   {
     auto it = g_deleteFiles.find(doc->id());
     if (it != g_deleteFiles.end())
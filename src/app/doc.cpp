@@ -153,10 +153,11 @@ void Doc::notifyPaletteChanged()
   notify_observers<DocEvent&>(&DocObserver::onPaletteChanged, ev);
 }
 
-void Doc::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame)
+void Doc::notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame, Layer* layer)
 {
   DocEvent ev(this);
   ev.sprite(sprite);
+  ev.layer(layer);
   ev.region(region);
   ev.frame(frame);
   notify_observers<DocEvent&>(&DocObserver::onSpritePixelsModified, ev);
@@ -283,12 +284,12 @@ void Doc::destroyMaskBoundaries()
 
 void Doc::generateMaskBoundaries(const Mask* mask)
 {
-  m_maskBoundaries.reset();
-
   // No mask specified? Use the current one in the document
   if (!mask) {
-    if (!isMaskVisible())       // The mask is hidden
+    if (!isMaskVisible()) {     // The mask is hidden
+      m_maskBoundaries.reset();
       return;                   // Done, without boundaries
+    }
     else
       mask = this->mask();      // Use the document mask
   }
@@ -296,10 +297,17 @@ void Doc::generateMaskBoundaries(const Mask* mask)
   ASSERT(mask);
 
   if (!mask->isEmpty()) {
-    m_maskBoundaries.reset(new MaskBoundaries(mask->bitmap()));
-    m_maskBoundaries->offset(mask->bounds().x,
-                             mask->bounds().y);
+    // Only the modified rows of the mask are regenerated when its
+    // bounds didn't change (e.g. painting with the selection tools)
+    if (m_maskBoundaries)
+      m_maskBoundaries->regenerate(mask->bitmap(),
+                                   mask->bounds().origin());
+    else
+      m_maskBoundaries.reset(new MaskBoundaries(mask->bitmap(),
+                                                mask->bounds().origin()));
   }
+  else
+    m_maskBoundaries.reset();
 
   notifySelectionBoundariesChanged();
 }
@@ -96,7 +96,7 @@ namespace app {
     void notifyGeneralUpdate();
     void notifyColorSpaceChanged();
     void notifyPaletteChanged();
-    void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame);
+    void notifySpritePixelsModified(Sprite* sprite, const gfx::Region& region, frame_t frame, Layer* layer);
     void notifyExposeSpritePixels(Sprite* sprite, const gfx::Region& region);
     void notifyLayerMergedDown(Layer* srcLayer, Layer* targetLayer);
     void notifyCelMoved(Layer* fromLayer, frame_t fromFrame, Layer* toLayer, frame_t toFrame);
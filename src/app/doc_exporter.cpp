@@ -21,15 +21,16 @@
 #include "app/snap_to_grid.h"
 #include "app/util/autocrop.h"
 #include "base/convert_to.h"
+#include "base/exception.h"
 #include "base/fs.h"
 #include "base/fstream_path.h"
+#include "base/process.h"
 #include "base/replace_string.h"
 #include "base/string.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/image.h"
-#include "doc/images_map.h"
-#include "doc/images_map.h"
+#include "doc/image_io.h"
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
@@ -45,12 +46,19 @@
 #include "render/ordered_dither.h"
 #include "render/render.h"
 
+#include <atomic>
 #include <cstdio>
+#include <exception>
 #include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <set>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
 #define DX_TRACE(...) // TRACEARGS
@@ -192,9 +200,14 @@ public:
     m_extrude(extrude),
     m_isLinked(false),
     m_isDuplicated(false),
+    m_id(-1),
     m_bounds(new SampleBounds(sprite)) {
   }
 
+  // Unique ID of the sample to find its render in SampleRenders
+  int id() const { return m_id; }
+  void setId(const int id) { m_id = id; }
+
   Doc* document() const { return m_document; }
   Sprite* sprite() const { return m_sprite; }
   Layer* layer() const {
@@ -252,31 +265,10 @@ public:
     m_bounds = bounds;
   }
 
-  ImageRef createRender(ImageBufferPtr& imageBuf) {
-    ASSERT(m_sprite);
-
-    ImageRef render(
-      Image::create(m_sprite->pixelFormat(),
-                    m_sprite->width(),
-                    m_sprite->height(),
-                    imageBuf));
-    render->setMaskColor(m_sprite->transparentColor());
-    clear_image(render.get(), m_sprite->transparentColor());
-    renderSample(render.get(), 0, 0, false);
-    return render;
-  }
-
-  void renderSample(doc::Image* dst, int x, int y, bool extrude) const {
-    RestoreVisibleLayers layersVisibility;
-    if (m_selLayers)
-      layersVisibility.showSelectedLayers(m_sprite,
-                                          *m_selLayers);
-
-    render::Render render;
-
-    // 1) We cannot use the Preferences because this is called from a non-UI thread
-    // 2) We should use the new blend mode always when we're saving files
-    //render.setNewBlend(Preferences::instance().experimental.newBlend());
+  // Areas of the sprite to draw in the texture at the given
+  // position.
+  std::vector<gfx::Clip> textureClips(int x, int y, bool extrude) const {
+    std::vector<gfx::Clip> clips;
 
     if (extrude) {
       const gfx::Rect& trim = trimmedBounds();
@@ -295,19 +287,34 @@ public:
       int szx[] = { 1, trim.w, 1 };
       int szy[] = { 1, trim.h, 1 };
 
-      // Render a 9-patch image extruding the sample one pixel on each
-      // side.
+      // A 9-patch image extruding the sample one pixel on each side.
       for (int j=0; j<3; ++j) {
         for (int i=0; i<3; ++i) {
-          gfx::Clip clip(x+dx[i], y+dy[j], gfx::RectT<int>(srcx[i], srcy[j], szx[i], szy[j]));
-          render.renderSprite(dst, m_sprite, m_frame, clip);
+          clips.push_back(
+            gfx::Clip(x+dx[i], y+dy[j], gfx::RectT<int>(srcx[i], srcy[j], szx[i], szy[j])));
         }
       }
     }
     else {
-      gfx::Clip clip(x, y, trimmedBounds());
-      render.renderSprite(dst, m_sprite, m_frame, clip);
+      clips.push_back(gfx::Clip(x, y, trimmedBounds()));
     }
+    return clips;
+  }
+
+  void renderSample(doc::Image* dst, int x, int y, bool extrude) const {
+    RestoreVisibleLayers layersVisibility;
+    if (m_selLayers)
+      layersVisibility.showSelectedLayers(m_sprite,
+                                          *m_selLayers);
+
+    render::Render render;
+
+    // 1) We cannot use the Preferences because this is called from a non-UI thread
+    // 2) We should use the new blend mode always when we're saving files
+    //render.setNewBlend(Preferences::instance().experimental.newBlend());
+
+    for (const gfx::Clip& clip : textureClips(x, y, extrude))
+      render.renderSprite(dst, m_sprite, m_frame, clip);
   }
 
 private:
@@ -321,6 +328,7 @@ private:
   bool m_extrude;
   bool m_isLinked;
   bool m_isDuplicated;
+  int m_id;
   SampleBoundsPtr m_bounds;
 };
 
@@ -337,6 +345,10 @@ public:
     m_samples.push_back(sample);
   }
 
+  Sample& operator[](const size_t i) {
+    return m_samples[i];
+  }
+
   const Sample& operator[](const size_t i) const {
     return m_samples[i];
   }
@@ -350,14 +362,300 @@ private:
   List m_samples;
 };
 
+// Renders of the samples. Each sample is rendered only one time
+// (using several threads) and the same image is used to trim the
+// sample, to find duplicated samples, and to draw it in the texture.
+// Renders are released when they are not needed anymore. When the
+// renders use more than kMaxMemSize bytes, the new renders are kept
+// compressed in memory, and when the compressed renders use more than
+// kMaxCompressedSize bytes, they are moved to a temporary file.
+class DocExporter::SampleRenders {
+public:
+  typedef std::vector<const Sample*> List;
+
+  // Maximum memory used by uncompressed renders
+  static const std::size_t kMaxMemSize = 256*1024*1024;
+
+  SampleRenders()
+    : m_memSize(0)
+    , m_compressedSize(0)
+    , m_fileEnd(0) {
+  }
+
+  ~SampleRenders() {
+    if (m_file.is_open()) {
+      m_file.close();
+      try {
+        base::delete_file(m_filename);
+      }
+      catch (const std::exception& ex) {
+        (void)ex;
+        DX_TRACE("DocExporter: Error deleting", m_filename, ex.what());
+      }
+    }
+  }
+
+  // Renders the given samples that weren't rendered yet.
+  void renderSamples(const List& samples, base::task_token& token) {
+    List pending;
+    for (const Sample* sample : samples) {
+      if (m_entries.find(sample->id()) == m_entries.end())
+        pending.push_back(sample);
+    }
+
+    // Samples of the same sprite/layers are rendered together (layers
+    // visibility is changed in this thread before rendering them)
+    for (std::size_t i=0, j; i<pending.size(); i=j) {
+      if (token.canceled())
+        return;
+
+      for (j=i+1; j<pending.size(); ++j) {
+        if (pending[j]->sprite() != pending[i]->sprite() ||
+            pending[j]->selectedLayers() != pending[i]->selectedLayers())
+          break;
+      }
+
+      RestoreVisibleLayers layersVisibility;
+      if (pending[i]->selectedLayers())
+        layersVisibility.showSelectedLayers(pending[i]->sprite(),
+                                            *pending[i]->selectedLayers());
+
+      std::atomic<std::size_t> next(i);
+      std::atomic<bool> stop(false);
+      std::exception_ptr error;
+      auto worker =
+        [this, &pending, &next, &stop, &error, j]{
+          render::Render render;
+          while (!stop) {
+            const std::size_t k = next++;
+            if (k >= j)
+              break;
+            try {
+              addRender(*pending[k], renderSample(render, *pending[k]));
+            }
+            catch (...) {
+              std::lock_guard<std::mutex> lock(m_mutex);
+              if (!error)
+                error = std::current_exception();
+              stop = true;
+            }
+          }
+        };
+
+      // This thread is a worker too
+      const int nthreads =
+        std::min<int>(std::max<int>(1, std::thread::hardware_concurrency()),
+                      int(j-i));
+      std::vector<std::thread> threads;
+      for (int t=1; t<nthreads; ++t)
+        threads.push_back(std::thread(worker));
+      worker();
+      for (auto& thread : threads)
+        thread.join();
+
+      if (error)
+        std::rethrow_exception(error);
+    }
+  }
+
+  // Returns the render of the whole sprite for the given sample.
+  ImageRef image(const Sample& sample) {
+    auto it = m_entries.find(sample.id());
+    if (it == m_entries.end()) {
+      RestoreVisibleLayers layersVisibility;
+      if (sample.selectedLayers())
+        layersVisibility.showSelectedLayers(sample.sprite(),
+                                            *sample.selectedLayers());
+
+      render::Render render;
+      addRender(sample, renderSample(render, sample));
+      it = m_entries.find(sample.id());
+      ASSERT(it != m_entries.end());
+    }
+
+    const Entry& entry = it->second;
+    if (entry.image)
+      return entry.image;
+
+    std::string compressed;
+    if (entry.fileSize > 0) {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      compressed.resize(entry.fileSize);
+      m_file.seekg(entry.fileOffset);
+      m_file.read(&compressed[0], entry.fileSize);
+      if (m_file.fail()) {
+        m_file.clear();
+        throw base::Exception("Error reading sample render from %s",
+                              m_filename.c_str());
+      }
+    }
+    std::istringstream is(entry.fileSize > 0 ? compressed: entry.compressed);
+    return ImageRef(read_image(is, false));
+  }
+
+  // Releases the memory used by the render of the given sample (it
+  // will be rendered again if it's needed).
+  void release(const Sample& sample) {
+    auto it = m_entries.find(sample.id());
+    if (it == m_entries.end())
+      return;
+
+    const Entry& entry = it->second;
+    if (entry.image)
+      m_memSize -= entry.image->getMemSize();
+    else
+      m_compressedSize -= entry.compressed.size();
+    m_entries.erase(it);
+  }
+
+private:
+  // Maximum memory used by compressed renders
+  static const std::size_t kMaxCompressedSize = 256*1024*1024;
+
+  struct Entry {
+    ImageRef image;             // Uncompressed render or...
+    std::string compressed;     // ...the compressed render or...
+    int64_t fileOffset = 0;     // ...the compressed render in the file
+    std::size_t fileSize = 0;
+  };
+
+  static ImageRef renderSample(render::Render& render,
+                               const Sample& sample) {
+    const Sprite* sprite = sample.sprite();
+    ImageRef image(Image::create(sprite->pixelFormat(),
+                                 sprite->width(),
+                                 sprite->height()));
+    image->setMaskColor(sprite->transparentColor());
+    clear_image(image.get(), sprite->transparentColor());
+    render.renderSprite(image.get(), sprite, sample.frame(),
+                        gfx::Clip(0, 0, sprite->bounds()));
+    return image;
+  }
+
+  void addRender(const Sample& sample, const ImageRef& image) {
+    const std::size_t size = image->getMemSize();
+    bool compress;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      compress = (m_memSize + size > kMaxMemSize);
+      if (!compress)
+        m_memSize += size;
+    }
+
+    Entry entry;
+    if (compress) {
+      std::ostringstream os;
+      write_image(os, image.get());
+      entry.compressed = os.str();
+    }
+    else
+      entry.image = image;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (compress) {
+      if (m_compressedSize + entry.compressed.size() > kMaxCompressedSize &&
+          saveToFile(entry)) {
+        std::string().swap(entry.compressed);
+      }
+      else
+        m_compressedSize += entry.compressed.size();
+    }
+    m_entries[sample.id()] = std::move(entry);
+  }
+
+  // Called with m_mutex locked. The space of released renders in the
+  // file is not reused (the file is deleted with the SampleRenders).
+  bool saveToFile(Entry& entry) {
+    if (!m_file.is_open()) {
+      static std::atomic<int> counter(0);
+      m_filename = base::join_path(
+        base::get_temp_path(),
+        PACKAGE "-sheet-" +
+        base::convert_to<std::string>(int(base::get_current_process_id())) + "-" +
+        base::convert_to<std::string>(++counter) + ".tmp");
+      m_file.open(FSTREAM_PATH(m_filename),
+                  std::fstream::in | std::fstream::out |
+                  std::fstream::trunc | std::fstream::binary);
+      if (!m_file.is_open())
+        return false;
+    }
+
+    m_file.seekp(m_fileEnd);
+    m_file.write(entry.compressed.c_str(), entry.compressed.size());
+    if (m_file.fail()) {
+      m_file.clear();
+      return false;
+    }
+    entry.fileOffset = m_fileEnd;
+    entry.fileSize = entry.compressed.size();
+    m_fileEnd += entry.fileSize;
+    return true;
+  }
+
+  std::map<int, Entry> m_entries;
+  std::size_t m_memSize;
+  std::size_t m_compressedSize;
+  std::mutex m_mutex;
+
+  // Temporary file with compressed renders
+  std::fstream m_file;
+  std::string m_filename;
+  int64_t m_fileEnd;
+};
+
 class DocExporter::LayoutSamples {
 public:
   virtual ~LayoutSamples() { }
   virtual void layoutSamples(Samples& samples,
+                             SampleRenders& renders,
                              int borderPadding,
                              int shapePadding,
                              int& width, int& height,
                              base::task_token& token) = 0;
+
+protected:
+  // Renders the samples that will be compared to find duplicates.
+  static void renderSamplesToMerge(Samples& samples,
+                                   SampleRenders& renders,
+                                   base::task_token& token) {
+    SampleRenders::List list;
+    for (const auto& sample : samples) {
+      if (!sample.isLinked() && !sample.isEmpty())
+        list.push_back(&sample);
+    }
+    renders.renderSamples(list, token);
+  }
+
+  // Finds duplicated samples comparing the hash of their renders, so
+  // the renders don't need to be kept in memory to find duplicates.
+  class Duplicates {
+  public:
+    Duplicates(Samples& samples, SampleRenders& renders)
+      : m_samples(samples)
+      , m_renders(renders) {
+    }
+
+    // Returns the index of a previous sample with the same render as
+    // the i-th sample, or -1 if it's the first one.
+    int find(int i) {
+      ImageRef sampleRender(m_renders.image(m_samples[i]));
+      const uint64_t hash = calculate_image_hash(sampleRender.get());
+
+      auto range = m_hashes.equal_range(hash);
+      for (auto it=range.first; it!=range.second; ++it) {
+        ImageRef other(m_renders.image(m_samples[it->second]));
+        if (is_same_image(sampleRender.get(), other.get()))
+          return it->second;
+      }
+      m_hashes.insert(std::make_pair(hash, i));
+      return -1;
+    }
+
+  private:
+    Samples& m_samples;
+    SampleRenders& m_renders;
+    std::unordered_multimap<uint64_t, int> m_hashes;
+  };
 };
 
 class DocExporter::SimpleLayoutSamples : public DocExporter::LayoutSamples {
@@ -375,12 +673,16 @@ public:
   }
 
   void layoutSamples(Samples& samples,
+                     SampleRenders& renders,
                      int borderPadding,
                      int shapePadding,
                      int& width, int& height,
                      base::task_token& token) override {
     DX_TRACE("SimpleLayoutSamples type", (int)m_type, width, height);
 
+    if (m_mergeDups)
+      renderSamplesToMerge(samples, renders, token);
+
     const bool breakBands =
       (m_type == SpriteSheetType::Columns ||
        m_type == SpriteSheetType::Rows);
@@ -389,7 +691,7 @@ public:
     const Layer* oldLayer = nullptr;
     const Tag* oldTag = nullptr;
 
-    doc::ImagesMap duplicates;
+    Duplicates duplicates(samples, renders);
     gfx::Point framePt(borderPadding, borderPadding);
     gfx::Size rowSize(0, 0);
 
@@ -420,20 +722,14 @@ public:
       }
 
       if (m_mergeDups) {
-        doc::ImageBufferPtr sampleBuf = std::make_shared<doc::ImageBuffer>();
-        doc::ImageRef sampleRender(sample.createRender(sampleBuf));
-        auto it = duplicates.find(sampleRender);
-        if (it != duplicates.end()) {
-          const uint32_t j = it->second;
-
+        const int j = duplicates.find(i);
+        if (j >= 0) {
           sample.setDuplicated();
           sample.setSharedBounds(samples[j].sharedBounds());
+          renders.release(sample);
           ++i;
           continue;
         }
-        else {
-          duplicates[sampleRender] = i;
-        }
       }
 
       const Sprite* sprite = sample.sprite();
@@ -531,12 +827,15 @@ private:
 class DocExporter::BestFitLayoutSamples : public DocExporter::LayoutSamples {
 public:
   void layoutSamples(Samples& samples,
+                     SampleRenders& renders,
                      int borderPadding,
                      int shapePadding,
                      int& width, int& height,
                      base::task_token& token) override {
     gfx::PackingRects pr(borderPadding, shapePadding);
-    doc::ImagesMap duplicates;
+    Duplicates duplicates(samples, renders);
+
+    renderSamplesToMerge(samples, renders, token);
 
     uint32_t i = 0;
     for (auto& sample : samples) {
@@ -551,21 +850,14 @@ public:
         continue;
       }
 
-      // We have to use one ImageBuffer for each image because we're
-      // going to store all images in the "duplicates" map.
-      doc::ImageBufferPtr sampleBuf = std::make_shared<doc::ImageBuffer>();
-      doc::ImageRef sampleRender(sample.createRender(sampleBuf));
-      auto it = duplicates.find(sampleRender);
-      if (it != duplicates.end()) {
-        const uint32_t j = it->second;
-
+      const int j = duplicates.find(i);
+      if (j >= 0) {
         sample.setDuplicated();
         sample.setSharedBounds(samples[j].sharedBounds());
+        renders.release(sample);
       }
-      else {
-        duplicates[sampleRender] = i;
+      else
         pr.add(sample.requiredSize());
-      }
       ++i;
     }
 
@@ -595,7 +887,6 @@ public:
 
 DocExporter::DocExporter()
   : m_docBuf(std::make_shared<doc::ImageBuffer>())
-  , m_sampleBuf(std::make_shared<doc::ImageBuffer>())
 {
   m_cache.spriteId = doc::NullId;
   reset();
@@ -668,7 +959,8 @@ Doc* DocExporter::exportSheet(Context* ctx, base::task_token& token)
   // Steps for sheet construction:
   // 1) Capture the samples (each sprite+frame pair)
   Samples samples;
-  captureSamples(samples, token);
+  SampleRenders renders;
+  captureSamples(samples, renders, token);
   if (samples.empty()) {
     if (!ctx->isUIAvailable()) {
       Console console;
@@ -681,7 +973,7 @@ Doc* DocExporter::exportSheet(Context* ctx, base::task_token& token)
   token.set_progress(0.2f);
 
   // 2) Layout those samples in a texture field.
-  layoutSamples(samples, token);
+  layoutSamples(samples, renders, token);
   if (token.canceled())
     return nullptr;
   token.set_progress(0.4f);
@@ -697,7 +989,7 @@ Doc* DocExporter::exportSheet(Context* ctx, base::task_token& token)
   Image* textureImage = texture->root()->firstLayer()
     ->cel(frame_t(0))->image();
 
-  renderTexture(ctx, samples, textureImage, token);
+  renderTexture(ctx, samples, renders, textureImage, token);
   if (token.canceled())
     return nullptr;
   token.set_progress(0.8f);
@@ -730,8 +1022,9 @@ gfx::Size DocExporter::calculateSheetSize()
 {
   base::task_token token;
   Samples samples;
-  captureSamples(samples, token);
-  layoutSamples(samples, token);
+  SampleRenders renders;
+  captureSamples(samples, renders, token);
+  layoutSamples(samples, renders, token);
   return calculateSheetSize(samples, token);
 }
 
@@ -842,10 +1135,20 @@ int DocExporter::addDocumentSamples(
 }
 
 void DocExporter::captureSamples(Samples& samples,
+                                 SampleRenders& renders,
                                  base::task_token& token)
 {
   DX_TRACE("DX: Capture samples");
 
+  // First we create all the possible samples, so the ones that need
+  // to be trimmed can be rendered in parallel. For each candidate we
+  // save the sprite bounds and the index of the linked sample (-1
+  // if it's not a linked cel).
+  Samples candidates;
+  std::vector<gfx::Rect> candidatesSpriteBounds;
+  std::vector<int> candidatesLinks;
+  std::vector<int> toRender;
+
   for (auto& item : m_documents) {
     if (token.canceled())
       return;
@@ -916,9 +1219,11 @@ void DocExporter::captureSamples(Samples& samples,
       Sample sample(
         doc, sprite, item.selLayers, frame, innerTag,
         filename, m_innerPadding, m_extrude);
+      sample.setId(candidates.size());
+
       Cel* cel = nullptr;
       Cel* link = nullptr;
-      bool done = false;
+      int linkIndex = -1;
 
       if (layer && layer->isImage()) {
         cel = layer->cel(frame);
@@ -928,108 +1233,150 @@ void DocExporter::captureSamples(Samples& samples,
 
       // Re-use linked samples
       if (link && m_mergeDuplicates) {
-        for (const Sample& other : samples) {
-          if (token.canceled())
-            return;
-
+        for (int j=0; j<candidates.size(); ++j) {
+          const Sample& other = candidates[j];
           if (other.sprite() == sprite &&
               other.layer() == layer &&
               other.frame() == link->frame()) {
-            ASSERT(!other.isLinked());
-
-            sample.setLinked();
-            sample.setSharedBounds(other.sharedBounds());
-            done = true;
+            ASSERT(candidatesLinks[j] < 0);
+            linkIndex = j;
             break;
           }
         }
-        // "done" variable can be false here, e.g. when we export a
-        // frame tag and the first linked cel is outside the tag range.
-        ASSERT(done || (!done && tag));
+        // "linkIndex" can be -1 here, e.g. when we export a frame tag
+        // and the first linked cel is outside the tag range.
+        ASSERT(linkIndex >= 0 || (linkIndex < 0 && tag));
       }
 
-      if (!done && (m_ignoreEmptyCels || m_trimCels)) {
-        // Ignore empty cels
-        if (layer && layer->isImage() && !cel && m_ignoreEmptyCels)
-          continue;
+      candidates.addSample(sample);
+      candidatesSpriteBounds.push_back(spriteBounds);
+      candidatesLinks.push_back(linkIndex);
 
-        ImageRef sampleRender(sample.createRender(m_sampleBuf));
+      // Samples that we'll need to render to trim them (empty cels
+      // will be ignored without rendering them)
+      if (linkIndex < 0 &&
+          (m_ignoreEmptyCels || m_trimCels) &&
+          !(layer && layer->isImage() && !cel && m_ignoreEmptyCels)) {
+        toRender.push_back(candidates.size()-1);
+      }
+    }
+  }
 
-        gfx::Rect frameBounds;
-        doc::color_t refColor = 0;
+  {
+    SampleRenders::List list;
+    for (int i : toRender)
+      list.push_back(&candidates[i]);
+    renders.renderSamples(list, token);
+  }
 
-        if (m_trimCels) {
-          if ((layer &&
-               layer->isBackground()) ||
-              (!layer &&
-               sprite->backgroundLayer() &&
-               sprite->backgroundLayer()->isVisible())) {
-            refColor = get_pixel(sampleRender.get(), 0, 0);
-          }
-          else {
-            refColor = sprite->transparentColor();
-          }
+  // Ignored candidates (e.g. empty frames)
+  std::vector<bool> ignored(candidates.size(), false);
+
+  for (int i=0; i<candidates.size(); ++i) {
+    if (token.canceled())
+      return;
+
+    Sample& sample = candidates[i];
+    Sprite* sprite = sample.sprite();
+    Layer* layer = sample.layer();
+    const frame_t frame = sample.frame();
+    const gfx::Rect& spriteBounds = candidatesSpriteBounds[i];
+    bool done = false;
+
+    // Re-use linked samples (if the linked sample wasn't ignored)
+    const int linkIndex = candidatesLinks[i];
+    if (linkIndex >= 0 && !ignored[linkIndex]) {
+      sample.setLinked();
+      sample.setSharedBounds(candidates[linkIndex].sharedBounds());
+      done = true;
+    }
+
+    if (!done && (m_ignoreEmptyCels || m_trimCels)) {
+      // Ignore empty cels
+      if (layer && layer->isImage() && !layer->cel(frame) && m_ignoreEmptyCels) {
+        ignored[i] = true;
+        continue;
+      }
+
+      ImageRef sampleRender(renders.image(sample));
+
+      gfx::Rect frameBounds;
+      doc::color_t refColor = 0;
+
+      if (m_trimCels) {
+        if ((layer &&
+             layer->isBackground()) ||
+            (!layer &&
+             sprite->backgroundLayer() &&
+             sprite->backgroundLayer()->isVisible())) {
+          refColor = get_pixel(sampleRender.get(), 0, 0);
         }
-        else if (m_ignoreEmptyCels)
+        else {
           refColor = sprite->transparentColor();
+        }
+      }
+      else if (m_ignoreEmptyCels)
+        refColor = sprite->transparentColor();
 
-        if (!algorithm::shrink_bounds(sampleRender.get(), spriteBounds, frameBounds, refColor)) {
-          // If shrink_bounds() returns false, it's because the whole
-          // image is transparent (equal to the mask color).
+      if (!algorithm::shrink_bounds(sampleRender.get(), spriteBounds, frameBounds, refColor)) {
+        // If shrink_bounds() returns false, it's because the whole
+        // image is transparent (equal to the mask color).
 
-          // Should we ignore this empty frame? (i.e. don't include
-          // the frame in the sprite sheet)
-          if (m_ignoreEmptyCels) {
-            for (Tag* tag : sprite->tags()) {
-              auto& delta = m_tagDelta[tag->id()];
+        // Should we ignore this empty frame? (i.e. don't include
+        // the frame in the sprite sheet)
+        if (m_ignoreEmptyCels) {
+          for (Tag* tag : sprite->tags()) {
+            auto& delta = m_tagDelta[tag->id()];
 
-              if (frame < tag->fromFrame()) --delta.first;
-              if (frame <= tag->toFrame()) --delta.second;
-            }
-            continue;
+            if (frame < tag->fromFrame()) --delta.first;
+            if (frame <= tag->toFrame()) --delta.second;
           }
-
-          // Create an entry with Size(1, 1) for this completely
-          // trimmed frame anyway so we conserve the frame information
-          // (position and duration of the frame in the JSON data, and
-          // the relative position of the frame in frame tags).
-          sample.setTrimmedBounds(frameBounds = gfx::Rect(0, 0, 1, 1));
+          ignored[i] = true;
+          renders.release(sample);
+          continue;
         }
 
-        if (m_trimCels) {
-          // TODO merge this code with the code in DocApi::trimSprite()
-          if (m_trimByGrid) {
-            const gfx::Rect& gridBounds = doc->sprite()->gridBounds();
-            gfx::Point posTopLeft =
-              snap_to_grid(gridBounds,
-                           frameBounds.origin(),
-                           PreferSnapTo::FloorGrid);
-            gfx::Point posBottomRight =
-              snap_to_grid(gridBounds,
-                           frameBounds.point2(),
-                           PreferSnapTo::CeilGrid);
-            frameBounds = gfx::Rect(posTopLeft, posBottomRight);
-          }
-          sample.setTrimmedBounds(frameBounds);
+        // Create an entry with Size(1, 1) for this completely
+        // trimmed frame anyway so we conserve the frame information
+        // (position and duration of the frame in the JSON data, and
+        // the relative position of the frame in frame tags).
+        sample.setTrimmedBounds(frameBounds = gfx::Rect(0, 0, 1, 1));
+      }
+
+      if (m_trimCels) {
+        // TODO merge this code with the code in DocApi::trimSprite()
+        if (m_trimByGrid) {
+          const gfx::Rect& gridBounds = sample.document()->sprite()->gridBounds();
+          gfx::Point posTopLeft =
+            snap_to_grid(gridBounds,
+                         frameBounds.origin(),
+                         PreferSnapTo::FloorGrid);
+          gfx::Point posBottomRight =
+            snap_to_grid(gridBounds,
+                         frameBounds.point2(),
+                         PreferSnapTo::CeilGrid);
+          frameBounds = gfx::Rect(posTopLeft, posBottomRight);
         }
-        else if (m_trimSprite)
-          sample.setTrimmedBounds(spriteBounds);
+        sample.setTrimmedBounds(frameBounds);
       }
       else if (m_trimSprite)
         sample.setTrimmedBounds(spriteBounds);
+    }
+    else if (m_trimSprite)
+      sample.setTrimmedBounds(spriteBounds);
 
-      samples.addSample(sample);
+    samples.addSample(sample);
 
-      DX_TRACE("DX:   - Sample:",
-               sample.document()->filename(),
-               "Layer:", sample.layer() ? sample.layer()->name(): "-",
-               "TrimmedBounds:", sample.trimmedBounds(),
-               "InTextureBounds:", sample.inTextureBounds());
-    }
+    DX_TRACE("DX:   - Sample:",
+             sample.document()->filename(),
+             "Layer:", sample.layer() ? sample.layer()->name(): "-",
+             "TrimmedBounds:", sample.trimmedBounds(),
+             "InTextureBounds:", sample.inTextureBounds());
   }
 }
 
 void DocExporter::layoutSamples(Samples& samples,
+                                SampleRenders& renders,
                                 base::task_token& token)
 {
   int width = m_textureWidth;
@@ -1039,7 +1386,7 @@ void DocExporter::layoutSamples(Samples& samples,
     case SpriteSheetType::Packed: {
       BestFitLayoutSamples layout;
       layout.layoutSamples(
-        samples, m_borderPadding, m_shapePadding,
+        samples, renders, m_borderPadding, m_shapePadding,
         width, height, token);
       break;
     }
@@ -1050,7 +1397,7 @@ void DocExporter::layoutSamples(Samples& samples,
         m_splitLayers, m_splitTags,
         m_mergeDuplicates);
       layout.layoutSamples(
-        samples, m_borderPadding, m_shapePadding,
+        samples, renders, m_borderPadding, m_shapePadding,
         width, height, token);
       break;
     }
@@ -1171,41 +1518,68 @@ Doc* DocExporter::createEmptyTexture(const Samples& samples,
 
 void DocExporter::renderTexture(Context* ctx,
                                 const Samples& samples,
+                                SampleRenders& renders,
                                 Image* textureImage,
                                 base::task_token& token) const
 {
-  textureImage->clear(0);
+  textureImage->clear(textureImage->maskColor());
 
   int i = 0;
-  for (const auto& sample : samples) {
-    if (token.canceled())
-      return;
-    token.set_progress(0.6f + 0.2f * i / int(samples.size()));
-
-    if (sample.isLinked() ||
-        sample.isDuplicated() ||
-        sample.isEmpty()) {
-      ++i;
-      continue;
+  while (i < samples.size()) {
+    // Render the next samples in parallel, limiting the memory used
+    // by the renders of each batch
+    SampleRenders::List list;
+    std::size_t batchSize = 0;
+    int end = i;
+    for (; end<samples.size() && batchSize<SampleRenders::kMaxMemSize; ++end) {
+      const Sample& sample = samples[end];
+      if (!sample.isLinked() &&
+          !sample.isDuplicated() &&
+          !sample.isEmpty()) {
+        list.push_back(&sample);
+        batchSize += std::size_t(sample.sprite()->width()) *
+                     std::size_t(sample.sprite()->height()) * 4;
+      }
     }
+    renders.renderSamples(list, token);
 
-    // Make the sprite compatible with the texture so the render()
-    // works correctly.
-    if (sample.sprite()->pixelFormat() != textureImage->pixelFormat()) {
-      cmd::SetPixelFormat(
-        sample.sprite(),
-        textureImage->pixelFormat(),
-        render::Dithering(),
-        nullptr)                // TODO add a delegate to show progress
-        .execute(ctx);
-    }
+    for (; i<end; ++i) {
+      const Sample& sample = samples[i];
+      if (token.canceled())
+        return;
+      token.set_progress(0.6f + 0.2f * i / int(samples.size()));
 
-    sample.renderSample(
-      textureImage,
-      sample.inTextureBounds().x+m_innerPadding,
-      sample.inTextureBounds().y+m_innerPadding,
-      m_extrude);
-    ++i;
+      if (sample.isLinked() ||
+          sample.isDuplicated() ||
+          sample.isEmpty()) {
+        continue;
+      }
+
+      const int x = sample.inTextureBounds().x+m_innerPadding;
+      const int y = sample.inTextureBounds().y+m_innerPadding;
+
+      // Copy the already rendered sample
+      ImageRef sampleRender(renders.image(sample));
+      renders.release(sample);
+      if (sampleRender->pixelFormat() == textureImage->pixelFormat()) {
+        for (const gfx::Clip& clip : sample.textureClips(x, y, m_extrude))
+          textureImage->copy(sampleRender.get(), clip);
+        continue;
+      }
+
+      // Make the sprite compatible with the texture so the render()
+      // works correctly.
+      if (sample.sprite()->pixelFormat() != textureImage->pixelFormat()) {
+        cmd::SetPixelFormat(
+          sample.sprite(),
+          textureImage->pixelFormat(),
+          render::Dithering(),
+          nullptr)              // TODO add a delegate to show progress
+          .execute(ctx);
+      }
+
+      sample.renderSample(textureImage, x, y, m_extrude);
+    }
   }
 }
 
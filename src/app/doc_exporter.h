@@ -96,13 +96,16 @@ namespace app {
   private:
     class Sample;
     class Samples;
+    class SampleRenders;
     class LayoutSamples;
     class SimpleLayoutSamples;
     class BestFitLayoutSamples;
 
     void captureSamples(Samples& samples,
+                        SampleRenders& renders,
                         base::task_token& token);
     void layoutSamples(Samples& samples,
+                       SampleRenders& renders,
                        base::task_token& token);
     gfx::Size calculateSheetSize(const Samples& samples,
                                  base::task_token& token) const;
@@ -110,6 +113,7 @@ namespace app {
                             base::task_token& token) const;
     void renderTexture(Context* ctx,
                        const Samples& samples,
+                       SampleRenders& renders,
                        doc::Image* textureImage,
                        base::task_token& token) const;
     void trimTexture(const Samples& samples, doc::Sprite* texture) const;
@@ -170,7 +174,6 @@ namespace app {
 
     // Buffers used
     doc::ImageBufferPtr m_docBuf;
-    doc::ImageBufferPtr m_sampleBuf;
 
     // Trimmed bounds of a specific sprite (to avoid recalculating
     // this)
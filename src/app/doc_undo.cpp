@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -31,6 +32,7 @@ namespace app {
 DocUndo::DocUndo()
   : m_undoHistory(this)
   , m_ctx(nullptr)
+  , m_cmdsSize(0)
   , m_totalUndoSize(0)
   , m_savedCounter(0)
   , m_savedStateIsLost(false)
@@ -57,7 +59,13 @@ void DocUndo::add(CmdTransaction* cmd)
   }
 
   m_undoHistory.add(cmd);
-  m_totalUndoSize += cmd->memSize();
+
+  // The memory used by the undo buffers is tracked by
+  // m_undoBuffersSize, as old buffers might be compressed or moved to
+  // disk in the background (see UndoBuffer)
+  cmd->setUndoBufferCounter(&m_undoBuffersSize);
+  m_cmdsSize += cmd->memSize();
+  updateTotalUndoSize();
 
   notify_observers(&DocUndoObserver::onAddUndoState, this);
   notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
@@ -79,6 +87,7 @@ void DocUndo::add(CmdTransaction* cmd)
              m_totalUndoSize > undoLimitSize) {
         if (!m_undoHistory.deleteFirstState())
           break;
+        updateTotalUndoSize();
       }
     }
   }
@@ -102,14 +111,14 @@ void DocUndo::undo()
   const undo::UndoState* state = nextUndo();
   ASSERT(state);
   const Cmd* cmd = STATE_CMD(state);
-  size_t oldSize = m_totalUndoSize;
-  m_totalUndoSize -= cmd->memSize();
+  m_cmdsSize -= cmd->memSize();
   {
     m_undoHistory.undo();
     notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
   }
-  m_totalUndoSize += cmd->memSize();
-  if (m_totalUndoSize != oldSize)
+  m_cmdsSize += cmd->memSize();
+
+  if (updateTotalUndoSize())
     notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
 }
 
@@ -118,14 +127,14 @@ void DocUndo::redo()
   const undo::UndoState* state = nextRedo();
   ASSERT(state);
   const Cmd* cmd = STATE_CMD(state);
-  size_t oldSize = m_totalUndoSize;
-  m_totalUndoSize -= cmd->memSize();
+  m_cmdsSize -= cmd->memSize();
   {
     m_undoHistory.redo();
     notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
   }
-  m_totalUndoSize += cmd->memSize();
-  if (m_totalUndoSize != oldSize)
+  m_cmdsSize += cmd->memSize();
+
+  if (updateTotalUndoSize())
     notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
 }
 
@@ -219,18 +228,26 @@ void DocUndo::moveToState(const undo::UndoState* state)
   m_undoHistory.moveTo(state);
   notify_observers(&DocUndoObserver::onCurrentUndoStateChange, this);
 
-  // Recalculate the total undo size
-  size_t oldSize = m_totalUndoSize;
-  m_totalUndoSize = 0;
+  // Recalculate the size of all commands (several states could be
+  // undone/redone)
+  m_cmdsSize = 0;
   const undo::UndoState* s = m_undoHistory.firstState();
   while (s) {
-    m_totalUndoSize += STATE_CMD(s)->memSize();
+    m_cmdsSize += STATE_CMD(s)->memSize();
     s = s->next();
   }
-  if (m_totalUndoSize != oldSize)
+
+  if (updateTotalUndoSize())
     notify_observers(&DocUndoObserver::onTotalUndoSizeChange, this);
 }
 
+bool DocUndo::updateTotalUndoSize()
+{
+  size_t oldSize = m_totalUndoSize;
+  m_totalUndoSize = m_cmdsSize + m_undoBuffersSize.size();
+  return (m_totalUndoSize != oldSize);
+}
+
 const undo::UndoState* DocUndo::nextUndo() const
 {
   return m_undoHistory.currentState();
@@ -255,7 +272,9 @@ void DocUndo::onDeleteUndoState(undo::UndoState* state)
              base::get_pretty_memory_size(cmd->memSize()).c_str(),
              base::get_pretty_memory_size(m_totalUndoSize).c_str());
 
-  m_totalUndoSize -= cmd->memSize();
+  // The memory of its undo buffers is removed from m_undoBuffersSize
+  // when the command is deleted
+  m_cmdsSize -= cmd->memSize();
   notify_observers(&DocUndoObserver::onDeleteUndoState, this, state);
 }
 
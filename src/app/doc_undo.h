@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -10,6 +11,7 @@
 
 #include "app/doc_range.h"
 #include "app/sprite_position.h"
+#include "app/util/undo_buffer.h"
 #include "base/disable_copying.h"
 #include "obs/observable.h"
 #include "undo/undo_history.h"
@@ -67,12 +69,19 @@ namespace app {
   private:
     const undo::UndoState* nextUndo() const;
     const undo::UndoState* nextRedo() const;
+    bool updateTotalUndoSize();
 
     // undo::UndoHistoryDelegate impl
     void onDeleteUndoState(undo::UndoState* state) override;
 
+    // Memory used by the undo buffers of the commands in the history
+    // (it's declared before m_undoHistory so it's destroyed after the
+    // commands).
+    UndoBufferCounter m_undoBuffersSize;
+
     undo::UndoHistory m_undoHistory;
     Context* m_ctx;
+    size_t m_cmdsSize;          // Memory used by commands (without undo buffers)
     size_t m_totalUndoSize;
 
     // This counter is equal to 0 if we are in the "saved state", i.e.
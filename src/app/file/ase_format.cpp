@@ -16,6 +16,7 @@
 #include "app/file/format_options.h"
 #include "app/pref/preferences.h"
 #include "base/cfile.h"
+#include "base/clamp.h"
 #include "base/exception.h"
 #include "base/file_handle.h"
 #include "base/fs.h"
@@ -29,7 +30,14 @@
 #include "ui/alert.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <cstdio>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace app {
 
@@ -82,6 +90,8 @@ private:
 
 } // anonymous namespace
 
+class CelCompressor;
+
 static void ase_file_prepare_header(FILE* f, dio::AsepriteHeader* header, const Sprite* sprite,
                                     const frame_t firstFrame, const frame_t totalFrames);
 static void ase_file_write_header(FILE* f, dio::AsepriteHeader* header);
@@ -92,6 +102,7 @@ static void ase_file_write_frame_header(FILE* f, dio::AsepriteFrameHeader* frame
 
 static void ase_file_write_layers(FILE* f, dio::AsepriteFrameHeader* frame_header, const Layer* layer, int child_level);
 static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_header,
+                                   CelCompressor& compressor,
                                    const Sprite* sprite, const Layer* layer,
                                    layer_t layer_index,
                                    const frame_t frame,
@@ -107,6 +118,7 @@ static void ase_file_write_color2_chunk(FILE* f, dio::AsepriteFrameHeader* frame
 static void ase_file_write_palette_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, const Palette* pal, int from, int to);
 static void ase_file_write_layer_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, const Layer* layer, int child_level);
 static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
+                                     CelCompressor& compressor,
                                      const Cel* cel,
                                      const LayerImage* layer,
                                      const layer_t layer_index,
@@ -129,6 +141,187 @@ static void ase_file_write_slice_chunk(FILE* f, dio::AsepriteFrameHeader* frame_
 static void ase_file_write_user_data_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header, const UserData* userData);
 static bool ase_has_groups(LayerGroup* group);
 static void ase_ungroup_all(LayerGroup* group);
+static const Cel* ase_get_cel_link(const Cel* cel, const LayerImage* layer,
+                                   const frame_t firstFrame);
+template<typename ImageTraits>
+static void compress_image(const Image* image, const int level,
+                           std::vector<uint8_t>& output);
+
+// Compresses the images of all cels that will be saved in the file
+// using several threads (each cel is compressed in its own zlib
+// stream, so this can be done in parallel). The compressed data is
+// requested in the same order that cels are written in the file.
+class CelCompressor {
+public:
+  CelCompressor(const Sprite* sprite,
+                const SelectedFrames& frames,
+                const frame_t firstFrame,
+                const int level);
+  ~CelCompressor();
+
+  // Waits the compressed data of the given image (it must be one of
+  // the images given in the constructor).
+  const std::vector<uint8_t>& compressedData(const Image* image);
+
+  // Releases the memory of the last requested image.
+  void releaseData(const Image* image);
+
+private:
+  struct Job {
+    const Image* image;
+    std::vector<uint8_t> data;
+    std::exception_ptr error;
+    bool done = false;
+  };
+
+  void addCels(const Layer* layer, const frame_t frame,
+               const frame_t firstFrame);
+  void workerThread();
+  void compressJob(Job& job);
+
+  // Maximum number of compressed images waiting to be written, and
+  // maximum size of their compressed data
+  static const int kMaxJobsAhead = 64;
+  static const std::size_t kMaxBytesAhead = 64*1024*1024;
+
+  const int m_level;
+  std::vector<Job> m_jobs;
+  std::map<ObjectId, int> m_jobIndexes;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_jobDone;
+  std::condition_variable m_jobRequested;
+  int m_nextJob = 0;            // Next job to be compressed
+  int m_lastRequestedJob = 0;   // Last job requested by the writer
+  std::size_t m_bytesAhead = 0; // Compressed data not released yet
+  bool m_stop = false;
+};
+
+CelCompressor::CelCompressor(const Sprite* sprite,
+                             const SelectedFrames& frames,
+                             const frame_t firstFrame,
+                             const int level)
+  : m_level(level)
+{
+  for (frame_t frame : frames)
+    addCels(sprite->root(), frame, firstFrame);
+
+  const int nthreads =
+    std::min<int>(std::max<int>(1, std::thread::hardware_concurrency()),
+                  int(m_jobs.size()));
+  for (int i=0; i<nthreads; ++i)
+    m_threads.push_back(std::thread([this]{ workerThread(); }));
+}
+
+CelCompressor::~CelCompressor()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_stop = true;
+    m_jobRequested.notify_all();
+  }
+  for (auto& thread : m_threads)
+    thread.join();
+}
+
+const std::vector<uint8_t>& CelCompressor::compressedData(const Image* image)
+{
+  auto it = m_jobIndexes.find(image->id());
+  ASSERT(it != m_jobIndexes.end());
+  Job& job = m_jobs[it->second];
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (m_lastRequestedJob < it->second) {
+    m_lastRequestedJob = it->second;
+    m_jobRequested.notify_all();
+  }
+  m_jobDone.wait(lock, [&job]{ return job.done; });
+
+  if (job.error)
+    std::rethrow_exception(job.error);
+
+  return job.data;
+}
+
+void CelCompressor::releaseData(const Image* image)
+{
+  auto it = m_jobIndexes.find(image->id());
+  ASSERT(it != m_jobIndexes.end());
+
+  std::vector<uint8_t> tmp;
+  std::unique_lock<std::mutex> lock(m_mutex);
+  Job& job = m_jobs[it->second];
+  m_bytesAhead -= job.data.size();
+  job.data.swap(tmp);
+  m_jobRequested.notify_all();
+}
+
+// Adds the same cels (and in the same order) that
+// ase_file_write_cel_chunk() will write as compressed cels.
+void CelCompressor::addCels(const Layer* layer, const frame_t frame,
+                            const frame_t firstFrame)
+{
+  if (layer->isImage()) {
+    const Cel* cel = layer->cel(frame);
+    if (cel &&
+        cel->image() &&
+        !ase_get_cel_link(cel, static_cast<const LayerImage*>(layer), firstFrame) &&
+        m_jobIndexes.find(cel->image()->id()) == m_jobIndexes.end()) {
+      m_jobIndexes[cel->image()->id()] = int(m_jobs.size());
+      m_jobs.emplace_back();
+      m_jobs.back().image = cel->image();
+    }
+  }
+
+  if (layer->isGroup()) {
+    for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers())
+      addCels(child, frame, firstFrame);
+  }
+}
+
+void CelCompressor::workerThread()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_stop && m_nextJob < int(m_jobs.size())) {
+    // Don't compress too many images ahead of the writer (the job
+    // requested by the writer is always compressed)
+    if (m_nextJob > m_lastRequestedJob &&
+        (m_nextJob > m_lastRequestedJob + kMaxJobsAhead ||
+         m_bytesAhead > kMaxBytesAhead)) {
+      m_jobRequested.wait(lock);
+      continue;
+    }
+
+    Job& job = m_jobs[m_nextJob++];
+    lock.unlock();
+    compressJob(job);
+    lock.lock();
+
+    m_bytesAhead += job.data.size();
+    job.done = true;
+    m_jobDone.notify_all();
+  }
+}
+
+void CelCompressor::compressJob(Job& job)
+{
+  try {
+    switch (job.image->pixelFormat()) {
+      case IMAGE_RGB:
+        compress_image<RgbTraits>(job.image, m_level, job.data);
+        break;
+      case IMAGE_GRAYSCALE:
+        compress_image<GrayscaleTraits>(job.image, m_level, job.data);
+        break;
+      case IMAGE_INDEXED:
+        compress_image<IndexedTraits>(job.image, m_level, job.data);
+        break;
+    }
+  }
+  catch (...) {
+    job.error = std::current_exception();
+  }
+}
 
 class ChunkWriter {
 public:
@@ -191,12 +384,25 @@ FileFormat* CreateAseFormat()
 
 bool AseFormat::onLoad(FileOp* fop)
 {
-  FileHandle handle(open_file_with_exception(fop->filename(), "rb"));
-  dio::StdioFileInterface fileInterface(handle.get());
+  // Try to map the whole file in memory (it's faster to read big
+  // files), or read it with stdio functions if it's not possible.
+  std::unique_ptr<dio::FileInterface> fileInterface;
+  FileHandle handle;
+  {
+    std::unique_ptr<dio::MappedFileInterface> mapped(
+      new dio::MappedFileInterface(fop->filename()));
+    if (mapped->isMapped()) {
+      fileInterface = std::move(mapped);
+    }
+    else {
+      handle = open_file_with_exception(fop->filename(), "rb");
+      fileInterface.reset(new dio::StdioFileInterface(handle.get()));
+    }
+  }
 
   DecodeDelegate delegate(fop);
   dio::AsepriteDecoder decoder;
-  decoder.initialize(&delegate, &fileInterface);
+  decoder.initialize(&delegate, fileInterface.get());
   if (!decoder.decode())
     return false;
 
@@ -264,6 +470,14 @@ bool AseFormat::onSave(FileOp* fop)
                           fop->roi().frames());
   ase_file_write_header(f, &header);
 
+  // Compress all cel images in background threads
+  CelCompressor compressor(
+    sprite,
+    fop->roi().selectedFrames(),
+    fop->roi().fromFrame(),
+    base::clamp(Preferences::instance().saveFile.compressionLevel(),
+                Z_DEFAULT_COMPRESSION, Z_BEST_COMPRESSION));
+
   bool require_new_palette_chunk = false;
   for (Palette* pal : sprite->getPalettes()) {
     if (pal->size() != 256 || pal->hasAlpha()) {
@@ -323,7 +537,7 @@ bool AseFormat::onSave(FileOp* fop)
     }
 
     // Write cel chunks
-    ase_file_write_cels(f, &frame_header,
+    ase_file_write_cels(f, &frame_header, compressor,
                         sprite, sprite->root(),
                         0, frame, fop->roi().fromFrame());
 
@@ -466,6 +680,7 @@ static void ase_file_write_layers(FILE* f, dio::AsepriteFrameHeader* frame_heade
 }
 
 static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_header,
+                                   CelCompressor& compressor,
                                    const Sprite* sprite, const Layer* layer,
                                    layer_t layer_index,
                                    const frame_t frame,
@@ -474,7 +689,7 @@ static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_head
   if (layer->isImage()) {
     const Cel* cel = layer->cel(frame);
     if (cel) {
-      ase_file_write_cel_chunk(f, frame_header, cel,
+      ase_file_write_cel_chunk(f, frame_header, compressor, cel,
                                static_cast<const LayerImage*>(layer),
                                layer_index, sprite, firstFrame);
 
@@ -495,7 +710,7 @@ static layer_t ase_file_write_cels(FILE* f, dio::AsepriteFrameHeader* frame_head
   if (layer->isGroup()) {
     for (const Layer* child : static_cast<const LayerGroup*>(layer)->layers()) {
       layer_index =
-        ase_file_write_cels(f, frame_header, sprite, child,
+        ase_file_write_cels(f, frame_header, compressor, sprite, child,
                             layer_index, frame, firstFrame);
     }
   }
@@ -684,8 +899,12 @@ static void write_raw_image(FILE* f, const Image* image)
 // Compressed Image
 //////////////////////////////////////////////////////////////////////
 
+// Compresses the image pixels in memory. The output must be the same
+// as the one produced when the image was compressed directly to the
+// file (same zlib stream, fed with one scanline at a time).
 template<typename ImageTraits>
-static void write_compressed_image(FILE* f, const Image* image)
+static void compress_image(const Image* image, const int level,
+                           std::vector<uint8_t>& output)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -694,13 +913,18 @@ static void write_compressed_image(FILE* f, const Image* image)
   zstream.zalloc = (alloc_func)0;
   zstream.zfree  = (free_func)0;
   zstream.opaque = (voidpf)0;
-  err = deflateInit(&zstream, Z_DEFAULT_COMPRESSION);
+  err = deflateInit(&zstream, level);
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in deflateInit().", err);
 
   std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
   std::vector<uint8_t> compressed(4096);
 
+  // The output grows as needed (the compressed data is usually much
+  // smaller than the image)
+  output.clear();
+  output.reserve(compressed.size());
+
   for (y=0; y<image->height(); y++) {
     typename ImageTraits::address_t address =
       (typename ImageTraits::address_t)image->getPixelAddress(0, y);
@@ -717,15 +941,16 @@ static void write_compressed_image(FILE* f, const Image* image)
 
       // Compress
       err = deflate(&zstream, flush);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
+      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+        deflateEnd(&zstream);
         throw base::Exception("ZLib error %d in deflate().", err);
+      }
 
       int output_bytes = compressed.size() - zstream.avail_out;
-      if (output_bytes > 0) {
-        if ((fwrite(&compressed[0], 1, output_bytes, f) != (size_t)output_bytes)
-            || ferror(f))
-          throw base::Exception("Error writing compressed image pixels.\n");
-      }
+      if (output_bytes > 0)
+        output.insert(output.end(),
+                      compressed.begin(),
+                      compressed.begin()+output_bytes);
     } while (zstream.avail_out == 0);
   }
 
@@ -734,19 +959,24 @@ static void write_compressed_image(FILE* f, const Image* image)
     throw base::Exception("ZLib error %d in deflateEnd().", err);
 }
 
+static void write_compressed_image(FILE* f, CelCompressor& compressor, const Image* image)
+{
+  const std::vector<uint8_t>& data = compressor.compressedData(image);
+  if (!data.empty()) {
+    if ((fwrite(&data[0], 1, data.size(), f) != data.size())
+        || ferror(f))
+      throw base::Exception("Error writing compressed image pixels.\n");
+  }
+  compressor.releaseData(image);
+}
+
 //////////////////////////////////////////////////////////////////////
 // Cel Chunk
 //////////////////////////////////////////////////////////////////////
 
-static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
-                                     const Cel* cel,
-                                     const LayerImage* layer,
-                                     const layer_t layer_index,
-                                     const Sprite* sprite,
-                                     const frame_t firstFrame)
+static const Cel* ase_get_cel_link(const Cel* cel, const LayerImage* layer,
+                                   const frame_t firstFrame)
 {
-  ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
-
   const Cel* link = cel->link();
 
   // In case the original link is outside the ROI, we've to find the
@@ -762,6 +992,21 @@ static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_he
       link = nullptr;
   }
 
+  return link;
+}
+
+static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_header,
+                                     CelCompressor& compressor,
+                                     const Cel* cel,
+                                     const LayerImage* layer,
+                                     const layer_t layer_index,
+                                     const Sprite* sprite,
+                                     const frame_t firstFrame)
+{
+  ChunkWriter chunk(f, frame_header, ASE_FILE_CHUNK_CEL);
+
+  const Cel* link = ase_get_cel_link(cel, layer, firstFrame);
+
   int cel_type = (link ? ASE_FILE_LINK_CEL: ASE_FILE_COMPRESSED_CEL);
 
   fputw(layer_index, f);
@@ -820,17 +1065,10 @@ static void ase_file_write_cel_chunk(FILE* f, dio::AsepriteFrameHeader* frame_he
 
         // Pixel data
         switch (image->pixelFormat()) {
-
           case IMAGE_RGB:
-            write_compressed_image<RgbTraits>(f, image);
-            break;
-
           case IMAGE_GRAYSCALE:
-            write_compressed_image<GrayscaleTraits>(f, image);
-            break;
-
           case IMAGE_INDEXED:
-            write_compressed_image<IndexedTraits>(f, image);
+            write_compressed_image(f, compressor, image);
             break;
         }
       }
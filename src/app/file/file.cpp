@@ -45,13 +45,23 @@
 #include "ask_for_color_profile.xml.h"
 #include "open_sequence.xml.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
 #include <cstdarg>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 namespace app {
 
 using namespace base;
 
+// Maximum size of the images of a sequence decoded ahead of the
+// merged frame
+static const std::size_t kMaxBytesAhead = 64*1024*1024;
+
 base::paths get_readable_extensions()
 {
   base::paths paths;
@@ -563,6 +573,50 @@ FileOp* FileOp::createSaveDocumentOperation(const Context* context,
   return fop.release();
 }
 
+// One file of a sequence decoded in a worker thread.
+struct FileOp::SequenceFile {
+  ImageRef image;               // nullptr if it couldn't be loaded
+  std::unique_ptr<Palette> palette;
+  bool hasAlpha = false;
+  color_t transparentColor = 0;
+  std::string error;
+};
+
+// Loads one file of the sequence with its own FileOp (document,
+// image, and palette), so several files can be loaded at the same
+// time. The image is merged in the sequence sprite by operate().
+void FileOp::loadSequenceFile(const std::string& filename,
+                              SequenceFile& file) const
+{
+  FileOp fop(FileOpLoad, m_context, &m_config);
+  fop.m_format = m_format;
+  fop.m_filename = filename;
+  fop.prepareForSequence();
+  fop.m_seq.palette->makeBlack();
+  fop.m_seq.has_alpha = false;
+
+  bool loadres = false;
+  try {
+    loadres = m_format->load(&fop);
+  }
+  catch (const std::exception& ex) {
+    fop.setError("%s\n", ex.what());
+  }
+
+  if (loadres && fop.m_document && fop.m_seq.image) {
+    file.image = fop.m_seq.image;
+    file.palette.reset(fop.m_seq.palette);
+    file.hasAlpha = fop.m_seq.has_alpha;
+    file.transparentColor = fop.m_document->sprite()->transparentColor();
+    fop.m_seq.palette = nullptr;
+  }
+  file.error = fop.m_error;
+
+  fop.m_seq.image.reset();
+  delete fop.m_seq.last_cel;
+  delete fop.m_document;
+}
+
 // Executes the file operation: loads or saves the sprite.
 //
 // It can be called from a different thread of the one used
@@ -590,7 +644,6 @@ void FileOp::operate(IFileOpProgress* progress)
       // Load the sequence
       frame_t frames(m_seq.filename_list.size());
       frame_t frame(0);
-      Image* old_image = nullptr;
       gfx::Size canvasSize(0, 0);
 
       // TODO setPalette for each frame???
@@ -606,7 +659,6 @@ void FileOp::operate(IFileOpProgress* progress)
           m_document->sprite()->setPalette(m_seq.palette, true);
         }
 
-        old_image = m_seq.image.get();
         m_seq.image.reset();
         m_seq.last_cel = NULL;
       };
@@ -615,67 +667,130 @@ void FileOp::operate(IFileOpProgress* progress)
       m_seq.progress_offset = 0.0f;
       m_seq.progress_fraction = 1.0f / (double)frames;
 
-      auto it = m_seq.filename_list.begin(),
-           end = m_seq.filename_list.end();
-      for (; it != end; ++it) {
-        m_filename = it->c_str();
+      // The other files are decoded in worker threads while the first
+      // one is loaded in this thread (it creates the document).
+      std::vector<SequenceFile> files(frames);
+      std::vector<bool> loaded(frames, false);
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::atomic<int> next(1);
+      std::atomic<bool> abort(false);
+      frame_t merging = 0;          // Frame being merged in this thread
+      std::size_t bytesAhead = 0;   // Decoded images not merged yet
+      std::vector<std::thread> threads;
+
+      const int nthreads = std::min<int>(
+        std::max<int>(1, int(std::thread::hardware_concurrency())),
+        frames-1);
+      for (int i=0; i<nthreads; ++i) {
+        threads.push_back(std::thread([&]{
+          for (int j=next++; j<frames; j=next++) {
+            // Don't decode too many images ahead of the merged frame
+            // (the frame to be merged is always decoded)
+            {
+              std::unique_lock<std::mutex> lock(mutex);
+              cv.wait(lock, [&]{ return (abort || j <= merging ||
+                                         bytesAhead <= kMaxBytesAhead); });
+            }
+
+            SequenceFile file;
+            if (!abort && !isStop())
+              loadSequenceFile(m_seq.filename_list[j], file);
+
+            std::unique_lock<std::mutex> lock(mutex);
+            if (file.image)
+              bytesAhead += file.image->getMemSize();
+            files[j] = std::move(file);
+            loaded[j] = true;
+            cv.notify_all();
+          }
+        }));
+      }
 
-        // Call the "load" procedure to read the first bitmap.
-        bool loadres = m_format->load(this);
+      auto join_threads = [&]{
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          abort = true;
+          cv.notify_all();
+        }
+        for (auto& thread : threads)
+          thread.join();
+        threads.clear();
+      };
+
+      // If the merge fails (e.g. not enough memory), the workers must
+      // be joined before the exception leaves this function.
+      try {
+        // First frame
+        m_filename = m_seq.filename_list[0];
+        const bool loadres = m_format->load(this);
         if (!loadres) {
           setError("Error loading frame %d from file \"%s\"\n",
                    frame+1, m_filename.c_str());
         }
 
-        // For the first frame...
-        if (!old_image) {
-          // Error reading the first frame
-          if (!loadres || !m_document || !m_seq.last_cel) {
-            m_seq.image.reset();
-            delete m_seq.last_cel;
-            delete m_document;
-            m_document = nullptr;
-            break;
-          }
-          // Read ok
-          else {
-            // Add the keyframe
-            add_image();
-          }
+        // Error reading the first frame
+        if (!loadres || !m_document || !m_seq.last_cel) {
+          m_seq.image.reset();
+          delete m_seq.last_cel;
+          m_seq.last_cel = nullptr;
+          delete m_document;
+          m_document = nullptr;
         }
-        // For other frames
+        // Read ok
         else {
-          // All done (or maybe not enough memory)
-          if (!loadres || !m_seq.last_cel) {
-            m_seq.image.reset();
-            delete m_seq.last_cel;
-            break;
-          }
+          // Add the keyframe
+          add_image();
+          ++frame;
+          m_seq.progress_offset += m_seq.progress_fraction;
+          setProgress(0.0);
+        }
 
-          // Compare the old frame with the new one
-#if USE_LINK // TODO this should be configurable through a check-box
-          if (count_diff_between_images(old_image, m_seq.image)) {
-            add_image();
+        // Merge the other frames in order
+        for (; m_document && frame<frames; ++frame) {
+          SequenceFile file;
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+            merging = frame;
+            cv.notify_all();
+            cv.wait(lock, [&]{ return loaded[frame]; });
+            file = std::move(files[frame]);
+            if (file.image)
+              bytesAhead -= file.image->getMemSize();
           }
-          // We don't need this image
-          else {
-            delete m_seq.image;
 
-            // But add a link frame
-            m_seq.last_cel->image = image_index;
-            layer_add_frame(m_seq.layer, m_seq.last_cel);
+          m_filename = m_seq.filename_list[frame];
+          if (!file.error.empty())
+            setError("%s", file.error.c_str());
 
-            m_seq.last_image = NULL;
-            m_seq.last_cel = NULL;
+          // All done (or maybe not enough memory)
+          if (!file.image ||
+              file.image->pixelFormat() != m_document->sprite()->pixelFormat()) {
+            if (!isStop())
+              setError("Error loading frame %d from file \"%s\"\n",
+                       frame+1, m_filename.c_str());
+            break;
           }
-#else
+
+          file.palette->copyColorsTo(m_seq.palette);
+          if (file.hasAlpha)
+            m_seq.has_alpha = true;
+          m_document->sprite()->setTransparentColor(file.transparentColor);
+
+          m_seq.image = file.image;
+          m_seq.last_cel = new Cel(m_seq.frame++, ImageRef(nullptr));
           add_image();
-#endif
-        }
 
-        ++frame;
-        m_seq.progress_offset += m_seq.progress_fraction;
+          m_seq.progress_offset += m_seq.progress_fraction;
+          setProgress(0.0);
+        }
+      }
+      catch (...) {
+        join_threads();
+        throw;
       }
+      join_threads();
+
       m_filename = *m_seq.filename_list.begin();
 
       // Final setup
@@ -729,87 +844,132 @@ void FileOp::operate(IFileOpProgress* progress)
     if (isSequence()) {
       ASSERT(m_format->support(FILE_SUPPORT_SEQUENCES));
 
-      Sprite* sprite = m_document->sprite();
-
-      // Create a temporary bitmap
-      m_seq.image.reset(Image::create(sprite->pixelFormat(),
-                                      sprite->width(),
-                                      sprite->height()));
-
-      m_seq.progress_offset = 0.0f;
-      m_seq.progress_fraction = 1.0f / (double)sprite->totalFrames();
-
-      // For each frame in the sprite.
-      render::Render render;
-      render.setNewBlend(m_config.newBlend);
+      const Sprite* sprite = m_document->sprite();
 
+      // Frames to be saved with the index of its output file
+      std::vector<std::pair<frame_t, frame_t>> outputFrames;
       frame_t outputFrame = 0;
       for (frame_t frame : m_roi.selectedFrames()) {
-        // Draw the "frame" in "m_seq.image"
         if (m_roi.slice()) {
           const SliceKey* key = m_roi.slice()->getByFrame(frame);
           if (!key || key->isEmpty())
             continue;           // Skip frame because there is no slice key
-
-          m_seq.image.reset(
-            Image::create(sprite->pixelFormat(),
-                          key->bounds().w,
-                          key->bounds().h));
-
-          render.renderSprite(
-            m_seq.image.get(), sprite, frame,
-            gfx::Clip(gfx::Point(0, 0), key->bounds()));
         }
-        else {
-          render.renderSprite(m_seq.image.get(), sprite, frame);
-        }
-
-        bool save = true;
+        outputFrames.push_back(std::make_pair(frame, outputFrame++));
+      }
 
-        // Check if we have to ignore empty frames
-        if (m_ignoreEmpty &&
-            !sprite->isOpaque() &&
-            doc::is_empty_image(m_seq.image.get())) {
-          save = false;
-        }
+      // Progress is updated when each file is saved
+      const int n = int(outputFrames.size());
+      m_seq.progress_offset = 0.0f;
+      m_seq.progress_fraction = 1.0f;
+
+      // Each file is rendered and encoded in a worker thread with its
+      // own FileOp (image, palette, and filename).
+      std::vector<std::string> errors(n);
+      std::mutex dirMutex;
+      std::atomic<int> next(0);
+      std::atomic<int> saved(0);
+      std::atomic<bool> abort(false);
+
+      auto save_files = [&]{
+        render::Render render;
+        render.setNewBlend(m_config.newBlend);
+
+        for (int i=next++; i<n && !abort && !isStop(); i=next++) {
+          const frame_t frame = outputFrames[i].first;
+          FileOp fop(FileOpSave, m_context, &m_config);
+          fop.m_format = m_format;
+          fop.m_document = m_document;
+          fop.prepareForSequence();
+          fop.m_formatOptions = m_formatOptions;
+
+          try {
+            // Draw the "frame" in "fop.m_seq.image"
+            if (m_roi.slice()) {
+              const SliceKey* key = m_roi.slice()->getByFrame(frame);
+              fop.m_seq.image.reset(
+                Image::create(sprite->pixelFormat(),
+                              key->bounds().w,
+                              key->bounds().h));
+
+              render.renderSprite(
+                fop.m_seq.image.get(), sprite, frame,
+                gfx::Clip(gfx::Point(0, 0), key->bounds()));
+            }
+            else {
+              fop.m_seq.image.reset(
+                Image::create(sprite->pixelFormat(),
+                              sprite->width(),
+                              sprite->height()));
 
-        if (save) {
-          // Setup the palette.
-          sprite->palette(frame)->copyColorsTo(m_seq.palette);
+              render.renderSprite(fop.m_seq.image.get(), sprite, frame);
+            }
 
-          // Setup the filename to be used.
-          m_filename = m_seq.filename_list[outputFrame];
+            bool save = true;
 
-          // Make directories
-          {
-            std::string dir = base::get_file_path(m_filename);
-            try {
-              if (!base::is_directory(dir))
-                base::make_all_directories(dir);
+            // Check if we have to ignore empty frames
+            if (m_ignoreEmpty &&
+                !sprite->isOpaque() &&
+                doc::is_empty_image(fop.m_seq.image.get())) {
+              save = false;
             }
-            catch (const std::exception& ex) {
-              // Ignore errors and make the delegate fail
-              setError("Error creating directory \"%s\"\n%s",
-                       dir.c_str(), ex.what());
+
+            if (save) {
+              // Setup the palette.
+              sprite->palette(frame)->copyColorsTo(fop.m_seq.palette);
+
+              // Setup the filename to be used.
+              fop.m_filename = m_seq.filename_list[outputFrames[i].second];
+
+              // Make directories
+              {
+                std::unique_lock<std::mutex> lock(dirMutex);
+                std::string dir = base::get_file_path(fop.m_filename);
+                try {
+                  if (!base::is_directory(dir))
+                    base::make_all_directories(dir);
+                }
+                catch (const std::exception& ex) {
+                  // Ignore errors and make the delegate fail
+                  fop.setError("Error creating directory \"%s\"\n%s",
+                               dir.c_str(), ex.what());
+                }
+              }
+
+              // Call the "save" procedure... did it fail?
+              if (!m_format->save(&fop)) {
+                fop.setError("Error saving frame %d in the file \"%s\"\n",
+                             outputFrames[i].second+1, fop.m_filename.c_str());
+                abort = true;
+              }
             }
           }
-
-          // Call the "save" procedure... did it fail?
-          if (!m_format->save(this)) {
-            setError("Error saving frame %d in the file \"%s\"\n",
-                     outputFrame+1, m_filename.c_str());
-            break;
+          catch (const std::exception& ex) {
+            fop.setError("Error saving frame %d: %s\n",
+                         outputFrames[i].second+1, ex.what());
+            abort = true;
           }
+          errors[i] = fop.m_error;
+          setProgress(double(++saved) / n);
         }
+      };
 
-        m_seq.progress_offset += m_seq.progress_fraction;
-        ++outputFrame;
-      }
+      std::vector<std::thread> threads;
+      const int nthreads = std::min<int>(
+        std::max<int>(1, int(std::thread::hardware_concurrency())),
+        n) - 1;                 // This thread saves files too
+      for (int i=0; i<nthreads; ++i)
+        threads.push_back(std::thread(save_files));
+      save_files();
+      for (auto& thread : threads)
+        thread.join();
+
+      // Errors in frame order
+      for (const std::string& error : errors)
+        if (!error.empty())
+          setError("%s", error.c_str());
 
       m_filename = *m_seq.filename_list.begin();
-
-      // Destroy the image
-      m_seq.image.reset();
     }
     // Direct save to a file.
     else {
@@ -1130,7 +1290,7 @@ void FileOp::setProgress(double progress)
   }
 
   if (m_progressInterface)
-    m_progressInterface->ackFileOpProgress(progress);
+    m_progressInterface->ackFileOpProgress(m_progress);
 }
 
 void FileOp::getFilenameList(base::paths& output) const
@@ -272,6 +272,10 @@ namespace app {
     } m_seq;
 
     void prepareForSequence();
+
+    struct SequenceFile;
+    void loadSequenceFile(const std::string& filename,
+                          SequenceFile& file) const;
   };
 
   // Available extensions for each load/save operation.
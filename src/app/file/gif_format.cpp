@@ -34,6 +34,15 @@
 
 #include <gif_lib.h>
 
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #ifdef _WIN32
   #include <io.h>
   #define posix_lseek  _lseek
@@ -104,6 +113,10 @@ FileFormat* CreateGifFormat()
   return new GifFormat;
 }
 
+// Maximum memory used by the RGB frames rendered ahead (and by the
+// frames waiting to be quantized) when a GIF file is saved.
+static const std::size_t kMaxBytesAhead = 64*1024*1024;
+
 static int interlaced_offset[] = { 0, 4, 2, 1 };
 static int interlaced_jumps[] = { 8, 8, 4, 2 };
 
@@ -868,10 +881,120 @@ bool GifFormat::onLoad(FileOp* fop)
 
 #ifdef ENABLE_SAVE
 
+// Executes the frame rendering and color quantization jobs of the
+// GifEncoder in several threads. Jobs are started in the same order
+// they are added, and the encoder waits each result in the order it
+// needs them to write the GIF file (only the LZW compression and the
+// file writing are done in the encoder thread).
+class GifJobQueue {
+public:
+  typedef int job_t;
+  typedef std::function<void()> Func;
+
+  GifJobQueue(const int nthreads) {
+    for (int i=0; i<nthreads; ++i)
+      m_threads.push_back(std::thread([this]{ workerThread(); }));
+  }
+
+  ~GifJobQueue() {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_stop = true;
+      m_jobAdded.notify_all();
+    }
+    for (auto& thread : m_threads)
+      thread.join();
+  }
+
+  job_t add(Func&& func) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_jobs.emplace_back();
+    m_jobs.back().func = std::move(func);
+    m_jobAdded.notify_one();
+    return job_t(m_jobs.size()-1);
+  }
+
+  bool isDone(const job_t job) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_jobs[job].done;
+  }
+
+  // Waits the given job, re-throwing the exception if the job failed.
+  void wait(const job_t job) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Job& j = m_jobs[job];
+    m_jobDone.wait(lock, [&j]{ return j.done; });
+    if (j.error)
+      std::rethrow_exception(j.error);
+  }
+
+private:
+  struct Job {
+    Func func;
+    std::exception_ptr error;
+    bool done = false;
+  };
+
+  void workerThread() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+      if (m_nextJob == int(m_jobs.size())) {
+        m_jobAdded.wait(lock);
+        continue;
+      }
+
+      // std::deque doesn't invalidate references to its elements
+      // when we add new jobs at the end.
+      Job& job = m_jobs[m_nextJob++];
+      lock.unlock();
+      try {
+        job.func();
+      }
+      catch (...) {
+        job.error = std::current_exception();
+      }
+      job.func = nullptr;
+      lock.lock();
+
+      job.done = true;
+      m_jobDone.notify_all();
+    }
+  }
+
+  std::deque<Job> m_jobs;
+  std::vector<std::thread> m_threads;
+  std::mutex m_mutex;
+  std::condition_variable m_jobAdded;
+  std::condition_variable m_jobDone;
+  int m_nextJob = 0;
+  bool m_stop = false;
+};
+
 class GifEncoder {
 public:
   typedef int gifframe_t;
 
+private:
+  // Result of the color quantization of one frame
+  struct QuantizedFrame {
+    std::unique_ptr<Palette> palette; // Optimized palette (if it's needed)
+    const Palette* framePalette;      // Palette used by the "image" indexes
+    PalettePicks usedColors;
+    ImageRef image;                   // Indexed pixels inside frameBounds
+  };
+
+  // Frame waiting to be written in the GIF file
+  struct PendingFrame {
+    gifframe_t gifFrame;
+    frame_t frame;
+    gfx::Rect frameBounds;
+    DisposalMethod disposal;
+    GifJobQueue::job_t job;           // -1 if it's already quantized
+    std::shared_ptr<QuantizedFrame> quantized;
+  };
+
+public:
+
   GifEncoder(FileOp* fop, GifFileType* gifFile)
     : m_fop(fop)
     , m_gifFile(gifFile)
@@ -933,11 +1056,6 @@ public:
 
     m_interlaced = gifOptions->interlaced();
     m_loop = (gifOptions->loop() ? 0: -1);
-
-    for (int i=0; i<3; ++i)
-      m_images[i].reset(Image::create(IMAGE_RGB,
-                                      m_spriteBounds.w,
-                                      m_spriteBounds.h));
   }
 
   ~GifEncoder() {
@@ -950,36 +1068,84 @@ public:
     if (m_loop >= 0)
       writeLoopExtension();
 
+    // In this code "gifFrame" will be the GIF frame, and "frame" will
+    // be the doc::Sprite frame.
+    const gifframe_t nframes = totalFrames();
+    std::vector<frame_t> frames;
+    frames.reserve(nframes);
+    for (frame_t frame : m_fop->roi().selectedFrames())
+      frames.push_back(frame);
+    ASSERT(int(frames.size()) == nframes);
+
+    // Frames are rendered (and quantized) in worker threads some
+    // frames ahead of the one we are writing. Each frame ahead is a
+    // full RGB copy, so the number of frames is limited by memory too.
+    const int nthreads =
+      std::max(1, std::min<int>(std::thread::hardware_concurrency(), nframes));
+    const std::size_t frameSize =
+      std::max<std::size_t>(1, std::size_t(m_spriteBounds.w) * m_spriteBounds.h * 4);
+    const int maxFramesAhead =
+      std::max<int>(1, int(std::min<std::size_t>(2*nthreads,
+                                                 kMaxBytesAhead / (2*frameSize))));
+
+    std::vector<ImageRef> renderedImages(nframes);
+    std::vector<GifJobQueue::job_t> renderJobs(nframes, -1);
+    std::deque<PendingFrame> pendingFrames;
+
+    // The queue is destroyed before the data used by its jobs
+    GifJobQueue jobs(nthreads);
+
+    gifframe_t nextRender = 0;
+    auto renderAhead =
+      [&](const gifframe_t to) {
+        for (; nextRender<=to && nextRender<nframes; ++nextRender) {
+          const gifframe_t i = nextRender;
+          renderedImages[i].reset(Image::create(IMAGE_RGB,
+                                                m_spriteBounds.w,
+                                                m_spriteBounds.h));
+          Image* dst = renderedImages[i].get();
+          const frame_t frame = frames[i];
+          renderJobs[i] = jobs.add([this, dst, frame]{ renderFrame(frame, dst); });
+        }
+      };
+
+    auto takeRenderedImage =
+      [&](const gifframe_t i) -> ImageRef {
+        renderAhead(i + maxFramesAhead);
+        jobs.wait(renderJobs[i]);
+        ImageRef image;
+        std::swap(image, renderedImages[i]);
+        return image;
+      };
+
+    auto writePendingFrame =
+      [&]{
+        PendingFrame& p = pendingFrames.front();
+        if (p.job >= 0)
+          jobs.wait(p.job);
+
+        writeImage(p.gifFrame, p.frame, p.frameBounds, p.disposal,
+                   // Only the last frame in the animation needs the fix
+                   (fix_last_frame_duration && p.gifFrame == nframes-1),
+                   *p.quantized);
+        m_fop->setProgress(double(p.gifFrame+1) / double(nframes));
+        pendingFrames.pop_front();
+      };
+
     // Previous and next images are used to decide the best disposal
     // method (e.g. if it's more convenient to restore the background
     // color or to restore the previous frame to reach the next one).
-    m_previousImage = m_images[0].get();
-    m_currentImage = m_images[1].get();
-    m_nextImage = m_images[2].get();
-
-    auto frame_beg = m_fop->roi().selectedFrames().begin();
-#if _DEBUG
-    auto frame_end = m_fop->roi().selectedFrames().end();
-#endif
-    auto frame_it = frame_beg;
-
-    // In this code "gifFrame" will be the GIF frame, and "frame" will
-    // be the doc::Sprite frame.
-    gifframe_t nframes = totalFrames();
     for (gifframe_t gifFrame=0; gifFrame<nframes; ++gifFrame) {
-      ASSERT(frame_it != frame_end);
-      frame_t frame = *frame_it;
-      ++frame_it;
+      const frame_t frame = frames[gifFrame];
 
       if (gifFrame == 0)
-        renderFrame(frame, m_nextImage);
-      else
-        std::swap(m_previousImage, m_currentImage);
+        m_nextImage = takeRenderedImage(0);
 
-      // Render next frame
-      std::swap(m_currentImage, m_nextImage);
+      m_previousImage = m_currentImage;
+      m_currentImage = m_nextImage;
+      m_nextImage.reset();
       if (gifFrame+1 < nframes)
-        renderFrame(*frame_it, m_nextImage);
+        m_nextImage = takeRenderedImage(gifFrame+1);
 
       gfx::Rect frameBounds;
       DisposalMethod disposal;
@@ -989,18 +1155,58 @@ public:
       if (frameBounds.isEmpty())
         frameBounds = gfx::Rect(0, 0, 1, 1);
 
-      writeImage(gifFrame, frame, frameBounds, disposal,
-                 // Only the last frame in the animation needs the fix
-                 (fix_last_frame_duration && gifFrame == nframes-1));
+      pendingFrames.emplace_back();
+      PendingFrame& p = pendingFrames.back();
+      p.gifFrame = gifFrame;
+      p.frame = frame;
+      p.frameBounds = frameBounds;
+      p.disposal = disposal;
+      p.quantized = std::make_shared<QuantizedFrame>();
+
+      // Create the optimized palette for RGB/Grayscale images (and
+      // convert the frame to indexed) in a worker thread. The pixels
+      // are copied because the disposal method modifies the current
+      // image.
+      if (m_quantizeColormaps) {
+        ImageRef src(crop_image(m_currentImage.get(), frameBounds, 0));
+        std::shared_ptr<QuantizedFrame> quantized = p.quantized;
+        p.job = jobs.add(
+          [this, src, quantized]{
+            quantized->palette.reset(createOptimizedPalette(src.get()));
+
+            RgbMap rgbmap;
+            rgbmap.regenerate(quantized->palette.get(), m_transparentIndex);
+
+            quantizeImage(src.get(), src->bounds(),
+                          quantized->palette.get(),
+                          &rgbmap, *quantized);
+          });
+      }
+      // The RgbMap of the sprite cannot be used from other threads
+      else {
+        quantizeImage(m_currentImage.get(), frameBounds,
+                      m_sprite->palette(frame),
+                      m_sprite->rgbMap(frame),
+                      *p.quantized);
+        p.job = -1;
+      }
 
       // Dispose/clear frame content
-      process_disposal_method(m_previousImage,
-                              m_currentImage,
+      process_disposal_method(m_previousImage.get(),
+                              m_currentImage.get(),
                               disposal,
                               frameBounds,
                               m_clearColor);
 
-      m_fop->setProgress(double(gifFrame+1) / double(nframes));
+      // Write the frames that are ready (or wait the oldest one if
+      // there are too many frames in memory)
+      while (!pendingFrames.empty() &&
+             (pendingFrames.front().job < 0 ||
+              jobs.isDone(pendingFrames.front().job) ||
+              int(pendingFrames.size()) > maxFramesAhead ||
+              gifFrame == nframes-1)) {
+        writePendingFrame();
+      }
     }
     return true;
   }
@@ -1115,11 +1321,11 @@ private:
       gfx::Rect prev, next;
 
       if (gifFrame-1 >= 0)
-        prev = calculateFrameBounds(m_currentImage, m_previousImage);
+        prev = calculateFrameBounds(m_currentImage.get(), m_previousImage.get());
 
       if (!m_hasBackground &&
           gifFrame+1 < totalFrames())
-        next = calculateFrameBounds(m_currentImage, m_nextImage);
+        next = calculateFrameBounds(m_currentImage.get(), m_nextImage.get());
 
       frameBounds = prev.createUnion(next);
 
@@ -1127,7 +1333,7 @@ private:
       // when we dispose the current one than clearing with the bg
       // color.
       if (m_hasBackground && !prev.isEmpty()) {
-        gfx::Rect prevNext = calculateFrameBounds(m_previousImage, m_nextImage);
+        gfx::Rect prevNext = calculateFrameBounds(m_previousImage.get(), m_nextImage.get());
         if (!prevNext.isEmpty() &&
             frameBounds.contains(prevNext) &&
             prevNext.w*prevNext.h < frameBounds.w*frameBounds.h) {
@@ -1142,40 +1348,23 @@ private:
     }
   }
 
-  void writeImage(const gifframe_t gifFrame,
-                  const frame_t frame,
-                  const gfx::Rect& frameBounds,
-                  const DisposalMethod disposal,
-                  const bool fixDuration) {
-    std::unique_ptr<Palette> framePaletteRef;
-    std::unique_ptr<RgbMap> rgbmapRef;
-    Palette* framePalette = m_sprite->palette(frame);
-    RgbMap* rgbmap = m_sprite->rgbMap(frame);
-
-    // Create optimized palette for RGB/Grayscale images
-    if (m_quantizeColormaps) {
-      framePaletteRef.reset(createOptimizedPalette(frameBounds));
-      framePalette = framePaletteRef.get();
-
-      rgbmapRef.reset(new RgbMap);
-      rgbmap = rgbmapRef.get();
-      rgbmap->regenerate(framePalette, m_transparentIndex);
-    }
-
-    // We will store the frameBounds pixels in frameImage, with the
+  // Converts the "bounds" area of the given RGB image to indexed
+  // colors of the given palette. It can be called from any thread
+  // if "rgbmap" is not shared with other threads.
+  void quantizeImage(const Image* src,
+                     const gfx::Rect& bounds,
+                     const Palette* framePalette,
+                     RgbMap* rgbmap,
+                     QuantizedFrame& output) const {
+    // We will store the bounds pixels in frameImage, with the
     // indexes that must be stored in the GIF file for this specific
     // frame.
-    if (!m_frameImageBuf)
-      m_frameImageBuf.reset(new ImageBuffer);
+    output.image.reset(Image::create(IMAGE_INDEXED, bounds.w, bounds.h));
+    output.framePalette = framePalette;
 
-    ImageRef frameImage(Image::create(IMAGE_INDEXED,
-                                      frameBounds.w,
-                                      frameBounds.h,
-                                      m_frameImageBuf));
-
-    // Convert the frameBounds area of m_currentImage (RGB) to frameImage (Indexed)
     // bool needsTransparent = false;
-    PalettePicks usedColors(framePalette->size());
+    PalettePicks& usedColors = output.usedColors;
+    usedColors.resize(framePalette->size());
 
     // If the sprite needs a transparent color we mark it as used so
     // the palette includes a spot for it. It doesn't matter if the
@@ -1188,56 +1377,65 @@ private:
       usedColors[i] = true;
     }
 
-    {
-      const LockImageBits<RgbTraits> srcBits(m_currentImage, frameBounds);
-      LockImageBits<IndexedTraits> dstBits(
-        frameImage.get(), gfx::Rect(0, 0, frameBounds.w, frameBounds.h));
+    const LockImageBits<RgbTraits> srcBits(src, bounds);
+    LockImageBits<IndexedTraits> dstBits(
+      output.image.get(), gfx::Rect(0, 0, bounds.w, bounds.h));
+
+    auto srcIt = srcBits.begin();
+    auto dstIt = dstBits.begin();
 
-      auto srcIt = srcBits.begin();
-      auto dstIt = dstBits.begin();
+    for (int y=0; y<bounds.h; ++y) {
+      for (int x=0; x<bounds.w; ++x, ++srcIt, ++dstIt) {
+        ASSERT(srcIt != srcBits.end());
+        ASSERT(dstIt != dstBits.end());
 
-      for (int y=0; y<frameBounds.h; ++y) {
-        for (int x=0; x<frameBounds.w; ++x, ++srcIt, ++dstIt) {
-          ASSERT(srcIt != srcBits.end());
-          ASSERT(dstIt != dstBits.end());
-
-          color_t color = *srcIt;
-          int i;
-
-          if (rgba_geta(color) >= 128) {
-            i = framePalette->findExactMatch(
-              rgba_getr(color),
-              rgba_getg(color),
-              rgba_getb(color),
-              255,
-              m_transparentIndex);
-            if (i < 0)
-              i = rgbmap->mapColor(rgba_getr(color),
-                                   rgba_getg(color),
-                                   rgba_getb(color),
-                                   255);
-          }
-          else {
-            ASSERT(m_transparentIndex >= 0);
-            if (m_transparentIndex >= 0)
-              i = m_transparentIndex;
-            else
-              i = m_bgIndex;
-          }
+        color_t color = *srcIt;
+        int i;
+
+        if (rgba_geta(color) >= 128) {
+          i = framePalette->findExactMatch(
+            rgba_getr(color),
+            rgba_getg(color),
+            rgba_getb(color),
+            255,
+            m_transparentIndex);
+          if (i < 0)
+            i = rgbmap->mapColor(rgba_getr(color),
+                                 rgba_getg(color),
+                                 rgba_getb(color),
+                                 255);
+        }
+        else {
+          ASSERT(m_transparentIndex >= 0);
+          if (m_transparentIndex >= 0)
+            i = m_transparentIndex;
+          else
+            i = m_bgIndex;
+        }
 
-          ASSERT(i >= 0);
+        ASSERT(i >= 0);
 
-          // This can happen when transparent color is outside the
-          // palette range (TODO something that shouldn't be possible
-          // from the program).
-          if (i >= usedColors.size())
-            usedColors.resize(i+1);
-          usedColors[i] = true;
+        // This can happen when transparent color is outside the
+        // palette range (TODO something that shouldn't be possible
+        // from the program).
+        if (i >= usedColors.size())
+          usedColors.resize(i+1);
+        usedColors[i] = true;
 
-          *dstIt = i;
-        }
+        *dstIt = i;
       }
     }
+  }
+
+  void writeImage(const gifframe_t gifFrame,
+                  const frame_t frame,
+                  const gfx::Rect& frameBounds,
+                  const DisposalMethod disposal,
+                  const bool fixDuration,
+                  const QuantizedFrame& quantized) {
+    const Palette* framePalette = quantized.framePalette;
+    const PalettePicks& usedColors = quantized.usedColors;
+    const Image* frameImage = quantized.image.get();
 
     int usedNColors = usedColors.picks();
 
@@ -1314,11 +1512,11 @@ private:
       GifFreeMapObject(colormap);
   }
 
-  Palette* createOptimizedPalette(const gfx::Rect& frameBounds) {
+  Palette* createOptimizedPalette(const Image* image) const {
     render::PaletteOptimizer optimizer;
 
-    // Feed the palette optimizer with pixels inside frameBounds
-    for (const auto& color : LockImageBits<RgbTraits>(m_currentImage, frameBounds)) {
+    // Feed the palette optimizer with all pixels of the frame area
+    for (const auto& color : LockImageBits<RgbTraits>(image)) {
       if (rgba_geta(color) >= 128)
         optimizer.feedWithRgbaColor(
           rgba(rgba_getr(color),
@@ -1331,7 +1529,7 @@ private:
     return palette;
   }
 
-  void renderFrame(frame_t frame, Image* dst) {
+  void renderFrame(frame_t frame, Image* dst) const {
     render::Render render;
     render.setNewBlend(m_fop->newBlend());
 
@@ -1381,11 +1579,9 @@ private:
   bool m_quantizeColormaps;
   bool m_interlaced;
   int m_loop;
-  ImageBufferPtr m_frameImageBuf;
-  ImageRef m_images[3];
-  Image* m_previousImage;
-  Image* m_currentImage;
-  Image* m_nextImage;
+  ImageRef m_previousImage;
+  ImageRef m_currentImage;
+  ImageRef m_nextImage;
 };
 
 bool GifFormat::onSave(FileOp* fop)
@@ -29,6 +29,7 @@
 #include "filters/tiled_mode.h"
 #include "gfx/rect.h"
 #include "render/onionskin_position.h"
+#include "render/quantization_algorithm.h"
 #include "render/zoom.h"
 
 #include "pref.xml.h"
@@ -22,6 +22,7 @@
 #include "base/file_handle.h"
 #include "base/fs.h"
 #include "base/fstream_path.h"
+#include "doc/algorithm/flip_type.h"
 #include "doc/anidir.h"
 #include "doc/blend_mode.h"
 #include "doc/color_mode.h"
@@ -320,6 +321,13 @@ Engine::Engine()
   setfield_integer(L, "NONE", doc::BrushPattern::PAINT_BRUSH);
   lua_pop(L, 1);
 
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_setglobal(L, "FlipType");
+  setfield_integer(L, "HORIZONTAL", doc::algorithm::FlipHorizontal);
+  setfield_integer(L, "VERTICAL", doc::algorithm::FlipVertical);
+  lua_pop(L, 1);
+
   lua_newtable(L);
   lua_pushvalue(L, -1);
   lua_setglobal(L, "FilterChannels");
@@ -23,17 +23,30 @@
 #include "app/tx.h"
 #include "app/util/autocrop.h"
 #include "app/util/resize_image.h"
+#include "base/clamp.h"
 #include "base/fs.h"
+#include "doc/algorithm/flip_image.h"
+#include "doc/algorithm/floodfill.h"
 #include "doc/algorithm/shrink_bounds.h"
 #include "doc/cel.h"
 #include "doc/image.h"
 #include "doc/image_ref.h"
+#include "doc/palette.h"
+#include "doc/palette_picks.h"
 #include "doc/primitives.h"
+#include "doc/rgbmap.h"
 #include "doc/sprite.h"
+#include "filters/convolution_matrix.h"
+#include "filters/convolution_matrix_filter.h"
+#include "filters/filter_indexed_data.h"
+#include "filters/filter_manager.h"
+#include "filters/median_filter.h"
 #include "render/render.h"
 
 #include <algorithm>
+#include <cstring>
 #include <memory>
+#include <vector>
 
 namespace app {
 namespace script {
@@ -77,6 +90,182 @@ struct ImageObj {
 
 int Image_clone(lua_State* L);
 
+// Applies a filter to the pixels of an image from a script. There is
+// no selection, so all pixels of the given area are modified.
+class ImageFilterManager : public filters::FilterManager
+                         , public filters::FilterIndexedData {
+public:
+  ImageFilterManager(const doc::Image* src,
+                     const gfx::Rect& srcBounds,
+                     doc::Image* dst,
+                     const gfx::Point& dstPos,
+                     const filters::Target target,
+                     const doc::Palette* palette,
+                     const doc::RgbMap* rgbmap)
+    : m_src(src)
+    , m_srcBounds(srcBounds)
+    , m_dst(dst)
+    , m_dstPos(dstPos)
+    , m_target(target)
+    , m_palette(palette)
+    , m_rgbmap(rgbmap)
+    , m_y(0)
+    , m_srcAddress(nullptr)
+    , m_dstAddress(nullptr) {
+  }
+
+  void apply(filters::Filter* filter) {
+    for (int v=0; v<m_srcBounds.h; ++v) {
+      m_y = m_srcBounds.y+v;
+      m_srcAddress = m_src->getPixelAddress(m_srcBounds.x, m_y);
+      m_dstAddress = m_dst->getPixelAddress(m_dstPos.x, m_dstPos.y+v);
+      switch (m_src->pixelFormat()) {
+        case doc::IMAGE_RGB:       filter->applyToRgba(this); break;
+        case doc::IMAGE_GRAYSCALE: filter->applyToGrayscale(this); break;
+        case doc::IMAGE_INDEXED:   filter->applyToIndexed(this); break;
+      }
+    }
+  }
+
+  // FilterManager implementation
+  doc::PixelFormat pixelFormat() const override { return m_src->pixelFormat(); }
+  const void* getSourceAddress() override { return m_srcAddress; }
+  void* getDestinationAddress() override { return m_dstAddress; }
+  int getWidth() override { return m_srcBounds.w; }
+  filters::Target getTarget() override { return m_target; }
+  filters::FilterIndexedData* getIndexedData() override { return this; }
+  bool skipPixel() override { return false; }
+  const doc::Image* getSourceImage() override { return m_src; }
+  int x() const override { return m_srcBounds.x; }
+  int y() const override { return m_y; }
+  bool isFirstRow() const override { return (m_y == m_srcBounds.y); }
+  bool isMaskActive() const override { return false; }
+
+  // FilterIndexedData implementation
+  const doc::Palette* getPalette() const override { return m_palette; }
+  const doc::RgbMap* getRgbMap() const override { return m_rgbmap; }
+  doc::Palette* getNewPalette() override { return nullptr; }
+  doc::PalettePicks getPalettePicks() override { return doc::PalettePicks(); }
+
+private:
+  const doc::Image* m_src;
+  gfx::Rect m_srcBounds;
+  doc::Image* m_dst;
+  gfx::Point m_dstPos;
+  filters::Target m_target;
+  const doc::Palette* m_palette;
+  const doc::RgbMap* m_rgbmap;
+  int m_y;
+  const void* m_srcAddress;
+  void* m_dstAddress;
+};
+
+// Horizontal lines collected by doc::algorithm::floodfill()
+struct FloodFillLines {
+  std::vector<gfx::Rect> lines;
+  gfx::Rect bounds;
+};
+
+void floodfill_hline(int x1, int y, int x2, void* data)
+{
+  auto ff = static_cast<FloodFillLines*>(data);
+  const gfx::Rect rc(x1, y, x2-x1+1, 1);
+  ff->lines.push_back(rc);
+  ff->bounds |= rc;
+}
+
+// Returns the area of the image specified in the optional rectangle
+// argument (the whole image by default). The area must be inside the
+// image bounds so the size of raw pixel buffers is predictable.
+gfx::Rect get_image_area_from_arg(lua_State* L, const doc::Image* img, int index)
+{
+  if (img->pixelFormat() == doc::IMAGE_BITMAP)
+    luaL_error(L, "bitmap images are not supported");
+
+  if (lua_isnone(L, index) || lua_isnil(L, index))
+    return img->bounds();
+
+  const gfx::Rect bounds = convert_args_into_rect(L, index);
+  if (bounds.isEmpty() || !img->bounds().contains(bounds))
+    luaL_error(L, "the rectangle must be inside the image bounds");
+  return bounds;
+}
+
+// Replaces each pixel of the given area with the value returned by
+// func(pixel).
+template<typename ImageTraits, typename Func>
+void transform_pixels_templ(doc::Image* img, const gfx::Rect& bounds, Func& func)
+{
+  for (int y=bounds.y; y<bounds.y2(); ++y) {
+    auto p = (typename ImageTraits::address_t)img->getPixelAddress(bounds.x, y);
+    for (int x=0; x<bounds.w; ++x, ++p)
+      *p = func(*p);
+  }
+}
+
+template<typename Func>
+void transform_pixels(doc::Image* img, const gfx::Rect& bounds, Func&& func)
+{
+  switch (img->pixelFormat()) {
+    case doc::IMAGE_RGB:
+      transform_pixels_templ<doc::RgbTraits>(img, bounds, func);
+      break;
+    case doc::IMAGE_GRAYSCALE:
+      transform_pixels_templ<doc::GrayscaleTraits>(img, bounds, func);
+      break;
+    case doc::IMAGE_INDEXED:
+      transform_pixels_templ<doc::IndexedTraits>(img, bounds, func);
+      break;
+  }
+}
+
+// Returns the palette and RGB map to use with the image (from its
+// sprite, or from the active sprite if the image isn't related to a
+// cel). Indexed images cannot be processed without them.
+void get_image_palette(lua_State* L, ImageObj* obj,
+                       const doc::Palette*& palette,
+                       const doc::RgbMap*& rgbmap)
+{
+  if (doc::Cel* cel = obj->cel(L)) {
+    palette = cel->sprite()->palette(cel->frame());
+    rgbmap = cel->sprite()->rgbMap(cel->frame());
+  }
+  else {
+    Site site = App::instance()->context()->activeSite();
+    palette = site.palette();
+    rgbmap = site.rgbMap();
+  }
+
+  if ((!palette || !rgbmap) &&
+      obj->image(L)->pixelFormat() == doc::IMAGE_INDEXED)
+    luaL_error(L, "a palette is needed to process indexed images");
+}
+
+// Modifies the given area of the image calling func(image, area). If
+// the image is related to a sprite, the modification is done in a
+// copy of the area and then committed as one undoable operation.
+//
+// As Lua errors are long jumps, func() must not raise Lua errors
+// (arguments must be validated before calling this function).
+template<typename Func>
+void modify_image_area(lua_State* L, ImageObj* obj, const gfx::Rect& bounds, Func&& func)
+{
+  doc::Image* dst = obj->image(L);
+  if (obj->cel(L) == nullptr) {
+    func(dst, bounds);
+  }
+  else {
+    ImageRef tmp(doc::crop_image(dst, bounds, dst->maskColor()));
+    func(tmp.get(), tmp->bounds());
+
+    Tx tx;
+    tx(new cmd::CopyRect(
+         dst, tmp.get(),
+         gfx::Clip(bounds.x, bounds.y, 0, 0, bounds.w, bounds.h)));
+    tx.commit();
+  }
+}
+
 int Image_new(lua_State* L)
 {
   doc::ImageSpec spec(doc::ColorMode::RGB, 1, 1, 0);
@@ -191,6 +380,44 @@ int Image_drawImage(lua_State* L)
   Image* dst = obj->image(L);
   const Image* src = sprite->image(L);
 
+  // Image:drawImage(image, position, opacity [, blendMode]) blends
+  // the source image instead of copying it (the position can be
+  // specified with a Point or with two integers).
+  const int optArg = (lua_isnumber(L, 3) ? 5: 4);
+  if (!lua_isnoneornil(L, optArg) ||
+      !lua_isnoneornil(L, optArg+1)) {
+    const int opacity = (lua_isnoneornil(L, optArg) ?
+                         255: base::clamp(int(lua_tointeger(L, optArg)), 0, 255));
+    doc::BlendMode blendMode = doc::BlendMode::NORMAL;
+    if (!lua_isnoneornil(L, optArg+1)) {
+      const lua_Integer mode = lua_tointeger(L, optArg+1);
+      if (mode < lua_Integer(doc::BlendMode::NORMAL) ||
+          mode > lua_Integer(doc::BlendMode::DIVIDE))
+        return luaL_argerror(L, optArg+1, "invalid blend mode");
+      blendMode = (doc::BlendMode)mode;
+    }
+    const doc::Palette* palette;
+    const doc::RgbMap* rgbmap;
+    get_image_palette(L, obj, palette, rgbmap);
+    if (!palette && src->pixelFormat() == doc::IMAGE_INDEXED)
+      return luaL_error(L, "a palette is needed to process indexed images");
+
+    const gfx::Rect bounds =
+      dst->bounds().createIntersection(gfx::Rect(pos, src->size()));
+    if (!bounds.isEmpty()) {
+      modify_image_area(
+        L, obj, bounds,
+        [src, palette, pos, bounds, opacity, blendMode](doc::Image* dst, const gfx::Rect& rc) {
+          render::composite_image(
+            dst, src, palette,
+            pos.x - bounds.x + rc.x,
+            pos.y - bounds.y + rc.y,
+            opacity, blendMode);
+        });
+    }
+    return 0;
+  }
+
   // If the destination image is not related to a sprite, we just draw
   // the source image without undo information.
   if (obj->cel(L) == nullptr) {
@@ -275,6 +502,268 @@ int Image_getPixel(lua_State* L)
   return 1;
 }
 
+// Returns the raw pixels of the given area as a string (rows from
+// top to bottom, each pixel in the same format that getPixel()
+// returns: 4 bytes RGBA, 2 bytes gray+alpha, or 1 byte index).
+int Image_getBytes(lua_State* L)
+{
+  const auto obj = get_obj<ImageObj>(L, 1);
+  const doc::Image* img = obj->image(L);
+  const gfx::Rect bounds = get_image_area_from_arg(L, img, 2);
+  const size_t rowBytes =
+    doc::calculate_rowstride_bytes(img->pixelFormat(), bounds.w);
+
+  luaL_Buffer b;
+  char* p = luaL_buffinitsize(L, &b, rowBytes*bounds.h);
+  for (int y=bounds.y; y<bounds.y2(); ++y, p+=rowBytes)
+    std::memcpy(p, img->getPixelAddress(bounds.x, y), rowBytes);
+  luaL_pushresultsize(&b, rowBytes*bounds.h);
+  return 1;
+}
+
+int Image_setBytes(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  size_t n;
+  const char* bytes = luaL_checklstring(L, 2, &n);
+  const doc::Image* img = obj->image(L);
+  const gfx::Rect bounds = get_image_area_from_arg(L, img, 3);
+  const size_t rowBytes =
+    doc::calculate_rowstride_bytes(img->pixelFormat(), bounds.w);
+  if (n != rowBytes*bounds.h)
+    return luaL_error(L, "invalid number of bytes (%d bytes expected)",
+                      int(rowBytes*bounds.h));
+
+  modify_image_area(
+    L, obj, bounds,
+    [bytes, rowBytes](doc::Image* dst, const gfx::Rect& rc) {
+      const char* p = bytes;
+      for (int y=rc.y; y<rc.y2(); ++y, p+=rowBytes)
+        std::memcpy(dst->getPixelAddress(rc.x, y), p, rowBytes);
+    });
+  return 0;
+}
+
+int Image_fill(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const doc::Image* img = obj->image(L);
+  doc::color_t color;
+  if (lua_isinteger(L, 2))
+    color = lua_tointeger(L, 2);
+  else
+    color = convert_args_into_pixel_color(L, 2);
+  const gfx::Rect bounds = get_image_area_from_arg(L, img, 3);
+
+  modify_image_area(
+    L, obj, bounds,
+    [color](doc::Image* dst, const gfx::Rect& rc) {
+      doc::fill_rect(dst, rc, color);
+    });
+  return 0;
+}
+
+// Image:flip([flipType [, rectangle]])
+int Image_flip(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const doc::Image* img = obj->image(L);
+  doc::algorithm::FlipType flipType = doc::algorithm::FlipHorizontal;
+  if (!lua_isnoneornil(L, 2)) {
+    const lua_Integer type = lua_tointeger(L, 2);
+    if (type != doc::algorithm::FlipHorizontal &&
+        type != doc::algorithm::FlipVertical)
+      return luaL_argerror(L, 2, "invalid flip type");
+    flipType = (doc::algorithm::FlipType)type;
+  }
+  const gfx::Rect bounds = get_image_area_from_arg(L, img, 3);
+
+  modify_image_area(
+    L, obj, bounds,
+    [flipType](doc::Image* dst, const gfx::Rect& rc) {
+      doc::algorithm::flip_image(dst, rc, flipType);
+    });
+  return 0;
+}
+
+// Image:floodFill(point, color [, tolerance [, contiguous]])
+int Image_floodFill(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const doc::Image* img = obj->image(L);
+  const gfx::Point pt = convert_args_into_point(L, 2);
+  doc::color_t color;
+  if (lua_isinteger(L, 3))
+    color = lua_tointeger(L, 3);
+  else
+    color = convert_args_into_pixel_color(L, 3);
+  const int tolerance = (lua_isnoneornil(L, 4) ?
+                         0: base::clamp(int(lua_tointeger(L, 4)), 0, 255));
+  const bool contiguous = (lua_isnoneornil(L, 5) ?
+                           true: lua_toboolean(L, 5));
+  if (img->pixelFormat() == doc::IMAGE_BITMAP)
+    return luaL_error(L, "bitmap images are not supported");
+  if (!img->bounds().contains(pt))
+    return 0;
+
+  FloodFillLines ff;
+  doc::algorithm::floodfill(
+    img, nullptr, pt.x, pt.y, img->bounds(),
+    doc::get_pixel(img, pt.x, pt.y),
+    tolerance, contiguous, false,
+    &ff, floodfill_hline);
+
+  if (!ff.bounds.isEmpty()) {
+    modify_image_area(
+      L, obj, ff.bounds,
+      [&ff, color](doc::Image* dst, const gfx::Rect& rc) {
+        const gfx::Point delta = rc.origin() - ff.bounds.origin();
+        for (const gfx::Rect& line : ff.lines)
+          doc::fill_rect(dst, gfx::Rect(line).offset(delta), color);
+      });
+  }
+  return 0;
+}
+
+// Applies the filter to the given area of the image reading the
+// original pixels from a copy of the image.
+int apply_filter(lua_State* L, ImageObj* obj,
+                 filters::Filter* filter,
+                 const filters::Target target,
+                 const gfx::Rect& bounds)
+{
+  const doc::Palette* palette;
+  const doc::RgbMap* rgbmap;
+  get_image_palette(L, obj, palette, rgbmap);
+
+  ImageRef src(doc::Image::createCopy(obj->image(L)));
+  modify_image_area(
+    L, obj, bounds,
+    [&](doc::Image* dst, const gfx::Rect& rc) {
+      ImageFilterManager filterMgr(src.get(), bounds, dst, rc.origin(),
+                                   target, palette, rgbmap);
+      filterMgr.apply(filter);
+    });
+  return 0;
+}
+
+// Image:blur([radius [, channels [, rectangle]]])
+int Image_blur(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const doc::Image* img = obj->image(L);
+  const int radius = (lua_isnoneornil(L, 2) ?
+                      1: base::clamp(int(lua_tointeger(L, 2)), 1, 32));
+  const filters::Target target = (lua_isnoneornil(L, 3) ?
+                                  TARGET_ALL_CHANNELS: lua_tointeger(L, 3));
+  const gfx::Rect bounds = get_image_area_from_arg(L, img, 4);
+
+  // Box blur
+  const int size = 2*radius+1;
+  auto matrix = std::make_shared<filters::ConvolutionMatrix>(size, size);
+  for (int v=0; v<size; ++v)
+    for (int u=0; u<size; ++u)
+      matrix->value(u, v) = 1;
+  matrix->setDiv(size*size);
+
+  filters::ConvolutionMatrixFilter filter;
+  filter.setMatrix(matrix);
+  return apply_filter(L, obj, &filter, target, bounds);
+}
+
+// Image:median([radius [, channels [, rectangle]]])
+int Image_median(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  const doc::Image* img = obj->image(L);
+  const int radius = (lua_isnoneornil(L, 2) ?
+                      1: base::clamp(int(lua_tointeger(L, 2)), 1, 32));
+  const filters::Target target = (lua_isnoneornil(L, 3) ?
+                                  TARGET_ALL_CHANNELS: lua_tointeger(L, 3));
+  const gfx::Rect bounds = get_image_area_from_arg(L, img, 4);
+
+  filters::MedianFilter filter;
+  filter.setSize(2*radius+1, 2*radius+1);
+  return apply_filter(L, obj, &filter, target, bounds);
+}
+
+// Image:mapPixels(table | function [, rectangle])
+//
+// Replaces each pixel value with table[value] (pixels without entry
+// in the table are not modified) or with the value returned by
+// function(value). The function is called only once for each
+// different pixel value, so it must not depend on other state.
+int Image_mapPixels(lua_State* L)
+{
+  auto obj = get_obj<ImageObj>(L, 1);
+  doc::Image* img = obj->image(L);
+  const bool isFunction = lua_isfunction(L, 2);
+  if (!isFunction && !lua_istable(L, 2))
+    return luaL_error(L, "a table or function is expected");
+  const gfx::Rect bounds = get_image_area_from_arg(L, img, 3);
+
+  // First pass: calculate the new value of each different pixel
+  // value in the "memo" table (here we can raise Lua errors as the
+  // image is not modified yet).
+  lua_newtable(L);
+  const int memo = lua_gettop(L);
+  bool first = true;
+  doc::color_t last = 0;
+  transform_pixels(
+    img, bounds,
+    [L, isFunction, memo, &first, &last](doc::color_t c) {
+      if (first || c != last) {
+        first = false;
+        last = c;
+        if (lua_rawgeti(L, memo, c) == LUA_TNIL) {
+          if (isFunction) {
+            lua_pushvalue(L, 2);
+            lua_pushinteger(L, c);
+            lua_call(L, 1, 1);
+          }
+          else
+            lua_rawgeti(L, 2, c);
+
+          if (lua_isnil(L, -1))
+            lua_pushinteger(L, c);
+          else if (lua_isinteger(L, -1))
+            lua_pushvalue(L, -1);
+          else {
+            const int i = lua_gettop(L);
+            lua_pushinteger(L, convert_args_into_pixel_color(L, i));
+          }
+          lua_rawseti(L, memo, c);
+          lua_pop(L, 1);
+        }
+        lua_pop(L, 1);
+      }
+      return c;
+    });
+
+  // Second pass: replace the pixels (without Lua errors)
+  modify_image_area(
+    L, obj, bounds,
+    [L, memo](doc::Image* dst, const gfx::Rect& rc) {
+      bool first = true;
+      doc::color_t last = 0, lastNew = 0;
+      transform_pixels(
+        dst, rc,
+        [L, memo, &first, &last, &lastNew](doc::color_t c) {
+          if (first || c != last) {
+            first = false;
+            last = c;
+            lua_rawgeti(L, memo, c);
+            lastNew = doc::color_t(lua_tointeger(L, -1));
+            lua_pop(L, 1);
+          }
+          return lastNew;
+        });
+    });
+
+  lua_pop(L, 1);                // Pop memo table
+  return 0;
+}
+
 int Image_isEqual(lua_State* L)
 {
   auto objA = get_obj<ImageObj>(L, 1);
@@ -461,6 +950,16 @@ int Image_get_spec(lua_State* L)
   return 1;
 }
 
+int Image_get_bytes(lua_State* L)
+{
+  return Image_getBytes(L);
+}
+
+int Image_set_bytes(lua_State* L)
+{
+  return Image_setBytes(L);
+}
+
 int Image_get_cel(lua_State* L)
 {
   const auto obj = get_obj<ImageObj>(L, 1);
@@ -476,6 +975,14 @@ const luaL_Reg Image_methods[] = {
   { "drawImage", Image_drawImage }, { "putImage", Image_drawImage }, // TODO putImage is deprecated
   { "drawSprite", Image_drawSprite }, { "putSprite", Image_drawSprite }, // TODO putSprite is deprecated
   { "pixels", Image_pixels },
+  { "getBytes", Image_getBytes },
+  { "setBytes", Image_setBytes },
+  { "fill", Image_fill },
+  { "mapPixels", Image_mapPixels },
+  { "flip", Image_flip },
+  { "floodFill", Image_floodFill },
+  { "blur", Image_blur },
+  { "median", Image_median },
   { "isEqual", Image_isEqual },
   { "isEmpty", Image_isEmpty },
   { "isPlain", Image_isPlain },
@@ -491,6 +998,7 @@ const Property Image_properties[] = {
   { "height", Image_get_height, nullptr },
   { "colorMode", Image_get_colorMode, nullptr },
   { "spec", Image_get_spec, nullptr },
+  { "bytes", Image_get_bytes, Image_set_bytes },
   { "cel", Image_get_cel, nullptr },
   { nullptr, nullptr, nullptr }
 };
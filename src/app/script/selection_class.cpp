@@ -18,7 +18,12 @@
 #include "app/script/luacpp.h"
 #include "app/transaction.h"
 #include "app/tx.h"
+#include "base/clamp.h"
+#include "doc/algorithm/floodfill.h"
+#include "doc/cel.h"
+#include "doc/image.h"
 #include "doc/mask.h"
+#include "doc/primitives.h"
 
 namespace app {
 namespace script {
@@ -234,6 +239,58 @@ int Selection_selectAll(lua_State* L)
   return 0;
 }
 
+void mask_add_hline(int x1, int y, int x2, void* data)
+{
+  static_cast<Mask*>(data)->add(gfx::Rect(x1, y, x2-x1+1, 1));
+}
+
+// Selection:selectColor(image, point [, tolerance [, contiguous]])
+//
+// Replaces the selection with the pixels of the image that are
+// similar to the pixel in the given point (like the Magic Wand
+// tool). If the image is from a cel, the cel position is used.
+int Selection_selectColor(lua_State* L)
+{
+  auto obj = get_obj<SelectionObj>(L, 1);
+  auto mask = obj->mask(L);
+  auto sprite = obj->sprite(L);
+  const Image* image = get_image_from_arg(L, 2);
+  const Cel* cel = get_image_cel_from_arg(L, 2);
+  const gfx::Point pt = convert_args_into_point(L, 3);
+  const int tolerance = (lua_isnoneornil(L, 4) ?
+                         0: base::clamp(int(lua_tointeger(L, 4)), 0, 255));
+  const bool contiguous = (lua_isnoneornil(L, 5) ?
+                           true: lua_toboolean(L, 5));
+  const gfx::Point origin = (cel ? cel->position(): gfx::Point(0, 0));
+
+  Mask newMask;
+  if (image->bounds().contains(pt)) {
+    // Reserve the whole image area and shrink the mask at the end
+    newMask.reserve(image->bounds());
+    newMask.freeze();
+    doc::algorithm::floodfill(
+      image, nullptr, pt.x, pt.y, image->bounds(),
+      get_pixel(image, pt.x, pt.y),
+      tolerance, contiguous, false,
+      &newMask, mask_add_hline);
+    newMask.unfreeze();
+    newMask.offsetOrigin(origin.x, origin.y);
+  }
+
+  if (sprite) {
+    Doc* doc = static_cast<Doc*>(sprite->document());
+    ASSERT(doc);
+
+    Tx tx;
+    tx(new cmd::SetMask(doc, &newMask));
+    tx.commit();
+  }
+  else {
+    replace(*mask, *mask, newMask);
+  }
+  return 0;
+}
+
 int Selection_contains(lua_State* L)
 {
   const auto obj = get_obj<SelectionObj>(L, 1);
@@ -315,6 +372,7 @@ const luaL_Reg Selection_methods[] = {
   { "add", Selection_add },
   { "subtract", Selection_subtract },
   { "intersect", Selection_intersect },
+  { "selectColor", Selection_selectColor },
   { "contains", Selection_contains },
   { "__gc", Selection_gc },
   { "__eq", Selection_eq },
@@ -0,0 +1,349 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/thumbnail_cache.h"
+
+#include "base/convert_to.h"
+#include "base/exception.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+#include "base/serialization.h"
+#include "base/sha1.h"
+#include "doc/image.h"
+#include "doc/image_io.h"
+#include "doc/string_io.h"
+
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <vector>
+
+#define THUMBCACHE_TRACE(...)
+
+namespace app {
+
+using namespace base::serialization;
+using namespace base::serialization::little_endian;
+
+namespace {
+
+const uint32_t kIndexMagicNumber = 0x58444E49; // 'INDX'
+const uint32_t kThumbnailMagicNumber = 0x424D4854; // 'THMB'
+const char* kIndexFilename = "index.dat";
+const char* kTempIndexFilename = "index.tmp";
+
+// Number of new thumbnails before saving the index file again
+const int kMaxUnsavedChanges = 32;
+
+bool same_time(const base::Time& a, const base::Time& b)
+{
+  return (a.year == b.year &&
+          a.month == b.month &&
+          a.day == b.day &&
+          a.hour == b.hour &&
+          a.minute == b.minute &&
+          a.second == b.second);
+}
+
+} // anonymous namespace
+
+ThumbnailCache::ThumbnailCache(const std::string& dir, const std::size_t maxSize)
+  : m_dir(dir)
+  , m_maxSize(maxSize)
+  , m_size(0)
+  , m_useCounter(0)
+  , m_unsavedChanges(0)
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  loadIndex();
+  removeOrphans();
+  discardOldEntries();
+}
+
+ThumbnailCache::~ThumbnailCache()
+{
+  flush();
+}
+
+doc::Image* ThumbnailCache::loadThumbnail(const std::string& filename)
+{
+  Entry key;
+  if (!getFileKey(filename, key))
+    return nullptr;
+
+  uint32_t lastUse;
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_entries.find(filename);
+    if (it == m_entries.end())
+      return nullptr;
+
+    // The file was modified
+    const Entry& entry = it->second;
+    if (!same_time(entry.mtime, key.mtime) ||
+        entry.fileSize != key.fileSize) {
+      removeEntry(it);
+      return nullptr;
+    }
+    lastUse = entry.lastUse;
+  }
+
+  // The thumbnail is read and decompressed without locking the mutex
+  std::unique_ptr<doc::Image> image;
+  try {
+    std::ifstream s(FSTREAM_PATH(thumbnailFilename(filename)),
+                    std::ifstream::binary);
+    if (s && read32(s) == kThumbnailMagicNumber)
+      image.reset(doc::read_image(s, false));
+  }
+  catch (const std::exception& ex) {
+    THUMBCACHE_TRACE("THUMBCACHE: Error loading thumbnail %s\n", ex.what());
+    image.reset();
+  }
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(filename);
+  if (it == m_entries.end())
+    return nullptr;
+
+  if (!image || image->pixelFormat() != doc::IMAGE_RGB) {
+    // Remove the entry only if the thumbnail wasn't saved again in
+    // the meantime
+    if (it->second.lastUse == lastUse)
+      removeEntry(it);
+    return nullptr;
+  }
+
+  it->second.lastUse = ++m_useCounter;
+  ++m_unsavedChanges;
+  return image.release();
+}
+
+void ThumbnailCache::saveThumbnail(const std::string& filename,
+                                   const doc::Image* thumbnail)
+{
+  ASSERT(thumbnail->pixelFormat() == doc::IMAGE_RGB);
+
+  Entry entry;
+  if (!getFileKey(filename, entry))
+    return;
+
+  std::lock_guard<std::mutex> lock(m_mutex);
+  auto it = m_entries.find(filename);
+  if (it != m_entries.end())
+    removeEntry(it);
+
+  const std::string fn = thumbnailFilename(filename);
+  try {
+    std::ofstream s(FSTREAM_PATH(fn), std::ofstream::binary);
+    write32(s, kThumbnailMagicNumber);
+    doc::write_image(s, thumbnail);
+    if (!s)
+      throw base::Exception("Error writing thumbnail");
+    entry.thumbnailSize = uint32_t(s.tellp());
+  }
+  catch (const std::exception& ex) {
+    THUMBCACHE_TRACE("THUMBCACHE: Error saving thumbnail %s\n", ex.what());
+    if (base::is_file(fn))
+      base::delete_file(fn);
+    return;
+  }
+
+  entry.lastUse = ++m_useCounter;
+  m_entries[filename] = entry;
+  m_size += entry.thumbnailSize;
+
+  discardOldEntries();
+
+  if (++m_unsavedChanges >= kMaxUnsavedChanges)
+    saveIndex();
+}
+
+void ThumbnailCache::flush()
+{
+  std::lock_guard<std::mutex> lock(m_mutex);
+  if (m_unsavedChanges > 0)
+    saveIndex();
+}
+
+std::string ThumbnailCache::thumbnailFilename(const std::string& filename) const
+{
+  return base::join_path(
+    m_dir,
+    base::convert_to<std::string>(base::Sha1::calculateFromString(filename)));
+}
+
+bool ThumbnailCache::getFileKey(const std::string& filename, Entry& entry) const
+{
+  if (!base::is_file(filename))
+    return false;
+
+  entry.mtime = base::get_modification_time(filename);
+  entry.fileSize = base::file_size(filename);
+  entry.thumbnailSize = 0;
+  entry.lastUse = 0;
+  return true;
+}
+
+void ThumbnailCache::loadIndex()
+{
+  const std::string fn = base::join_path(m_dir, kIndexFilename);
+  if (!base::is_file(fn))
+    return;
+
+  std::ifstream s(FSTREAM_PATH(fn), std::ifstream::binary);
+  if (!s || read32(s) != kIndexMagicNumber)
+    return;
+
+  m_useCounter = read32(s);
+  const uint32_t n = read32(s);
+  for (uint32_t i=0; i<n && s; ++i) {
+    std::string filename = doc::read_string(s);
+    Entry entry;
+    entry.mtime.year = read16(s);
+    entry.mtime.month = read8(s);
+    entry.mtime.day = read8(s);
+    entry.mtime.hour = read8(s);
+    entry.mtime.minute = read8(s);
+    entry.mtime.second = read8(s);
+    entry.fileSize = read32(s);
+    entry.fileSize |= uint64_t(read32(s)) << 32;
+    entry.thumbnailSize = read32(s);
+    entry.lastUse = read32(s);
+    if (!s)
+      break;
+
+    m_entries[filename] = entry;
+    m_size += entry.thumbnailSize;
+  }
+}
+
+// The index is written in a temporary file and then renamed, so the
+// old index is kept if the program crashes while it's being saved.
+void ThumbnailCache::saveIndex()
+{
+  const std::string fn = base::join_path(m_dir, kIndexFilename);
+  const std::string tmp = base::join_path(m_dir, kTempIndexFilename);
+  try {
+    {
+      std::ofstream s(FSTREAM_PATH(tmp), std::ofstream::binary);
+      write32(s, kIndexMagicNumber);
+      write32(s, m_useCounter);
+      write32(s, uint32_t(m_entries.size()));
+      for (const auto& it : m_entries) {
+        const Entry& entry = it.second;
+        doc::write_string(s, it.first);
+        write16(s, entry.mtime.year);
+        write8(s, entry.mtime.month);
+        write8(s, entry.mtime.day);
+        write8(s, entry.mtime.hour);
+        write8(s, entry.mtime.minute);
+        write8(s, entry.mtime.second);
+        write32(s, uint32_t(entry.fileSize & 0xffffffff));
+        write32(s, uint32_t(entry.fileSize >> 32));
+        write32(s, entry.thumbnailSize);
+        write32(s, entry.lastUse);
+      }
+      if (!s)
+        throw base::Exception("Error writing thumbnail index");
+    }
+
+#ifdef _WIN32
+    // MoveFile() doesn't replace an existent file
+    if (base::is_file(fn))
+      base::delete_file(fn);
+#endif
+    base::move_file(tmp, fn);
+  }
+  catch (const std::exception& ex) {
+    THUMBCACHE_TRACE("THUMBCACHE: Error saving index %s\n", ex.what());
+    return;
+  }
+  m_unsavedChanges = 0;
+}
+
+void ThumbnailCache::removeEntry(Entries::iterator it)
+{
+  const std::string fn = thumbnailFilename(it->first);
+  if (base::is_file(fn)) {
+    try {
+      base::delete_file(fn);
+    }
+    catch (const std::exception& ex) {
+      THUMBCACHE_TRACE("THUMBCACHE: Error deleting thumbnail %s\n", ex.what());
+    }
+  }
+
+  m_size -= it->second.thumbnailSize;
+  m_entries.erase(it);
+  ++m_unsavedChanges;
+}
+
+// Removes thumbnail files that are not in the index (e.g. saved after
+// the last time the index was saved, before a crash or by other
+// instance of the program), and entries without a thumbnail file, so
+// m_size is the real size of the cache.
+void ThumbnailCache::removeOrphans()
+{
+  std::set<std::string> thumbnails;
+  for (auto it=m_entries.begin(); it!=m_entries.end(); ) {
+    const std::string fn = thumbnailFilename(it->first);
+    if (base::is_file(fn)) {
+      thumbnails.insert(base::get_file_name(fn));
+      ++it;
+    }
+    else {
+      m_size -= it->second.thumbnailSize;
+      it = m_entries.erase(it);
+      ++m_unsavedChanges;
+    }
+  }
+
+  for (const auto& fn : base::list_files(m_dir)) {
+    if (fn == kIndexFilename ||
+        thumbnails.find(fn) != thumbnails.end())
+      continue;
+
+    THUMBCACHE_TRACE("THUMBCACHE: Removing orphan %s\n", fn.c_str());
+    try {
+      base::delete_file(base::join_path(m_dir, fn));
+    }
+    catch (const std::exception& ex) {
+      THUMBCACHE_TRACE("THUMBCACHE: Error deleting thumbnail %s\n", ex.what());
+    }
+  }
+}
+
+// Removes the least recently used thumbnails until the cache size is
+// less than the maximum size.
+void ThumbnailCache::discardOldEntries()
+{
+  if (m_size <= m_maxSize)
+    return;
+
+  std::vector<Entries::iterator> lru;
+  lru.reserve(m_entries.size());
+  for (auto it=m_entries.begin(); it!=m_entries.end(); ++it)
+    lru.push_back(it);
+  std::sort(lru.begin(), lru.end(),
+            [](const Entries::iterator& a, const Entries::iterator& b) {
+              return a->second.lastUse < b->second.lastUse;
+            });
+
+  for (auto it : lru) {
+    if (m_size <= m_maxSize)
+      break;
+    THUMBCACHE_TRACE("THUMBCACHE: Discarding %s\n", it->first.c_str());
+    removeEntry(it);
+  }
+}
+
+} // namespace app
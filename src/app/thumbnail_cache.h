@@ -0,0 +1,82 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_THUMBNAIL_CACHE_H_INCLUDED
+#define APP_THUMBNAIL_CACHE_H_INCLUDED
+#pragma once
+
+#include "base/disable_copying.h"
+#include "base/time.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+namespace doc {
+  class Image;
+}
+
+namespace app {
+
+  // Persistent cache of file thumbnails (used by the file selector)
+  // saved in a directory of the user configuration. Each thumbnail
+  // is saved in its own file (with the RGBA pixels compressed with
+  // zlib), and an index file keeps the key of each thumbnail (path,
+  // modification time and size of the original file) and the order
+  // in which they were used to discard the least recently used ones
+  // when the cache is bigger than the given size.
+  //
+  // All member functions are thread-safe.
+  class ThumbnailCache {
+  public:
+    ThumbnailCache(const std::string& dir, const std::size_t maxSize);
+    ~ThumbnailCache();
+
+    // Returns a new RGBA image with the thumbnail of the given file,
+    // or nullptr if the thumbnail is not in the cache (or the file
+    // was modified after the thumbnail was saved).
+    doc::Image* loadThumbnail(const std::string& filename);
+
+    // Saves the RGBA thumbnail of the given file.
+    void saveThumbnail(const std::string& filename,
+                       const doc::Image* thumbnail);
+
+    // Saves the index file (it's saved automatically in the
+    // destructor and after some new thumbnails)
+    void flush();
+
+  private:
+    struct Entry {
+      base::Time mtime;         // Modification time of the file
+      uint64_t fileSize;        // Size of the file
+      uint32_t thumbnailSize;   // Size of the thumbnail in the cache
+      uint32_t lastUse;         // Counter of the last time it was used
+    };
+    typedef std::map<std::string, Entry> Entries;
+
+    std::string thumbnailFilename(const std::string& filename) const;
+    bool getFileKey(const std::string& filename, Entry& entry) const;
+    void loadIndex();
+    void saveIndex();
+    void removeOrphans();
+    void removeEntry(Entries::iterator it);
+    void discardOldEntries();
+
+    std::string m_dir;
+    std::size_t m_maxSize;
+    std::size_t m_size;         // Total size of all thumbnails
+    uint32_t m_useCounter;
+    int m_unsavedChanges;
+    Entries m_entries;
+    std::mutex m_mutex;
+
+    DISABLE_COPYING(ThumbnailCache);
+  };
+
+} // namespace app
+
+#endif
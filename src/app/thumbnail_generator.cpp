@@ -16,12 +16,17 @@
 #include "app/doc.h"
 #include "app/file/file.h"
 #include "app/file_system.h"
+#include "app/pref/preferences.h"
+#include "app/resource_finder.h"
+#include "app/thumbnail_cache.h"
 #include "base/bind.h"
+#include "base/fs.h"
 #include "base/scoped_lock.h"
 #include "base/thread.h"
 #include "doc/algorithm/rotate.h"
 #include "doc/conversion_to_surface.h"
 #include "doc/image.h"
+#include "doc/image_bits.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
 #include "doc/sprite.h"
@@ -37,10 +42,59 @@
 
 namespace app {
 
+// Converts the thumbnail to RGBA, the format saved in the
+// ThumbnailCache and used to create the os::Surface.
+static Image* convert_thumbnail_to_rgba(const Image* image,
+                                        const Palette* palette)
+{
+  Image* rgbaImage = Image::create(IMAGE_RGB, image->width(), image->height());
+  LockImageBits<RgbTraits> dstBits(rgbaImage);
+  auto dstIt = dstBits.begin();
+
+  switch (image->pixelFormat()) {
+
+    case IMAGE_RGB:
+      rgbaImage->copy(image, gfx::Clip(image->bounds()));
+      break;
+
+    case IMAGE_GRAYSCALE:
+      for (const color_t c : LockImageBits<GrayscaleTraits>(image)) {
+        const int v = graya_getv(c);
+        *dstIt = rgba(v, v, v, graya_geta(c));
+        ++dstIt;
+      }
+      break;
+
+    case IMAGE_INDEXED:
+      for (const color_t c : LockImageBits<IndexedTraits>(image)) {
+        *dstIt = (int(c) < palette->size() ? palette->getEntry(c): 0);
+        ++dstIt;
+      }
+      break;
+  }
+  return rgbaImage;
+}
+
+static os::Surface* create_thumbnail_surface(const Image* rgbaImage)
+{
+  os::Surface* thumbnail =
+    os::instance()->createRgbaSurface(
+      rgbaImage->width(),
+      rgbaImage->height());
+
+  convert_image_to_surface(
+    rgbaImage, nullptr, thumbnail,
+    0, 0, 0, 0, rgbaImage->width(), rgbaImage->height());
+
+  return thumbnail;
+}
+
 class ThumbnailGenerator::Worker {
 public:
-  Worker(base::concurrent_queue<ThumbnailGenerator::Item>& queue)
+  Worker(base::concurrent_queue<ThumbnailGenerator::Item>& queue,
+         ThumbnailCache* cache)
     : m_queue(queue)
+    , m_cache(cache)
     , m_fop(nullptr)
     , m_isDone(false)
     , m_thread(base::Bind<void>(&Worker::loadBgThread, this)) {
@@ -156,16 +210,16 @@ private:
 
       // Set the thumbnail of the file-item.
       if (thumbnailImage) {
-        os::Surface* thumbnail =
-          os::instance()->createRgbaSurface(
-            thumbnailImage->width(),
-            thumbnailImage->height());
+        std::unique_ptr<Image> rgbaImage(
+          convert_thumbnail_to_rgba(thumbnailImage.get(), palette.get()));
 
-        convert_image_to_surface(
-          thumbnailImage.get(), palette.get(), thumbnail,
-          0, 0, 0, 0, thumbnailImage->width(), thumbnailImage->height());
+        // Save the thumbnail in the disk cache to avoid loading the
+        // file again the next time.
+        if (m_cache)
+          m_cache->saveThumbnail(m_item.fileitem->fileName(), rgbaImage.get());
 
-        m_item.fileitem->setThumbnail(thumbnail);
+        m_item.fileitem->setThumbnail(
+          create_thumbnail_surface(rgbaImage.get()));
       }
 
       THUMB_TRACE("FOP done with thumbnail: %s %s\n",
@@ -200,6 +254,7 @@ private:
   }
 
   base::concurrent_queue<Item>& m_queue;
+  ThumbnailCache* m_cache;
   app::ThumbnailGenerator::Item m_item;
   FileOp* m_fop;
   mutable base::mutex m_mutex;
@@ -227,6 +282,38 @@ ThumbnailGenerator::ThumbnailGenerator()
   int n = std::thread::hardware_concurrency()-1;
   if (n < 1) n = 1;
   m_maxWorkers = n;
+
+  // Thumbnails are saved in the "thumbnails" folder of the user
+  // configuration (a size of 0 disables the cache)
+  const int cacheSize = Preferences::instance().fileSelector.thumbnailCacheSize();
+  if (cacheSize > 0) {
+    try {
+      ResourceFinder rf;
+      rf.includeUserDir(base::join_path("thumbnails", ".").c_str());
+      const std::string dir = rf.getFirstOrCreateDefault();
+      if (!base::is_directory(dir))
+        base::make_all_directories(dir);
+
+      m_cache.reset(
+        new ThumbnailCache(dir, std::size_t(cacheSize)*1024*1024));
+    }
+    catch (const std::exception& ex) {
+      LOG(ERROR) << "THUMB: Cannot create thumbnail cache: " << ex.what() << "\n";
+    }
+  }
+}
+
+ThumbnailGenerator::~ThumbnailGenerator()
+{
+  // Stop workers before saving the cache index
+  stopAllWorkers();
+  {
+    base::scoped_lock hold(m_workersAccess);
+    for (auto worker : m_workers)
+      delete worker;
+    m_workers.clear();
+  }
+  m_cache.reset();
 }
 
 bool ThumbnailGenerator::checkWorkers()
@@ -256,6 +343,19 @@ void ThumbnailGenerator::generateThumbnail(IFileItem* fileitem)
       fileitem->getThumbnail())
     return;
 
+  // Use the thumbnail from the disk cache (if the file wasn't
+  // modified since the thumbnail was generated)
+  if (m_cache && fileitem->getThumbnailProgress() == 0.0) {
+    std::unique_ptr<Image> rgbaImage(
+      m_cache->loadThumbnail(fileitem->fileName()));
+    if (rgbaImage) {
+      THUMB_TRACE("Thumbnail from cache for %s\n",
+                  fileitem->fileName().c_str());
+      fileitem->setThumbnail(create_thumbnail_surface(rgbaImage.get()));
+      return;
+    }
+  }
+
   if (fileitem->getThumbnailProgress() > 0.0) {
     if (fileitem->getThumbnailProgress() == 0.00001) {
       m_remainingItems.prioritize(
@@ -328,7 +428,7 @@ void ThumbnailGenerator::startWorker()
 {
   base::scoped_lock hold(m_workersAccess);
   if (m_workers.size() < m_maxWorkers) {
-    std::unique_ptr<Worker> worker(new Worker(m_remainingItems));
+    std::unique_ptr<Worker> worker(new Worker(m_remainingItems, m_cache.get()));
     m_workers.push_back(worker.get());
     worker.release();
   }
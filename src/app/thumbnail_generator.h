@@ -22,10 +22,12 @@ namespace base {
 namespace app {
   class FileOp;
   class IFileItem;
+  class ThumbnailCache;
 
   class ThumbnailGenerator {
     ThumbnailGenerator();
   public:
+    ~ThumbnailGenerator();
     static ThumbnailGenerator* instance();
 
     // Generate a thumbnail for the given file-item.  It must be called
@@ -60,6 +62,7 @@ namespace app {
     };
 
     int m_maxWorkers;
+    std::unique_ptr<ThumbnailCache> m_cache;
     WorkerList m_workers;
     base::mutex m_workersAccess;
     std::unique_ptr<base::thread> m_stopThread;
@@ -10,15 +10,22 @@
 #include "config.h"
 #endif
 
+#include "app/thumbnails.h"
+
+#include "base/time.h"
 #include "doc/blend_mode.h"
 #include "doc/cel.h"
 #include "doc/conversion_to_surface.h"
+#include "doc/image.h"
 #include "doc/layer.h"
+#include "doc/palette.h"
 #include "doc/sprite.h"
 #include "os/surface.h"
 #include "os/system.h"
 #include "render/render.h"
 
+#include <tuple>
+
 namespace app {
 namespace thumb {
 
@@ -69,5 +76,136 @@ os::Surface* get_cel_thumbnail(const doc::Cel* cel,
     return nullptr;
 }
 
+bool CelThumbnailCache::Key::operator<(const Key& o) const
+{
+  return (std::tie(imageId, imageVersion, paletteId, paletteModifications,
+                   pixelRatioW, pixelRatioH, transparentColor, background,
+                   size.w, size.h) <
+          std::tie(o.imageId, o.imageVersion, o.paletteId, o.paletteModifications,
+                   o.pixelRatioW, o.pixelRatioH, o.transparentColor, o.background,
+                   o.size.w, o.size.h));
+}
+
+CelThumbnailCache::CelThumbnailCache(const std::size_t maxMemSize)
+  : m_memSize(0)
+  , m_maxMemSize(maxMemSize)
+{
+}
+
+CelThumbnailCache::~CelThumbnailCache()
+{
+  clear();
+}
+
+os::Surface* CelThumbnailCache::getCelThumbnail(const doc::Cel* cel,
+                                                const gfx::Size& fitInSize)
+{
+  Key key;
+  if (!makeKey(cel, fitInSize, key))
+    return nullptr;
+
+  auto it = m_entries.find(key);
+  if (it != m_entries.end()) {
+    // Move the entry to the front of the LRU list
+    m_lru.splice(m_lru.begin(), m_lru, it->second.lruIt);
+    return it->second.surface;
+  }
+
+  if (m_pendingKeys.insert(key).second) {
+    Request req;
+    req.celId = cel->id();
+    req.key = key;
+    req.fitInSize = fitInSize;
+    m_pending.push_back(req);
+  }
+  return nullptr;
+}
+
+bool CelThumbnailCache::renderPending(const int maxMsecs)
+{
+  const base::tick_t t0 = base::current_tick();
+  bool rendered = false;
+
+  while (!m_pending.empty()) {
+    const Request req = m_pending.front();
+    m_pending.pop_front();
+    m_pendingKeys.erase(req.key);
+
+    // The cel could be deleted or modified since the request
+    const doc::Cel* cel = doc::get<doc::Cel>(req.celId);
+    Key key;
+    if (!cel ||
+        !makeKey(cel, req.fitInSize, key) ||
+        key < req.key || req.key < key ||
+        m_entries.find(key) != m_entries.end())
+      continue;
+
+    os::Surface* surface = get_cel_thumbnail(cel, req.fitInSize);
+    if (!surface)
+      continue;
+
+    m_lru.push_front(key);
+    Entry& entry = m_entries[key];
+    entry.surface = surface;
+    entry.lruIt = m_lru.begin();
+    m_memSize += 4*surface->width()*surface->height();
+    rendered = true;
+
+    if (base::current_tick() - t0 >= base::tick_t(maxMsecs))
+      break;
+  }
+
+  discardOldEntries();
+  return rendered;
+}
+
+void CelThumbnailCache::clear()
+{
+  for (auto& it : m_entries)
+    it.second.surface->dispose();
+  m_entries.clear();
+  m_lru.clear();
+  m_pending.clear();
+  m_pendingKeys.clear();
+  m_memSize = 0;
+}
+
+bool CelThumbnailCache::makeKey(const doc::Cel* cel,
+                                const gfx::Size& fitInSize,
+                                Key& key) const
+{
+  const doc::Image* image = cel->image();
+  const doc::Sprite* sprite = cel->sprite();
+  if (!image || !sprite)
+    return false;
+
+  const doc::Palette* palette = sprite->palette(cel->frame());
+  key.imageId = image->id();
+  key.imageVersion = image->version();
+  key.paletteId = palette->id();
+  key.paletteModifications = palette->getModifications();
+  key.pixelRatioW = sprite->pixelRatio().w;
+  key.pixelRatioH = sprite->pixelRatio().h;
+  key.transparentColor = sprite->transparentColor();
+  key.background = (cel->layer() && cel->layer()->isBackground());
+  key.size = fitInSize;
+  return true;
+}
+
+// Removes the least recently used thumbnails until the memory used
+// by the cache is less than the maximum.
+void CelThumbnailCache::discardOldEntries()
+{
+  while (m_memSize > m_maxMemSize && !m_lru.empty()) {
+    auto it = m_entries.find(m_lru.back());
+    ASSERT(it != m_entries.end());
+    os::Surface* surface = it->second.surface;
+    m_memSize -= 4*surface->width()*surface->height();
+    surface->dispose();
+    m_entries.erase(it);
+    m_lru.pop_back();
+  }
+}
+
 } // thumb
 } // app
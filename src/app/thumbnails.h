@@ -9,8 +9,16 @@
 #define APP_THUMBNAILS_H_INCLUDED
 #pragma once
 
+#include "doc/color.h"
+#include "doc/object_id.h"
+#include "doc/object_version.h"
 #include "gfx/size.h"
 
+#include <cstddef>
+#include <list>
+#include <map>
+#include <set>
+
 namespace doc {
   class Cel;
 }
@@ -25,6 +33,67 @@ namespace thumb {
   os::Surface* get_cel_thumbnail(const doc::Cel* cel,
                                  const gfx::Size& fitInSize);
 
+  // Cache of cel thumbnails. Thumbnails are identified by the cel
+  // image id/version, the palette, and the thumbnail size, so a
+  // modified image doesn't need to be invalidated explicitly (the
+  // old thumbnail is discarded when the cache is full).
+  //
+  // Missing thumbnails are not rendered in getCelThumbnail(), they
+  // are queued and rendered later with renderPending() (e.g. from a
+  // timer), so painting a lot of cels doesn't block the UI.
+  class CelThumbnailCache {
+  public:
+    CelThumbnailCache(const std::size_t maxMemSize);
+    ~CelThumbnailCache();
+
+    // Returns the thumbnail of the given cel (the surface is owned
+    // by the cache and is valid until the next call of
+    // renderPending() or clear()), or nullptr if it's not ready yet.
+    os::Surface* getCelThumbnail(const doc::Cel* cel,
+                                 const gfx::Size& fitInSize);
+
+    // Renders queued thumbnails until "maxMsecs" milliseconds pass.
+    // Returns true if some thumbnail was rendered.
+    bool renderPending(const int maxMsecs);
+    bool hasPending() const { return !m_pending.empty(); }
+
+    void clear();
+
+  private:
+    struct Key {
+      doc::ObjectId imageId;
+      doc::ObjectVersion imageVersion;
+      doc::ObjectId paletteId;
+      int paletteModifications;
+      int pixelRatioW, pixelRatioH;
+      doc::color_t transparentColor; // Used to render indexed images
+      bool background;               // Background layers are opaque
+      gfx::Size size;
+      bool operator<(const Key& other) const;
+    };
+
+    struct Entry {
+      os::Surface* surface;
+      std::list<Key>::iterator lruIt;
+    };
+
+    struct Request {
+      doc::ObjectId celId;
+      Key key;
+      gfx::Size fitInSize;
+    };
+
+    bool makeKey(const doc::Cel* cel, const gfx::Size& fitInSize, Key& key) const;
+    void discardOldEntries();
+
+    std::map<Key, Entry> m_entries;
+    std::list<Key> m_lru;             // Most recently used keys first
+    std::list<Request> m_pending;     // Thumbnails to render
+    std::set<Key> m_pendingKeys;
+    std::size_t m_memSize;
+    std::size_t m_maxMemSize;
+  };
+
 } // thumb
 } // app
 
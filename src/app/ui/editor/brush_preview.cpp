@@ -267,7 +267,7 @@ void BrushPreview::show(const gfx::Point& screenPos)
 
     document->notifySpritePixelsModified(
       sprite, gfx::Region(m_lastBounds = extraCelBounds),
-      m_lastFrame = site.frame());
+      m_lastFrame = site.frame(), site.layer());
 
     m_withRealPreview = true;
   }
@@ -330,7 +330,8 @@ void BrushPreview::hide()
     if (document && sprite) {
       document->setExtraCel(ExtraCelRef(nullptr));
       document->notifySpritePixelsModified(
-        sprite, gfx::Region(m_lastBounds), m_lastFrame);
+        sprite, gfx::Region(m_lastBounds), m_lastFrame,
+        m_editor->layer());
     }
 
     m_withRealPreview = false;
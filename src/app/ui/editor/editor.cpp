@@ -38,10 +38,12 @@
 #include "app/ui/editor/editor_customization_delegate.h"
 #include "app/ui/editor/editor_decorator.h"
 #include "app/ui/editor/editor_render.h"
+#include "app/ui/editor/editor_render_cache.h"
 #include "app/ui/editor/glue.h"
 #include "app/ui/editor/moving_pixels_state.h"
 #include "app/ui/editor/pixels_movement.h"
 #include "app/ui/editor/play_state.h"
+#include "app/ui/editor/playback_cache.h"
 #include "app/ui/editor/scrolling_state.h"
 #include "app/ui/editor/standby_state.h"
 #include "app/ui/editor/zooming_state.h"
@@ -156,6 +158,8 @@ Editor::Editor(Doc* document, EditorFlags flags)
   , m_isPlaying(false)
   , m_showGuidesThisCel(nullptr)
   , m_tagFocusBand(-1)
+  , m_renderCache(new EditorRenderCache)
+  , m_playbackCache(nullptr)
 {
   if (!m_renderEngine)
     m_renderEngine = new EditorRender;
@@ -193,7 +197,7 @@ Editor::Editor(Doc* document, EditorFlags flags)
   m_tiledConn = m_docPref.tiled.AfterChange.connect(base::Bind<void>(&Editor::onTiledModeChange, this));
   m_gridConn = m_docPref.grid.AfterChange.connect(base::Bind<void>(&Editor::invalidate, this));
   m_pixelGridConn = m_docPref.pixelGrid.AfterChange.connect(base::Bind<void>(&Editor::invalidate, this));
-  m_bgConn = m_docPref.bg.AfterChange.connect(base::Bind<void>(&Editor::invalidate, this));
+  m_bgConn = m_docPref.bg.AfterChange.connect(base::Bind<void>(&Editor::onBgChange, this));
   m_onionskinConn = m_docPref.onionskin.AfterChange.connect(base::Bind<void>(&Editor::invalidate, this));
   m_symmetryModeConn = Preferences::instance().symmetryMode.enabled.AfterChange.connect(base::Bind<void>(&Editor::invalidateIfActive, this));
   m_showExtrasConn =
@@ -606,10 +610,7 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
     m_renderEngine->setNewBlendMethod(Preferences::instance().experimental.newBlend());
     m_renderEngine->setRefLayersVisiblity(true);
     m_renderEngine->setSelectedLayer(m_layer);
-    if (m_flags & Editor::kUseNonactiveLayersOpacityWhenEnabled)
-      m_renderEngine->setNonactiveLayersOpacity(Preferences::instance().experimental.nonactiveLayersOpacity());
-    else
-      m_renderEngine->setNonactiveLayersOpacity(255);
+    m_renderEngine->setNonactiveLayersOpacity(nonactiveLayersOpacity());
     m_renderEngine->setProjection(
       newEngine ? render::Projection(): m_proj);
     m_renderEngine->setupBackground(m_document, rendered->pixelFormat());
@@ -650,8 +651,55 @@ void Editor::drawOneSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& sprite
         m_layer, m_frame);
     }
 
-    m_renderEngine->renderSprite(
-      rendered.get(), m_sprite, m_frame, gfx::Clip(0, 0, rc2));
+    const Image* previewImage = m_renderEngine->previewImage();
+
+    // The frames rendered in background threads must use the same
+    // settings as the editor.
+    if (m_playbackCache)
+      m_playbackCache->setRenderSettings(
+        m_layer, nonactiveLayersOpacity(),
+        Preferences::instance().experimental.newBlend());
+
+    // Use the frame rendered in a background thread if we are
+    // playing the animation and there is nothing else to show.
+    if (m_playbackCache &&
+        newEngine &&
+        !m_renderEngine->hasOnionskin() &&
+        !previewImage &&
+        (!extraCel || extraCel->type() == render::ExtraType::NONE) &&
+        m_playbackCache->copyFrame(m_frame, rendered.get(), rc2)) {
+      // Pixels already copied
+    }
+    // Use the cache of rendered tiles if we are rendering the sprite
+    // without zoom, and the preview image (if any) is in the active
+    // layer (in other case we need to re-compose all layers).
+    else if (newEngine &&
+             !m_renderEngine->hasOnionskin() &&
+             (!previewImage ||
+              (m_renderEngine->previewLayer() == m_layer &&
+               m_renderEngine->previewFrame() == m_frame))) {
+      // Tiles that intersect the extra cel or the preview image
+      // cannot be cached as they will change in the next render.
+      gfx::Rect volatileBounds;
+      if (extraCel && extraCel->type() != render::ExtraType::NONE &&
+          extraCel->cel() && extraCel->image()) {
+        volatileBounds |= gfx::Rect(extraCel->cel()->position(),
+                                    extraCel->image()->size());
+      }
+      if (previewImage) {
+        volatileBounds |= m_renderEngine->previewBounds();
+        if (Cel* cel = (m_layer ? m_layer->cel(m_frame): nullptr))
+          volatileBounds |= cel->bounds();
+      }
+
+      m_renderCache->renderSprite(
+        m_renderEngine, rendered.get(), m_sprite, m_layer, m_frame,
+        rc2, volatileBounds);
+    }
+    else {
+      m_renderEngine->renderSprite(
+        rendered.get(), m_sprite, m_frame, gfx::Clip(0, 0, rc2));
+    }
 
     m_renderEngine->removeExtraImage();
   }
@@ -916,7 +964,17 @@ void Editor::drawMask(Graphics* g)
   pt.x = m_padding.x + m_proj.applyX(pt.x);
   pt.y = m_padding.y + m_proj.applyY(pt.y);
 
-  for (const auto& seg : *m_document->getMaskBoundaries()) {
+  // Visible area of the sprite, we draw only the segments in the
+  // bands of rows that intersect this area.
+  gfx::Rect spriteBounds = m_proj.remove(g->getClipBounds().offset(-pt));
+  spriteBounds.enlarge(1);
+
+  for (const auto& seg : m_document->getMaskBoundaries()->segmentsIn(spriteBounds)) {
+    const gfx::Rect& segBounds = seg.bounds();
+    if (segBounds.x > spriteBounds.x2() || segBounds.x2() < spriteBounds.x ||
+        segBounds.y > spriteBounds.y2() || segBounds.y2() < spriteBounds.y)
+      continue;
+
     CheckedDrawMode checked(g, m_antsOffset,
                             gfx::rgba(0, 0, 0, 255),
                             gfx::rgba(255, 255, 255, 255));
@@ -2125,6 +2183,51 @@ void Editor::onShowExtrasChange()
   invalidate();
 }
 
+void Editor::onBgChange()
+{
+  m_renderCache->invalidate();
+  invalidatePlaybackCache();
+  invalidate();
+}
+
+void Editor::onGeneralUpdate(DocEvent& ev)
+{
+  // Some changes (e.g. from scripts) modify pixels without a
+  // specific notification, so we discard all the rendered tiles.
+  m_renderCache->invalidate();
+  invalidatePlaybackCache();
+}
+
+void Editor::onPaletteChanged(DocEvent& ev)
+{
+  m_renderCache->invalidate();
+  invalidatePlaybackCache();
+}
+
+void Editor::onSpriteTransparentColorChanged(DocEvent& ev)
+{
+  m_renderCache->invalidate();
+  invalidatePlaybackCache();
+}
+
+void Editor::onSpritePixelsModified(DocEvent& ev)
+{
+  if (ev.sprite() == m_sprite) {
+    m_renderCache->invalidateRegion(ev.region(), ev.frame(), ev.layer());
+
+    // Other frames with the same (linked) image are discarded by the
+    // playback cache when the new image version is detected.
+    if (m_playbackCache)
+      m_playbackCache->invalidateFrame(ev.frame());
+  }
+}
+
+void Editor::invalidatePlaybackCache()
+{
+  if (m_playbackCache)
+    m_playbackCache->invalidate();
+}
+
 void Editor::onColorSpaceChanged(DocEvent& ev)
 {
   // As the document has a new color space, we've to redraw the
@@ -2644,6 +2747,19 @@ void Editor::setAnimationSpeedMultiplier(double speed)
   m_aniSpeed = speed;
 }
 
+void Editor::setPlaybackCache(PlaybackCache* cache)
+{
+  m_playbackCache = cache;
+}
+
+int Editor::nonactiveLayersOpacity() const
+{
+  if (m_flags & Editor::kUseNonactiveLayersOpacityWhenEnabled)
+    return Preferences::instance().experimental.nonactiveLayersOpacity();
+  else
+    return 255;
+}
+
 void Editor::showMouseCursor(CursorType cursorType,
                              const Cursor* cursor)
 {
@@ -37,6 +37,7 @@
 #include "ui/timer.h"
 #include "ui/widget.h"
 
+#include <memory>
 #include <set>
 
 namespace doc {
@@ -57,7 +58,9 @@ namespace app {
   class DocView;
   class EditorCustomizationDelegate;
   class EditorRender;
+  class EditorRenderCache;
   class PixelsMovement;
+  class PlaybackCache;
   class Site;
 
   namespace tools {
@@ -268,6 +271,13 @@ namespace app {
     double getAnimationSpeedMultiplier() const;
     void setAnimationSpeedMultiplier(double speed);
 
+    // Frames rendered in background threads during the playback (the
+    // cache is owned by the PlayState).
+    void setPlaybackCache(PlaybackCache* cache);
+
+    // Opacity used to render non-active layers in this editor
+    int nonactiveLayersOpacity() const;
+
     // Functions to be used in EditorState::onSetCursor()
     void showMouseCursor(ui::CursorType cursorType,
                          const ui::Cursor* cursor = nullptr);
@@ -328,8 +338,13 @@ namespace app {
     void onTiledModeBeforeChange();
     void onTiledModeChange();
     void onShowExtrasChange();
+    void onBgChange();
 
     // DocObserver impl
+    void onGeneralUpdate(DocEvent& ev) override;
+    void onPaletteChanged(DocEvent& ev) override;
+    void onSpriteTransparentColorChanged(DocEvent& ev) override;
+    void onSpritePixelsModified(DocEvent& ev) override;
     void onColorSpaceChanged(DocEvent& ev) override;
     void onExposeSpritePixels(DocEvent& ev) override;
     void onSpritePixelRatioChanged(DocEvent& ev) override;
@@ -349,6 +364,7 @@ namespace app {
     void updateQuicktool();
     void updateToolByTipProximity(ui::PointerType pointerType);
     void updateToolLoopModifiersIndicators();
+    void invalidatePlaybackCache();
 
     void drawBackground(ui::Graphics* g);
     void drawSpriteUnclippedRect(ui::Graphics* g, const gfx::Rect& rc);
@@ -466,6 +482,12 @@ namespace app {
     // For slices
     doc::SelectedObjects m_selectedSlices;
 
+    // Cache of rendered tiles of this editor
+    std::unique_ptr<EditorRenderCache> m_renderCache;
+
+    // Cache of rendered frames while the animation is playing
+    PlaybackCache* m_playbackCache;
+
     // The render engine must be shared between all editors so when a
     // DrawingState is being used in one editor, other editors for the
     // same document can show the same preview image/stroke being drawn
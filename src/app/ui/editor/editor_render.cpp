@@ -13,6 +13,7 @@
 
 #include "app/color_utils.h"
 #include "app/pref/preferences.h"
+#include "doc/image.h"
 #include "render/render.h"
 
 namespace app {
@@ -21,8 +22,14 @@ static doc::ImageBufferPtr g_renderBuffer;
 
 EditorRender::EditorRender()
   : m_render(new render::Render)
+  , m_nonactiveLayersOpacity(255)
+  , m_newBlend(Preferences::instance().experimental.newBlend())
+  , m_onionskin(false)
+  , m_previewLayer(nullptr)
+  , m_previewFrame(0)
+  , m_previewImage(nullptr)
 {
-  m_render->setNewBlend(Preferences::instance().experimental.newBlend());
+  m_render->setNewBlend(m_newBlend);
 }
 
 EditorRender::~EditorRender()
@@ -37,11 +44,13 @@ void EditorRender::setRefLayersVisiblity(const bool visible)
 
 void EditorRender::setNonactiveLayersOpacity(const int opacity)
 {
+  m_nonactiveLayersOpacity = opacity;
   m_render->setNonactiveLayersOpacity(opacity);
 }
 
 void EditorRender::setNewBlendMethod(const bool newBlend)
 {
+  m_newBlend = newBlend;
   m_render->setNewBlend(newBlend);
 }
 
@@ -109,14 +118,27 @@ void EditorRender::setPreviewImage(const doc::Layer* layer,
                          const gfx::Point& pos,
                          const doc::BlendMode blendMode)
 {
+  m_previewLayer = layer;
+  m_previewFrame = frame;
+  m_previewImage = image;
+  m_previewPos = pos;
   m_render->setPreviewImage(layer, frame, image, pos, blendMode);
 }
 
 void EditorRender::removePreviewImage()
 {
+  m_previewImage = nullptr;
   m_render->removePreviewImage();
 }
 
+gfx::Rect EditorRender::previewBounds() const
+{
+  if (m_previewImage)
+    return gfx::Rect(m_previewPos, m_previewImage->size());
+  else
+    return gfx::Rect();
+}
+
 void EditorRender::setExtraImage(
   render::ExtraType type,
   const doc::Cel* cel,
@@ -136,14 +158,32 @@ void EditorRender::removeExtraImage()
 
 void EditorRender::setOnionskin(const render::OnionskinOptions& options)
 {
+  m_onionskin = (options.type() != render::OnionskinType::NONE);
   m_render->setOnionskin(options);
 }
 
 void EditorRender::disableOnionskin()
 {
+  m_onionskin = false;
   m_render->disableOnionskin();
 }
 
+void EditorRender::setRenderLayersBelow(const doc::Layer* layer)
+{
+  m_render->setRenderLayersBelow(layer);
+}
+
+void EditorRender::setRenderLayersFrom(const doc::Layer* layer,
+                                       const doc::Image* backdrop)
+{
+  m_render->setRenderLayersFrom(layer, backdrop);
+}
+
+void EditorRender::removeRenderLayersRange()
+{
+  m_render->removeRenderLayersRange();
+}
+
 void EditorRender::renderSprite(
   doc::Image* dstImage,
   const doc::Sprite* sprite,
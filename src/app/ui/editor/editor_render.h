@@ -16,6 +16,7 @@
 #include "doc/pixel_format.h"
 #include "gfx/clip.h"
 #include "gfx/point.h"
+#include "gfx/rect.h"
 #include "render/extra_type.h"
 #include "render/onionskin_options.h"
 #include "render/projection.h"
@@ -44,6 +45,9 @@ namespace app {
     void setNonactiveLayersOpacity(const int opacity);
     void setNewBlendMethod(const bool newBlend);
 
+    int nonactiveLayersOpacity() const { return m_nonactiveLayersOpacity; }
+    bool newBlendMethod() const { return m_newBlend; }
+
     void setProjection(const render::Projection& projection);
 
     void setupBackground(Doc* doc, doc::PixelFormat pixelFormat);
@@ -58,6 +62,13 @@ namespace app {
                          const doc::BlendMode blendMode);
     void removePreviewImage();
 
+    // Information about the active preview image (returns nullptr if
+    // there is no preview image)
+    const doc::Image* previewImage() const { return m_previewImage; }
+    const doc::Layer* previewLayer() const { return m_previewLayer; }
+    doc::frame_t previewFrame() const { return m_previewFrame; }
+    gfx::Rect previewBounds() const;
+
     void setExtraImage(
       render::ExtraType type,
       const doc::Cel* cel,
@@ -69,6 +80,12 @@ namespace app {
 
     void setOnionskin(const render::OnionskinOptions& options);
     void disableOnionskin();
+    bool hasOnionskin() const { return m_onionskin; }
+
+    void setRenderLayersBelow(const doc::Layer* layer);
+    void setRenderLayersFrom(const doc::Layer* layer,
+                             const doc::Image* backdrop);
+    void removeRenderLayersRange();
 
     void renderSprite(
       doc::Image* dstImage,
@@ -95,6 +112,13 @@ namespace app {
 
   private:
     render::Render* m_render;
+    int m_nonactiveLayersOpacity;
+    bool m_newBlend;
+    bool m_onionskin;
+    const doc::Layer* m_previewLayer;
+    doc::frame_t m_previewFrame;
+    const doc::Image* m_previewImage;
+    gfx::Point m_previewPos;
   };
 
 } // namespace app
@@ -0,0 +1,348 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/editor_render_cache.h"
+
+#include "app/ui/editor/editor_render.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+#include "gfx/clip.h"
+
+#include <algorithm>
+
+namespace app {
+
+using namespace doc;
+
+namespace {
+
+// Maximum memory used by the tiles of one editor
+const std::size_t kMaxMemSize = 128*1024*1024;
+
+} // anonymous namespace
+
+bool EditorRenderCache::LayerState::operator==(const LayerState& o) const
+{
+  return (layer == o.layer &&
+          visible == o.visible &&
+          opacity == o.opacity &&
+          blendMode == o.blendMode &&
+          imageId == o.imageId &&
+          imageVersion == o.imageVersion &&
+          celOpacity == o.celOpacity &&
+          celBounds == o.celBounds);
+}
+
+EditorRenderCache::EditorRenderCache()
+  : m_sprite(nullptr)
+  , m_activeLayer(nullptr)
+  , m_frame(-1)
+  , m_nonactiveLayersOpacity(255)
+  , m_newBlend(true)
+  , m_belowCount(0)
+  , m_cols(0)
+  , m_rows(0)
+  , m_memSize(0)
+{
+}
+
+void EditorRenderCache::renderSprite(EditorRender* render,
+                                     Image* dstImage,
+                                     const Sprite* sprite,
+                                     const Layer* activeLayer,
+                                     const frame_t frame,
+                                     const gfx::Rect& area,
+                                     const gfx::Rect& volatileBounds)
+{
+  updateKey(sprite, activeLayer, frame,
+            render->nonactiveLayersOpacity(),
+            render->newBlendMethod());
+  updateLayerStates(sprite, activeLayer, frame);
+  discardTilesIfNeeded(area);
+
+  const gfx::Rect spriteBounds = sprite->bounds();
+  const int tx1 = std::max(0, area.x / kTileSize);
+  const int ty1 = std::max(0, area.y / kTileSize);
+  const int tx2 = std::min(m_cols-1, (area.x2()-1) / kTileSize);
+  const int ty2 = std::min(m_rows-1, (area.y2()-1) / kTileSize);
+
+  for (int ty=ty1; ty<=ty2; ++ty) {
+    for (int tx=tx1; tx<=tx2; ++tx) {
+      Tile& tile = m_tiles[ty*m_cols + tx];
+      const gfx::Rect tileBounds =
+        spriteBounds.createIntersection(
+          gfx::Rect(tx*kTileSize, ty*kTileSize, kTileSize, kTileSize));
+      const gfx::Rect rc = area.createIntersection(tileBounds);
+      if (rc.isEmpty())
+        continue;
+
+      ImageRef src;
+
+      // Use (or create) the final composition of the tile
+      if (!tileBounds.intersects(volatileBounds)) {
+        if (!tile.full)
+          tile.full = renderTile(render, sprite, frame, tileBounds);
+        src = tile.full;
+      }
+      // Composite the active layer and the layers above it over the
+      // cached backdrop
+      else {
+        if (!tile.below) {
+          render->setRenderLayersBelow(activeLayer);
+          tile.below = renderTile(render, sprite, frame, tileBounds);
+        }
+        render->setRenderLayersFrom(activeLayer, tile.below.get());
+        if (!m_tmpBuf)
+          m_tmpBuf.reset(new ImageBuffer);
+        src.reset(Image::create(IMAGE_RGB, tileBounds.w, tileBounds.h,
+                                m_tmpBuf));
+        render->renderSprite(src.get(), sprite, frame,
+                             gfx::Clip(0, 0, tileBounds));
+        render->removeRenderLayersRange();
+      }
+
+      dstImage->copy(src.get(),
+                     gfx::Clip(rc.x - area.x,
+                               rc.y - area.y,
+                               rc.x - tileBounds.x,
+                               rc.y - tileBounds.y,
+                               rc.w, rc.h));
+    }
+  }
+}
+
+void EditorRenderCache::invalidate()
+{
+  for (Tile& tile : m_tiles) {
+    tile.full.reset();
+    tile.below.reset();
+  }
+  m_memSize = 0;
+}
+
+void EditorRenderCache::invalidateRegion(const gfx::Region& region,
+                                         const frame_t frame,
+                                         const Layer* layer)
+{
+  if (frame != m_frame)
+    return;
+
+  // Modified pixels of a layer below the active layer (or from an
+  // unknown layer) affect the backdrop too.
+  const bool below = (!layer || layer != m_activeLayer);
+  for (const gfx::Rect& rc : region)
+    invalidateTiles(rc, below);
+}
+
+void EditorRenderCache::updateKey(const Sprite* sprite,
+                                  const Layer* activeLayer,
+                                  const frame_t frame,
+                                  const int nonactiveLayersOpacity,
+                                  const bool newBlend)
+{
+  if (m_sprite != sprite ||
+      m_frame != frame ||
+      m_spriteSize != sprite->size() ||
+      m_nonactiveLayersOpacity != nonactiveLayersOpacity ||
+      m_newBlend != newBlend) {
+    m_sprite = sprite;
+    m_activeLayer = activeLayer;
+    m_frame = frame;
+    m_spriteSize = sprite->size();
+    m_nonactiveLayersOpacity = nonactiveLayersOpacity;
+    m_newBlend = newBlend;
+    m_layerStates.clear();
+
+    m_cols = (m_spriteSize.w + kTileSize - 1) / kTileSize;
+    m_rows = (m_spriteSize.h + kTileSize - 1) / kTileSize;
+    m_tiles.clear();
+    m_tiles.resize(m_cols*m_rows);
+    m_memSize = 0;
+  }
+  else if (m_activeLayer != activeLayer) {
+    m_activeLayer = activeLayer;
+
+    // The opacity of non-active layers depends on the active layer
+    if (m_nonactiveLayersOpacity != 255)
+      invalidate();
+    else
+      invalidateBelowTiles();
+  }
+}
+
+void EditorRenderCache::updateLayerStates(const Sprite* sprite,
+                                          const Layer* activeLayer,
+                                          const frame_t frame)
+{
+  LayerStates states;
+  int belowCount = -1;
+  states.reserve(m_layerStates.size());
+  collectLayerStates(sprite->root(), true, activeLayer, frame,
+                     states, belowCount);
+  if (belowCount < 0)
+    belowCount = int(states.size());
+
+  // The stack of layers has changed (new/removed/moved layers)
+  if (states.size() != m_layerStates.size() ||
+      !std::equal(states.begin(), states.end(), m_layerStates.begin(),
+                  [](const LayerState& a, const LayerState& b) {
+                    return a.layer == b.layer;
+                  })) {
+    invalidate();
+  }
+  else {
+    for (int i=0; i<int(states.size()); ++i) {
+      const LayerState& a = m_layerStates[i];
+      const LayerState& b = states[i];
+      if (a != b) {
+        const bool below = (i < belowCount || i < m_belowCount);
+        invalidateTiles(a.celBounds, below);
+        invalidateTiles(b.celBounds, below);
+      }
+    }
+    // Some layer was moved from/to the backdrop
+    if (belowCount != m_belowCount)
+      invalidateBelowTiles();
+  }
+
+  std::swap(m_layerStates, states);
+  m_belowCount = belowCount;
+}
+
+// Collects the layers in the same order they are composited by
+// render::Render. "belowCount" is the number of layers composited
+// before the active layer.
+void EditorRenderCache::collectLayerStates(const LayerGroup* group,
+                                           const bool visible,
+                                           const Layer* activeLayer,
+                                           const frame_t frame,
+                                           LayerStates& states,
+                                           int& belowCount) const
+{
+  for (const Layer* layer : group->layers()) {
+    const bool layerVisible = (visible && layer->isVisible());
+    if (layer == activeLayer && layerVisible && belowCount < 0)
+      belowCount = int(states.size());
+
+    if (layer->isGroup()) {
+      collectLayerStates(static_cast<const LayerGroup*>(layer),
+                         layerVisible, activeLayer, frame,
+                         states, belowCount);
+      continue;
+    }
+
+    LayerState state;
+    state.layer = layer;
+    state.visible = layerVisible;
+    state.opacity = 255;
+    state.blendMode = BlendMode::NORMAL;
+    state.imageId = NullId;
+    state.imageVersion = 0;
+    state.celOpacity = 0;
+
+    if (layer->isImage()) {
+      auto imgLayer = static_cast<const LayerImage*>(layer);
+      state.opacity = imgLayer->opacity();
+      state.blendMode = imgLayer->blendMode();
+    }
+
+    if (const Cel* cel = layer->cel(frame)) {
+      const Image* image = cel->image();
+      state.imageId = image->id();
+      state.imageVersion = image->version();
+      state.celOpacity = cel->opacity();
+      // Reference layers can be scaled/positioned with sub-pixel
+      // precision
+      if (layer->isReference())
+        state.celBounds = gfx::Rect(0, 0, m_spriteSize.w, m_spriteSize.h);
+      else
+        state.celBounds = cel->bounds();
+    }
+    states.push_back(state);
+  }
+}
+
+void EditorRenderCache::invalidateTiles(const gfx::Rect& bounds, const bool below)
+{
+  const gfx::Rect rc = bounds.createIntersection(gfx::Rect(0, 0, m_spriteSize.w, m_spriteSize.h));
+  if (rc.isEmpty())
+    return;
+
+  const int tx1 = rc.x / kTileSize;
+  const int ty1 = rc.y / kTileSize;
+  const int tx2 = (rc.x2()-1) / kTileSize;
+  const int ty2 = (rc.y2()-1) / kTileSize;
+
+  for (int ty=ty1; ty<=ty2; ++ty) {
+    for (int tx=tx1; tx<=tx2; ++tx) {
+      Tile& tile = m_tiles[ty*m_cols + tx];
+      if (tile.full) {
+        m_memSize -= tile.full->getMemSize();
+        tile.full.reset();
+      }
+      if (below && tile.below) {
+        m_memSize -= tile.below->getMemSize();
+        tile.below.reset();
+      }
+    }
+  }
+}
+
+void EditorRenderCache::invalidateBelowTiles()
+{
+  for (Tile& tile : m_tiles) {
+    if (tile.below) {
+      m_memSize -= tile.below->getMemSize();
+      tile.below.reset();
+    }
+  }
+}
+
+// Keeps the memory used by the cache under kMaxMemSize discarding
+// the tiles outside the area that we're going to render.
+void EditorRenderCache::discardTilesIfNeeded(const gfx::Rect& area)
+{
+  if (m_memSize < kMaxMemSize)
+    return;
+
+  for (int ty=0; ty<m_rows; ++ty) {
+    for (int tx=0; tx<m_cols; ++tx) {
+      if (!area.intersects(gfx::Rect(tx*kTileSize, ty*kTileSize,
+                                     kTileSize, kTileSize))) {
+        Tile& tile = m_tiles[ty*m_cols + tx];
+        if (tile.full) {
+          m_memSize -= tile.full->getMemSize();
+          tile.full.reset();
+        }
+        if (tile.below) {
+          m_memSize -= tile.below->getMemSize();
+          tile.below.reset();
+        }
+      }
+    }
+  }
+}
+
+ImageRef EditorRenderCache::renderTile(EditorRender* render,
+                                       const Sprite* sprite,
+                                       const frame_t frame,
+                                       const gfx::Rect& tileBounds)
+{
+  ImageRef image(Image::create(IMAGE_RGB, tileBounds.w, tileBounds.h));
+  render->renderSprite(image.get(), sprite, frame,
+                       gfx::Clip(0, 0, tileBounds));
+  render->removeRenderLayersRange();
+  m_memSize += image->getMemSize();
+  return image;
+}
+
+} // namespace app
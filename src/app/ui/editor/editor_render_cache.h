@@ -0,0 +1,135 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UI_EDITOR_RENDER_CACHE_H_INCLUDED
+#define APP_UI_EDITOR_RENDER_CACHE_H_INCLUDED
+#pragma once
+
+#include "doc/blend_mode.h"
+#include "doc/frame.h"
+#include "doc/image_buffer.h"
+#include "doc/image_ref.h"
+#include "doc/object_id.h"
+#include "doc/object_version.h"
+#include "gfx/rect.h"
+#include "gfx/region.h"
+#include "gfx/size.h"
+
+#include <vector>
+
+namespace doc {
+  class Image;
+  class Layer;
+  class LayerGroup;
+  class Sprite;
+}
+
+namespace app {
+  class EditorRender;
+
+  // Cache of rendered tiles of the sprite (without zoom) used by one
+  // editor. Each tile can keep the final composition of all layers
+  // and the backdrop of the active layer (the composition of the
+  // layers below it). So when only the active layer changes (e.g. on
+  // each step of a brush stroke) we have to composite just the
+  // active layer and the ones above it, and tiles that weren't
+  // touched are not rendered at all.
+  class EditorRenderCache {
+  public:
+    static const int kTileSize = 64;
+
+    EditorRenderCache();
+
+    // Renders the "area" of the sprite (in sprite coordinates) in the
+    // (0, 0) position of "dstImage" using the cached tiles (and
+    // rendering the missing ones). The final composition of tiles
+    // intersecting "volatileBounds" (e.g. the bounds of the extra cel
+    // or the preview image of the active layer) is not cached.
+    void renderSprite(EditorRender* render,
+                      doc::Image* dstImage,
+                      const doc::Sprite* sprite,
+                      const doc::Layer* activeLayer,
+                      const doc::frame_t frame,
+                      const gfx::Rect& area,
+                      const gfx::Rect& volatileBounds);
+
+    // Discards all tiles (e.g. when the background or the palette
+    // changes).
+    void invalidate();
+
+    // Discards the tiles in the given region (in sprite coordinates)
+    // of the given frame. If "layer" is the active layer, the
+    // backdrop of those tiles is still valid.
+    void invalidateRegion(const gfx::Region& region,
+                          const doc::frame_t frame,
+                          const doc::Layer* layer);
+
+  private:
+    struct Tile {
+      doc::ImageRef full;       // All layers
+      doc::ImageRef below;      // Layers below the active layer
+    };
+
+    // State of each layer that affects the rendered pixels, used to
+    // detect changes that weren't notified to the editor (e.g. new
+    // image versions after undo/redo).
+    struct LayerState {
+      const doc::Layer* layer;
+      bool visible;
+      int opacity;
+      doc::BlendMode blendMode;
+      doc::ObjectId imageId;
+      doc::ObjectVersion imageVersion;
+      int celOpacity;
+      gfx::Rect celBounds;
+
+      bool operator==(const LayerState& o) const;
+      bool operator!=(const LayerState& o) const { return !operator==(o); }
+    };
+    typedef std::vector<LayerState> LayerStates;
+
+    void updateKey(const doc::Sprite* sprite,
+                   const doc::Layer* activeLayer,
+                   const doc::frame_t frame,
+                   const int nonactiveLayersOpacity,
+                   const bool newBlend);
+    void updateLayerStates(const doc::Sprite* sprite,
+                           const doc::Layer* activeLayer,
+                           const doc::frame_t frame);
+    void collectLayerStates(const doc::LayerGroup* group,
+                            const bool visible,
+                            const doc::Layer* activeLayer,
+                            const doc::frame_t frame,
+                            LayerStates& states,
+                            int& belowCount) const;
+    void invalidateTiles(const gfx::Rect& bounds, const bool below);
+    void invalidateBelowTiles();
+    void discardTilesIfNeeded(const gfx::Rect& area);
+    doc::ImageRef renderTile(EditorRender* render,
+                             const doc::Sprite* sprite,
+                             const doc::frame_t frame,
+                             const gfx::Rect& tileBounds);
+
+    // Key of the cached tiles
+    const doc::Sprite* m_sprite;
+    const doc::Layer* m_activeLayer;
+    doc::frame_t m_frame;
+    gfx::Size m_spriteSize;
+    int m_nonactiveLayersOpacity;
+    bool m_newBlend;
+
+    LayerStates m_layerStates;
+    int m_belowCount;           // Number of layers below m_activeLayer
+
+    int m_cols, m_rows;
+    std::vector<Tile> m_tiles;
+    std::size_t m_memSize;      // Memory used by all tiles (in bytes)
+    doc::ImageBufferPtr m_tmpBuf;
+  };
+
+} // namespace app
+
+#endif
@@ -524,7 +524,8 @@ void PixelsMovement::moveImage(const gfx::Point& pos, MoveModifier moveModifier)
     m_document->notifySpritePixelsModified(
       m_site.sprite(),
       gfx::Region(fullBounds),
-      m_site.frame());
+      m_site.frame(),
+      m_site.layer());
   }
 }
 
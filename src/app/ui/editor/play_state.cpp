@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2018  David Capello
 //
 // This program is distributed under the terms of
@@ -17,9 +18,12 @@
 #include "app/tools/ink.h"
 #include "app/ui/editor/editor.h"
 #include "app/ui/editor/editor_customization_delegate.h"
+#include "app/ui/editor/playback_cache.h"
 #include "app/ui/editor/scrolling_state.h"
 #include "app/ui/skin/skin_theme.h"
+#include "app/ui/status_bar.h"
 #include "app/ui_context.h"
+#include "base/mem_utils.h"
 #include "doc/handle_anidir.h"
 #include "doc/tag.h"
 #include "ui/manager.h"
@@ -41,6 +45,7 @@ PlayState::PlayState(const bool playOnce,
   , m_pingPongForward(true)
   , m_refFrame(0)
   , m_tag(nullptr)
+  , m_statsTick(0)
 {
   m_playTimer.Tick.connect(&PlayState::onPlaybackTick, this);
 
@@ -50,6 +55,12 @@ PlayState::PlayState(const bool playOnce,
     &PlayState::onBeforeCommandExecution, this);
 }
 
+PlayState::~PlayState()
+{
+  // Wait the background threads before the editor is deleted
+  m_playbackCache.reset();
+}
+
 void PlayState::onEnterState(Editor* editor)
 {
   StateWithWheelBehavior::onEnterState(editor);
@@ -84,6 +95,20 @@ void PlayState::onEnterState(Editor* editor)
   m_curFrameTick = base::current_tick();
   m_pingPongForward = true;
 
+  // Start rendering the next frames in background (it's useless with
+  // onion skinning as the editor has to render several frames anyway)
+  if (!m_playbackCache &&
+      Preferences::instance().experimental.playbackCache() &&
+      !m_editor->docPref().onionskin.active()) {
+    m_playbackCache.reset(
+      new PlaybackCache(m_editor->document(),
+                        m_editor->layer(),
+                        m_editor->nonactiveLayersOpacity(),
+                        Preferences::instance().experimental.newBlend()));
+    m_editor->setPlaybackCache(m_playbackCache.get());
+  }
+  updatePlaybackCache();
+
   // Maybe we came from ScrollingState and the timer is already
   // running.
   if (!m_playTimer.isRunning())
@@ -97,6 +122,11 @@ EditorState::LeaveAction PlayState::onLeaveState(Editor* editor, EditorState* ne
   if (!m_toScroll) {
     m_playTimer.stop();
 
+    if (m_playbackCache) {
+      m_editor->setPlaybackCache(nullptr);
+      m_playbackCache.reset();
+    }
+
     if (m_playOnce || Preferences::instance().general.rewindOnStop())
       m_editor->setFrame(m_refFrame);
   }
@@ -183,6 +213,7 @@ void PlayState::onPlaybackTick()
   m_nextFrameTime -= (base::current_tick() - m_curFrameTick);
 
   doc::Sprite* sprite = m_editor->sprite();
+  bool frameChanged = false;
 
   while (m_nextFrameTime <= 0) {
     doc::frame_t frame = m_editor->frame();
@@ -216,8 +247,17 @@ void PlayState::onPlaybackTick()
       sprite, frame, frame_t(1), m_tag,
       m_pingPongForward);
 
+    if (m_playbackCache)
+      m_playbackCache->checkHit(frame);
+
     m_editor->setFrame(frame);
     m_nextFrameTime += getNextFrameTime();
+    frameChanged = true;
+  }
+
+  if (frameChanged && m_editor->isPlaying()) {
+    updatePlaybackCache();
+    showPlaybackCacheStats();
   }
 
   m_curFrameTick = base::current_tick();
@@ -260,4 +300,44 @@ double PlayState::getNextFrameTime()
     / m_editor->getAnimationSpeedMultiplier(); // The "speed multiplier" is a "duration divider"
 }
 
+void PlayState::updatePlaybackCache()
+{
+  if (!m_playbackCache)
+    return;
+
+  // The current frame and the next ones in the order they will be
+  // shown (following the tag's AniDir)
+  doc::Sprite* sprite = m_editor->sprite();
+  doc::frame_t frame = m_editor->frame();
+  bool pingPongForward = m_pingPongForward;
+  std::vector<doc::frame_t> frames;
+  frames.push_back(frame);
+  for (int i=1; i<m_playbackCache->capacity(); ++i) {
+    frame = calculate_next_frame(
+      sprite, frame, frame_t(1), m_tag,
+      pingPongForward);
+    frames.push_back(frame);
+  }
+  m_playbackCache->setUpcomingFrames(frames);
+}
+
+void PlayState::showPlaybackCacheStats()
+{
+  if (!m_playbackCache)
+    return;
+
+  // Don't update the status bar too often
+  const base::tick_t now = base::current_tick();
+  if (now - m_statsTick < 500)
+    return;
+  m_statsTick = now;
+
+  StatusBar::instance()->setStatusText(
+    0, "Playback cache: %d/%d frames, %s, %d%% hits",
+    m_playbackCache->readyFrames(),
+    m_playbackCache->capacity(),
+    base::get_pretty_memory_size(m_playbackCache->memSize()).c_str(),
+    m_playbackCache->hitRate());
+}
+
 } // namespace app
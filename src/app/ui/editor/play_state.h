@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -14,6 +15,8 @@
 #include "obs/connection.h"
 #include "ui/timer.h"
 
+#include <memory>
+
 namespace doc {
   class Tag;
 }
@@ -21,11 +24,13 @@ namespace doc {
 namespace app {
 
   class CommandExecutionEvent;
+  class PlaybackCache;
 
   class PlayState : public StateWithWheelBehavior {
   public:
     PlayState(const bool playOnce,
               const bool playAll);
+    ~PlayState();
 
     void onEnterState(Editor* editor) override;
     LeaveAction onLeaveState(Editor* editor, EditorState* newState) override;
@@ -44,6 +49,8 @@ namespace app {
     void onBeforeCommandExecution(CommandExecutionEvent& ev);
 
     double getNextFrameTime();
+    void updatePlaybackCache();
+    void showPlaybackCacheStats();
 
     Editor* m_editor;
     bool m_playOnce;
@@ -61,6 +68,10 @@ namespace app {
     doc::Tag* m_tag;
 
     obs::scoped_connection m_ctxConn;
+
+    // Upcoming frames rendered in background threads
+    std::unique_ptr<PlaybackCache> m_playbackCache;
+    base::tick_t m_statsTick;
   };
 
 } // namespace app
@@ -0,0 +1,363 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/ui/editor/playback_cache.h"
+
+#include "app/doc.h"
+#include "app/ui/editor/editor_render.h"
+#include "doc/cel.h"
+#include "doc/image.h"
+#include "doc/layer.h"
+#include "doc/sprite.h"
+#include "gfx/clip.h"
+
+#include <algorithm>
+
+namespace app {
+
+using namespace doc;
+
+namespace {
+
+// Maximum memory used by the rendered frames
+const std::size_t kMaxMemSize = 256*1024*1024;
+
+// Maximum number of frames rendered in advance
+const int kMaxFrames = 64;
+
+} // anonymous namespace
+
+bool PlaybackCache::LayerState::operator==(const LayerState& o) const
+{
+  return (layer == o.layer &&
+          visible == o.visible &&
+          opacity == o.opacity &&
+          blendMode == o.blendMode &&
+          imageId == o.imageId &&
+          imageVersion == o.imageVersion &&
+          celOpacity == o.celOpacity &&
+          celPosition == o.celPosition);
+}
+
+PlaybackCache::PlaybackCache(Doc* doc,
+                             const Layer* selectedLayer,
+                             const int nonactiveLayersOpacity,
+                             const bool newBlend)
+  : m_doc(doc)
+  , m_sprite(doc->sprite())
+  , m_selectedLayer(nonactiveLayersOpacity < 255 ? selectedLayer: nullptr)
+  , m_nonactiveLayersOpacity(nonactiveLayersOpacity)
+  , m_newBlend(newBlend)
+  , m_generation(0)
+  , m_hits(0)
+  , m_misses(0)
+  , m_paused(false)
+  , m_done(false)
+{
+  const std::size_t frameSize =
+    std::max<std::size_t>(1, std::size_t(m_sprite->width()) * m_sprite->height() * 4);
+  m_capacity = int(std::min<std::size_t>(kMaxFrames, kMaxMemSize / frameSize));
+  m_capacity = std::max(2, m_capacity);
+
+  // One thread is left for the UI thread
+  const int nthreads = std::min<int>(
+    std::max<int>(1, int(std::thread::hardware_concurrency())-1),
+    m_capacity);
+
+  // Each thread has its own render engine
+  for (int i=0; i<nthreads; ++i) {
+    m_renders.push_back(std::unique_ptr<EditorRender>(createRender()));
+    m_newRenders.push_back(nullptr);
+  }
+
+  for (int i=0; i<nthreads; ++i)
+    m_threads.push_back(std::thread([this, i]{ workerThread(i); }));
+}
+
+PlaybackCache::~PlaybackCache()
+{
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done = true;
+    m_cv.notify_all();
+  }
+  for (auto& thread : m_threads)
+    thread.join();
+}
+
+void PlaybackCache::setUpcomingFrames(const std::vector<frame_t>& frames)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+
+  std::vector<Entry> entries;
+  entries.reserve(m_capacity);
+  for (frame_t frame : frames) {
+    if (int(entries.size()) == m_capacity)
+      break;
+
+    auto it = std::find_if(entries.begin(), entries.end(),
+                           [frame](const Entry& e){ return e.frame == frame; });
+    if (it != entries.end())
+      continue;
+
+    // Reuse the already rendered frame
+    if (Entry* old = findEntry(frame))
+      entries.push_back(*old);
+    else
+      entries.push_back(Entry{ frame, ImageRef(), LayerStates(), false, 0 });
+  }
+
+  m_entries.swap(entries);
+  m_paused = false;
+  m_cv.notify_all();
+}
+
+bool PlaybackCache::copyFrame(const frame_t frame,
+                              Image* dstImage,
+                              const gfx::Rect& area)
+{
+  // Layers visibility can be changed without notifications, so we
+  // compare the current state of the layers with the rendered one.
+  LayerStates key;
+  collectLayerStates(m_sprite->root(), true, frame, key);
+
+  ImageRef image;
+  {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    Entry* entry = findEntry(frame);
+    if (!entry || !entry->image)
+      return false;
+
+    if (entry->key != key) {
+      entry->image.reset();
+      entry->key.clear();
+      entry->rendering = false;
+      ++entry->generation;
+      m_cv.notify_all();
+      return false;
+    }
+    image = entry->image;
+  }
+
+  // Rendered images are not modified after they are ready, so we can
+  // copy the pixels without locking the mutex.
+  dstImage->copy(image.get(), gfx::Clip(0, 0, area));
+  return true;
+}
+
+bool PlaybackCache::checkHit(const frame_t frame)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  Entry* entry = findEntry(frame);
+  if (entry && entry->image) {
+    ++m_hits;
+    return true;
+  }
+  else {
+    ++m_misses;
+    return false;
+  }
+}
+
+void PlaybackCache::setRenderSettings(const Layer* selectedLayer,
+                                      const int nonactiveLayersOpacity,
+                                      const bool newBlend)
+{
+  // The selected layer is only different if the other layers are
+  // translucent
+  if (nonactiveLayersOpacity == 255)
+    selectedLayer = nullptr;
+
+  if (m_selectedLayer == selectedLayer &&
+      m_nonactiveLayersOpacity == nonactiveLayersOpacity &&
+      m_newBlend == newBlend)
+    return;
+
+  m_selectedLayer = selectedLayer;
+  m_nonactiveLayersOpacity = nonactiveLayersOpacity;
+  m_newBlend = newBlend;
+  invalidate();
+}
+
+void PlaybackCache::invalidate()
+{
+  // New render engines are configured here in the UI thread (as it
+  // accesses the preferences of the document), the workers might be
+  // still using the old ones.
+  std::vector<std::unique_ptr<EditorRender>> renders;
+  for (std::size_t i=0; i<m_renders.size(); ++i)
+    renders.push_back(std::unique_ptr<EditorRender>(createRender()));
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_newRenders.swap(renders);
+  ++m_generation;
+  for (Entry& entry : m_entries) {
+    entry.image.reset();
+    entry.rendering = false;
+  }
+  m_cv.notify_all();
+}
+
+void PlaybackCache::invalidateFrame(const frame_t frame)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  if (Entry* entry = findEntry(frame)) {
+    entry->image.reset();
+    entry->rendering = false;
+    ++entry->generation;
+    m_cv.notify_all();
+  }
+}
+
+int PlaybackCache::readyFrames()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  return int(std::count_if(m_entries.begin(), m_entries.end(),
+                           [](const Entry& e){ return e.image != nullptr; }));
+}
+
+std::size_t PlaybackCache::memSize()
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  std::size_t size = 0;
+  for (const Entry& entry : m_entries)
+    if (entry.image)
+      size += entry.image->getMemSize();
+  return size;
+}
+
+int PlaybackCache::hitRate() const
+{
+  const int total = m_hits + m_misses;
+  return (total > 0 ? 100 * m_hits / total: 0);
+}
+
+EditorRender* PlaybackCache::createRender() const
+{
+  EditorRender* render = new EditorRender;
+  render->setNewBlendMethod(m_newBlend);
+  render->setRefLayersVisiblity(true);
+  render->setSelectedLayer(m_selectedLayer);
+  render->setNonactiveLayersOpacity(m_nonactiveLayersOpacity);
+  render->setupBackground(m_doc, IMAGE_RGB);
+  render->disableOnionskin();
+  return render;
+}
+
+PlaybackCache::Entry* PlaybackCache::findEntry(const frame_t frame)
+{
+  for (Entry& entry : m_entries)
+    if (entry.frame == frame)
+      return &entry;
+  return nullptr;
+}
+
+// Collects the state of the layers in the same order they are
+// composited by render::Render.
+void PlaybackCache::collectLayerStates(const LayerGroup* group,
+                                       const bool visible,
+                                       const frame_t frame,
+                                       LayerStates& states) const
+{
+  for (const Layer* layer : group->layers()) {
+    const bool layerVisible = (visible && layer->isVisible());
+    if (layer->isGroup()) {
+      collectLayerStates(static_cast<const LayerGroup*>(layer),
+                         layerVisible, frame, states);
+      continue;
+    }
+
+    LayerState state;
+    state.layer = layer;
+    state.visible = layerVisible;
+    state.opacity = 255;
+    state.blendMode = BlendMode::NORMAL;
+    state.imageId = NullId;
+    state.imageVersion = 0;
+    state.celOpacity = 0;
+
+    if (layer->isImage()) {
+      auto imgLayer = static_cast<const LayerImage*>(layer);
+      state.opacity = imgLayer->opacity();
+      state.blendMode = imgLayer->blendMode();
+    }
+
+    if (const Cel* cel = layer->cel(frame)) {
+      state.imageId = cel->image()->id();
+      state.imageVersion = cel->image()->version();
+      state.celOpacity = cel->opacity();
+      state.celPosition = cel->position();
+    }
+    states.push_back(state);
+  }
+}
+
+void PlaybackCache::workerThread(const int worker)
+{
+  std::unique_lock<std::mutex> lock(m_mutex);
+  while (!m_done) {
+    // Use the new render engine (with the new settings)
+    if (m_newRenders[worker])
+      m_renders[worker] = std::move(m_newRenders[worker]);
+
+    // Next frame to render (in the order they will be shown)
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                           [](const Entry& e){ return !e.image && !e.rendering; });
+    if (m_paused || it == m_entries.end()) {
+      m_cv.wait(lock);
+      continue;
+    }
+
+    EditorRender* render = m_renders[worker].get();
+    const frame_t frame = it->frame;
+    const int generation = m_generation;
+    const int entryGeneration = it->generation;
+    it->rendering = true;
+    lock.unlock();
+
+    ImageRef image;
+    LayerStates key;
+    const bool locked = m_doc->lock(Doc::ReadLock, 0);
+    if (locked) {
+      collectLayerStates(m_sprite->root(), true, frame, key);
+      image.reset(Image::create(IMAGE_RGB, m_sprite->width(), m_sprite->height()));
+      render->renderSprite(image.get(), m_sprite, frame,
+                           gfx::Clip(0, 0, m_sprite->bounds()));
+
+      // Layers visibility can be changed without locking the
+      // document, so the render is discarded if it was changed
+      // while we were rendering.
+      LayerStates keyAfter;
+      collectLayerStates(m_sprite->root(), true, frame, keyAfter);
+      if (key != keyAfter)
+        image.reset();
+
+      m_doc->unlock();
+    }
+
+    lock.lock();
+    Entry* entry = findEntry(frame);
+    if (entry && entry->rendering &&
+        generation == m_generation &&
+        entryGeneration == entry->generation) {
+      entry->rendering = false;
+      entry->image = image;
+      entry->key = std::move(key);
+    }
+
+    // The document is locked to be modified, all workers wait until
+    // the next frame is shown (instead of trying to lock the document
+    // again and again while it's being modified).
+    if (!locked)
+      m_paused = true;
+  }
+}
+
+} // namespace app
@@ -0,0 +1,150 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UI_EDITOR_PLAYBACK_CACHE_H_INCLUDED
+#define APP_UI_EDITOR_PLAYBACK_CACHE_H_INCLUDED
+#pragma once
+
+#include "doc/blend_mode.h"
+#include "doc/frame.h"
+#include "doc/image_ref.h"
+#include "doc/object_id.h"
+#include "doc/object_version.h"
+#include "gfx/point.h"
+#include "gfx/rect.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace doc {
+  class Image;
+  class Layer;
+  class LayerGroup;
+  class Sprite;
+}
+
+namespace app {
+  class Doc;
+  class EditorRender;
+
+  // Frames of the sprite composed in background threads while the
+  // animation is being played in an editor (see PlayState). The
+  // editor gives the list of upcoming frames (in the order they will
+  // be shown, following the tag's AniDir) and the worker threads
+  // render them in a bounded set of images, so when the frame is
+  // shown the editor just has to copy the pixels.
+  class PlaybackCache {
+  public:
+    // The settings to render frames are the same that the editor
+    // uses to render the sprite with the new render engine.
+    PlaybackCache(Doc* doc,
+                  const doc::Layer* selectedLayer,
+                  const int nonactiveLayersOpacity,
+                  const bool newBlend);
+    ~PlaybackCache();
+
+    // Maximum number of frames that can be kept in memory.
+    int capacity() const { return m_capacity; }
+
+    // Sets the frames that will be shown next (only the first
+    // capacity() frames are rendered). Other frames are discarded.
+    // Workers paused because the document was locked are resumed.
+    void setUpcomingFrames(const std::vector<doc::frame_t>& frames);
+
+    // Copies the given area of the rendered frame (in sprite
+    // coordinates) to the (0, 0) position of "dstImage". Returns
+    // false if the frame is not ready yet, or if the layers changed
+    // after the frame was rendered (e.g. a hidden layer).
+    bool copyFrame(const doc::frame_t frame,
+                   doc::Image* dstImage,
+                   const gfx::Rect& area);
+
+    // Returns true if the given frame is ready to be shown, and
+    // updates the hit rate statistics.
+    bool checkHit(const doc::frame_t frame);
+
+    // Updates the settings to render frames (the editor calls it each
+    // time it draws the sprite). If they are different, all frames
+    // are discarded.
+    void setRenderSettings(const doc::Layer* selectedLayer,
+                           const int nonactiveLayersOpacity,
+                           const bool newBlend);
+
+    // Discards all frames (e.g. when the palette or the background is
+    // modified) and configures the render engines again.
+    void invalidate();
+
+    // Discards the given frame (e.g. when its pixels are modified).
+    void invalidateFrame(const doc::frame_t frame);
+
+    // Statistics for the status bar
+    int readyFrames();
+    std::size_t memSize();
+    int hitRate() const;        // Percentage of frames that were ready
+
+  private:
+    // State of each layer that affects the rendered pixels of a
+    // frame, used to detect changes that weren't notified to the
+    // editor (e.g. hidden layers or new image versions).
+    struct LayerState {
+      const doc::Layer* layer;
+      bool visible;
+      int opacity;
+      doc::BlendMode blendMode;
+      doc::ObjectId imageId;
+      doc::ObjectVersion imageVersion;
+      int celOpacity;
+      gfx::Point celPosition;
+
+      bool operator==(const LayerState& o) const;
+    };
+    typedef std::vector<LayerState> LayerStates;
+
+    struct Entry {
+      doc::frame_t frame;
+      doc::ImageRef image;      // nullptr if it's not ready yet
+      LayerStates key;          // State of the layers in "image"
+      bool rendering;
+      int generation;           // Incremented when the frame is invalidated
+    };
+
+    EditorRender* createRender() const;
+    Entry* findEntry(const doc::frame_t frame);
+    void collectLayerStates(const doc::LayerGroup* group,
+                            const bool visible,
+                            const doc::frame_t frame,
+                            LayerStates& states) const;
+    void workerThread(const int worker);
+
+    Doc* m_doc;
+    const doc::Sprite* m_sprite;
+    const doc::Layer* m_selectedLayer; // Only if nonactive layers are translucent
+    int m_nonactiveLayersOpacity;
+    bool m_newBlend;
+    int m_capacity;
+    std::vector<Entry> m_entries;  // Upcoming frames (in order)
+    int m_generation;              // Incremented when frames are invalidated
+    int m_hits;
+    int m_misses;
+    bool m_paused;                 // Document locked to be modified
+    bool m_done;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // Render engine of each worker, and the new render engine
+    // configured by the UI thread (it's taken by the worker before
+    // rendering its next frame).
+    std::vector<std::unique_ptr<EditorRender>> m_renders;
+    std::vector<std::unique_ptr<EditorRender>> m_newRenders;
+    std::vector<std::thread> m_threads;
+  };
+
+} // namespace app
+
+#endif
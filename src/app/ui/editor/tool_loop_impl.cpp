@@ -306,7 +306,7 @@ public:
 #endif
 
     m_document->notifySpritePixelsModified(
-      m_sprite, dirtyArea, m_frame);
+      m_sprite, dirtyArea, m_frame, m_layer);
   }
 
   void updateStatusBar(const char* text) override {
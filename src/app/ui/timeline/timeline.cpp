@@ -79,6 +79,14 @@ struct Timeline::DrawCelData {
 
 namespace {
 
+  // Memory used by the cache of cel thumbnails
+  const std::size_t kThumbnailsCacheMemSize = 32*1024*1024;
+
+  // Pending thumbnails are rendered in slices of kThumbnailsRenderTime
+  // milliseconds to keep the UI responsive
+  const int kThumbnailsTimerInterval = 10;
+  const int kThumbnailsRenderTime = 8;
+
   template<typename Pred>
   void for_each_expanded_layer(LayerGroup* group,
                                Pred&& pred,
@@ -198,6 +206,8 @@ Timeline::Timeline(TooltipManager* tooltipManager)
   , m_scroll(false)
   , m_fromTimeline(false)
   , m_aniControls(tooltipManager)
+  , m_thumbnailsCache(kThumbnailsCacheMemSize)
+  , m_thumbnailsTimer(kThumbnailsTimerInterval, this)
 {
   enableFlags(CTRL_RIGHT_CLICK);
 
@@ -214,6 +224,8 @@ Timeline::Timeline(TooltipManager* tooltipManager)
   m_hbar.setTransparent(true);
   m_vbar.setTransparent(true);
   initTheme();
+
+  m_thumbnailsTimer.Tick.connect([this]{ onThumbnailsTimer(); });
 }
 
 Timeline::~Timeline()
@@ -222,6 +234,7 @@ Timeline::~Timeline()
     m_separator_x / guiscale());
 
   m_clipboard_timer.stop();
+  m_thumbnailsTimer.stop();
 
   detachDocument();
   m_context->documents().remove_observer(this);
@@ -336,6 +349,8 @@ void Timeline::detachDocument()
 
   if (m_document) {
     m_thumbnailsPrefConn.disconnect();
+    m_thumbnailsTimer.stop();
+    m_thumbnailsCache.clear();
     m_document->remove_observer(this);
     m_document = nullptr;
     m_sprite = nullptr;
@@ -1323,14 +1338,15 @@ void Timeline::drawCel(ui::Graphics* g, layer_t layerIndex, frame_t frame, Cel*
         skinTheme()->calcBorder(this, style));
 
     if (!thumb_bounds.isEmpty()) {
-      if (os::Surface* surface = thumb::get_cel_thumbnail(cel, thumb_bounds.size())) {
-        const int t = base::clamp(thumb_bounds.w/8, 4, 16);
-        draw_checked_grid(g, thumb_bounds, gfx::Size(t, t), docPref());
+      // The checked grid is used as a placeholder until the thumbnail
+      // is rendered
+      const int t = base::clamp(thumb_bounds.w/8, 4, 16);
+      draw_checked_grid(g, thumb_bounds, gfx::Size(t, t), docPref());
 
+      if (os::Surface* surface = getCelThumbnail(cel, thumb_bounds.size())) {
         g->drawRgbaSurface(surface,
                            thumb_bounds.center().x-surface->width()/2,
                            thumb_bounds.center().y-surface->height()/2);
-        surface->dispose();
       }
     }
   }
@@ -1413,15 +1429,34 @@ void Timeline::drawCelOverlay(ui::Graphics* g)
 
   gfx::Rect rc = m_sprite->bounds().fitIn(
     gfx::Rect(m_thumbnailsOverlayBounds).shrink(1));
-  if (os::Surface* surface = thumb::get_cel_thumbnail(cel, rc.size())) {
-    draw_checked_grid(g, rc, gfx::Size(8, 8)*ui::guiscale(), docPref());
+  draw_checked_grid(g, rc, gfx::Size(8, 8)*ui::guiscale(), docPref());
 
+  if (os::Surface* surface = getCelThumbnail(cel, rc.size())) {
     g->drawRgbaSurface(surface,
                        rc.center().x-surface->width()/2,
                        rc.center().y-surface->height()/2);
-    g->drawRect(gfx::rgba(0, 0, 0, 128), m_thumbnailsOverlayBounds);
-    surface->dispose();
   }
+  g->drawRect(gfx::rgba(0, 0, 0, 128), m_thumbnailsOverlayBounds);
+}
+
+// Returns the cached thumbnail of the cel, or nullptr if it's not
+// ready yet (in that case the thumbnail is rendered later from
+// onThumbnailsTimer()).
+os::Surface* Timeline::getCelThumbnail(const Cel* cel, const gfx::Size& size)
+{
+  os::Surface* surface = m_thumbnailsCache.getCelThumbnail(cel, size);
+  if (!surface && !m_thumbnailsTimer.isRunning())
+    m_thumbnailsTimer.start();
+  return surface;
+}
+
+void Timeline::onThumbnailsTimer()
+{
+  if (m_thumbnailsCache.renderPending(kThumbnailsRenderTime))
+    invalidate();
+
+  if (!m_thumbnailsCache.hasPending())
+    m_thumbnailsTimer.stop();
 }
 
 void Timeline::drawCelLinkDecorators(ui::Graphics* g, const gfx::Rect& bounds,
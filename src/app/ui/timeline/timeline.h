@@ -14,6 +14,7 @@
 #include "app/doc_range.h"
 #include "app/loop_tag.h"
 #include "app/pref/preferences.h"
+#include "app/thumbnails.h"
 #include "app/ui/editor/editor_observer.h"
 #include "app/ui/input_chain_element.h"
 #include "app/ui/timeline/ani_controls.h"
@@ -387,6 +388,8 @@ namespace app {
 
     void updateCelOverlayBounds(const Hit& hit);
     void drawCelOverlay(ui::Graphics* g);
+    os::Surface* getCelThumbnail(const Cel* cel, const gfx::Size& size);
+    void onThumbnailsTimer();
     void onThumbnailsPrefChange();
     void setZoom(const double zoom);
     void setZoomAndUpdate(const double zoom,
@@ -457,6 +460,8 @@ namespace app {
     Hit m_thumbnailsOverlayHit;
     gfx::Point m_thumbnailsOverlayDirection;
     obs::connection m_thumbnailsPrefConn;
+    thumb::CelThumbnailCache m_thumbnailsCache;
+    ui::Timer m_thumbnailsTimer;
 
     // Temporal data used to move the range.
     struct MoveRange {
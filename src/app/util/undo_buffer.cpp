@@ -0,0 +1,486 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "app/util/undo_buffer.h"
+
+#include "base/convert_to.h"
+#include "base/debug.h"
+#include "base/exception.h"
+#include "base/fs.h"
+#include "base/fstream_path.h"
+#include "base/process.h"
+#include "zlib.h"
+
+#include <condition_variable>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#define UNDOBUF_TRACE(...) // TRACEARGS
+
+namespace app {
+
+namespace {
+
+// Total size of uncompressed buffers, when this limit is exceeded the
+// least recently used buffers are compressed.
+const size_t kMaxRawSize = 64*1024*1024;
+
+// Total size of compressed buffers in memory, when this limit is
+// exceeded the least recently used ones are moved to disk.
+const size_t kMaxCompressedSize = 256*1024*1024;
+
+// Maximum size of the temporary file, when the file is full the
+// compressed buffers are kept in memory.
+const size_t kMaxFileSize = 1024*1024*1024;
+
+} // anonymous namespace
+
+class UndoBufferStorage {
+public:
+  static UndoBufferStorage* instance() {
+    static UndoBufferStorage storage;
+    return &storage;
+  }
+
+  UndoBufferStorage()
+    : m_done(false)
+    , m_totalRawSize(0)
+    , m_totalCompressedSize(0)
+    , m_maxRawSize(kMaxRawSize)
+    , m_maxCompressedSize(kMaxCompressedSize)
+    , m_maxFileSize(kMaxFileSize)
+    , m_fileEnd(0)
+    , m_fileError(false) {
+  }
+
+  ~UndoBufferStorage() {
+    if (m_thread.joinable()) {
+      {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_done = true;
+        m_cv.notify_one();
+      }
+      m_thread.join();
+    }
+
+    if (m_file.is_open()) {
+      m_file.close();
+      try {
+        base::delete_file(m_filename);
+      }
+      catch (const std::exception& ex) {
+        (void)ex;
+        UNDOBUF_TRACE("UNDOBUF: Error deleting", m_filename, ex.what());
+      }
+    }
+  }
+
+  void add(UndoBuffer* buf) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_buffers.push_front(buf);
+    buf->m_it = m_buffers.begin();
+
+    if (!m_thread.joinable())
+      m_thread = std::thread([this]{ backgroundThread(); });
+  }
+
+  void remove(UndoBuffer* buf) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_busyCv.wait(lock, [buf]{ return !buf->m_busy; });
+
+    if (buf->m_counter)
+      buf->m_counter->m_size -= dataSize(buf);
+
+    switch (buf->m_state) {
+      case UndoBuffer::State::Raw:
+        m_totalRawSize -= buf->m_rawSize;
+        break;
+      case UndoBuffer::State::Compressed:
+        m_totalCompressedSize -= buf->m_compressed.size();
+        break;
+      case UndoBuffer::State::OnDisk:
+        freeFileSpace(buf->m_fileOffset, buf->m_fileSize);
+        break;
+    }
+    m_buffers.erase(buf->m_it);
+  }
+
+  void lock(UndoBuffer* buf) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_busyCv.wait(lock, [buf]{ return !buf->m_busy; });
+
+    if (buf->m_state == UndoBuffer::State::OnDisk) {
+      const size_t oldSize = dataSize(buf);
+      loadFromFile(buf);
+      updateCounter(buf, oldSize);
+    }
+
+    if (buf->m_state == UndoBuffer::State::Compressed) {
+      const size_t oldSize = dataSize(buf);
+      UNDOBUF_TRACE("UNDOBUF: Decompress", buf, buf->m_rawSize, "bytes");
+
+      buf->m_raw.resize(buf->m_rawSize);
+      uLongf rawSize = buf->m_raw.size();
+      if (rawSize > 0) {
+        int err = uncompress(&buf->m_raw[0], &rawSize,
+                             &buf->m_compressed[0], buf->m_compressed.size());
+        if (err != Z_OK || rawSize != buf->m_raw.size())
+          throw base::Exception("ZLib error %d in uncompress().", err);
+      }
+
+      m_totalCompressedSize -= buf->m_compressed.size();
+      m_totalRawSize += buf->m_rawSize;
+      base::buffer().swap(buf->m_compressed);
+      buf->m_state = UndoBuffer::State::Raw;
+      updateCounter(buf, oldSize);
+    }
+
+    ++buf->m_locks;
+
+    // Move to the front of the list (most recently used)
+    m_buffers.splice(m_buffers.begin(), m_buffers, buf->m_it);
+  }
+
+  void unlock(UndoBuffer* buf) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    ASSERT(buf->m_locks > 0);
+    ASSERT(buf->m_state == UndoBuffer::State::Raw);
+    --buf->m_locks;
+
+    // The raw data could be resized
+    const size_t oldSize = dataSize(buf);
+    m_totalRawSize -= buf->m_rawSize;
+    buf->m_rawSize = buf->m_raw.size();
+    m_totalRawSize += buf->m_rawSize;
+    updateCounter(buf, oldSize);
+
+    if (m_totalRawSize > m_maxRawSize)
+      m_cv.notify_one();
+  }
+
+  size_t memSize(const UndoBuffer* buf) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return (buf->m_counter ? 0: dataSize(buf));
+  }
+
+  void setCounter(UndoBuffer* buf, UndoBufferCounter* counter) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (buf->m_counter)
+      buf->m_counter->m_size -= dataSize(buf);
+    buf->m_counter = counter;
+    if (buf->m_counter)
+      buf->m_counter->m_size += dataSize(buf);
+  }
+
+  void setLimits(size_t maxRawSize,
+                 size_t maxCompressedSize,
+                 size_t maxFileSize) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_maxRawSize = maxRawSize;
+    m_maxCompressedSize = maxCompressedSize;
+    m_maxFileSize = maxFileSize;
+    m_cv.notify_one();
+  }
+
+private:
+  // Called with m_mutex locked. Memory used in RAM by the data of
+  // the given buffer.
+  static size_t dataSize(const UndoBuffer* buf) {
+    switch (buf->m_state) {
+      case UndoBuffer::State::Raw: return buf->m_rawSize;
+      case UndoBuffer::State::Compressed: return buf->m_compressed.size();
+      case UndoBuffer::State::OnDisk: break;
+    }
+    return 0;
+  }
+
+  // Called with m_mutex locked after the data size of the buffer
+  // changed from oldSize.
+  static void updateCounter(UndoBuffer* buf, const size_t oldSize) {
+    if (buf->m_counter) {
+      buf->m_counter->m_size -= oldSize;
+      buf->m_counter->m_size += dataSize(buf);
+    }
+  }
+
+  // Returns the least recently used buffer that can be compressed
+  // (the most recent buffer is never compressed).
+  UndoBuffer* nextBufferToCompress() const {
+    if (m_totalRawSize <= m_maxRawSize || m_buffers.size() < 2)
+      return nullptr;
+
+    for (auto it=m_buffers.rbegin(), end=std::prev(m_buffers.rend()); it!=end; ++it) {
+      UndoBuffer* buf = *it;
+      if (buf->m_state == UndoBuffer::State::Raw &&
+          !buf->m_locks && !buf->m_raw.empty())
+        return buf;
+    }
+    return nullptr;
+  }
+
+  // Returns the least recently used compressed buffer that can be
+  // saved in the file (space for it is reserved in the file).
+  UndoBuffer* nextBufferToSave() {
+    if (m_totalCompressedSize <= m_maxCompressedSize || m_fileError)
+      return nullptr;
+
+    for (auto it=m_buffers.rbegin(), end=m_buffers.rend(); it!=end; ++it) {
+      UndoBuffer* buf = *it;
+      if (buf->m_state == UndoBuffer::State::Compressed &&
+          allocFileSpace(buf->m_compressed.size(), buf->m_fileOffset)) {
+        buf->m_fileSize = buf->m_compressed.size();
+        return buf;
+      }
+    }
+    return nullptr;
+  }
+
+  void backgroundThread() {
+    UNDOBUF_TRACE("UNDOBUF: [BG] Background thread start");
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_done) {
+      if (UndoBuffer* buf = nextBufferToCompress()) {
+        buf->m_busy = true;
+        lock.unlock();
+
+        // The raw data cannot be modified while the buffer is busy
+        const base::buffer& raw = buf->m_raw;
+        uLongf compressedSize = compressBound(raw.size());
+        base::buffer compressed(compressedSize);
+        int err = compress2(&compressed[0], &compressedSize,
+                            &raw[0], raw.size(), Z_BEST_SPEED);
+        compressed.resize(compressedSize);
+
+        lock.lock();
+        buf->m_busy = false;
+        m_busyCv.notify_all();
+
+        if (err != Z_OK) {
+          UNDOBUF_TRACE("UNDOBUF: [BG] ZLib error", err, "in compress2()");
+          m_cv.wait(lock);
+          continue;
+        }
+
+        UNDOBUF_TRACE("UNDOBUF: [BG] Compressed", buf, buf->m_rawSize,
+                      "->", compressed.size(), "bytes");
+
+        const size_t oldSize = dataSize(buf);
+        m_totalRawSize -= buf->m_rawSize;
+        m_totalCompressedSize += compressed.size();
+        buf->m_compressed = std::move(compressed);
+        base::buffer().swap(buf->m_raw);
+        buf->m_state = UndoBuffer::State::Compressed;
+        updateCounter(buf, oldSize);
+      }
+      else if (UndoBuffer* buf = nextBufferToSave()) {
+        buf->m_busy = true;
+        lock.unlock();
+
+        const bool ok = saveToFile(buf);
+
+        lock.lock();
+        buf->m_busy = false;
+        m_busyCv.notify_all();
+
+        if (!ok) {
+          // Keep all buffers in memory
+          m_fileError = true;
+          freeFileSpace(buf->m_fileOffset, buf->m_fileSize);
+          continue;
+        }
+
+        UNDOBUF_TRACE("UNDOBUF: [BG] Saved", buf, buf->m_fileSize,
+                      "bytes at", buf->m_fileOffset);
+
+        const size_t oldSize = dataSize(buf);
+        m_totalCompressedSize -= buf->m_compressed.size();
+        base::buffer().swap(buf->m_compressed);
+        buf->m_state = UndoBuffer::State::OnDisk;
+        updateCounter(buf, oldSize);
+      }
+      else
+        m_cv.wait(lock);
+    }
+
+    UNDOBUF_TRACE("UNDOBUF: [BG] Background thread end");
+  }
+
+  // Called from the background thread without locking m_mutex
+  bool saveToFile(UndoBuffer* buf) {
+    std::unique_lock<std::mutex> lock(m_fileMutex);
+    if (!m_file.is_open()) {
+      m_filename = base::join_path(
+        base::get_temp_path(),
+        PACKAGE "-undo-" + base::convert_to<std::string>(int(base::get_current_process_id())) + ".tmp");
+      m_file.open(FSTREAM_PATH(m_filename),
+                  std::fstream::in | std::fstream::out |
+                  std::fstream::trunc | std::fstream::binary);
+      if (!m_file.is_open())
+        return false;
+    }
+
+    m_file.seekp(buf->m_fileOffset);
+    m_file.write((const char*)&buf->m_compressed[0], buf->m_fileSize);
+    m_file.flush();
+    if (m_file.fail()) {
+      m_file.clear();
+      return false;
+    }
+    return true;
+  }
+
+  // Called with m_mutex locked
+  void loadFromFile(UndoBuffer* buf) {
+    UNDOBUF_TRACE("UNDOBUF: Load", buf, buf->m_fileSize,
+                  "bytes from", buf->m_fileOffset);
+
+    buf->m_compressed.resize(buf->m_fileSize);
+    {
+      std::unique_lock<std::mutex> lock(m_fileMutex);
+      m_file.seekg(buf->m_fileOffset);
+      m_file.read((char*)&buf->m_compressed[0], buf->m_fileSize);
+      if (m_file.fail()) {
+        m_file.clear();
+        throw base::Exception("Error reading undo data from %s",
+                              m_filename.c_str());
+      }
+    }
+
+    freeFileSpace(buf->m_fileOffset, buf->m_fileSize);
+    m_totalCompressedSize += buf->m_compressed.size();
+    buf->m_state = UndoBuffer::State::Compressed;
+  }
+
+  // Called with m_mutex locked. Finds space in the file for the given
+  // number of bytes (reusing the space of released buffers). Returns
+  // false if the file cannot grow more.
+  bool allocFileSpace(const size_t size, int64_t& offset) {
+    for (auto it=m_fileFreeSpace.begin(); it!=m_fileFreeSpace.end(); ++it) {
+      if (it->second >= size) {
+        offset = it->first;
+        const size_t rest = it->second - size;
+        m_fileFreeSpace.erase(it);
+        if (rest > 0)
+          m_fileFreeSpace[offset+int64_t(size)] = rest;
+        return true;
+      }
+    }
+
+    if (m_fileEnd + int64_t(size) > int64_t(m_maxFileSize))
+      return false;
+
+    offset = m_fileEnd;
+    m_fileEnd += size;
+    return true;
+  }
+
+  // Called with m_mutex locked. Adds the given space to the free
+  // space of the file (merging it with the adjacent free space).
+  void freeFileSpace(int64_t offset, size_t size) {
+    auto next = m_fileFreeSpace.lower_bound(offset);
+    if (next != m_fileFreeSpace.end() &&
+        next->first == offset+int64_t(size)) {
+      size += next->second;
+      next = m_fileFreeSpace.erase(next);
+    }
+    if (next != m_fileFreeSpace.begin()) {
+      auto prev = std::prev(next);
+      if (prev->first+int64_t(prev->second) == offset) {
+        offset = prev->first;
+        size += prev->second;
+        m_fileFreeSpace.erase(prev);
+      }
+    }
+
+    // The free space at the end of the file is reused by allocFileSpace()
+    if (offset+int64_t(size) == m_fileEnd)
+      m_fileEnd = offset;
+    else
+      m_fileFreeSpace[offset] = size;
+
+    // Maybe a buffer can be saved now
+    m_cv.notify_one();
+  }
+
+  bool m_done;
+  std::list<UndoBuffer*> m_buffers; // From most to least recently used
+  size_t m_totalRawSize;
+  size_t m_totalCompressedSize;
+  size_t m_maxRawSize;
+  size_t m_maxCompressedSize;
+  size_t m_maxFileSize;
+  std::mutex m_mutex;
+  std::condition_variable m_cv;     // To wake up the background thread
+  std::condition_variable m_busyCv; // To wait busy buffers
+  std::thread m_thread;
+
+  // Temporary file with the least recently used buffers
+  std::mutex m_fileMutex;
+  std::fstream m_file;
+  std::string m_filename;
+  int64_t m_fileEnd;
+  std::map<int64_t, size_t> m_fileFreeSpace; // Offset -> Size
+  bool m_fileError;
+};
+
+UndoBuffer::Lock::Lock(UndoBuffer& buffer)
+  : m_buffer(buffer)
+{
+  UndoBufferStorage::instance()->lock(&m_buffer);
+}
+
+UndoBuffer::Lock::~Lock()
+{
+  UndoBufferStorage::instance()->unlock(&m_buffer);
+}
+
+UndoBuffer::UndoBuffer()
+  : m_state(State::Raw)
+  , m_locks(0)
+  , m_busy(false)
+  , m_rawSize(0)
+  , m_fileOffset(0)
+  , m_fileSize(0)
+  , m_counter(nullptr)
+{
+  UndoBufferStorage::instance()->add(this);
+}
+
+UndoBuffer::~UndoBuffer()
+{
+  ASSERT(m_locks == 0);
+  UndoBufferStorage::instance()->remove(this);
+}
+
+size_t UndoBuffer::memSize() const
+{
+  return sizeof(*this) + UndoBufferStorage::instance()->memSize(this);
+}
+
+void UndoBuffer::setCounter(UndoBufferCounter* counter)
+{
+  UndoBufferStorage::instance()->setCounter(this, counter);
+}
+
+// static
+void UndoBuffer::setLimits(size_t maxRawSize,
+                           size_t maxCompressedSize,
+                           size_t maxFileSize)
+{
+  UndoBufferStorage::instance()->setLimits(maxRawSize,
+                                           maxCompressedSize,
+                                           maxFileSize);
+}
+
+} // namespace app
@@ -0,0 +1,94 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#ifndef APP_UTIL_UNDO_BUFFER_H_INCLUDED
+#define APP_UTIL_UNDO_BUFFER_H_INCLUDED
+#pragma once
+
+#include "base/buffer.h"
+#include "base/disable_copying.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+
+namespace app {
+
+  // Memory used in RAM by the data of a group of undo buffers (e.g.
+  // the buffers of the undo history of one document). It's updated
+  // when the buffers are compressed/moved to disk in the background,
+  // so the owner doesn't need to iterate all its buffers to know the
+  // memory they use.
+  class UndoBufferCounter {
+  public:
+    UndoBufferCounter() : m_size(0) { }
+    size_t size() const { return m_size; }
+  private:
+    std::atomic<size_t> m_size;
+    friend class UndoBufferStorage;
+    DISABLE_COPYING(UndoBufferCounter);
+  };
+
+  // Buffer of raw data to undo/redo a command (e.g. the pixels of
+  // cmd::CopyRegion). When the total size of raw undo buffers is too
+  // big, the least recently used ones are compressed in a background
+  // thread, and if the compressed buffers are too big too, they are
+  // moved to a temporary file. The data is decompressed/loaded again
+  // only when it's needed (i.e. when we undo/redo the command).
+  class UndoBuffer {
+  public:
+    // Gives access to the raw data of the buffer. The buffer will not
+    // be compressed while the UndoBuffer::Lock is alive.
+    class Lock {
+    public:
+      Lock(UndoBuffer& buffer);
+      ~Lock();
+      base::buffer& data() { return m_buffer.m_raw; }
+    private:
+      UndoBuffer& m_buffer;
+      DISABLE_COPYING(Lock);
+    };
+
+    UndoBuffer();
+    ~UndoBuffer();
+
+    // Memory used by this buffer in RAM (the buffer might be
+    // compressed or on disk). The data is not included if the buffer
+    // has a counter (it's included in the counter).
+    size_t memSize() const;
+
+    // Sets the counter where the memory used by the data of this
+    // buffer is added (it can be nullptr).
+    void setCounter(UndoBufferCounter* counter);
+
+    // Changes the maximum size of uncompressed buffers, compressed
+    // buffers in memory, and the temporary file (used in tests).
+    static void setLimits(size_t maxRawSize,
+                          size_t maxCompressedSize,
+                          size_t maxFileSize);
+
+  private:
+    enum class State { Raw, Compressed, OnDisk };
+
+    State m_state;
+    int m_locks;
+    bool m_busy;              // Compressed/saved in the background thread
+    base::buffer m_raw;
+    base::buffer m_compressed;
+    size_t m_rawSize;         // Size of the uncompressed data
+    int64_t m_fileOffset;     // Position in the file when it's OnDisk
+    size_t m_fileSize;
+    UndoBufferCounter* m_counter;
+    std::list<UndoBuffer*>::iterator m_it;
+
+    friend class UndoBufferStorage;
+    DISABLE_COPYING(UndoBuffer);
+  };
+
+} // namespace app
+
+#endif
@@ -0,0 +1,81 @@
+// Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
+//
+// This program is distributed under the terms of
+// the End-User License Agreement for Aseprite.
+
+#include "tests/test.h"
+
+#include "app/util/undo_buffer.h"
+
+#include <chrono>
+#include <functional>
+#include <thread>
+
+using namespace app;
+
+namespace {
+
+// Waits the background thread of the undo buffers
+bool wait_until(const std::function<bool()>& condition)
+{
+  for (int i=0; i<5000; ++i) {
+    if (condition())
+      return true;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  return false;
+}
+
+} // anonymous namespace
+
+TEST(UndoBuffer, RawCompressedOnDisk)
+{
+  const size_t kSize = 1024*1024;
+  const size_t kBigLimit = 1024*1024*1024;
+  base::buffer data(kSize);
+  for (size_t i=0; i<kSize; ++i)
+    data[i] = uint8_t(i % 251);
+
+  UndoBufferCounter counter;
+  UndoBuffer a;
+  UndoBuffer b;
+  a.setCounter(&counter);
+  {
+    UndoBuffer::Lock lock(a);
+    lock.data() = data;
+  }
+  EXPECT_EQ(kSize, counter.size());
+  EXPECT_EQ(sizeof(UndoBuffer), a.memSize());
+
+  // "b" is the most recently used buffer (it's never compressed)
+  {
+    UndoBuffer::Lock lock(b);
+    lock.data().resize(1);
+  }
+  EXPECT_EQ(sizeof(UndoBuffer) + 1, b.memSize());
+
+  // Raw -> Compressed
+  UndoBuffer::setLimits(0, kBigLimit, kBigLimit);
+  ASSERT_TRUE(wait_until([&counter]{
+                           return (counter.size() > 0 &&
+                                   counter.size() < kSize);
+                         }));
+
+  // Compressed -> OnDisk
+  UndoBuffer::setLimits(0, 0, kBigLimit);
+  ASSERT_TRUE(wait_until([&counter]{ return counter.size() == 0; }));
+
+  // OnDisk -> Raw
+  UndoBuffer::setLimits(kBigLimit, kBigLimit, kBigLimit);
+  {
+    UndoBuffer::Lock lock(a);
+    EXPECT_EQ(kSize, counter.size());
+    ASSERT_EQ(kSize, lock.data().size());
+    EXPECT_TRUE(data == lock.data());
+  }
+
+  a.setCounter(nullptr);
+  EXPECT_EQ(0, counter.size());
+  EXPECT_EQ(sizeof(UndoBuffer) + kSize, a.memSize());
+}
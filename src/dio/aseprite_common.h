@@ -52,6 +52,10 @@
 #define ASE_SLICE_FLAG_HAS_CENTER_BOUNDS    1
 #define ASE_SLICE_FLAG_HAS_PIVOT_POINT      2
 
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
 namespace dio {
 
 struct AsepriteHeader {
@@ -90,6 +94,25 @@ struct AsepriteChunk {
   int start;
 };
 
+// Position of each chunk in the file (the chunk data starts 6 bytes
+// after "pos", after its size and type fields)
+struct AsepriteChunkEntry {
+  size_t pos;
+  uint32_t size;
+  uint16_t type;
+};
+
+struct AsepriteFrameEntry {
+  size_t pos;
+  AsepriteFrameHeader header;
+  std::vector<AsepriteChunkEntry> chunks;
+};
+
+// Frames and chunks of the file located reading only their headers.
+// The decoder still reads all chunks in order and inflates all cels
+// when the file is opened (doc::Image needs the pixels in memory).
+typedef std::vector<AsepriteFrameEntry> AsepriteFrameIndex;
+
 } // namespace dio
 
 #endif
@@ -25,7 +25,11 @@
 #include "fmt/format.h"
 #include "zlib.h"
 
+#include <algorithm>
+#include <atomic>
 #include <cstdio>
+#include <cstring>
+#include <thread>
 
 namespace dio {
 
@@ -74,15 +78,16 @@ bool AsepriteDecoder::decode()
   if (nframes > 1 && delegate()->decodeOneFrame())
     nframes = 1;
 
-  // Read frame by frame to end-of-file
-  for (doc::frame_t frame=0; frame<nframes; ++frame) {
-    // Start frame position
-    size_t frame_pos = f()->tell();
-    delegate()->progress((float)frame_pos / (float)header.size);
+  // Locate all frames and chunks in the file (reading just their
+  // headers) before reading their content
+  AsepriteFrameIndex frameIndex;
+  readFrameIndex(nframes, frameIndex);
 
-    // Read frame header
-    AsepriteFrameHeader frame_header;
-    readFrameHeader(&frame_header);
+  // Read frame by frame to end-of-file
+  for (doc::frame_t frame=0; frame<doc::frame_t(frameIndex.size()); ++frame) {
+    const AsepriteFrameEntry& frameEntry = frameIndex[frame];
+    const AsepriteFrameHeader& frame_header = frameEntry.header;
+    delegate()->progress((float)(frameEntry.pos - m_compressedBytes) / (float)header.size);
 
     // Correct frame type
     if (frame_header.magic == ASE_FILE_FRAME_MAGIC) {
@@ -91,14 +96,16 @@ bool AsepriteDecoder::decode()
         sprite->setFrameDuration(frame, frame_header.duration);
 
       // Read chunks
-      for (uint32_t c=0; c<frame_header.chunks; c++) {
+      for (const AsepriteChunkEntry& chunk : frameEntry.chunks) {
         // Start chunk position
-        size_t chunk_pos = f()->tell();
-        delegate()->progress((float)chunk_pos / (float)header.size);
+        const size_t chunk_pos = chunk.pos;
+        const size_t chunk_size = chunk.size;
+        const int chunk_type = chunk.type;
+        // The compressed cels found until now will be inflated later
+        delegate()->progress((float)(chunk_pos - m_compressedBytes) / (float)header.size);
 
-        // Read chunk information
-        int chunk_size = read32();
-        int chunk_type = read16();
+        // Skip chunk size and type
+        f()->seek(chunk_pos+6);
 
         switch (chunk_type) {
 
@@ -212,18 +219,15 @@ bool AsepriteDecoder::decode()
             break;
         }
 
-        // Skip chunk size
-        f()->seek(chunk_pos+chunk_size);
       }
     }
 
-    // Skip frame size
-    f()->seek(frame_pos+frame_header.size);
-
     if (delegate()->isCanceled())
       break;
   }
 
+  decompressImages(&header);
+
   delegate()->onSprite(sprite.release());
   return true;
 }
@@ -283,6 +287,39 @@ bool AsepriteDecoder::readHeader(AsepriteHeader* header)
   return true;
 }
 
+void AsepriteDecoder::readFrameIndex(const doc::frame_t nframes,
+                                     AsepriteFrameIndex& frameIndex)
+{
+  size_t frame_pos = f()->tell();
+
+  frameIndex.reserve(nframes);
+  for (doc::frame_t frame=0; frame<nframes && f()->ok(); ++frame) {
+    f()->seek(frame_pos);
+
+    frameIndex.emplace_back();
+    AsepriteFrameEntry& frameEntry = frameIndex.back();
+    frameEntry.pos = frame_pos;
+    readFrameHeader(&frameEntry.header);
+
+    if (frameEntry.header.magic == ASE_FILE_FRAME_MAGIC) {
+      for (uint32_t c=0; c<frameEntry.header.chunks; ++c) {
+        AsepriteChunkEntry chunk;
+        chunk.pos = f()->tell();
+        chunk.size = read32();
+        chunk.type = read16();
+        if (!f()->ok())
+          break;
+
+        frameEntry.chunks.push_back(chunk);
+        f()->seek(chunk.pos+chunk.size);
+      }
+    }
+
+    // Skip frame size
+    frame_pos += frameEntry.header.size;
+  }
+}
+
 void AsepriteDecoder::readFrameHeader(AsepriteFrameHeader* frame_header)
 {
   frame_header->size = read32();
@@ -504,12 +541,13 @@ void read_raw_image(FileInterface* f,
 // Compressed Image
 //////////////////////////////////////////////////////////////////////
 
+// Inflates the given zlib stream directly in the rows of the image
+// (there is no intermediate buffer). It can be called from any
+// thread.
 template<typename ImageTraits>
-void read_compressed_image(FileInterface* f,
-                           DecodeDelegate* delegate,
-                           doc::Image* image,
-                           size_t chunk_end,
-                           AsepriteHeader* header)
+void inflate_image(const uint8_t* data,
+                   const size_t size,
+                   doc::Image* image)
 {
   PixelIO<ImageTraits> pixel_io;
   z_stream zstream;
@@ -523,64 +561,133 @@ void read_compressed_image(FileInterface* f,
   if (err != Z_OK)
     throw base::Exception("ZLib error %d in inflateInit().", err);
 
-  std::vector<uint8_t> scanline(ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> uncompressed(image->height() * ImageTraits::getRowStrideBytes(image->width()));
-  std::vector<uint8_t> compressed(4096);
-  int uncompressed_offset = 0;
+  zstream.next_in = (Bytef*)data;
+  zstream.avail_in = uInt(size);
 
-  while (true) {
-    size_t input_bytes;
+  const int w = image->width();
+  const size_t rowBytes = ImageTraits::getRowStrideBytes(w);
 
-    if (f->tell()+compressed.size() > chunk_end) {
-      input_bytes = chunk_end - f->tell(); // Remaining bytes
-      ASSERT(input_bytes < compressed.size());
-
-      if (input_bytes == 0)
-        break;                  // Done, we consumed all chunk
-    }
-    else
-      input_bytes = compressed.size();
+  for (y=0; y<image->height(); ++y) {
+    typename ImageTraits::address_t address =
+      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
 
-    size_t bytes_read = f->readBytes(&compressed[0], input_bytes);
-    zstream.next_in = (Bytef*)&compressed[0];
-    zstream.avail_in = bytes_read;
+    zstream.next_out = (Bytef*)address;
+    zstream.avail_out = uInt(rowBytes);
 
-    do {
-      zstream.next_out = (Bytef*)&scanline[0];
-      zstream.avail_out = scanline.size();
+    err = inflate(&zstream, Z_NO_FLUSH);
+    if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR) {
+      inflateEnd(&zstream);
+      throw base::Exception("ZLib error %d in inflate().", err);
+    }
 
-      err = inflate(&zstream, Z_NO_FLUSH);
-      if (err != Z_OK && err != Z_STREAM_END && err != Z_BUF_ERROR)
-        throw base::Exception("ZLib error %d in inflate().", err);
+    // Missing pixels (the stream ended before the end of the image)
+    // are zero
+    if (zstream.avail_out > 0)
+      std::memset(((uint8_t*)address) + rowBytes - zstream.avail_out,
+                  0, zstream.avail_out);
 
-      size_t uncompressed_bytes = scanline.size() - zstream.avail_out;
-      if (uncompressed_bytes > 0) {
-        if (uncompressed_offset+uncompressed_bytes > uncompressed.size())
-          throw base::Exception("Bad compressed image.");
+    // Convert the pixels from the file format to the memory format
+    // in-place (each pixel is read before it's written)
+    if (ImageTraits::bytes_per_pixel > 1)
+      pixel_io.read_scanline(address, w, (uint8_t*)address);
+  }
 
-        std::copy(scanline.begin(), scanline.begin()+uncompressed_bytes,
-                  uncompressed.begin()+uncompressed_offset);
+  // Check that there are no more pixels in the stream
+  uint8_t extra;
+  zstream.next_out = (Bytef*)&extra;
+  zstream.avail_out = 1;
+  err = inflate(&zstream, Z_NO_FLUSH);
+  const bool tooMuchData = (zstream.avail_out == 0);
 
-        uncompressed_offset += uncompressed_bytes;
-      }
-    } while (zstream.avail_out == 0);
+  err = inflateEnd(&zstream);
+  if (tooMuchData)
+    throw base::Exception("Bad compressed image.");
+  if (err != Z_OK)
+    throw base::Exception("ZLib error %d in inflateEnd().", err);
+}
 
-    delegate->progress((float)f->tell() / (float)header->size);
+void inflate_image(const uint8_t* data,
+                   const size_t size,
+                   doc::Image* image)
+{
+  switch (image->pixelFormat()) {
+    case doc::IMAGE_RGB:
+      inflate_image<doc::RgbTraits>(data, size, image);
+      break;
+    case doc::IMAGE_GRAYSCALE:
+      inflate_image<doc::GrayscaleTraits>(data, size, image);
+      break;
+    case doc::IMAGE_INDEXED:
+      inflate_image<doc::IndexedTraits>(data, size, image);
+      break;
   }
+}
 
-  uncompressed_offset = 0;
-  for (y=0; y<image->height(); y++) {
-    typename ImageTraits::address_t address =
-      (typename ImageTraits::address_t)image->getPixelAddress(0, y);
-
-    pixel_io.read_scanline(address, image->width(), &uncompressed[uncompressed_offset]);
+// Inflates the images of all compressed cels using several threads
+// (each cel is compressed in its own zlib stream). The calling
+// thread works as one of the workers and it's the only one that uses
+// the delegate.
+void AsepriteDecoder::decompressImages(AsepriteHeader* header)
+{
+  const int n = int(m_compressedImages.size());
+  if (n == 0)
+    return;
+
+  const size_t totalBytes = m_compressedBytes;
+  std::vector<std::string> errors(n);
+  std::atomic<int> nextImage(0);
+  std::atomic<size_t> inflatedBytes(0);
+  std::atomic<bool> stop(false);
+
+  auto worker =
+    [&](const bool isMainThread) {
+      while (!stop) {
+        const int i = nextImage++;
+        if (i >= n)
+          break;
+
+        const CompressedImage& ci = m_compressedImages[i];
+        try {
+          inflate_image(ci.data, ci.size, ci.image.get());
+        }
+        catch (const std::exception& e) {
+          errors[i] = e.what();
+        }
+        inflatedBytes += ci.size;
 
-    uncompressed_offset += ImageTraits::getRowStrideBytes(image->width());
+        if (isMainThread) {
+          delegate()->progress(
+            (float)(header->size - totalBytes + inflatedBytes) / (float)header->size);
+          if (delegate()->isCanceled())
+            stop = true;
+        }
+      }
+    };
+
+  const int nthreads =
+    std::max(1, std::min<int>(std::thread::hardware_concurrency(), n));
+  std::vector<std::thread> threads;
+  for (int i=1; i<nthreads; ++i)
+    threads.push_back(std::thread([&worker]{ worker(false); }));
+  worker(true);
+  for (auto& thread : threads)
+    thread.join();
+
+  // OK, in case of error we can show the problem, but continue
+  // loading more cels.
+  for (const std::string& error : errors) {
+    if (!error.empty())
+      delegate()->error(error);
   }
 
-  err = inflateEnd(&zstream);
-  if (err != Z_OK)
-    throw base::Exception("ZLib error %d in inflateEnd().", err);
+  // Copied cels (from links with different position/opacity) were
+  // created before the pixels of the original cel were inflated.
+  for (const auto& copy : m_copiedImages)
+    doc::copy_image(copy.first.get(), copy.second.get());
+
+  m_compressedImages.clear();
+  m_copiedImages.clear();
+  m_compressedBytes = 0;
 }
 
 //////////////////////////////////////////////////////////////////////
@@ -671,6 +778,10 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
           cel.reset(doc::Cel::MakeCopy(frame, link));
           cel->setPosition(x, y);
           cel->setOpacity(opacity);
+
+          // The pixels of the linked cel might not be inflated yet
+          m_copiedImages.push_back(
+            std::make_pair(cel->imageRef(), link->imageRef()));
         }
       }
       else {
@@ -688,31 +799,20 @@ doc::Cel* AsepriteDecoder::readCelChunk(doc::Sprite* sprite,
       if (w > 0 && h > 0) {
         doc::ImageRef image(doc::Image::create(pixelFormat, w, h));
 
-        // Try to read pixel data
-        try {
-          switch (image->pixelFormat()) {
-
-            case doc::IMAGE_RGB:
-              read_compressed_image<doc::RgbTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
-
-            case doc::IMAGE_GRAYSCALE:
-              read_compressed_image<doc::GrayscaleTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
-
-            case doc::IMAGE_INDEXED:
-              read_compressed_image<doc::IndexedTraits>(
-                f(), delegate(), image.get(), chunk_end, header);
-              break;
-          }
-        }
-        // OK, in case of error we can show the problem, but continue
-        // loading more cels.
-        catch (const std::exception& e) {
-          delegate()->error(e.what());
+        // The pixels are inflated in decompressImages() after reading
+        // all chunks. Here we just locate the compressed data.
+        CompressedImage ci;
+        ci.image = image;
+        ci.size = (f()->tell() < chunk_end ? chunk_end - f()->tell(): 0);
+        ci.data = f()->mappedBytes(f()->tell(), ci.size);
+        if (!ci.data) {
+          ci.buffer.reset(new std::vector<uint8_t>(ci.size));
+          if (ci.size > 0)
+            ci.size = readBytes(&(*ci.buffer)[0], ci.size);
+          ci.data = (ci.size > 0 ? &(*ci.buffer)[0]: nullptr);
         }
+        m_compressedBytes += ci.size;
+        m_compressedImages.push_back(std::move(ci));
 
         cel.reset(new doc::Cel(frame, image));
         cel->setPosition(x, y);
@@ -1,5 +1,5 @@
 // Aseprite Document IO Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2019 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -9,14 +9,19 @@
 #define DIO_ASEPRITE_DECODER_H_INCLUDED
 #pragma once
 
+#include "dio/aseprite_common.h"
 #include "dio/decoder.h"
 #include "doc/frame.h"
+#include "doc/image_ref.h"
 #include "doc/layer_list.h"
 #include "doc/pixel_format.h"
 #include "doc/slices.h"
 #include "doc/tags.h"
 
+#include <memory>
 #include <string>
+#include <utility>
+#include <vector>
 
 namespace doc {
   class Cel;
@@ -30,15 +35,24 @@ namespace doc {
 
 namespace dio {
 
-struct AsepriteHeader;
-struct AsepriteFrameHeader;
-
 class AsepriteDecoder : public Decoder {
 public:
+  AsepriteDecoder() : m_compressedBytes(0) { }
   bool decode() override;
 
 private:
+  // Compressed pixels of a cel that will be inflated after reading
+  // all chunks
+  struct CompressedImage {
+    doc::ImageRef image;
+    const uint8_t* data;        // Data in the mapped file or in "buffer"
+    size_t size;
+    std::unique_ptr<std::vector<uint8_t>> buffer;
+  };
+
   bool readHeader(AsepriteHeader* header);
+  void readFrameIndex(const doc::frame_t nframes,
+                      AsepriteFrameIndex& frameIndex);
   void readFrameHeader(AsepriteFrameHeader* frame_header);
   void readPadding(const int bytes);
   std::string readString();
@@ -59,6 +73,11 @@ private:
   void readSlicesChunk(doc::Slices& slices);
   doc::Slice* readSliceChunk(doc::Slices& slices);
   void readUserDataChunk(doc::UserData* userData);
+  void decompressImages(AsepriteHeader* header);
+
+  std::vector<CompressedImage> m_compressedImages;
+  std::vector<std::pair<doc::ImageRef, doc::ImageRef>> m_copiedImages;
+  size_t m_compressedBytes;
 };
 
 } // namespace dio
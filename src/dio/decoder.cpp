@@ -1,5 +1,5 @@
 // Aseprite Document IO Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2019 Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -35,11 +35,10 @@ uint8_t Decoder::read8()
 
 uint16_t Decoder::read16()
 {
-  int b1 = m_f->read8();
-  int b2 = m_f->read8();
-
-  if (m_f->ok()) {
-    return ((b2 << 8) | b1); // Little endian
+  // Read all bytes at once (just one virtual call)
+  uint8_t b[2];
+  if (m_f->readBytes(b, 2) == 2) {
+    return ((b[1] << 8) | b[0]); // Little endian
   }
   else
     return 0;
@@ -47,14 +46,10 @@ uint16_t Decoder::read16()
 
 uint32_t Decoder::read32()
 {
-  int b1 = m_f->read8();
-  int b2 = m_f->read8();
-  int b3 = m_f->read8();
-  int b4 = m_f->read8();
-
-  if (m_f->ok()) {
+  uint8_t b[4];
+  if (m_f->readBytes(b, 4) == 4) {
     // Little endian
-    return ((b4 << 24) | (b3 << 16) | (b2 << 8) | b1);
+    return ((uint32_t(b[3]) << 24) | (b[2] << 16) | (b[1] << 8) | b[0]);
   }
   else
     return 0;
@@ -1,4 +1,5 @@
 // Aseprite Document IO Library
+// Copyright (c) 2019 Igara Studio S.A.
 // Copyright (c) 2017-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,6 +12,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <cstdio>
+#include <string>
 
 namespace dio {
 
@@ -34,6 +36,12 @@ public:
   // Writes one byte in the file (or do nothing if ok() = false)
   virtual void write8(uint8_t value) = 0;
 
+  // Returns a pointer to the "n" bytes starting at "absPos" if the
+  // file content is accessible directly from memory (e.g. a
+  // memory-mapped file), or nullptr if the bytes must be read with
+  // readBytes().
+  virtual const uint8_t* mappedBytes(size_t absPos, size_t n) { return nullptr; }
+
 };
 
 class StdioFileInterface : public FileInterface {
@@ -50,6 +58,33 @@ private:
   bool m_ok;
 };
 
+// Read-only file mapped in memory. It's faster than
+// StdioFileInterface to read big files (there are no system calls
+// or copies to read each byte), and pages are loaded only when they
+// are accessed.
+class MappedFileInterface : public FileInterface {
+public:
+  MappedFileInterface(const std::string& filename);
+  ~MappedFileInterface();
+  bool ok() const override;
+  size_t tell() override;
+  void seek(size_t absPos) override;
+  uint8_t read8() override;
+  size_t readBytes(uint8_t* buf, size_t n) override;
+  void write8(uint8_t value) override;
+  const uint8_t* mappedBytes(size_t absPos, size_t n) override;
+
+  // Returns false if the file couldn't be mapped (e.g. it doesn't
+  // exist or it's empty)
+  bool isMapped() const { return m_data != nullptr; }
+
+private:
+  const uint8_t* m_data;
+  size_t m_size;
+  size_t m_pos;
+  bool m_ok;
+};
+
 } // namespace dio
 
 #endif
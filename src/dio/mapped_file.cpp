@@ -0,0 +1,137 @@
+// Aseprite Document IO Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "dio/file_interface.h"
+
+#ifdef _WIN32
+  #include "base/string.h"
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+
+namespace dio {
+
+MappedFileInterface::MappedFileInterface(const std::string& filename)
+  : m_data(nullptr)
+  , m_size(0)
+  , m_pos(0)
+  , m_ok(false)
+{
+#ifdef _WIN32
+  HANDLE file = CreateFileW(base::from_utf8(filename).c_str(),
+                            GENERIC_READ, FILE_SHARE_READ, nullptr,
+                            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    return;
+
+  LARGE_INTEGER size;
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+    HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY,
+                                        0, 0, nullptr);
+    if (mapping) {
+      m_data = (const uint8_t*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (m_data)
+        m_size = size_t(size.QuadPart);
+
+      // The view keeps a reference to the mapping object
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+#else
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return;
+
+  struct stat sts;
+  if (fstat(fd, &sts) == 0 && sts.st_size > 0) {
+    void* data = mmap(nullptr, sts.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data != MAP_FAILED) {
+      m_data = (const uint8_t*)data;
+      m_size = size_t(sts.st_size);
+    }
+  }
+  // The mapping is still valid after closing the file descriptor
+  close(fd);
+#endif
+
+  m_ok = (m_data != nullptr);
+}
+
+MappedFileInterface::~MappedFileInterface()
+{
+  if (!m_data)
+    return;
+
+#ifdef _WIN32
+  UnmapViewOfFile(m_data);
+#else
+  munmap((void*)m_data, m_size);
+#endif
+}
+
+bool MappedFileInterface::ok() const
+{
+  return m_ok;
+}
+
+size_t MappedFileInterface::tell()
+{
+  return m_pos;
+}
+
+void MappedFileInterface::seek(size_t absPos)
+{
+  m_pos = absPos;
+}
+
+uint8_t MappedFileInterface::read8()
+{
+  if (m_pos < m_size)
+    return m_data[m_pos++];
+
+  m_ok = false;
+  return 0;
+}
+
+size_t MappedFileInterface::readBytes(uint8_t* buf, size_t n)
+{
+  size_t n2 = (m_pos < m_size ? std::min(n, m_size - m_pos): 0);
+  if (n2 > 0) {
+    std::memcpy(buf, m_data + m_pos, n2);
+    m_pos += n2;
+  }
+  if (n2 != n)
+    m_ok = false;
+  return n2;
+}
+
+void MappedFileInterface::write8(uint8_t value)
+{
+  // Read-only file
+  m_ok = false;
+}
+
+const uint8_t* MappedFileInterface::mappedBytes(size_t absPos, size_t n)
+{
+  if (absPos <= m_size && n <= m_size - absPos)
+    return m_data + absPos;
+  else
+    return nullptr;
+}
+
+} // namespace dio
@@ -1,54 +1,37 @@
-// The floodfill routine.
-// By Shawn Hargreaves.
-//
-// Changes by David Capello:
-// - Adapted to Aseprite
-// - Added non-contiguous mode
-// - Added mask parameter
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
 //
 // This file is released under the terms of the MIT license.
 // Read LICENSE.txt for more information.
-//
-// TODO rewrite this algorithm from scratch
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#include "doc/algorithm/floodfill.h"
+
 #include "base/base.h"
-#include "doc/algo.h"
 #include "doc/image.h"
+#include "doc/image_traits.h"
 #include "doc/mask.h"
-#include "doc/primitives.h"
 #include "doc/primitives_fast.h"
 
-#include <climits>
-#include <cmath>
+#include <algorithm>
+#include <cstdint>
 #include <vector>
 
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_FLOODFILL_SSE2 1
+  #include <emmintrin.h>
+#endif
+
 namespace doc {
 namespace algorithm {
 
-struct FLOODED_LINE {   // store segments which have been flooded
-  short flags;          // status of the segment
-  short lpos, rpos;     // left and right ends of segment
-  short y;              // y coordinate of the segment
-  int next;             // linked list if several per line
-};
-
-/* Note: a 'short' is not sufficient for 'next' above in some corner cases. */
+namespace {
 
-
-static std::vector<FLOODED_LINE> flood_buf;
-static int flood_count;          /* number of flooded segments */
-
-#define FLOOD_IN_USE             1
-#define FLOOD_TODO_ABOVE         2
-#define FLOOD_TODO_BELOW         4
-
-#define FLOOD_LINE(c)            (&flood_buf[c])
-
-static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
+inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
 {
   if (tolerance == 0)
     return (c1 == c2) || (rgba_geta(c1) == 0 && rgba_geta(c2) == 0);
@@ -72,7 +55,7 @@ static inline bool color_equal_32(color_t c1, color_t c2, int tolerance)
   }
 }
 
-static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
+inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
 {
   if (tolerance == 0)
     return (c1 == c2) || (graya_geta(c1) == 0 && graya_geta(c2) == 0);
@@ -90,7 +73,7 @@ static inline bool color_equal_16(color_t c1, color_t c2, int tolerance)
   }
 }
 
-static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
+inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
 {
   if (tolerance == 0)
     return (c1 == c2);
@@ -99,7 +82,7 @@ static inline bool color_equal_8(color_t c1, color_t c2, int tolerance)
 }
 
 template<typename ImageTraits>
-static inline bool color_equal(color_t c1, color_t c2, int tolerance)
+inline bool color_equal(color_t c1, color_t c2, int tolerance)
 {
   static_assert(false && sizeof(ImageTraits), "Invalid color comparison");
   return false;
@@ -123,212 +106,260 @@ inline bool color_equal<IndexedTraits>(color_t c1, color_t c2, int tolerance)
   return color_equal_8(c1, c2, tolerance);
 }
 
-
-
-/* flooder:
- *  Fills a horizontal line around the specified position, and adds it
- *  to the list of drawn segments. Returns the first x coordinate after
- *  the part of the line which it has dealt with.
- */
-static int flooder(const Image* image,
-                   const Mask* mask,
-                   int x, int y,
-                   const gfx::Rect& bounds,
-                   color_t src_color, int tolerance, void *data, AlgoHLine proc)
+template<>
+inline bool color_equal<BitmapTraits>(color_t c1, color_t c2, int tolerance)
 {
-#define MASKED(u, v)                                                    \
-        (mask &&                                                        \
-         (!mask->bounds().contains(u, v) ||                             \
-          (mask->bitmap() &&                                            \
-           !get_pixel_fast<BitmapTraits>(mask->bitmap(),                \
-                                         (u)-mask->bounds().x,          \
-                                         (v)-mask->bounds().y))))
-
-  FLOODED_LINE *p;
-  int left = 0, right = 0;
-  int c;
-
-  switch (image->pixelFormat()) {
-
-    case IMAGE_RGB:
-      {
-        uint32_t* address = reinterpret_cast<uint32_t*>(image->getPixelAddress(0, y));
-
-        // Check start pixel
-        if (!color_equal_32((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_32((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_32((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
-
-    case IMAGE_GRAYSCALE:
-      {
-        uint16_t* address = reinterpret_cast<uint16_t*>(image->getPixelAddress(0, y));
-
-        // Check start pixel
-        if (!color_equal_16((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_16((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_16((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
-
-    case IMAGE_INDEXED:
-      {
-        uint8_t* address = image->getPixelAddress(0, y);
-
-        // Check start pixel
-        if (!color_equal_8((int)*(address+x), src_color, tolerance) || MASKED(x, y))
-          return x+1;
-
-        // Work left from starting point
-        for (left=x-1; left>=bounds.x; left--) {
-          if (!color_equal_8((int)*(address+left), src_color, tolerance) || MASKED(left, y))
-            break;
-        }
-
-        // Work right from starting point
-        for (right=x+1; right<bounds.x2(); right++) {
-          if (!color_equal_8((int)*(address+right), src_color, tolerance) || MASKED(right, y))
-            break;
-        }
-      }
-      break;
-
-    default:
-      // Check start pixel
-      if (get_pixel(image, x, y) != src_color || MASKED(x, y))
-        return x+1;
-
-      // Work left from starting point
-      for (left=x-1; left>=bounds.x; left--) {
-        if (get_pixel(image, left, y) != src_color || MASKED(left, y))
-          break;
-      }
+  return (c1 == c2);
+}
 
-      // Work right from starting point
-      for (right=x+1; right<bounds.x2(); right++) {
-        if (get_pixel(image, right, y) != src_color || MASKED(right, y))
-          break;
-      }
-      break;
+// Reads pixels of one row of the image.
+template<typename ImageTraits>
+class RowReader {
+public:
+  RowReader(const Image* image, int y)
+    : m_row(reinterpret_cast<typename ImageTraits::const_address_t>(
+              image->getPixelAddress(0, y))) {
   }
+  color_t operator[](int x) const { return m_row[x]; }
+  typename ImageTraits::const_address_t address() const { return m_row; }
+private:
+  typename ImageTraits::const_address_t m_row;
+};
 
-  left++;
-  right--;
-
-  /* draw the line */
-  (*proc)(left, y, right, data);
+template<>
+class RowReader<BitmapTraits> {
+public:
+  RowReader(const Image* image, int y)
+    : m_image(image), m_y(y) {
+  }
+  color_t operator[](int x) const {
+    return get_pixel_fast<BitmapTraits>(m_image, x, m_y);
+  }
+private:
+  const Image* m_image;
+  int m_y;
+};
 
-  /* store it in the list of flooded segments */
-  c = y;
-  p = FLOOD_LINE(c);
+// Returns the first x in [x, x2) where the pixel of the row is not
+// equal to "color" (or x2 if all pixels are equal).
+template<typename ImageTraits>
+int find_run_end(const RowReader<ImageTraits>& row, int x, const int x2,
+                 const color_t color, const int tolerance)
+{
+  while (x < x2 && color_equal<ImageTraits>(row[x], color, tolerance))
+    ++x;
+  return x;
+}
 
-  if (p->flags) {
-    while (p->next) {
-      c = p->next;
-      p = FLOOD_LINE(c);
+// RGB rows are compared 4 pixels at a time with SSE2 (with the same
+// result as color_equal_32()).
+template<>
+int find_run_end<RgbTraits>(const RowReader<RgbTraits>& row, int x, const int x2,
+                            const color_t color, const int tolerance)
+{
+  const uint32_t* p = row.address();
+#if DOC_FLOODFILL_SSE2
+  const __m128i c = _mm_set1_epi32(int(color));
+  const __m128i tol = _mm_set1_epi8(char(std::min(std::max(tolerance, 0), 255)));
+  const __m128i alphaMask = _mm_set1_epi32(int(rgba_a_mask));
+  const __m128i zero = _mm_setzero_si128();
+  const bool transparent = (rgba_geta(color) == 0);
+
+  for (; x+4 <= x2; x += 4) {
+    const __m128i px = _mm_loadu_si128((const __m128i*)(p+x));
+
+    // Absolute difference of each channel, then the pixel is equal
+    // if no channel difference is greater than the tolerance
+    const __m128i diff = _mm_or_si128(_mm_subs_epu8(px, c),
+                                      _mm_subs_epu8(c, px));
+    __m128i equal = _mm_cmpeq_epi32(_mm_subs_epu8(diff, tol), zero);
+
+    // Two transparent pixels are always equal
+    if (transparent)
+      equal = _mm_or_si128(
+        equal, _mm_cmpeq_epi32(_mm_and_si128(px, alphaMask), zero));
+
+    int bits = _mm_movemask_epi8(equal);
+    if (bits != 0xffff) {
+      for (; (bits & 0xf) == 0xf; bits >>= 4)
+        ++x;
+      return x;
     }
+  }
+#endif
+  while (x < x2 && color_equal_32(p[x], color, tolerance))
+    ++x;
+  return x;
+}
 
-    p->next = c = flood_count++;
-    flood_buf.resize(flood_count);
-    p = FLOOD_LINE(c);
+// Scanline flood fill. All the state of the algorithm is in this
+// object (there is no global/static data), so several flood fills
+// can run at the same time in different threads.
+//
+// Each filled span is marked in a bitmap of visited pixels (one bit
+// per pixel of "bounds") and pushed to a stack, then the rows above
+// and below the span are scanned looking for new spans to fill. In
+// this way each pixel is compared a constant number of times.
+template<typename ImageTraits>
+class FloodFill {
+public:
+  FloodFill(const Image* image,
+            const Mask* mask,
+            const gfx::Rect& bounds,
+            const color_t srcColor,
+            const int tolerance,
+            const bool isEightConnected,
+            void* data,
+            AlgoHLine proc)
+    : m_image(image)
+    , m_mask(mask)
+    , m_bounds(bounds)
+    , m_srcColor(srcColor)
+    , m_tolerance(tolerance)
+    , m_ext(isEightConnected ? 1: 0)
+    , m_data(data)
+    , m_proc(proc)
+    , m_rowWords((bounds.w+31) / 32)
+    , m_visited(m_rowWords*bounds.h, 0) {
   }
 
-  p->flags = FLOOD_IN_USE;
-  p->lpos = left;
-  p->rpos = right;
-  p->y = y;
-  p->next = 0;
+  void fill(const int x, const int y) {
+    if (!isInside(RowReader<ImageTraits>(m_image, y), x, y))
+      return;
 
-  if (y > bounds.y)
-    p->flags |= FLOOD_TODO_ABOVE;
+    fillSpan(x, y);
 
-  if (y+1 < bounds.y2())
-    p->flags |= FLOOD_TODO_BELOW;
+    while (!m_stack.empty()) {
+      const Span span = m_stack.back();
+      m_stack.pop_back();
 
-  return right+2;
-}
+      const int x1 = std::max(m_bounds.x, span.x1 - m_ext);
+      const int x2 = std::min(m_bounds.x2()-1, span.x2 + m_ext);
+      if (span.y > m_bounds.y)
+        scanRow(x1, x2, span.y-1);
+      if (span.y+1 < m_bounds.y2())
+        scanRow(x1, x2, span.y+1);
+    }
+  }
 
+private:
+  struct Span {
+    int x1, x2, y;
+  };
 
+  bool isInside(const RowReader<ImageTraits>& row, int x, int y) const {
+    return (color_equal<ImageTraits>(row[x], m_srcColor, m_tolerance) &&
+            !isMasked(x, y));
+  }
 
-/* check_flood_line:
- *  Checks a line segment, using the scratch buffer is to store a list of
- *  segments which have already been drawn in order to minimise the required
- *  number of tests.
- */
-static int check_flood_line(const Image* image,
-                            const Mask* mask,
-                            int y, int left, int right,
-                            const gfx::Rect& bounds,
-                            int src_color, int tolerance, void *data, AlgoHLine proc)
-{
-  int c;
-  FLOODED_LINE *p;
-  int ret = false;
+  bool isMasked(int x, int y) const {
+    return (m_mask &&
+            (!m_mask->bounds().contains(x, y) ||
+             (m_mask->bitmap() &&
+              !get_pixel_fast<BitmapTraits>(m_mask->bitmap(),
+                                            x-m_mask->bounds().x,
+                                            y-m_mask->bounds().y))));
+  }
 
-  while (left <= right) {
-    c = y;
+  uint32_t* visitedRow(int y) {
+    return &m_visited[(y-m_bounds.y)*m_rowWords];
+  }
 
-    for (;;) {
-      p = FLOOD_LINE(c);
+  // Returns the first x in [x, x2] that is not visited in the given
+  // row, or x2+1 if all pixels were already visited (skipping whole
+  // words of visited pixels).
+  int nextUnvisited(int x, const int x2, const int y) {
+    const uint32_t* row = visitedRow(y);
+    while (x <= x2) {
+      const int u = x - m_bounds.x;
+      const uint32_t word = row[u / 32];
+      if (word == 0xffffffff) {
+        x += 32 - (u % 32);
+        continue;
+      }
+      if ((word & (1u << (u % 32))) == 0)
+        return x;
+      ++x;
+    }
+    return x2+1;
+  }
 
-      if ((left >= p->lpos) && (left <= p->rpos)) {
-        left = p->rpos+2;
-        break;
+  void setVisited(const int x1, const int x2, const int y) {
+    uint32_t* row = visitedRow(y);
+    for (int u=x1-m_bounds.x; u<=x2-m_bounds.x; ) {
+      if ((u % 32) == 0 && u+31 <= x2-m_bounds.x) {
+        row[u / 32] = 0xffffffff;
+        u += 32;
+      }
+      else {
+        row[u / 32] |= (1u << (u % 32));
+        ++u;
       }
+    }
+  }
 
-      c = p->next;
+  // Fills the span that contains the (x, y) pixel (which must be
+  // inside and not visited). Returns the right end of the span.
+  int fillSpan(const int x, const int y) {
+    const RowReader<ImageTraits> row(m_image, y);
+    int left = x;
+    int right = x;
+
+    while (left > m_bounds.x && isInside(row, left-1, y))
+      --left;
+
+    // Pixels to the right are compared in runs (the mask is checked
+    // only for pixels with the same color)
+    const int end = find_run_end(row, right+1, m_bounds.x2(),
+                                 m_srcColor, m_tolerance);
+    while (right+1 < end && !isMasked(right+1, y))
+      ++right;
+
+    setVisited(left, right, y);
+    (*m_proc)(left, y, right, m_data);
+
+    Span span;
+    span.x1 = left;
+    span.x2 = right;
+    span.y = y;
+    m_stack.push_back(span);
+    return right;
+  }
 
-      if (!c) {
-        left = flooder(image, mask, left, y, bounds, src_color, tolerance, data, proc);
-        ret = true;
-        break;
-      }
+  // Fills all the spans that intersect [x1, x2] in the given row.
+  void scanRow(int x, const int x2, const int y) {
+    const RowReader<ImageTraits> row(m_image, y);
+    while ((x = nextUnvisited(x, x2, y)) <= x2) {
+      if (isInside(row, x, y))
+        x = fillSpan(x, y)+2;   // x+1 is outside the span
+      else
+        ++x;
     }
   }
 
-  return ret;
-}
+  const Image* m_image;
+  const Mask* m_mask;
+  const gfx::Rect m_bounds;
+  const color_t m_srcColor;
+  const int m_tolerance;
+  const int m_ext;              // Extra pixel to check diagonal pixels
+  void* m_data;
+  AlgoHLine m_proc;
+  const int m_rowWords;
+  std::vector<uint32_t> m_visited;
+  std::vector<Span> m_stack;
+};
 
 template<typename ImageTraits>
-static void replace_color(const Image* image, const gfx::Rect& bounds, int src_color, int tolerance, void* data, AlgoHLine proc)
+void replace_color(const Image* image, const gfx::Rect& bounds, int src_color, int tolerance, void* data, AlgoHLine proc)
 {
-  typename ImageTraits::address_t address;
-
   for (int y=bounds.y; y<bounds.y2(); ++y) {
-    address = reinterpret_cast<typename ImageTraits::address_t>(image->getPixelAddress(bounds.x, y));
+    const RowReader<ImageTraits> row(image, y);
 
-    for (int x=bounds.x; x<bounds.x2(); ++x, ++address) {
-      int right = -1;
-
-      if (color_equal<ImageTraits>((int)(*address), src_color, tolerance)) {
-        ++address;
-        for (right=x+1; right<bounds.x2(); ++right, ++address) {
-          if (!color_equal<ImageTraits>((int)(*address), src_color, tolerance))
-            break;
-        }
+    for (int x=bounds.x; x<bounds.x2(); ++x) {
+      if (color_equal<ImageTraits>(row[x], src_color, tolerance)) {
+        const int right = find_run_end(row, x+1, bounds.x2(),
+                                       src_color, tolerance);
         (*proc)(x, y, right-1, data);
         x = right;
       }
@@ -336,13 +367,36 @@ static void replace_color(const Image* image, const gfx::Rect& bounds, int src_c
   }
 }
 
-/* floodfill:
- *  Fills an enclosed area (starting at point x, y) with the specified color.
- */
+template<typename ImageTraits>
+void floodfill_templ(const Image* image,
+                     const Mask* mask,
+                     const int x, const int y,
+                     const gfx::Rect& bounds,
+                     const doc::color_t src_color,
+                     const int tolerance,
+                     const bool contiguous,
+                     const bool isEightConnected,
+                     void* data,
+                     AlgoHLine proc)
+{
+  // Non-contiguous case, we replace colors in the whole image.
+  if (!contiguous) {
+    replace_color<ImageTraits>(image, bounds, src_color, tolerance, data, proc);
+    return;
+  }
+
+  FloodFill<ImageTraits> floodFill(image, mask, bounds, src_color,
+                                   tolerance, isEightConnected,
+                                   data, proc);
+  floodFill.fill(x, y);
+}
+
+} // anonymous namespace
+
 void floodfill(const Image* image,
                const Mask* mask,
                const int x, const int y,
-               const gfx::Rect& bounds,
+               const gfx::Rect& bounds0,
                const doc::color_t src_color,
                const int tolerance,
                const bool contiguous,
@@ -351,130 +405,32 @@ void floodfill(const Image* image,
                AlgoHLine proc)
 {
   // Make sure we have a valid starting point
-  if ((x < 0) || (x >= image->width()) ||
-      (y < 0) || (y >= image->height()))
-    return;
-
-  // Non-contiguous case, we replace colors in the whole image.
-  if (!contiguous) {
-    switch (image->pixelFormat()) {
-      case IMAGE_RGB:
-        replace_color<RgbTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-      case IMAGE_GRAYSCALE:
-        replace_color<GrayscaleTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-      case IMAGE_INDEXED:
-        replace_color<IndexedTraits>(image, bounds, src_color, tolerance, data, proc);
-        break;
-    }
+  const gfx::Rect bounds = bounds0.createIntersection(image->bounds());
+  if (!bounds.contains(x, y))
     return;
-  }
 
-  /* set up the list of flooded segments */
-  flood_buf.resize(image->height());
-  flood_count = image->height();
-  FLOODED_LINE* p = (FLOODED_LINE*)&flood_buf[0];
-  for (int c=0; c<flood_count; c++) {
-    p[c].flags = 0;
-    p[c].lpos = SHRT_MAX;
-    p[c].rpos = SHRT_MIN;
-    p[c].y = y;
-    p[c].next = 0;
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB:
+      floodfill_templ<RgbTraits>(
+        image, mask, x, y, bounds, src_color, tolerance,
+        contiguous, isEightConnected, data, proc);
+      break;
+    case IMAGE_GRAYSCALE:
+      floodfill_templ<GrayscaleTraits>(
+        image, mask, x, y, bounds, src_color, tolerance,
+        contiguous, isEightConnected, data, proc);
+      break;
+    case IMAGE_INDEXED:
+      floodfill_templ<IndexedTraits>(
+        image, mask, x, y, bounds, src_color, tolerance,
+        contiguous, isEightConnected, data, proc);
+      break;
+    case IMAGE_BITMAP:
+      floodfill_templ<BitmapTraits>(
+        image, mask, x, y, bounds, src_color, tolerance,
+        contiguous, isEightConnected, data, proc);
+      break;
   }
-
-  // Start up the flood algorithm
-  flooder(image, mask, x, y, bounds, src_color, tolerance, data, proc);
-
-  // Continue as long as there are some segments still to test
-  bool done;
-  do {
-    done = true;
-
-    // For each line on the screen
-    for (int c=0; c<flood_count; c++) {
-
-      p = FLOOD_LINE(c);
-
-      // Check below the segment?
-      if (p->flags & FLOOD_TODO_BELOW) {
-        p->flags &= ~FLOOD_TODO_BELOW;
-
-        if (isEightConnected) {
-          if (p->lpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y+1, p->lpos+1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->lpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y+1, p->lpos-1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y+1, p->lpos, p->rpos+1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-
-          if (p->rpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y+1, p->lpos, p->rpos-1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-            p = FLOOD_LINE(c);
-          }
-        }
-
-        if (check_flood_line(image, mask, p->y+1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          p = FLOOD_LINE(c);
-        }
-      }
-
-      // Check above the segment?
-      if (p->flags & FLOOD_TODO_ABOVE) {
-        p->flags &= ~FLOOD_TODO_ABOVE;
-
-        if (isEightConnected) {
-          if (p->lpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y-1, p->lpos+1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-          }
-          if (p->lpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y-1, p->lpos-1, p->rpos, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-          }
-
-          if (p->rpos+1 < bounds.x2() &&
-              check_flood_line(image, mask, p->y-1, p->lpos, p->rpos+1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-          }
-          if (p->rpos-1 >= 0 &&
-              check_flood_line(image, mask, p->y-1, p->lpos, p->rpos-1, bounds,
-                               src_color, tolerance, data, proc)) {
-            done = false;
-          }
-        }
-
-        if (check_flood_line(image, mask, p->y-1, p->lpos, p->rpos, bounds,
-                             src_color, tolerance, data, proc)) {
-          done = false;
-          // Special case shortcut for going backwards
-          if ((c > bounds.y) && (c < bounds.y2()))
-            c -= 2;
-        }
-      }
-    }
-  } while (!done);
 }
 
 } // namespace algorithm
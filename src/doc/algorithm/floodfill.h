@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
 // Copyright (c) 2001-2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -19,6 +20,14 @@ namespace doc {
 
   namespace algorithm {
 
+    // Calls "proc" for each horizontal line of pixels of "image"
+    // inside "bounds" that are connected to (x, y) and have a color
+    // similar to "srcColor" (or for all similar pixels if
+    // "contiguous" is false). Pixels outside the "mask" (if it's not
+    // nullptr) are excluded.
+    //
+    // It doesn't use global/static data, so it can be called from
+    // several threads at the same time.
     void floodfill(const Image* image,
                    const Mask* mask,
                    const int x, const int y,
@@ -0,0 +1,271 @@
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/algorithm/floodfill.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask.h"
+#include "doc/primitives.h"
+#include "doc/random_test_utils.h"
+
+#include <cstdlib>
+#include <deque>
+#include <memory>
+#include <vector>
+
+using namespace doc;
+
+namespace {
+
+struct Filled {
+  int w;
+  std::vector<int> count;     // Number of times each pixel was filled
+};
+
+void count_hline(int x1, int y, int x2, void* data)
+{
+  auto filled = static_cast<Filled*>(data);
+  for (int x=x1; x<=x2; ++x)
+    ++filled->count[y*filled->w + x];
+}
+
+// Scalar color comparisons of the flood fill (the RGB rows are
+// compared with SSE2 in floodfill.cpp)
+bool ref_color_equal_32(color_t c1, color_t c2, int tolerance)
+{
+  if (tolerance == 0)
+    return (c1 == c2) || (rgba_geta(c1) == 0 && rgba_geta(c2) == 0);
+  if (rgba_geta(c1) == 0 && rgba_geta(c2) == 0)
+    return true;
+  return (std::abs(int(rgba_getr(c1)) - int(rgba_getr(c2))) <= tolerance &&
+          std::abs(int(rgba_getg(c1)) - int(rgba_getg(c2))) <= tolerance &&
+          std::abs(int(rgba_getb(c1)) - int(rgba_getb(c2))) <= tolerance &&
+          std::abs(int(rgba_geta(c1)) - int(rgba_geta(c2))) <= tolerance);
+}
+
+bool ref_color_equal_16(color_t c1, color_t c2, int tolerance)
+{
+  if (tolerance == 0)
+    return (c1 == c2) || (graya_geta(c1) == 0 && graya_geta(c2) == 0);
+  if (graya_geta(c1) == 0 && graya_geta(c2) == 0)
+    return true;
+  return (std::abs(int(graya_getv(c1)) - int(graya_getv(c2))) <= tolerance &&
+          std::abs(int(graya_geta(c1)) - int(graya_geta(c2))) <= tolerance);
+}
+
+bool ref_color_equal_8(color_t c1, color_t c2, int tolerance)
+{
+  return std::abs(int(c1) - int(c2)) <= tolerance;
+}
+
+bool ref_color_equal(const Image* image, color_t c1, color_t c2, int tolerance)
+{
+  switch (image->pixelFormat()) {
+    case IMAGE_RGB: return ref_color_equal_32(c1, c2, tolerance);
+    case IMAGE_GRAYSCALE: return ref_color_equal_16(c1, c2, tolerance);
+    default: return ref_color_equal_8(c1, c2, tolerance);
+  }
+}
+
+// Reference implementation (breadth-first search, or all similar
+// pixels if it's not contiguous)
+std::vector<int> reference_floodfill(const Image* image,
+                                     const Mask* mask,
+                                     const int x, const int y,
+                                     const gfx::Rect& bounds0,
+                                     const color_t srcColor,
+                                     const int tolerance,
+                                     const bool contiguous,
+                                     const bool isEightConnected)
+{
+  const int w = image->width();
+  const gfx::Rect bounds = bounds0.createIntersection(image->bounds());
+  std::vector<int> result(w*image->height(), 0);
+  if (!bounds.contains(x, y))
+    return result;
+
+  auto similar = [image, srcColor, tolerance](const gfx::Point& pt) {
+    return ref_color_equal(image, get_pixel(image, pt.x, pt.y),
+                           srcColor, tolerance);
+  };
+
+  if (!contiguous) {
+    for (int v=bounds.y; v<bounds.y2(); ++v)
+      for (int u=bounds.x; u<bounds.x2(); ++u)
+        result[v*w + u] = (similar(gfx::Point(u, v)) ? 1: 0);
+    return result;
+  }
+
+  auto inside = [&](const gfx::Point& pt) {
+    return (bounds.contains(pt) &&
+            similar(pt) &&
+            (!mask || mask->containsPoint(pt.x, pt.y)));
+  };
+  if (!inside(gfx::Point(x, y)))
+    return result;
+
+  std::deque<gfx::Point> queue;
+  queue.push_back(gfx::Point(x, y));
+  result[y*w + x] = 1;
+  while (!queue.empty()) {
+    const gfx::Point pt = queue.front();
+    queue.pop_front();
+    for (int v=-1; v<=1; ++v) {
+      for (int u=-1; u<=1; ++u) {
+        if ((u == 0 && v == 0) || (!isEightConnected && u != 0 && v != 0))
+          continue;
+        const gfx::Point pt2(pt.x+u, pt.y+v);
+        if (inside(pt2) && !result[pt2.y*w + pt2.x]) {
+          result[pt2.y*w + pt2.x] = 1;
+          queue.push_back(pt2);
+        }
+      }
+    }
+  }
+  return result;
+}
+
+// Compares the flood fill with the reference implementation in
+// random images with the given colors (random tolerances, bounds,
+// masks, and contiguous/non-contiguous modes).
+void compare_with_reference(const PixelFormat pixelFormat,
+                            const std::vector<color_t>& colors,
+                            const int maxTolerance)
+{
+  test::for_each_random_case(
+    500, 70, 40,
+    [&](const int i, const int w, const int h) {
+      ImageRef image(test::random_image(pixelFormat, w, h, colors,
+                                        test::random_int(100)));
+
+      gfx::Rect bounds = test::random_rect(image->bounds(), 3);
+      if (test::random_int(3) == 0)
+        bounds = image->bounds();
+
+      const int x = test::random_int(w);
+      const int y = test::random_int(h);
+      const bool isEightConnected = (test::random_int(2) == 1);
+      const bool contiguous = (test::random_int(4) != 0);
+
+      int tolerance = 0;
+      switch (test::random_int(3)) {
+        case 1: tolerance = 1+test::random_int(maxTolerance); break;
+        case 2: tolerance = maxTolerance; break;
+      }
+
+      color_t srcColor = get_pixel(image.get(), x, y);
+      if (test::random_int(4) == 0)
+        srcColor = colors[test::random_int(int(colors.size()))];
+
+      // The mask is used only in contiguous mode
+      std::unique_ptr<Mask> mask;
+      if (contiguous && test::random_int(3) == 0) {
+        mask.reset(new Mask);
+        mask->add(test::random_rect(image->bounds(), 2));
+        mask->add(test::random_rect(image->bounds(), 2));
+        mask->subtract(test::random_rect(image->bounds(), 2));
+        if (mask->isEmpty())
+          mask->add(image->bounds());
+      }
+
+      Filled filled;
+      filled.w = w;
+      filled.count.resize(w*h, 0);
+      algorithm::floodfill(image.get(), mask.get(), x, y, bounds,
+                           srcColor, tolerance,
+                           contiguous, isEightConnected,
+                           &filled, count_hline);
+
+      // Each pixel must be filled just one time
+      EXPECT_EQ(reference_floodfill(image.get(), mask.get(), x, y, bounds,
+                                    srcColor, tolerance,
+                                    contiguous, isEightConnected),
+                filled.count)
+        << "i=" << i << " w=" << w << " h=" << h
+        << " tolerance=" << tolerance
+        << " contiguous=" << contiguous
+        << " mask=" << (mask ? 1: 0);
+    });
+}
+
+} // anonymous namespace
+
+TEST(FloodFill, Simple)
+{
+  // 0 0 1 0
+  // 1 0 1 0
+  // 0 1 0 0
+  ImageRef image(Image::create(IMAGE_INDEXED, 4, 3));
+  clear_image(image.get(), 0);
+  put_pixel(image.get(), 2, 0, 1);
+  put_pixel(image.get(), 0, 1, 1);
+  put_pixel(image.get(), 2, 1, 1);
+  put_pixel(image.get(), 1, 2, 1);
+
+  Filled filled;
+  filled.w = 4;
+  filled.count.resize(12, 0);
+  algorithm::floodfill(image.get(), nullptr, 0, 0, image->bounds(),
+                       0, 0, true, false, &filled, count_hline);
+
+  const std::vector<int> expected = { 1, 1, 0, 0,
+                                      0, 1, 0, 0,
+                                      0, 0, 0, 0 };
+  EXPECT_EQ(expected, filled.count);
+
+  // With 8-connectivity we can go from (1,1) to (0,2) and (3,*)
+  std::fill(filled.count.begin(), filled.count.end(), 0);
+  algorithm::floodfill(image.get(), nullptr, 0, 0, image->bounds(),
+                       0, 0, true, true, &filled, count_hline);
+
+  const std::vector<int> expected8 = { 1, 1, 0, 1,
+                                       0, 1, 0, 1,
+                                       1, 0, 1, 1 };
+  EXPECT_EQ(expected8, filled.count);
+}
+
+TEST(FloodFill, IndexedCompareWithReference)
+{
+  compare_with_reference(IMAGE_INDEXED, { 0, 1, 2, 3 }, 2);
+}
+
+TEST(FloodFill, RgbCompareWithReference)
+{
+  // Similar colors and transparent pixels with different RGB values
+  compare_with_reference(IMAGE_RGB,
+                         { rgba(0, 0, 0, 255),
+                           rgba(10, 10, 10, 255),
+                           rgba(12, 8, 9, 250),
+                           rgba(255, 0, 0, 255),
+                           rgba(250, 5, 3, 240),
+                           rgba(10, 20, 30, 0),
+                           rgba(200, 0, 0, 0) },
+                         255);
+}
+
+TEST(FloodFill, GrayscaleCompareWithReference)
+{
+  compare_with_reference(IMAGE_GRAYSCALE,
+                         { graya(0, 255),
+                           graya(10, 255),
+                           graya(14, 250),
+                           graya(255, 128),
+                           graya(30, 0),
+                           graya(200, 0) },
+                         255);
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
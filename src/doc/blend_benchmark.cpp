@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2019  Igara Studio S.A.
 // Copyright (c) 2017 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -12,6 +13,8 @@
 
 #include <benchmark/benchmark.h>
 
+#include <vector>
+
 using namespace doc;
 
 static void CustomArguments(benchmark::internal::Benchmark* b) {
@@ -53,4 +56,38 @@ BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_saturation)->Apply(CustomArguments)
 BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_color)->Apply(CustomArguments);
 BENCHMARK_TEMPLATE(BM_Rgba, rgba_blender_hsl_luminosity)->Apply(CustomArguments);
 
+template<BlendMode M>
+void BM_RgbaRow(benchmark::State& state) {
+  const int n = 4096;
+  const bool simd = (state.range(0) != 0);
+  std::vector<color_t> src(n), dst(n);
+  for (int i=0; i<n; ++i) {
+    src[i] = rgba(i & 255, (i*3) & 255, (i*7) & 255, (i*11) & 255);
+    dst[i] = rgba((i*5) & 255, (i*13) & 255, i & 255, 255 - (i & 255));
+  }
+  BlendFunc func = get_rgba_blender(M, true);
+  BlendRowFunc rowFunc = get_rgba_row_blender(M, true);
+  if (simd && !rowFunc) {
+    state.SkipWithError("No SIMD version");
+    return;
+  }
+  while (state.KeepRunning()) {
+    if (simd)
+      rowFunc(&dst[0], &src[0], n, 200, 0);
+    else {
+      for (int i=0; i<n; ++i)
+        if (src[i] != 0)
+          dst[i] = func(dst[i], src[i], 200);
+    }
+    benchmark::DoNotOptimize(dst[0]);
+  }
+  state.SetItemsProcessed(int64_t(state.iterations()) * n);
+}
+
+BENCHMARK_TEMPLATE(BM_RgbaRow, BlendMode::NORMAL)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_RgbaRow, BlendMode::MULTIPLY)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_RgbaRow, BlendMode::SCREEN)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_RgbaRow, BlendMode::DARKEN)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(BM_RgbaRow, BlendMode::ADDITION)->Arg(0)->Arg(1);
+
 BENCHMARK_MAIN();
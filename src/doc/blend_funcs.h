@@ -68,6 +68,16 @@ namespace doc {
   BlendFunc get_graya_blender(BlendMode blendmode, const bool newBlend);
   BlendFunc get_indexed_blender(BlendMode blendmode, const bool newBlend);
 
+  // Blends "n" pixels of a row: dst[i] = blend(dst[i], src[i], opacity),
+  // skipping "src" pixels equal to "maskColor". The result is exactly
+  // the same as calling the BlendFunc for each pixel.
+  typedef void (*BlendRowFunc)(color_t* dst, const color_t* src, int n,
+                               int opacity, color_t maskColor);
+
+  // Returns a vectorized (SIMD) version of the RGBA blender for the
+  // given mode, or nullptr if the mode (or the CPU) is not supported.
+  BlendRowFunc get_rgba_row_blender(BlendMode blendmode, const bool newBlend);
+
 } // namespace doc
 
 #endif
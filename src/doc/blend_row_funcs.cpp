@@ -0,0 +1,301 @@
+// Aseprite Document Library
+// Copyright (c) 2019  Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+//
+// --
+//
+// SIMD versions of the RGBA blend functions (blend_funcs.cpp) to
+// blend whole rows of pixels. All these functions must return exactly
+// the same result as the scalar versions (see blend_row_funcs_tests.cpp).
+//
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/blend_funcs.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_BLEND_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+namespace doc {
+
+#ifdef DOC_BLEND_SSE2
+
+namespace {
+
+// Each __m128i contains one channel (0-255) of 4 pixels in 32-bit
+// lanes, so we have room for intermediate values of the scalar
+// formulas (which use "int" variables).
+struct Pixels {
+  __m128i r, g, b, a;
+};
+
+inline __m128i if_then_else(const __m128i mask, const __m128i a, const __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(mask, a),
+                      _mm_andnot_si128(mask, b));
+}
+
+inline Pixels unpack(const __m128i p)
+{
+  const __m128i ff = _mm_set1_epi32(0xff);
+  Pixels px;
+  px.r = _mm_and_si128(p, ff);
+  px.g = _mm_and_si128(_mm_srli_epi32(p, rgba_g_shift), ff);
+  px.b = _mm_and_si128(_mm_srli_epi32(p, rgba_b_shift), ff);
+  px.a = _mm_srli_epi32(p, rgba_a_shift);
+  return px;
+}
+
+// Each channel is truncated to 8 bits as the doc::rgba() function
+// does with its uint8_t arguments.
+inline __m128i pack(const __m128i r, const __m128i g, const __m128i b, const __m128i a)
+{
+  const __m128i ff = _mm_set1_epi32(0xff);
+  return _mm_or_si128(
+    _mm_or_si128(_mm_and_si128(r, ff),
+                 _mm_slli_epi32(_mm_and_si128(g, ff), rgba_g_shift)),
+    _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b, ff), rgba_b_shift),
+                 _mm_slli_epi32(_mm_and_si128(a, ff), rgba_a_shift)));
+}
+
+// Signed 32-bit product of "a" (in int16 range) and "b" (0-255). As
+// the high 16 bits of "b" lanes are zero, _mm_madd_epi16() gives us
+// the exact a*b product (SSE2 doesn't have _mm_mullo_epi32()).
+inline __m128i mul(const __m128i a, const __m128i b)
+{
+  return _mm_madd_epi16(a, b);
+}
+
+// Same as the MUL_UN8() macro from pixman (with signed "a" values).
+inline __m128i mul_un8(const __m128i a, const __m128i b)
+{
+  const __m128i t = _mm_add_epi32(mul(a, b), _mm_set1_epi32(0x80));
+  return _mm_srai_epi32(_mm_add_epi32(_mm_srai_epi32(t, 8), t), 8);
+}
+
+// Integer division (truncated toward zero). The numerator is in the
+// [-65025,65025] range and the denominator in [1,255], so the float
+// division is precise enough to give the exact integer result.
+inline __m128i div_trunc(const __m128i a, const __m128i b)
+{
+  return _mm_cvttps_epi32(_mm_div_ps(_mm_cvtepi32_ps(a),
+                                     _mm_cvtepi32_ps(b)));
+}
+
+// Per-channel blend operations used to modify the source color
+// before the normal blending (see rgba_blender_multiply(), etc.).
+
+struct NormalOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return s;
+  }
+};
+
+struct MultiplyOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return mul_un8(b, s);
+  }
+};
+
+struct ScreenOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return _mm_sub_epi32(_mm_add_epi32(b, s), mul_un8(b, s));
+  }
+};
+
+// Channels values are in the [0,255] range (the high 16 bits of each
+// lane are zero), so the 16-bit min/max instructions work as 32-bit ones.
+
+struct DarkenOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return _mm_min_epi16(b, s);
+  }
+};
+
+struct LightenOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return _mm_max_epi16(b, s);
+  }
+};
+
+struct DifferenceOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return _mm_sub_epi32(_mm_max_epi16(b, s),
+                         _mm_min_epi16(b, s));
+  }
+};
+
+struct ExclusionOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    const __m128i t = mul_un8(b, s);
+    return _mm_sub_epi32(_mm_add_epi32(b, s), _mm_add_epi32(t, t));
+  }
+};
+
+struct AdditionOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return _mm_min_epi16(_mm_add_epi32(b, s), _mm_set1_epi32(255));
+  }
+};
+
+struct SubtractOp {
+  static __m128i apply(const __m128i b, const __m128i s) {
+    return _mm_sub_epi32(b, _mm_min_epi16(b, s));
+  }
+};
+
+// rgba_blender_normal() for 4 pixels
+inline __m128i blend_normal(const __m128i backdrop, const Pixels& B,
+                            const __m128i src, const Pixels& S,
+                            const __m128i opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i Sa = mul_un8(S.a, opacity);
+
+  // Transparent backdrop
+  const __m128i transparentBackdrop =
+    _mm_or_si128(_mm_and_si128(src, _mm_set1_epi32(rgba_rgb_mask)),
+                 _mm_slli_epi32(Sa, rgba_a_shift));
+
+  // Ra = Sa + Ba - Ba*Sa
+  // Rc = Bc + (Sc-Bc)*Sa/Ra
+  const __m128i Ra = _mm_sub_epi32(_mm_add_epi32(Sa, B.a), mul_un8(B.a, Sa));
+  const __m128i Rr = _mm_add_epi32(B.r, div_trunc(mul(_mm_sub_epi32(S.r, B.r), Sa), Ra));
+  const __m128i Rg = _mm_add_epi32(B.g, div_trunc(mul(_mm_sub_epi32(S.g, B.g), Sa), Ra));
+  const __m128i Rb = _mm_add_epi32(B.b, div_trunc(mul(_mm_sub_epi32(S.b, B.b), Sa), Ra));
+
+  return if_then_else(_mm_cmpeq_epi32(B.a, zero),
+                      transparentBackdrop,
+                      if_then_else(_mm_cmpeq_epi32(S.a, zero),
+                                   backdrop,
+                                   pack(Rr, Rg, Rb, Ra)));
+}
+
+// rgba_blender_merge() for 4 pixels (with a different opacity for
+// each pixel)
+inline __m128i blend_merge(const __m128i backdrop,
+                           const __m128i src,
+                           const __m128i opacity)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const Pixels B = unpack(backdrop);
+  const Pixels S = unpack(src);
+
+  const __m128i Rr = _mm_add_epi32(B.r, mul_un8(_mm_sub_epi32(S.r, B.r), opacity));
+  const __m128i Rg = _mm_add_epi32(B.g, mul_un8(_mm_sub_epi32(S.g, B.g), opacity));
+  const __m128i Rb = _mm_add_epi32(B.b, mul_un8(_mm_sub_epi32(S.b, B.b), opacity));
+  const __m128i Ra = _mm_add_epi32(B.a, mul_un8(_mm_sub_epi32(S.a, B.a), opacity));
+
+  const __m128i rgbMask = _mm_set1_epi32(rgba_rgb_mask);
+  __m128i rgb =
+    if_then_else(_mm_cmpeq_epi32(B.a, zero),
+                 _mm_and_si128(src, rgbMask),
+                 if_then_else(_mm_cmpeq_epi32(S.a, zero),
+                              _mm_and_si128(backdrop, rgbMask),
+                              _mm_and_si128(pack(Rr, Rg, Rb, zero), rgbMask)));
+  rgb = _mm_andnot_si128(_mm_cmpeq_epi32(Ra, zero), rgb);
+
+  return _mm_or_si128(rgb, _mm_slli_epi32(_mm_and_si128(Ra, _mm_set1_epi32(0xff)),
+                                          rgba_a_shift));
+}
+
+// Blends 4 pixels with the given Op. With NewBlend=true it's the
+// equivalent of the RGBA_BLENDER_N() macro.
+template<typename Op, bool NewBlend>
+inline __m128i blend_op(const __m128i backdrop, const __m128i src, const __m128i opacity)
+{
+  const Pixels B = unpack(backdrop);
+  const Pixels S = unpack(src);
+  const __m128i blendSrc =
+    _mm_or_si128(pack(Op::apply(B.r, S.r),
+                      Op::apply(B.g, S.g),
+                      Op::apply(B.b, S.b),
+                      _mm_setzero_si128()),
+                 _mm_and_si128(src, _mm_set1_epi32(rgba_a_mask)));
+  const __m128i blend = blend_normal(backdrop, B, blendSrc, unpack(blendSrc), opacity);
+  if (!NewBlend)
+    return blend;
+
+  const __m128i normal = blend_normal(backdrop, B, src, S, opacity);
+  const __m128i normalToBlendMerge = blend_merge(normal, blend, B.a);
+  const __m128i srcTotalAlpha = mul_un8(S.a, opacity);
+  const __m128i compositeAlpha = mul_un8(B.a, srcTotalAlpha);
+
+  return if_then_else(_mm_cmpeq_epi32(B.a, _mm_setzero_si128()),
+                      normal,
+                      blend_merge(normalToBlendMerge, blend, compositeAlpha));
+}
+
+template<typename Op, bool NewBlend, BlendFunc F>
+void rgba_row_blender_sse2(color_t* dst, const color_t* src, int n,
+                           int opacity, color_t maskColor)
+{
+  const __m128i opacityv = _mm_set1_epi32(opacity);
+  const __m128i maskv = _mm_set1_epi32(maskColor);
+
+  for (; n >= 4; n -= 4, dst += 4, src += 4) {
+    const __m128i b = _mm_loadu_si128((const __m128i*)dst);
+    const __m128i s = _mm_loadu_si128((const __m128i*)src);
+    const __m128i r = blend_op<Op, NewBlend>(b, s, opacityv);
+    _mm_storeu_si128((__m128i*)dst,
+                     if_then_else(_mm_cmpeq_epi32(s, maskv), b, r));
+  }
+
+  // Remaining pixels
+  for (; n > 0; --n, ++dst, ++src) {
+    if (*src != maskColor)
+      *dst = F(*dst, *src, opacity);
+  }
+}
+
+} // anonymous namespace
+
+#define RGBA_ROW_BLENDER(op, func)                                      \
+  (newBlend ? rgba_row_blender_sse2<op, true, func##_n>:                \
+              rgba_row_blender_sse2<op, false, func>)
+
+// The "_n" functions are defined in blend_funcs.cpp
+color_t rgba_blender_multiply_n(color_t backdrop, color_t src, int opacity);
+color_t rgba_blender_screen_n(color_t backdrop, color_t src, int opacity);
+color_t rgba_blender_darken_n(color_t backdrop, color_t src, int opacity);
+color_t rgba_blender_lighten_n(color_t backdrop, color_t src, int opacity);
+color_t rgba_blender_difference_n(color_t backdrop, color_t src, int opacity);
+color_t rgba_blender_exclusion_n(color_t backdrop, color_t src, int opacity);
+color_t rgba_blender_addition_n(color_t backdrop, color_t src, int opacity);
+color_t rgba_blender_subtract_n(color_t backdrop, color_t src, int opacity);
+
+BlendRowFunc get_rgba_row_blender(BlendMode blendmode, const bool newBlend)
+{
+  switch (blendmode) {
+    case BlendMode::NORMAL:     return rgba_row_blender_sse2<NormalOp, false, rgba_blender_normal>;
+    case BlendMode::MULTIPLY:   return RGBA_ROW_BLENDER(MultiplyOp, rgba_blender_multiply);
+    case BlendMode::SCREEN:     return RGBA_ROW_BLENDER(ScreenOp, rgba_blender_screen);
+    case BlendMode::DARKEN:     return RGBA_ROW_BLENDER(DarkenOp, rgba_blender_darken);
+    case BlendMode::LIGHTEN:    return RGBA_ROW_BLENDER(LightenOp, rgba_blender_lighten);
+    case BlendMode::DIFFERENCE: return RGBA_ROW_BLENDER(DifferenceOp, rgba_blender_difference);
+    case BlendMode::EXCLUSION:  return RGBA_ROW_BLENDER(ExclusionOp, rgba_blender_exclusion);
+    case BlendMode::ADDITION:   return RGBA_ROW_BLENDER(AdditionOp, rgba_blender_addition);
+    case BlendMode::SUBTRACT:   return RGBA_ROW_BLENDER(SubtractOp, rgba_blender_subtract);
+    default:
+      // Other blend modes are not vectorized yet
+      return nullptr;
+  }
+}
+
+#else  // DOC_BLEND_SSE2
+
+BlendRowFunc get_rgba_row_blender(BlendMode blendmode, const bool newBlend)
+{
+  return nullptr;
+}
+
+#endif // DOC_BLEND_SSE2
+
+} // namespace doc
@@ -0,0 +1,112 @@
+// Aseprite Document Library
+// Copyright (c) 2019  Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/blend_funcs.h"
+
+#include <cstdlib>
+#include <vector>
+
+using namespace doc;
+
+namespace {
+
+color_t random_color()
+{
+  // Use a small set of alpha values to test the special cases
+  // (transparent/opaque backdrop and source pixels).
+  static const int alphas[] = { 0, 0, 1, 128, 254, 255, 255 };
+  return rgba(std::rand() % 256,
+              std::rand() % 256,
+              std::rand() % 256,
+              (std::rand() % 2) ? alphas[std::rand() % 7]: std::rand() % 256);
+}
+
+void test_row_blender(BlendMode mode, bool newBlend)
+{
+  BlendRowFunc rowFunc = get_rgba_row_blender(mode, newBlend);
+  if (!rowFunc)
+    return;
+
+  BlendFunc func = get_rgba_blender(mode, newBlend);
+  const int opacities[] = { 0, 1, 64, 128, 200, 255 };
+  const color_t maskColor = 0;
+
+  std::srand(1);
+  for (int opacity : opacities) {
+    // Use an odd size to test the non-vectorized remaining pixels too
+    const int n = 1023;
+    std::vector<color_t> src(n), dst(n), expected(n);
+    for (int i=0; i<n; ++i) {
+      src[i] = (i % 17 == 0 ? maskColor: random_color());
+      dst[i] = random_color();
+      expected[i] = (src[i] != maskColor ? func(dst[i], src[i], opacity): dst[i]);
+    }
+
+    rowFunc(&dst[0], &src[0], n, opacity, maskColor);
+
+    for (int i=0; i<n; ++i) {
+      ASSERT_EQ(expected[i], dst[i])
+        << "blend mode " << int(mode)
+        << " newBlend=" << newBlend
+        << " opacity=" << opacity
+        << " pixel " << i;
+    }
+  }
+}
+
+} // anonymous namespace
+
+TEST(BlendRowFuncs, SameResultAsScalarBlenders)
+{
+  const BlendMode modes[] = {
+    BlendMode::NORMAL,
+    BlendMode::MULTIPLY,
+    BlendMode::SCREEN,
+    BlendMode::DARKEN,
+    BlendMode::LIGHTEN,
+    BlendMode::DIFFERENCE,
+    BlendMode::EXCLUSION,
+    BlendMode::ADDITION,
+    BlendMode::SUBTRACT
+  };
+  for (BlendMode mode : modes) {
+    test_row_blender(mode, false);
+    test_row_blender(mode, true);
+  }
+}
+
+TEST(BlendRowFuncs, AllBackdropAlphas)
+{
+  BlendRowFunc rowFunc = get_rgba_row_blender(BlendMode::NORMAL, true);
+  if (!rowFunc)
+    return;
+
+  for (int opacity=0; opacity<256; opacity+=15) {
+    for (int Ba=0; Ba<256; ++Ba) {
+      std::vector<color_t> src(256), dst(256), expected(256);
+      for (int Sa=0; Sa<256; ++Sa) {
+        src[Sa] = rgba(200, 64, 32, Sa);
+        dst[Sa] = rgba(10, 128, 250, Ba);
+        expected[Sa] = (src[Sa] != 0 ? rgba_blender_normal(dst[Sa], src[Sa], opacity): dst[Sa]);
+      }
+      rowFunc(&dst[0], &src[0], 256, opacity, 0);
+      for (int Sa=0; Sa<256; ++Sa)
+        ASSERT_EQ(expected[Sa], dst[Sa]);
+    }
+  }
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
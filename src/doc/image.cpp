@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2019 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -23,6 +23,9 @@ namespace doc {
 Image::Image(const ImageSpec& spec)
   : Object(ObjectType::Image)
   , m_spec(spec)
+  , m_hash(0)
+  , m_hashVersion(0)
+  , m_hashValid(false)
 {
 }
 
@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2019 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -85,11 +85,29 @@ namespace doc {
     virtual void fillRect(int x1, int y1, int x2, int y2, color_t color) = 0;
     virtual void blendRect(int x1, int y1, int x2, int y2, color_t color, int opacity) = 0;
 
+    // Hash of all pixels cached by calculate_image_hash(), it's valid
+    // only for the version of the image when it was calculated.
+    bool getCachedHash(uint64_t& hash) const {
+      if (m_hashValid && m_hashVersion == version()) {
+        hash = m_hash;
+        return true;
+      }
+      return false;
+    }
+    void setCachedHash(uint64_t hash) const {
+      m_hash = hash;
+      m_hashVersion = version();
+      m_hashValid = true;
+    }
+
   protected:
     Image(const ImageSpec& spec);
 
   private:
     ImageSpec m_spec;
+    mutable uint64_t m_hash;
+    mutable ObjectVersion m_hashVersion;
+    mutable bool m_hashValid;
   };
 
 } // namespace doc
@@ -0,0 +1,278 @@
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/primitives.h"
+
+#include "doc/image.h"
+#include "doc/image_traits.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define DOC_HASH_SSE2 1
+  #include <emmintrin.h>
+#endif
+
+namespace doc {
+
+namespace {
+
+// Streaming implementation of the XXH64 algorithm. The input is
+// consumed in stripes of 32 bytes by 4 independent lanes, so the CPU
+// can process the lanes in parallel.
+class Hash64 {
+public:
+  explicit Hash64(const uint64_t seed = 0)
+    : m_size(0)
+    , m_bufSize(0) {
+    m_v[0] = seed + P1 + P2;
+    m_v[1] = seed + P2;
+    m_v[2] = seed;
+    m_v[3] = seed - P1;
+  }
+
+  void update(const void* data, size_t n) {
+    const uint8_t* p = (const uint8_t*)data;
+    m_size += n;
+
+    if (m_bufSize > 0) {
+      const size_t k = std::min(n, size_t(32) - m_bufSize);
+      std::memcpy(m_buf+m_bufSize, p, k);
+      m_bufSize += k;
+      p += k;
+      n -= k;
+      if (m_bufSize < 32)
+        return;
+      stripe(m_buf);
+      m_bufSize = 0;
+    }
+
+    for (; n >= 32; p += 32, n -= 32)
+      stripe(p);
+
+    if (n > 0) {
+      std::memcpy(m_buf, p, n);
+      m_bufSize = n;
+    }
+  }
+
+  uint64_t digest() const {
+    uint64_t h;
+    if (m_size >= 32) {
+      h = rotl(m_v[0], 1) + rotl(m_v[1], 7) + rotl(m_v[2], 12) + rotl(m_v[3], 18);
+      for (int i=0; i<4; ++i) {
+        h ^= round(0, m_v[i]);
+        h = h*P1 + P4;
+      }
+    }
+    else
+      h = m_v[2] + P5;      // m_v[2] == seed
+    h += m_size;
+
+    const uint8_t* p = m_buf;
+    size_t n = m_bufSize;
+    for (; n >= 8; p += 8, n -= 8) {
+      h ^= round(0, read64(p));
+      h = rotl(h, 27)*P1 + P4;
+    }
+    if (n >= 4) {
+      h ^= uint64_t(read32(p)) * P1;
+      h = rotl(h, 23)*P2 + P3;
+      p += 4;
+      n -= 4;
+    }
+    for (; n > 0; ++p, --n) {
+      h ^= (*p) * P5;
+      h = rotl(h, 11)*P1;
+    }
+
+    h ^= h >> 33;
+    h *= P2;
+    h ^= h >> 29;
+    h *= P3;
+    h ^= h >> 32;
+    return h;
+  }
+
+private:
+  static const uint64_t P1 = 11400714785074694791ULL;
+  static const uint64_t P2 = 14029467366897019727ULL;
+  static const uint64_t P3 = 1609587929392839161ULL;
+  static const uint64_t P4 = 9650029242287828579ULL;
+  static const uint64_t P5 = 2870177450012600261ULL;
+
+  static uint64_t rotl(const uint64_t x, const int r) {
+    return (x << r) | (x >> (64 - r));
+  }
+
+  static uint64_t round(uint64_t acc, const uint64_t input) {
+    acc += input * P2;
+    acc = rotl(acc, 31);
+    return acc * P1;
+  }
+
+  static uint64_t read64(const uint8_t* p) {
+    uint64_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  static uint32_t read32(const uint8_t* p) {
+    uint32_t v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+  }
+
+  void stripe(const uint8_t* p) {
+    m_v[0] = round(m_v[0], read64(p));
+    m_v[1] = round(m_v[1], read64(p+8));
+    m_v[2] = round(m_v[2], read64(p+16));
+    m_v[3] = round(m_v[3], read64(p+24));
+  }
+
+  uint64_t m_v[4];
+  uint64_t m_size;
+  uint8_t m_buf[32];
+  size_t m_bufSize;
+};
+
+// Copies a row of RGBA pixels replacing fully transparent pixels
+// with 0 (so they are hashed as equal, like RgbTraits::same_color()).
+void normalize_rgb_row(const uint32_t* src, uint32_t* dst, const int n)
+{
+  int x = 0;
+#if DOC_HASH_SSE2
+  const __m128i alphaMask = _mm_set1_epi32(int(rgba_a_mask));
+  const __m128i zero = _mm_setzero_si128();
+  for (; x+4 <= n; x += 4) {
+    const __m128i c = _mm_loadu_si128((const __m128i*)(src+x));
+    const __m128i transparent = _mm_cmpeq_epi32(_mm_and_si128(c, alphaMask), zero);
+    _mm_storeu_si128((__m128i*)(dst+x), _mm_andnot_si128(transparent, c));
+  }
+#endif
+  for (; x<n; ++x)
+    dst[x] = ((src[x] & rgba_a_mask) ? src[x]: 0);
+}
+
+void normalize_gray_row(const uint16_t* src, uint16_t* dst, const int n)
+{
+  for (int x=0; x<n; ++x)
+    dst[x] = ((src[x] & graya_a_mask) ? src[x]: 0);
+}
+
+void unpack_bitmap_row(const uint8_t* src, uint8_t* dst, const int x0, const int n)
+{
+  for (int x=0; x<n; ++x) {
+    const int i = x0+x;
+    dst[x] = ((src[i >> 3] & (1 << (i & 7))) ? 1: 0);
+  }
+}
+
+} // anonymous namespace
+
+uint64_t calculate_image_hash(const Image* img, const gfx::Rect& bounds0)
+{
+  const gfx::Rect bounds = bounds0.createIntersection(img->bounds());
+  const int w = bounds.w;
+  const int h = bounds.h;
+
+  Hash64 hash;
+  if (bounds.isEmpty())
+    return hash.digest();
+
+  switch (img->pixelFormat()) {
+
+    case IMAGE_RGB: {
+      std::vector<uint32_t> row(w);
+      for (int y=0; y<h; ++y) {
+        normalize_rgb_row(
+          (const uint32_t*)img->getPixelAddress(bounds.x, bounds.y+y),
+          &row[0], w);
+        hash.update(&row[0], w*sizeof(uint32_t));
+      }
+      break;
+    }
+
+    case IMAGE_GRAYSCALE: {
+      std::vector<uint16_t> row(w);
+      for (int y=0; y<h; ++y) {
+        normalize_gray_row(
+          (const uint16_t*)img->getPixelAddress(bounds.x, bounds.y+y),
+          &row[0], w);
+        hash.update(&row[0], w*sizeof(uint16_t));
+      }
+      break;
+    }
+
+    case IMAGE_INDEXED:
+      for (int y=0; y<h; ++y)
+        hash.update(img->getPixelAddress(bounds.x, bounds.y+y), w);
+      break;
+
+    case IMAGE_BITMAP: {
+      std::vector<uint8_t> row(w);
+      for (int y=0; y<h; ++y) {
+        unpack_bitmap_row(img->getPixelAddress(0, bounds.y+y),
+                          &row[0], bounds.x, w);
+        hash.update(&row[0], w);
+      }
+      break;
+    }
+  }
+
+  // Images of different sizes with the same pixels must have
+  // different hashes
+  const int32_t size[2] = { w, h };
+  hash.update(size, sizeof(size));
+  return hash.digest();
+}
+
+uint64_t calculate_image_raw_hash(const Image* img, const gfx::Rect& bounds0)
+{
+  const gfx::Rect bounds = bounds0.createIntersection(img->bounds());
+  const int w = bounds.w;
+  const int h = bounds.h;
+
+  Hash64 hash;
+  if (bounds.isEmpty())
+    return hash.digest();
+
+  if (img->pixelFormat() == IMAGE_BITMAP) {
+    std::vector<uint8_t> row(w);
+    for (int y=0; y<h; ++y) {
+      unpack_bitmap_row(img->getPixelAddress(0, bounds.y+y),
+                        &row[0], bounds.x, w);
+      hash.update(&row[0], w);
+    }
+  }
+  else {
+    const int rowBytes = img->getRowStrideSize(w);
+    for (int y=0; y<h; ++y)
+      hash.update(img->getPixelAddress(bounds.x, bounds.y+y), rowBytes);
+  }
+
+  const int32_t size[2] = { w, h };
+  hash.update(size, sizeof(size));
+  return hash.digest();
+}
+
+uint64_t calculate_image_hash(const Image* img)
+{
+  uint64_t hash;
+  if (!img->getCachedHash(hash)) {
+    hash = calculate_image_hash(img, img->bounds());
+    img->setCachedHash(hash);
+  }
+  return hash;
+}
+
+} // namespace doc
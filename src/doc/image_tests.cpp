@@ -1,5 +1,5 @@
 // Aseprite Document Library
-// Copyright (c) 2018 Igara Studio S.A.
+// Copyright (c) 2018-2019 Igara Studio S.A.
 // Copyright (c) 2001-2018 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -153,6 +153,81 @@ TEST(Image, DiffRgbImages)
   ASSERT_FALSE(is_same_image(a.get(), b.get()));
 }
 
+TEST(Image, HashRgbImages)
+{
+  std::unique_ptr<Image> a(Image::create(IMAGE_RGB, 33, 33));
+  std::unique_ptr<Image> b(Image::create(IMAGE_RGB, 33, 33));
+
+  clear_image(a.get(), rgba(0, 0, 0, 0));
+  clear_image(b.get(), rgba(0, 0, 0, 0));
+  EXPECT_EQ(calculate_image_hash(a.get()), calculate_image_hash(b.get()));
+
+  // Same hash because alpha=0 (like is_same_image())
+  put_pixel(a.get(), 0, 0, rgba(255, 0, 0, 0));
+  a->incrementVersion();
+  EXPECT_EQ(calculate_image_hash(a.get()), calculate_image_hash(b.get()));
+
+  // A change in any pixel changes the hash (the first pixels too)
+  put_pixel(a.get(), 0, 0, rgba(255, 0, 0, 255));
+  a->incrementVersion();
+  EXPECT_NE(calculate_image_hash(a.get()), calculate_image_hash(b.get()));
+
+  put_pixel(b.get(), 0, 0, rgba(255, 0, 0, 255));
+  put_pixel(b.get(), 32, 32, rgba(0, 0, 255, 128));
+  b->incrementVersion();
+  EXPECT_NE(calculate_image_hash(a.get()), calculate_image_hash(b.get()));
+  EXPECT_EQ(calculate_image_hash(a.get(), gfx::Rect(0, 0, 32, 32)),
+            calculate_image_hash(b.get(), gfx::Rect(0, 0, 32, 32)));
+
+  // The hash is cached until the image version changes
+  const uint64_t hash = calculate_image_hash(b.get());
+  put_pixel(b.get(), 32, 32, rgba(0, 0, 0, 0));
+  EXPECT_EQ(hash, calculate_image_hash(b.get()));
+  b->incrementVersion();
+  EXPECT_EQ(calculate_image_hash(a.get()), calculate_image_hash(b.get()));
+
+  // Same pixels with different sizes
+  std::unique_ptr<Image> c(Image::create(IMAGE_RGB, 32, 33));
+  std::unique_ptr<Image> d(Image::create(IMAGE_RGB, 33, 32));
+  clear_image(c.get(), rgba(0, 0, 0, 0));
+  clear_image(d.get(), rgba(0, 0, 0, 0));
+  EXPECT_NE(calculate_image_hash(c.get()), calculate_image_hash(d.get()));
+}
+
+TEST(Image, RawHashIncludesTransparentPixels)
+{
+  std::unique_ptr<Image> a(Image::create(IMAGE_RGB, 33, 33));
+  std::unique_ptr<Image> b(Image::create(IMAGE_RGB, 33, 33));
+  clear_image(a.get(), rgba(0, 0, 0, 0));
+  clear_image(b.get(), rgba(0, 0, 0, 0));
+  EXPECT_EQ(calculate_image_raw_hash(a.get(), a->bounds()),
+            calculate_image_raw_hash(b.get(), b->bounds()));
+
+  // Different raw hash when only the color of a transparent pixel
+  // changes (but the same normalized hash)
+  put_pixel(a.get(), 32, 32, rgba(255, 0, 0, 0));
+  EXPECT_NE(calculate_image_raw_hash(a.get(), a->bounds()),
+            calculate_image_raw_hash(b.get(), b->bounds()));
+  EXPECT_EQ(calculate_image_hash(a.get(), a->bounds()),
+            calculate_image_hash(b.get(), b->bounds()));
+  EXPECT_EQ(calculate_image_raw_hash(a.get(), gfx::Rect(0, 0, 32, 32)),
+            calculate_image_raw_hash(b.get(), gfx::Rect(0, 0, 32, 32)));
+}
+
+TEST(Image, HashBitmapImages)
+{
+  std::unique_ptr<Image> a(Image::create(IMAGE_BITMAP, 20, 4));
+  clear_image(a.get(), 0);
+  put_pixel(a.get(), 3, 1, 1);
+  put_pixel(a.get(), 13, 1, 1);
+
+  // Same pixels in bounds that don't start in a byte boundary
+  EXPECT_EQ(calculate_image_hash(a.get(), gfx::Rect(0, 0, 8, 4)),
+            calculate_image_hash(a.get(), gfx::Rect(10, 0, 8, 4)));
+  EXPECT_NE(calculate_image_hash(a.get(), gfx::Rect(0, 0, 8, 4)),
+            calculate_image_hash(a.get(), gfx::Rect(11, 0, 8, 4)));
+}
+
 TYPED_TEST(ImageAllTypes, DrawHLine)
 {
   typedef TypeParam ImageTraits;
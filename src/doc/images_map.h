@@ -17,9 +17,11 @@
 namespace doc {
   namespace details {
 
+    // Uses the hash cached in the image, so the image must not be
+    // modified while it's a key of the map.
     struct image_hash {
       size_t operator()(const ImageRef& i) const {
-        return calculate_image_hash(i.get(), i->bounds());
+        return size_t(calculate_image_hash(i.get()));
       }
     };
 
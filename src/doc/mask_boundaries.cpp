@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -10,330 +11,228 @@
 
 #include "doc/mask_boundaries.h"
 
-#include "doc/image_impl.h"
+#include "doc/image.h"
+#include "doc/primitives.h"
+
+#include <algorithm>
+#include <cstring>
 
 namespace doc {
 
-MaskBoundaries::MaskBoundaries(const Image* bitmap)
-{
-  int x, y, w = bitmap->width(), h = bitmap->height();
+namespace {
 
-  const LockImageBits<BitmapTraits> bits(bitmap);
-  auto it = bits.begin();       // Current pixel iterator
-#if _DEBUG
-  auto prevIt = bits.begin();   // Previous row iterator (same X pos)
-#endif
+// Number of rows of each band of segments
+const int kBandHeight = 64;
 
-  // Vertical segments being expanded from the previous row.
-  std::vector<int> vertSegs(w+1, -1);
+inline const uint8_t* bitmap_row(const Image* bitmap, int y)
+{
+  return bitmap->getPixelAddress(0, y);
+}
 
-  // Horizontal segment being expanded from the previous column.
-  int horzSeg;
+inline bool bitmap_pixel(const uint8_t* row, int x)
+{
+  return (row[x >> 3] & (1 << (x & 7))) ? true: false;
+}
 
-#define new_hseg(open) {                                        \
-    m_segs.push_back(Segment(open, gfx::Rect(x, y, 1, 0)));     \
-    horzSeg = int(m_segs.size()-1);                             \
-  }
-#define new_vseg(open) {                                        \
-    m_segs.push_back(Segment(open, gfx::Rect(x, y, 0, 1)));     \
-    vertSegs[x] = int(m_segs.size()-1);                         \
-  }
-#define expand_hseg() { \
-    ASSERT(hseg);       \
-    ++hseg->m_bounds.w; \
+// Returns true if the pixels of the given rows are equal (ignoring
+// the padding bits at the end of the row)
+bool same_bitmap_row(const uint8_t* a, const uint8_t* b, int w)
+{
+  const int fullBytes = (w >> 3);
+  if (std::memcmp(a, b, fullBytes) != 0)
+    return false;
+
+  if (w & 7) {
+    const uint8_t lastMask = uint8_t((1 << (w & 7)) - 1);
+    if ((a[fullBytes] & lastMask) != (b[fullBytes] & lastMask))
+      return false;
   }
-#define expand_vseg() { \
-    ASSERT(vseg);       \
-    ++vseg->m_bounds.h; \
+  return true;
+}
+
+} // anonymous namespace
+
+MaskBoundaries::MaskBoundaries(const Image* bitmap,
+                               const gfx::Point& origin)
+{
+  regenerate(bitmap, origin);
+}
+
+MaskBoundaries::Range MaskBoundaries::segmentsIn(const gfx::Rect& bounds) const
+{
+  const int nbands = int(m_bandStart.size())-1;
+  if (nbands <= 0 || bounds.isEmpty())
+    return Range(m_segs.end(), m_segs.end());
+
+  // Horizontal segments in the row "bounds.y" are drawn in the
+  // previous row of pixels, so we include one extra row.
+  const int b1 = std::max(0, (bounds.y - m_origin.y - 1) / kBandHeight);
+  const int b2 = std::min(nbands-1, (bounds.y2() - m_origin.y) / kBandHeight);
+  if (bounds.y2() < m_origin.y || b1 > b2)
+    return Range(m_segs.end(), m_segs.end());
+
+  return Range(m_segs.begin() + m_bandStart[b1],
+               m_segs.begin() + m_bandStart[b2+1]);
+}
+
+void MaskBoundaries::regenerate(const Image* bitmap,
+                                const gfx::Point& origin)
+{
+  ASSERT(bitmap->pixelFormat() == IMAGE_BITMAP);
+
+  const int w = bitmap->width();
+  const int h = bitmap->height();
+  const int nbands = h / kBandHeight + 1;
+
+  // Regenerate everything
+  if (!m_bitmap ||
+      m_origin != origin ||
+      m_bitmap->width() != w ||
+      m_bitmap->height() != h) {
+    m_origin = origin;
+    m_segs.clear();
+    m_bandStart.resize(nbands+1);
+    for (int band=0; band<nbands; ++band) {
+      m_bandStart[band] = int(m_segs.size());
+      generateBand(bitmap, band, m_segs);
+    }
+    m_bandStart[nbands] = int(m_segs.size());
+    m_bitmap.reset(Image::createCopy(bitmap));
+    return;
   }
-#define stop_expanding_hseg() {                 \
-    horzSeg = -1;                               \
+
+  // Find the bands affected by modified rows. A modified row "y"
+  // changes the horizontal edges in the rows "y" and "y+1", and the
+  // vertical edges of the row "y".
+  std::vector<bool> dirty(nbands, false);
+  bool anyDirty = false;
+  for (int y=0; y<h; ++y) {
+    if (!same_bitmap_row(bitmap_row(bitmap, y),
+                         bitmap_row(m_bitmap.get(), y), w)) {
+      dirty[y / kBandHeight] = true;
+      dirty[(y+1) / kBandHeight] = true;
+      anyDirty = true;
+    }
   }
-#define stop_expanding_vseg() {                 \
-    vertSegs[x] = -1;                           \
+  if (!anyDirty)
+    return;
+
+  list_type segs;
+  segs.reserve(m_segs.size());
+  std::vector<int> bandStart(nbands+1);
+  for (int band=0; band<nbands; ++band) {
+    bandStart[band] = int(segs.size());
+    if (dirty[band])
+      generateBand(bitmap, band, segs);
+    else
+      segs.insert(segs.end(),
+                  m_segs.begin() + m_bandStart[band],
+                  m_segs.begin() + m_bandStart[band+1]);
   }
+  bandStart[nbands] = int(segs.size());
 
-  for (y=0; y<=h; ++y) {
-    bool prevColor = false;         // Previous color (X-1) same Y row
-    horzSeg = -1;
+  m_segs.swap(segs);
+  m_bandStart.swap(bandStart);
+  copy_image(m_bitmap.get(), bitmap);
+}
 
-    for (x=0; x<=w; ++x) {
-      bool color = (x < w && y < h && *it ? true: false);
-#if _DEBUG
-      bool prevRowColor = (x < w && y > 0 && *prevIt ? true: false);
-#endif
-      Segment* hseg = (horzSeg >= 0 ? &m_segs[horzSeg]: nullptr);
-      Segment* vseg = (vertSegs[x] >= 0 ? &m_segs[vertSegs[x]]: nullptr);
-
-      //
-      // -   -
-      //
-      // -   1
-      //
-      if (color) {
-        //
-        // - | -
-        //   o
-        // -   1
-        //
-        if (vseg) {
-          //
-          // 0 | 1
-          //   o
-          // -   1
-          //
-          if (vseg->open()) {
-            ASSERT(prevRowColor);
-
-            //
-            // 0 | 1
-            // --x
-            // 1   1
-            //
-            if (hseg) {
-              ASSERT(hseg->open());
-              ASSERT(prevColor);
-              stop_expanding_hseg();
-              stop_expanding_vseg();
-            }
-            //
-            // 0 | 1
-            //   |
-            // 0 | 1
-            //   o
-            else {
-              ASSERT(!prevColor);
-              expand_vseg();
-            }
-          }
-          //
-          // 1 | 0
-          //   x--o
-          // -   1
-          //
-          else {
-            ASSERT(!prevRowColor);
-
-            //
-            // 1 | 0
-            // --x--o
-            // 0 | 1
-            //   o
-            if (hseg) {
-              ASSERT(!prevColor);
-              ASSERT(!hseg->open());
-              new_hseg(true);
-              new_vseg(true);
-            }
-            //
-            // 1 | 0
-            //   x--o
-            // 1   1
-            //
-            else {
-              ASSERT(prevColor);
-              new_hseg(true);
-              stop_expanding_vseg();
-            }
-          }
-        }
-        //
-        // -   -  (there is no vertical segment in this row, both colors are equal)
-        //
-        // -   1
-        //
-        else {
-          //
-          // -   -
-          // --o
-          // -   1
-          //
-          if (hseg) {
-            //
-            // 0   0
-            // -----o
-            // 1   1
-            //
-            if (hseg->open()) {
-              ASSERT(prevColor);
-              expand_hseg();
-            }
-            //
-            // 1   1
-            // --x
-            // 0 | 1
-            //   o
-            else {
-              ASSERT(!prevColor);
-              stop_expanding_hseg();
-              new_vseg(true);
-            }
-          }
-          else {
-            //
-            // 1   1
-            //
-            // 1   1
-            //
-            if (prevColor) {
-              // Do nothing, we are inside boundaries
-            }
-            //
-            // 0   0
-            //    --o
-            // 0 | 1
-            //   o
-            else {
-              // First two segments of a corner
-              new_hseg(true);
-              new_vseg(true);
-            }
-          }
+void MaskBoundaries::offset(int x, int y)
+{
+  for (Segment& seg : m_segs)
+    seg.offset(x, y);
+
+  m_origin.x += x;
+  m_origin.y += y;
+}
+
+// Generates the segments of the given band: horizontal edges of the
+// rows [y1, y2) and vertical edges of the pixels in the same rows
+// (the last band includes the bottom edge of the bitmap). An edge
+// is "open" if the pixel at the right/bottom of it is set.
+void MaskBoundaries::generateBand(const Image* bitmap, const int band,
+                                  list_type& segs) const
+{
+  const int w = bitmap->width();
+  const int h = bitmap->height();
+  const int fullBytes = (w >> 3);
+  const int y1 = band * kBandHeight;
+  const int y2 = std::min(y1 + kBandHeight, h+1);
+
+  // Horizontal edges between the rows "y-1" and "y"
+  for (int y=y1; y<y2; ++y) {
+    const uint8_t* above = (y > 0 ? bitmap_row(bitmap, y-1): nullptr);
+    const uint8_t* below = (y < h ? bitmap_row(bitmap, y): nullptr);
+    int hseg = -1;
+
+    for (int x=0; x<w; ) {
+      // Skip 8 pixels without edges
+      if ((x & 7) == 0 && (x >> 3) < fullBytes) {
+        const uint8_t a = (above ? above[x >> 3]: 0);
+        const uint8_t b = (below ? below[x >> 3]: 0);
+        if (a == b) {
+          hseg = -1;
+          x += 8;
+          continue;
         }
       }
-      //
-      // -   -
-      //
-      // -   0
-      //
-      else {
-        //
-        // - | -
-        //   o
-        // -   0
-        //
-        if (vseg) {
-          //
-          // 0 | 1
-          //   o
-          // -   0
-          //
-          if (vseg->open()) {
-            ASSERT(prevRowColor);
-
-            //
-            // 0 | 1
-            // --x--o
-            // 1 | 0
-            //   o
-            if (hseg) {
-              ASSERT(hseg->open());
-              ASSERT(prevColor);
-              new_hseg(false);
-              new_vseg(false);
-            }
-            //
-            // 0 | 1
-            //   x--o
-            // 0   0
-            //
-            else {
-              ASSERT(!prevColor);
-              new_hseg(false);
-              stop_expanding_vseg();
-            }
-          }
-          //
-          // 1 | 0
-          //   o
-          // -   0
-          //
-          else {
-            ASSERT(!prevRowColor);
-
-            //
-            // 1 | 0
-            // --x
-            // 0   0
-            //
-            if (hseg) {
-              ASSERT(!prevColor);
-              stop_expanding_hseg();
-              stop_expanding_vseg();
-            }
-            //
-            // 1 | 0
-            //   |
-            // 1 | 0
-            //   o
-            else {
-              ASSERT(prevColor);
-              expand_vseg();
-            }
-          }
-        }
-        //
-        // -   -  (there is no vertical segment in this row, both colors are equal)
-        //
-        // -   0
-        //
+
+      const bool a = (above && bitmap_pixel(above, x));
+      const bool b = (below && bitmap_pixel(below, x));
+      if (a != b) {
+        if (hseg >= 0 && segs[hseg].m_open == b)
+          ++segs[hseg].m_bounds.w;
         else {
-          //
-          // -   -
-          // --o
-          // -   0
-          //
-          if (hseg) {
-            //
-            // 0   0
-            // --x
-            // 1 | 0
-            //   o
-            if (hseg->open()) {
-              ASSERT(prevColor);
-              stop_expanding_hseg();
-              new_vseg(false);
-            }
-            //
-            // 1   1
-            // -----o
-            // 0   0
-            //
-            else {
-              ASSERT(!prevColor);
-              expand_hseg();
-            }
-          }
-          else {
-            //
-            // 1   1
-            //    --o
-            // 1 | 0
-            //   o
-            if (prevColor) {
-              new_hseg(false);
-              new_vseg(false);
-            }
-            //
-            // 0   0
-            //
-            // 0   0
-            //
-            else {
-              // Do nothing, we are inside boundaries
-            }
-          }
+          segs.push_back(Segment(b, gfx::Rect(m_origin.x+x, m_origin.y+y, 1, 0)));
+          hseg = int(segs.size()-1);
         }
       }
-
-      prevColor = color;
-      if (x < w) {
-#if _DEBUG
-        if (y > 0) ++prevIt;
-#endif
-        if (y < h) ++it;
-      }
+      else
+        hseg = -1;
+      ++x;
     }
   }
 
-  ASSERT(it == bits.end());
-  ASSERT(prevIt == bits.end());
-}
+  // Vertical edges between the pixels "x-1" and "x" (segments are
+  // expanded from the previous row)
+  std::vector<int> vertSegs(w+1, -1);
+  auto addVertEdge =
+    [&segs, &vertSegs, this](const int x, const int y, const bool open) {
+      const int i = vertSegs[x];
+      if (i >= 0 &&
+          segs[i].m_open == open &&
+          segs[i].m_bounds.y2() == m_origin.y+y) {
+        ++segs[i].m_bounds.h;
+      }
+      else {
+        segs.push_back(Segment(open, gfx::Rect(m_origin.x+x, m_origin.y+y, 0, 1)));
+        vertSegs[x] = int(segs.size()-1);
+      }
+    };
+
+  for (int y=y1; y<std::min(y2, h); ++y) {
+    const uint8_t* row = bitmap_row(bitmap, y);
+    bool prev = false;
+
+    for (int x=0; x<=w; ) {
+      // 8 pixels with the same color, only the left edge can be
+      // different
+      if ((x & 7) == 0 && (x >> 3) < fullBytes &&
+          (row[x >> 3] == 0 || row[x >> 3] == 0xff)) {
+        const bool color = (row[x >> 3] != 0);
+        if (color != prev)
+          addVertEdge(x, y, color);
+        prev = color;
+        x += 8;
+        continue;
+      }
 
-void MaskBoundaries::offset(int x, int y)
-{
-  for (Segment& seg : m_segs)
-    seg.offset(x, y);
+      const bool color = (x < w && bitmap_pixel(row, x));
+      if (color != prev)
+        addVertEdge(x, y, color);
+      prev = color;
+      ++x;
+    }
+  }
 }
 
 } // namespace doc
@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -8,6 +9,8 @@
 #define DOC_MASK_BOUNDARIES_H_INCLUDED
 #pragma once
 
+#include "doc/image_ref.h"
+#include "gfx/point.h"
 #include "gfx/rect.h"
 
 #include <vector>
@@ -15,6 +18,13 @@
 namespace doc {
   class Image;
 
+  // Segments of the edges of a bitmap (e.g. to draw the marching
+  // ants of the selection).
+  //
+  // Segments are grouped in bands of rows (no segment crosses two
+  // bands), so regenerate() can recalculate only the bands of
+  // modified rows, and segmentsIn() can return only the segments of
+  // the visible rows.
   class MaskBoundaries {
   public:
     class Segment {
@@ -41,17 +51,44 @@ namespace doc {
     typedef list_type::iterator iterator;
     typedef list_type::const_iterator const_iterator;
 
-    MaskBoundaries(const Image* bitmap);
+    class Range {
+    public:
+      Range(const_iterator begin, const_iterator end)
+        : m_begin(begin), m_end(end) { }
+      const_iterator begin() const { return m_begin; }
+      const_iterator end() const { return m_end; }
+    private:
+      const_iterator m_begin, m_end;
+    };
+
+    MaskBoundaries(const Image* bitmap,
+                   const gfx::Point& origin = gfx::Point(0, 0));
 
     const_iterator begin() const { return m_segs.begin(); }
     const_iterator end() const { return m_segs.end(); }
     iterator begin() { return m_segs.begin(); }
     iterator end() { return m_segs.end(); }
 
+    // Returns the segments in the rows of the given bounds (it can
+    // include segments outside the bounds, but all segments that
+    // intersect the bounds are included).
+    Range segmentsIn(const gfx::Rect& bounds) const;
+
+    // Regenerates the segments for a new version of the bitmap. If
+    // the bitmap has the same size and origin, only the bands of the
+    // modified rows are regenerated.
+    void regenerate(const Image* bitmap,
+                    const gfx::Point& origin = gfx::Point(0, 0));
+
     void offset(int x, int y);
 
   private:
+    void generateBand(const Image* bitmap, const int band, list_type& segs) const;
+
     list_type m_segs;
+    std::vector<int> m_bandStart;  // Index of the first segment of each band
+    ImageRef m_bitmap;             // Copy of the bitmap to detect modified rows
+    gfx::Point m_origin;
   };
 
 } // namespace doc
@@ -0,0 +1,189 @@
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/mask_boundaries.h"
+#include "doc/primitives.h"
+#include "doc/random_test_utils.h"
+
+#include <set>
+#include <tuple>
+
+using namespace doc;
+
+namespace {
+
+// Each edge of one pixel (vertical, x, y, open), so segments can be
+// compared independently of how they are split in bands.
+typedef std::set<std::tuple<bool, int, int, bool>> Edges;
+
+Edges get_edges(MaskBoundaries::Range range)
+{
+  Edges edges;
+  for (const auto& seg : range) {
+    const gfx::Rect& b = seg.bounds();
+    if (seg.vertical()) {
+      for (int y=b.y; y<b.y2(); ++y)
+        EXPECT_TRUE(edges.insert(std::make_tuple(true, b.x, y, seg.open())).second);
+    }
+    else {
+      for (int x=b.x; x<b.x2(); ++x)
+        EXPECT_TRUE(edges.insert(std::make_tuple(false, x, b.y, seg.open())).second);
+    }
+  }
+  return edges;
+}
+
+Edges get_edges(const MaskBoundaries& mb)
+{
+  return get_edges(MaskBoundaries::Range(mb.begin(), mb.end()));
+}
+
+// Reference: checks the neighbors of each pixel
+Edges get_reference_edges(const Image* bitmap, const gfx::Point& origin)
+{
+  const int w = bitmap->width();
+  const int h = bitmap->height();
+  auto pixel =
+    [bitmap, w, h](const int x, const int y) -> bool {
+      return (x >= 0 && y >= 0 && x < w && y < h &&
+              get_pixel(bitmap, x, y) != 0);
+    };
+
+  Edges edges;
+  for (int y=0; y<=h; ++y) {
+    for (int x=0; x<=w; ++x) {
+      const bool c = pixel(x, y);
+      if (x < w && pixel(x, y-1) != c)
+        edges.insert(std::make_tuple(false, origin.x+x, origin.y+y, c));
+      if (y < h && pixel(x-1, y) != c)
+        edges.insert(std::make_tuple(true, origin.x+x, origin.y+y, c));
+    }
+  }
+  return edges;
+}
+
+void toggle_pixel(Image* bitmap, int x, int y)
+{
+  put_pixel(bitmap, x, y, get_pixel(bitmap, x, y) ? 0: 1);
+}
+
+} // anonymous namespace
+
+TEST(MaskBoundaries, OnePixel)
+{
+  ImageRef bitmap(Image::create(IMAGE_BITMAP, 3, 3));
+  clear_image(bitmap.get(), 0);
+  put_pixel(bitmap.get(), 1, 1, 1);
+
+  MaskBoundaries mb(bitmap.get(), gfx::Point(10, 20));
+  Edges expected;
+  expected.insert(std::make_tuple(false, 11, 21, true));
+  expected.insert(std::make_tuple(false, 11, 22, false));
+  expected.insert(std::make_tuple(true, 11, 21, true));
+  expected.insert(std::make_tuple(true, 12, 21, false));
+  EXPECT_EQ(expected, get_edges(mb));
+}
+
+TEST(MaskBoundaries, CompareWithReference)
+{
+  test::for_each_random_case(
+    50, 150, 300,
+    [](const int i, const int w, const int h) {
+      const gfx::Point origin(test::random_int(20) - 10,
+                              test::random_int(20) - 10);
+      ImageRef bitmap(test::random_image(IMAGE_BITMAP, w, h, { 0, 1 },
+                                         test::random_int(100)));
+
+      const MaskBoundaries mb(bitmap.get(), origin);
+      ASSERT_EQ(get_reference_edges(bitmap.get(), origin), get_edges(mb))
+        << "w=" << w << " h=" << h << " i=" << i;
+    });
+}
+
+TEST(MaskBoundaries, SegmentsIn)
+{
+  test::for_each_random_case(
+    50, 150, 300,
+    [](const int i, const int w, const int h) {
+      const gfx::Point origin(test::random_int(20) - 10,
+                              test::random_int(20) - 10);
+      ImageRef bitmap(test::random_image(IMAGE_BITMAP, w, h, { 0, 1 },
+                                         test::random_int(100)));
+      const MaskBoundaries mb(bitmap.get(), origin);
+      const Edges all = get_edges(mb);
+
+      for (int j=0; j<10; ++j) {
+        const gfx::Rect bounds =
+          test::random_rect(gfx::Rect(origin.x, origin.y, w, h), 70);
+        const Edges edges = get_edges(mb.segmentsIn(bounds));
+
+        // All edges that intersect the rows of the bounds must be
+        // included (horizontal edges in the bottom side too)
+        for (const auto& edge : all) {
+          const bool vertical = std::get<0>(edge);
+          const int y = std::get<2>(edge);
+          if (bounds.isEmpty() ||
+              y < bounds.y ||
+              y > bounds.y2() ||
+              (vertical && y == bounds.y2()))
+            continue;
+          ASSERT_TRUE(edges.find(edge) != edges.end())
+            << "w=" << w << " h=" << h << " i=" << i << " j=" << j
+            << " bounds=" << bounds.x << "," << bounds.y << ","
+            << bounds.w << "," << bounds.h;
+        }
+      }
+    });
+}
+
+TEST(MaskBoundaries, RegenerateSameAsFullRebuild)
+{
+  test::for_each_random_case(
+    50, 150, 300,
+    [](const int i, const int w, const int h) {
+      const gfx::Point origin(test::random_int(20) - 10,
+                              test::random_int(20) - 10);
+      ImageRef bitmap(test::random_image(IMAGE_BITMAP, w, h, { 0, 1 },
+                                         test::random_int(100)));
+
+      MaskBoundaries mb(bitmap.get(), origin);
+
+      for (int j=0; j<10; ++j) {
+        // Toggle some random pixels
+        const int n = test::random_int(8);
+        for (int k=0; k<n; ++k)
+          toggle_pixel(bitmap.get(), test::random_int(w), test::random_int(h));
+
+        // Toggle a random rectangle
+        if (test::random_int(2)) {
+          const gfx::Rect rc(test::random_int(w), test::random_int(h),
+                             1 + test::random_int(20), 1 + test::random_int(100));
+          for (int y=rc.y; y<rc.y2() && y<h; ++y)
+            for (int x=rc.x; x<rc.x2() && x<w; ++x)
+              toggle_pixel(bitmap.get(), x, y);
+        }
+
+        mb.regenerate(bitmap.get(), origin);
+
+        ASSERT_EQ(get_reference_edges(bitmap.get(), origin), get_edges(mb))
+          << "w=" << w << " h=" << h << " i=" << i << " j=" << j;
+      }
+    });
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,124 @@
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "doc/palette_kdtree.h"
+
+#include "doc/palette.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace doc {
+
+namespace {
+
+// Same weights used in Palette::findBestfit() for R, G, B, and A
+const int kWeights[4] = { 30*30, 59*59, 11*11, 8*8 };
+
+} // anonymous namespace
+
+void PaletteKdTree::build(const Palette* palette, int maskIndex, int shift)
+{
+  m_nodes.clear();
+
+  const int size = std::min(256, palette->size());
+  m_nodes.reserve(size);
+  for (int i=0; i<size; ++i) {
+    if (i == maskIndex)
+      continue;
+
+    const color_t c = palette->getEntry(i);
+    Node node;
+    node.c[0] = int(rgba_getr(c)) >> shift;
+    node.c[1] = int(rgba_getg(c)) >> shift;
+    node.c[2] = int(rgba_getb(c)) >> shift;
+    node.c[3] = int(rgba_geta(c)) >> shift;
+    node.index = i;
+    node.axis = 0;
+    m_nodes.push_back(node);
+  }
+
+  buildRange(0, int(m_nodes.size()));
+}
+
+int PaletteKdTree::nearest(int r, int g, int b, int a) const
+{
+  const int q[4] = { r, g, b, a };
+  int bestIndex = 0;
+  int bestDist = std::numeric_limits<int>::max();
+  nearestInRange(q, 0, int(m_nodes.size()), bestIndex, bestDist);
+  return bestIndex;
+}
+
+// The node in the middle of the [lo,hi) range splits the range in
+// two halves along the axis with the greatest (weighted) spread.
+void PaletteKdTree::buildRange(int lo, int hi)
+{
+  if (hi - lo < 2)
+    return;
+
+  int axis = 0;
+  int maxSpread = -1;
+  for (int k=0; k<4; ++k) {
+    auto minmax = std::minmax_element(
+      m_nodes.begin()+lo, m_nodes.begin()+hi,
+      [k](const Node& a, const Node& b){ return a.c[k] < b.c[k]; });
+    const int d = minmax.second->c[k] - minmax.first->c[k];
+    const int spread = d*d*kWeights[k];
+    if (spread > maxSpread) {
+      maxSpread = spread;
+      axis = k;
+    }
+  }
+
+  const int mid = (lo + hi) / 2;
+  std::nth_element(
+    m_nodes.begin()+lo, m_nodes.begin()+mid, m_nodes.begin()+hi,
+    [axis](const Node& a, const Node& b){ return a.c[axis] < b.c[axis]; });
+  m_nodes[mid].axis = axis;
+
+  buildRange(lo, mid);
+  buildRange(mid+1, hi);
+}
+
+void PaletteKdTree::nearestInRange(const int q[4], int lo, int hi,
+                                   int& bestIndex, int& bestDist) const
+{
+  if (lo >= hi)
+    return;
+
+  const int mid = (lo + hi) / 2;
+  const Node& node = m_nodes[mid];
+
+  int dist = 0;
+  for (int k=0; k<4; ++k) {
+    const int d = q[k] - node.c[k];
+    dist += d*d*kWeights[k];
+  }
+  if (dist < bestDist ||
+      (dist == bestDist && node.index < bestIndex)) {
+    bestDist = dist;
+    bestIndex = node.index;
+  }
+
+  const int d = q[node.axis] - node.c[node.axis];
+  if (d < 0) {
+    nearestInRange(q, lo, mid, bestIndex, bestDist);
+    if (d*d*kWeights[node.axis] <= bestDist)
+      nearestInRange(q, mid+1, hi, bestIndex, bestDist);
+  }
+  else {
+    nearestInRange(q, mid+1, hi, bestIndex, bestDist);
+    if (d*d*kWeights[node.axis] <= bestDist)
+      nearestInRange(q, lo, mid, bestIndex, bestDist);
+  }
+}
+
+} // namespace doc
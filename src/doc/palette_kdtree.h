@@ -0,0 +1,53 @@
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_PALETTE_KDTREE_H_INCLUDED
+#define DOC_PALETTE_KDTREE_H_INCLUDED
+#pragma once
+
+#include <vector>
+
+namespace doc {
+
+  class Palette;
+
+  // K-d tree of the entries of a palette to find the nearest entry
+  // of a RGBA color, using the same weighted distance of
+  // Palette::findBestfit(). The tree is read-only after build(), so
+  // nearest() can be called from several threads at the same time.
+  class PaletteKdTree {
+  public:
+    // Creates the tree with all entries of the palette excluding the
+    // "maskIndex". The given number of less significant bits of each
+    // component are discarded (e.g. 3 bits to get the same result as
+    // Palette::findBestfit()).
+    void build(const Palette* palette, int maskIndex, int shift);
+
+    // Returns the index of the palette entry that is nearest to the
+    // given color (components with the "shift" already applied). If
+    // there are several entries at the same distance, the one with
+    // the lowest index is returned.
+    int nearest(int r, int g, int b, int a) const;
+
+    bool empty() const { return m_nodes.empty(); }
+
+  private:
+    struct Node {
+      int c[4];                 // RGBA components
+      int index;                // Palette index
+      int axis;                 // Split axis of this node
+    };
+
+    void buildRange(int lo, int hi);
+    void nearestInRange(const int q[4], int lo, int hi,
+                        int& bestIndex, int& bestDist) const;
+
+    std::vector<Node> m_nodes;
+  };
+
+} // namespace doc
+
+#endif
@@ -416,49 +416,4 @@ void remap_image(Image* image, const Remap& remap)
     *it = remap[*it];
 }
 
-// TODO test this hash routine and find a better alternative
-
-template <typename ImageTraits, uint32_t Mask>
-static uint32_t calculate_image_hash_templ(const Image* image,
-                                           const gfx::Rect& bounds)
-{
-  uint32_t hash = 0;
-  for (int y=0; y<bounds.h; ++y) {
-    auto p = (typename ImageTraits::address_t)image->getPixelAddress(bounds.x, bounds.y+y);
-    for (int x=0; x<bounds.w; ++x, ++p) {
-      uint32_t value = *p;
-      uint32_t mask = Mask;
-      while (mask) {
-        hash += value & mask & 0xff;
-        hash <<= 1;
-        value >>= 8;
-        mask >>= 8;
-      }
-    }
-  }
-  return hash;
-}
-
-uint32_t calculate_image_hash(const Image* img, const gfx::Rect& bounds)
-{
-  switch (img->pixelFormat()) {
-    case IMAGE_RGB:       return calculate_image_hash_templ<RgbTraits, rgba_rgb_mask>(img, bounds);
-    case IMAGE_GRAYSCALE: return calculate_image_hash_templ<GrayscaleTraits, graya_v_mask>(img, bounds);
-    case IMAGE_INDEXED:   return calculate_image_hash_templ<IndexedTraits, 0xff>(img, bounds);
-    case IMAGE_BITMAP:    return calculate_image_hash_templ<BitmapTraits, 1>(img, bounds);
-  }
-
-  uint32_t hash = 0;
-  for (int y=0; y<bounds.h; ++y) {
-    int bytes = img->getRowStrideSize(bounds.w);
-    uint8_t* p = img->getPixelAddress(bounds.x, bounds.y+y);
-    while (bytes-- > 0) {
-      hash += *p;
-      hash <<= 1;
-      ++p;
-    }
-  }
-  return hash;
-}
-
 } // namespace doc
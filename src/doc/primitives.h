@@ -49,9 +49,22 @@ namespace doc {
 
   void remap_image(Image* image, const Remap& remap);
 
-  uint32_t calculate_image_hash(const Image* image,
+  // 64-bit hash of the pixels in the given bounds (implemented in
+  // image_hash.cpp). It's consistent with is_same_image(): fully
+  // transparent RGB/grayscale pixels are hashed as zero.
+  uint64_t calculate_image_hash(const Image* image,
                                 const gfx::Rect& bounds);
 
+  // 64-bit hash of the raw bytes of the pixels in the given bounds,
+  // so it changes when the color of a transparent pixel changes.
+  uint64_t calculate_image_raw_hash(const Image* image,
+                                    const gfx::Rect& bounds);
+
+  // Hash of the whole image, cached in the image until its version
+  // changes (so Image::incrementVersion() must be called after
+  // modifying the pixels).
+  uint64_t calculate_image_hash(const Image* image);
+
 } // namespace doc
 
 #endif
@@ -0,0 +1,77 @@
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef DOC_RANDOM_TEST_UTILS_H_INCLUDED
+#define DOC_RANDOM_TEST_UTILS_H_INCLUDED
+#pragma once
+
+#include "doc/color.h"
+#include "doc/image.h"
+#include "doc/image_ref.h"
+#include "doc/pixel_format.h"
+#include "doc/primitives.h"
+#include "gfx/rect.h"
+
+#include <cstdlib>
+#include <vector>
+
+namespace doc {
+namespace test {
+
+  // Helpers for tests that compare an algorithm with a simple
+  // reference implementation using random images. The sequence of
+  // random numbers is always the same, so a failing case can be
+  // reproduced with its index.
+
+  inline int random_int(const int n) {
+    return std::rand() % n;
+  }
+
+  // Calls "testCase(i, w, h)" for "n" cases with random image sizes
+  // (between 1x1 and maxW x maxH).
+  template<typename TestCase>
+  void for_each_random_case(const int n,
+                            const int maxW, const int maxH,
+                            TestCase testCase) {
+    std::srand(1);
+    for (int i=0; i<n; ++i) {
+      const int w = 1 + random_int(maxW);
+      const int h = 1 + random_int(maxH);
+      testCase(i, w, h);
+    }
+  }
+
+  // Creates an image where each pixel is colors[0] or (with the
+  // given density, from 0 to 100) one of the other colors.
+  inline ImageRef random_image(const PixelFormat pixelFormat,
+                               const int w, const int h,
+                               const std::vector<color_t>& colors,
+                               const int density) {
+    ImageRef image(Image::create(pixelFormat, w, h));
+    for (int y=0; y<h; ++y) {
+      for (int x=0; x<w; ++x) {
+        color_t c = colors[0];
+        if (colors.size() > 1 && random_int(100) < density)
+          c = colors[1 + random_int(int(colors.size())-1)];
+        put_pixel(image.get(), x, y, c);
+      }
+    }
+    return image;
+  }
+
+  // Random rectangle that can be partially outside "bounds" (up to
+  // "margin" pixels) or empty.
+  inline gfx::Rect random_rect(const gfx::Rect& bounds, const int margin) {
+    return gfx::Rect(bounds.x - margin + random_int(bounds.w + margin),
+                     bounds.y - margin + random_int(bounds.h + margin),
+                     random_int(bounds.w + 2*margin),
+                     random_int(bounds.h + 2*margin));
+  }
+
+} // namespace test
+} // namespace doc
+
+#endif
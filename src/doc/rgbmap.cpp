@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -13,6 +14,11 @@
 #include "doc/color_scales.h"
 #include "doc/palette.h"
 
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <thread>
+
 namespace doc {
 
 #define RSIZE   32
@@ -21,9 +27,10 @@ namespace doc {
 #define ASIZE   8
 #define MAPSIZE (RSIZE*GSIZE*BSIZE*ASIZE)
 
-RgbMap::RgbMap()
+RgbMap::RgbMap(Mode mode)
   : Object(ObjectType::RgbMap)
-  , m_map(MAPSIZE)
+  , m_mode(mode)
+  , m_map(mode == Mode::Exact ? 0: MAPSIZE)
   , m_palette(NULL)
   , m_modifications(0)
   , m_maskIndex(0)
@@ -42,9 +49,22 @@ void RgbMap::regenerate(const Palette* palette, int mask_index)
   m_modifications = palette->getModifications();
   m_maskIndex = mask_index;
 
-  // Mark all entries as invalid (need to be regenerated)
-  for (uint16_t& entry : m_map)
-    entry |= INVALID;
+  switch (m_mode) {
+
+    case Mode::Lazy:
+      // Mark all entries as invalid (need to be regenerated)
+      for (uint16_t& entry : m_map)
+        entry |= INVALID;
+      break;
+
+    case Mode::Precomputed:
+      generateAllEntries();
+      break;
+
+    case Mode::Exact:
+      m_tree.build(palette, mask_index, 0);
+      break;
+  }
 }
 
 int RgbMap::generateEntry(int i, int r, int g, int b, int a) const
@@ -57,4 +77,127 @@ int RgbMap::generateEntry(int i, int r, int g, int b, int a) const
       scale_3bits_to_8bits(a>>5), m_maskIndex);
 }
 
+int RgbMap::mapExactColor(int r, int g, int b, int a) const
+{
+  // Mask index is like alpha = 0 (as in Palette::findBestfit())
+  if (a == 0 && m_maskIndex >= 0)
+    return m_maskIndex;
+
+  return m_tree.nearest(r, g, b, a);
+}
+
+// Fills the whole table with the same values that generateEntry()
+// would return. The table is divided in blocks of 4x4x4 RGB entries
+// (for each alpha level), and for each block we keep only the
+// palette entries that can be the nearest one to some color of the
+// block (entries that are nearer than the farthest point of the block
+// to the best entry), so the nearest entry of each color is searched
+// in a small list of candidates. Blocks are distributed between
+// threads.
+void RgbMap::generateAllEntries()
+{
+  // Same weights and 5-bit components used in Palette::findBestfit()
+  const int weights[4] = { 30*30, 59*59, 11*11, 8*8 };
+  struct Entry {
+    int c[4];
+    int index;
+  };
+  std::vector<Entry> entries;
+  const int size = std::min(256, m_palette->size());
+  for (int i=0; i<size; ++i) {
+    if (i == m_maskIndex)
+      continue;
+    const color_t c = m_palette->getEntry(i);
+    entries.push_back(Entry { { int(rgba_getr(c)) >> 3,
+                                int(rgba_getg(c)) >> 3,
+                                int(rgba_getb(c)) >> 3,
+                                int(rgba_geta(c)) >> 3 }, i });
+  }
+
+  const int kBlockSize = 4;
+  const int kBlocksPerAxis = RSIZE / kBlockSize;
+  const int nblocks = kBlocksPerAxis*kBlocksPerAxis*kBlocksPerAxis*ASIZE;
+
+  auto worker =
+    [this, &entries, &weights, kBlocksPerAxis](const int block1, const int block2) {
+      std::vector<int> minDists(entries.size());
+      std::vector<const Entry*> candidates;
+      candidates.reserve(entries.size());
+
+      for (int block=block1; block<block2; ++block) {
+        const int a = block % ASIZE;
+        const int b1 = kBlockSize * ((block / ASIZE) % kBlocksPerAxis);
+        const int g1 = kBlockSize * ((block / ASIZE / kBlocksPerAxis) % kBlocksPerAxis);
+        const int r1 = kBlockSize * (block / ASIZE / kBlocksPerAxis / kBlocksPerAxis);
+        const int a5 = (scale_3bits_to_8bits(a) >> 3);
+        const int lo[4] = { r1, g1, b1, a5 };
+        const int hi[4] = { r1+kBlockSize-1, g1+kBlockSize-1, b1+kBlockSize-1, a5 };
+
+        // Mask index is like alpha = 0 (see Palette::findBestfit())
+        const bool mask = (a5 == 0 && m_maskIndex >= 0);
+
+        // Candidates for this block
+        candidates.clear();
+        if (!mask) {
+          int threshold = std::numeric_limits<int>::max();
+          for (int j=0; j<int(entries.size()); ++j) {
+            int minDist = 0, maxDist = 0;
+            for (int k=0; k<4; ++k) {
+              const int c = entries[j].c[k];
+              const int dmin = (c < lo[k] ? lo[k]-c: (c > hi[k] ? c-hi[k]: 0));
+              const int dmax = std::max(std::abs(c-lo[k]), std::abs(c-hi[k]));
+              minDist += dmin*dmin*weights[k];
+              maxDist += dmax*dmax*weights[k];
+            }
+            minDists[j] = minDist;
+            threshold = std::min(threshold, maxDist);
+          }
+          for (int j=0; j<int(entries.size()); ++j)
+            if (minDists[j] <= threshold)
+              candidates.push_back(&entries[j]);
+        }
+
+        for (int r=r1; r<=hi[0]; ++r)
+          for (int g=g1; g<=hi[1]; ++g)
+            for (int b=b1; b<=hi[2]; ++b) {
+              const int i = a | (b << 3) | (g << 8) | (r << 13);
+              if (mask) {
+                m_map[i] = m_maskIndex;
+                continue;
+              }
+
+              // Candidates are sorted by palette index, so we get the
+              // lowest index between entries at the same distance.
+              int bestfit = 0;
+              int lowest = std::numeric_limits<int>::max();
+              for (const Entry* e : candidates) {
+                const int dr = r - e->c[0];
+                const int dg = g - e->c[1];
+                const int db = b - e->c[2];
+                const int da = a5 - e->c[3];
+                const int dist =
+                  dr*dr*weights[0] + dg*dg*weights[1] +
+                  db*db*weights[2] + da*da*weights[3];
+                if (dist < lowest) {
+                  bestfit = e->index;
+                  lowest = dist;
+                }
+              }
+              m_map[i] = bestfit;
+            }
+      }
+    };
+
+  const int nthreads =
+    std::max(1, std::min<int>(std::thread::hardware_concurrency(), 8));
+  std::vector<std::thread> threads;
+  for (int t=1; t<nthreads; ++t)
+    threads.push_back(std::thread(worker,
+                                  nblocks * t / nthreads,
+                                  nblocks * (t+1) / nthreads));
+  worker(0, nblocks / nthreads);
+  for (auto& thread : threads)
+    thread.join();
+}
+
 } // namespace doc
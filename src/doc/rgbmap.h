@@ -1,4 +1,5 @@
 // Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
 // Copyright (c) 2001-2016 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -11,6 +12,7 @@
 #include "base/debug.h"
 #include "base/disable_copying.h"
 #include "doc/object.h"
+#include "doc/palette_kdtree.h"
 
 #include <vector>
 
@@ -24,7 +26,26 @@ namespace doc {
     const int INVALID = 256;
 
   public:
-    RgbMap();
+    enum class Mode {
+      // Entries of the table (5 bits for RGB, 3 bits for alpha) are
+      // calculated the first time they are used. It's not
+      // thread-safe (mapColor() modifies the table).
+      Lazy,
+
+      // Same results as Lazy, but all entries are calculated (in
+      // several threads) in regenerate(), so mapColor() can be
+      // called from several threads at the same time.
+      Precomputed,
+
+      // Nearest palette entry using the full 8-bit precision of each
+      // component (there is no table). mapColor() can be called
+      // from several threads at the same time.
+      Exact,
+    };
+
+    RgbMap(Mode mode = Mode::Lazy);
+
+    Mode mode() const { return m_mode; }
 
     bool match(const Palette* palette) const;
     void regenerate(const Palette* palette, int mask_index);
@@ -34,9 +55,13 @@ namespace doc {
       ASSERT(g >= 0 && g < 256);
       ASSERT(b >= 0 && b < 256);
       ASSERT(a >= 0 && a < 256);
+      if (m_mode == Mode::Exact)
+        return mapExactColor(r, g, b, a);
+
       // bits -> bbbbbgggggrrrrraaa
       int i = (a>>5) | ((b>>3) << 3) | ((g>>3) << 8) | ((r>>3) << 13);
       int v = m_map[i];
+      ASSERT(m_mode == Mode::Lazy || !(v & INVALID));
       return (v & INVALID) ? generateEntry(i, r, g, b, a): v;
     }
 
@@ -44,8 +69,12 @@ namespace doc {
 
   private:
     int generateEntry(int i, int r, int g, int b, int a) const;
+    int mapExactColor(int r, int g, int b, int a) const;
+    void generateAllEntries();
 
+    Mode m_mode;
     mutable std::vector<uint16_t> m_map;
+    PaletteKdTree m_tree;
     const Palette* m_palette;
     int m_modifications;
     int m_maskIndex;
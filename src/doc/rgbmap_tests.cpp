@@ -0,0 +1,108 @@
+// Aseprite Document Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gtest/gtest.h>
+
+#include "doc/palette.h"
+#include "doc/rgbmap.h"
+
+#include <cstdlib>
+#include <limits>
+
+using namespace doc;
+
+namespace {
+
+void fill_random_palette(Palette& pal)
+{
+  for (int i=0; i<pal.size(); ++i)
+    pal.setEntry(i, rgba(std::rand() % 256,
+                         std::rand() % 256,
+                         std::rand() % 256,
+                         (std::rand() % 2) ? 255: std::rand() % 256));
+
+  // Repeated entries to test that the lowest index is used
+  if (pal.size() > 4)
+    pal.setEntry(pal.size()-1, pal.getEntry(2));
+}
+
+} // anonymous namespace
+
+TEST(RgbMap, PrecomputedSameAsLazy)
+{
+  std::srand(1);
+  const int sizes[] = { 1, 2, 16, 255, 256 };
+  const int maskIndexes[] = { -1, 0, 3 };
+  for (int size : sizes) {
+    Palette pal(frame_t(0), size);
+    fill_random_palette(pal);
+
+    for (int maskIndex : maskIndexes) {
+      RgbMap lazy(RgbMap::Mode::Lazy);
+      RgbMap precomputed(RgbMap::Mode::Precomputed);
+      lazy.regenerate(&pal, maskIndex);
+      precomputed.regenerate(&pal, maskIndex);
+
+      for (int r=0; r<256; r+=8)
+        for (int g=0; g<256; g+=8)
+          for (int b=0; b<256; b+=8)
+            for (int a=0; a<256; a+=32)
+              ASSERT_EQ(lazy.mapColor(r, g, b, a),
+                        precomputed.mapColor(r, g, b, a))
+                << "size=" << size << " maskIndex=" << maskIndex
+                << " rgba=" << r << "," << g << "," << b << "," << a;
+    }
+  }
+}
+
+TEST(RgbMap, ExactNearestEntry)
+{
+  std::srand(2);
+  Palette pal(frame_t(0), 200);
+  fill_random_palette(pal);
+
+  const int maskIndex = 5;
+  RgbMap exact(RgbMap::Mode::Exact);
+  exact.regenerate(&pal, maskIndex);
+
+  for (int n=0; n<20000; ++n) {
+    const int r = std::rand() % 256;
+    const int g = std::rand() % 256;
+    const int b = std::rand() % 256;
+    const int a = 1 + std::rand() % 255;
+
+    // Linear search with the same weights of Palette::findBestfit()
+    int expected = 0;
+    int lowest = std::numeric_limits<int>::max();
+    for (int i=0; i<pal.size(); ++i) {
+      if (i == maskIndex)
+        continue;
+      const color_t c = pal.getEntry(i);
+      const int dr = r - int(rgba_getr(c));
+      const int dg = g - int(rgba_getg(c));
+      const int db = b - int(rgba_getb(c));
+      const int da = a - int(rgba_geta(c));
+      const int dist = dr*dr*30*30 + dg*dg*59*59 + db*db*11*11 + da*da*8*8;
+      if (dist < lowest) {
+        lowest = dist;
+        expected = i;
+      }
+    }
+    ASSERT_EQ(expected, exact.mapColor(r, g, b, a));
+  }
+
+  EXPECT_EQ(maskIndex, exact.mapColor(10, 20, 30, 0));
+}
+
+int main(int argc, char** argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -19,6 +19,10 @@ namespace filters {
 
   // Interface which applies a filter to a sprite given a FilterManager
   // which indicates where we have to apply the filter.
+  //
+  // The applyTo*() member functions can be called at the same time
+  // from several threads (each one with its own FilterManager and a
+  // different row), so they must not modify the filter state.
   class Filter {
   public:
     virtual ~Filter() { }
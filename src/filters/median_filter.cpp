@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2017  David Capello
 //
 // This program is distributed under the terms of
@@ -20,17 +21,22 @@
 #include "filters/tiled_mode.h"
 
 #include <algorithm>
+#include <vector>
 
 namespace filters {
 
 using namespace doc;
 
 namespace {
+  // Per-call scratch buffers (one per channel) so the filter can be
+  // applied to several rows from different threads at the same time.
+  typedef std::vector<std::vector<uint8_t> > Channels;
+
   struct GetPixelsDelegateRgba {
-    std::vector<std::vector<uint8_t> >& channel;
+    Channels& channel;
     int c;
 
-    GetPixelsDelegateRgba(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+    GetPixelsDelegateRgba(Channels& channel) : channel(channel) { }
 
     void reset() { c = 0; }
 
@@ -45,10 +51,10 @@ namespace {
   };
 
   struct GetPixelsDelegateGrayscale {
-    std::vector<std::vector<uint8_t> >& channel;
+    Channels& channel;
     int c;
 
-    GetPixelsDelegateGrayscale(std::vector<std::vector<uint8_t> >& channel) : channel(channel) { }
+    GetPixelsDelegateGrayscale(Channels& channel) : channel(channel) { }
 
     void reset() { c = 0; }
 
@@ -62,11 +68,11 @@ namespace {
 
   struct GetPixelsDelegateIndexed {
     const Palette* pal;
-    std::vector<std::vector<uint8_t> >& channel;
+    Channels& channel;
     Target target;
     int c;
 
-    GetPixelsDelegateIndexed(const Palette* pal, std::vector<std::vector<uint8_t> >& channel, Target target)
+    GetPixelsDelegateIndexed(const Palette* pal, Channels& channel, Target target)
       : pal(pal), channel(channel), target(target) { }
 
     void reset() { c = 0; }
@@ -93,7 +99,6 @@ MedianFilter::MedianFilter()
   , m_width(1)
   , m_height(1)
   , m_ncolors(0)
-  , m_channel(4)
 {
 }
 
@@ -110,9 +115,6 @@ void MedianFilter::setSize(int width, int height)
   m_width = MAX(1, width);
   m_height = MAX(1, height);
   m_ncolors = width*height;
-
-  for (int c = 0; c < 4; ++c)
-    m_channel[c].resize(m_ncolors);
 }
 
 const char* MedianFilter::getName()
@@ -127,7 +129,8 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
   Target target = filterMgr->getTarget();
   int color;
   int r, g, b, a;
-  GetPixelsDelegateRgba delegate(m_channel);
+  Channels channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateRgba delegate(channel);
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
@@ -146,29 +149,29 @@ void MedianFilter::applyToRgba(FilterManager* filterMgr)
     color = get_pixel_fast<RgbTraits>(src, x, y);
 
     if (target & TARGET_RED_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      r = m_channel[0][m_ncolors/2];
+      std::sort(channel[0].begin(), channel[0].end());
+      r = channel[0][m_ncolors/2];
     }
     else
       r = rgba_getr(color);
 
     if (target & TARGET_GREEN_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      g = m_channel[1][m_ncolors/2];
+      std::sort(channel[1].begin(), channel[1].end());
+      g = channel[1][m_ncolors/2];
     }
     else
       g = rgba_getg(color);
 
     if (target & TARGET_BLUE_CHANNEL) {
-      std::sort(m_channel[2].begin(), m_channel[2].end());
-      b = m_channel[2][m_ncolors/2];
+      std::sort(channel[2].begin(), channel[2].end());
+      b = channel[2][m_ncolors/2];
     }
     else
       b = rgba_getb(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[3].begin(), m_channel[3].end());
-      a = m_channel[3][m_ncolors/2];
+      std::sort(channel[3].begin(), channel[3].end());
+      a = channel[3][m_ncolors/2];
     }
     else
       a = rgba_geta(color);
@@ -183,7 +186,8 @@ void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
   uint16_t* dst_address = (uint16_t*)filterMgr->getDestinationAddress();
   Target target = filterMgr->getTarget();
   int color, k, a;
-  GetPixelsDelegateGrayscale delegate(m_channel);
+  Channels channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateGrayscale delegate(channel);
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
@@ -202,15 +206,15 @@ void MedianFilter::applyToGrayscale(FilterManager* filterMgr)
     color = get_pixel_fast<GrayscaleTraits>(src, x, y);
 
     if (target & TARGET_GRAY_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      k = m_channel[0][m_ncolors/2];
+      std::sort(channel[0].begin(), channel[0].end());
+      k = channel[0][m_ncolors/2];
     }
     else
       k = graya_getv(color);
 
     if (target & TARGET_ALPHA_CHANNEL) {
-      std::sort(m_channel[1].begin(), m_channel[1].end());
-      a = m_channel[1][m_ncolors/2];
+      std::sort(channel[1].begin(), channel[1].end());
+      a = channel[1][m_ncolors/2];
     }
     else
       a = graya_geta(color);
@@ -227,7 +231,8 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
   const RgbMap* rgbmap = filterMgr->getIndexedData()->getRgbMap();
   Target target = filterMgr->getTarget();
   int color, r, g, b, a;
-  GetPixelsDelegateIndexed delegate(pal, m_channel, target);
+  Channels channel(4, std::vector<uint8_t>(m_ncolors));
+  GetPixelsDelegateIndexed delegate(pal, channel, target);
   int x = filterMgr->x();
   int x2 = x+filterMgr->getWidth();
   int y = filterMgr->y();
@@ -244,37 +249,37 @@ void MedianFilter::applyToIndexed(FilterManager* filterMgr)
                                           m_tiledMode, delegate);
 
     if (target & TARGET_INDEX_CHANNEL) {
-      std::sort(m_channel[0].begin(), m_channel[0].end());
-      *(dst_address++) = m_channel[0][m_ncolors/2];
+      std::sort(channel[0].begin(), channel[0].end());
+      *(dst_address++) = channel[0][m_ncolors/2];
     }
     else {
       color = get_pixel_fast<IndexedTraits>(src, x, y);
       color = pal->getEntry(color);
 
       if (target & TARGET_RED_CHANNEL) {
-        std::sort(m_channel[0].begin(), m_channel[0].end());
-        r = m_channel[0][m_ncolors/2];
+        std::sort(channel[0].begin(), channel[0].end());
+        r = channel[0][m_ncolors/2];
       }
       else
         r = rgba_getr(color);
 
       if (target & TARGET_GREEN_CHANNEL) {
-        std::sort(m_channel[1].begin(), m_channel[1].end());
-        g = m_channel[1][m_ncolors/2];
+        std::sort(channel[1].begin(), channel[1].end());
+        g = channel[1][m_ncolors/2];
       }
       else
         g = rgba_getg(pal->getEntry(color));
 
       if (target & TARGET_BLUE_CHANNEL) {
-        std::sort(m_channel[2].begin(), m_channel[2].end());
-        b = m_channel[2][m_ncolors/2];
+        std::sort(channel[2].begin(), channel[2].end());
+        b = channel[2][m_ncolors/2];
       }
       else
         b = rgba_getb(color);
 
       if (target & TARGET_ALPHA_CHANNEL) {
-        std::sort(m_channel[3].begin(), m_channel[3].end());
-        a = m_channel[3][m_ncolors/2];
+        std::sort(channel[3].begin(), channel[3].end());
+        a = channel[3][m_ncolors/2];
       }
       else
         a = rgba_geta(color);
@@ -1,4 +1,5 @@
 // Aseprite
+// Copyright (C) 2019  Igara Studio S.A.
 // Copyright (C) 2001-2016  David Capello
 //
 // This program is distributed under the terms of
@@ -12,8 +13,6 @@
 #include "filters/filter.h"
 #include "filters/tiled_mode.h"
 
-#include <vector>
-
 namespace filters {
 
   class MedianFilter : public Filter {
@@ -38,7 +37,6 @@ namespace filters {
     int m_width;
     int m_height;
     int m_ncolors;
-    std::vector<std::vector<uint8_t> > m_channel;
   };
 
 } // namespace filters
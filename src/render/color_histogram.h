@@ -1,4 +1,5 @@
 // Aseprite Render Library
+// Copyright (c) 2019 Igara Studio S.A.
 // Copyright (c) 2001-2015 David Capello
 //
 // This file is released under the terms of the MIT license.
@@ -16,7 +17,9 @@
 #include "doc/image_traits.h"
 #include "doc/palette.h"
 
+#include "render/kmeans.h"
 #include "render/median_cut.h"
+#include "render/quantization_algorithm.h"
 
 namespace render {
   using namespace doc;
@@ -77,11 +80,45 @@ namespace render {
       }
     }
 
+    // Adds all samples of the "other" histogram to this one (e.g. to
+    // join histograms created by different threads). The
+    // high-precision colors of "other" are added after the colors
+    // of this histogram.
+    void addHistogram(const ColorHistogram& other) {
+      for (std::size_t i=0; i<m_histogram.size(); ++i) {
+        const std::size_t count = other.m_histogram[i];
+        if (m_histogram[i] < std::numeric_limits<std::size_t>::max()-count) // Avoid overflow
+          m_histogram[i] += count;
+        else
+          m_histogram[i] = std::numeric_limits<std::size_t>::max();
+      }
+
+      if (m_useHighPrecision) {
+        if (!other.m_useHighPrecision) {
+          m_useHighPrecision = false;
+          return;
+        }
+        for (doc::color_t color : other.m_highPrecision) {
+          if (std::find(m_highPrecision.begin(), m_highPrecision.end(), color) != m_highPrecision.end())
+            continue;
+
+          if (m_highPrecision.size() < 256) {
+            m_highPrecision.push_back(color);
+          }
+          else {
+            m_useHighPrecision = false;
+            break;
+          }
+        }
+      }
+    }
+
     // Creates a set of entries for the given palette in the given range
     // with the more important colors in the histogram. Returns the
     // number of used entries in the palette (maybe the range [from,to]
     // is more than necessary).
-    int createOptimizedPalette(Palette* palette) {
+    int createOptimizedPalette(Palette* palette,
+                               const QuantizationAlgorithm algorithm = QuantizationAlgorithm::MedianCut) {
       // Can we use the high-precision table?
       if (m_useHighPrecision && int(m_highPrecision.size()) <= palette->size()) {
         for (int i=0; i<(int)m_highPrecision.size(); ++i)
@@ -95,6 +132,9 @@ namespace render {
         std::vector<doc::color_t> result;
         median_cut(*this, palette->size(), result);
 
+        if (algorithm == QuantizationAlgorithm::KMeans)
+          kmeans(*this, result);
+
         for (int i=0; i<(int)result.size(); ++i)
           palette->setEntry(i, result[i]);
 
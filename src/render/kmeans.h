@@ -0,0 +1,149 @@
+// Aseprite Render Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_KMEANS_H_INCLUDED
+#define RENDER_KMEANS_H_INCLUDED
+#pragma once
+
+#include "doc/color.h"
+
+#include <algorithm>
+#include <limits>
+#include <thread>
+#include <vector>
+
+namespace render {
+
+  // Refines the given "colors" (e.g. the result of median_cut()) with
+  // the k-means algorithm: each color is moved to the mean of the
+  // histogram entries that are nearer to it than to any other color,
+  // until the colors don't change or we reach "maxIterations". The
+  // entries of the histogram are distributed between several threads
+  // to look for their nearest color.
+  template<class Histogram>
+  void kmeans(const Histogram& histogram,
+              std::vector<doc::color_t>& colors,
+              const int maxIterations = 8)
+  {
+    struct Entry {
+      int r, g, b, a;
+      double count;
+    };
+
+    struct Sum {
+      double r = 0.0, g = 0.0, b = 0.0, a = 0.0;
+      double count = 0.0;
+    };
+
+    const int k = int(colors.size());
+    if (k < 2)
+      return;
+
+    // Collect all entries of the histogram with samples (with the
+    // same scale used by median_cut() to convert them to 8-bit)
+    std::vector<Entry> entries;
+    for (int a=0; a<Histogram::AElements; ++a)
+      for (int b=0; b<Histogram::BElements; ++b)
+        for (int g=0; g<Histogram::GElements; ++g)
+          for (int r=0; r<Histogram::RElements; ++r) {
+            const std::size_t count = histogram.at(r, g, b, a);
+            if (count > 0)
+              entries.push_back(
+                Entry { 255 * r / (Histogram::RElements-1),
+                        255 * g / (Histogram::GElements-1),
+                        255 * b / (Histogram::BElements-1),
+                        255 * a / (Histogram::AElements-1),
+                        double(count) });
+          }
+
+    const int n = int(entries.size());
+    if (n <= k)
+      return;
+
+    const int kMinEntriesPerThread = 4096;
+    const int nthreads =
+      std::max(1, std::min<int>(std::thread::hardware_concurrency(),
+                                n / kMinEntriesPerThread));
+
+    std::vector<int> nearest(n, -1);
+    std::vector<std::vector<Sum> > sums(nthreads);
+    std::vector<int> changes(nthreads);
+
+    auto worker =
+      [&entries, &colors, &nearest, &sums, &changes, k, n, nthreads](int t) {
+        std::vector<Sum>& sum = sums[t];
+        sum.assign(k, Sum());
+        changes[t] = 0;
+
+        const int i1 = int(std::size_t(n) * t / nthreads);
+        const int i2 = int(std::size_t(n) * (t+1) / nthreads);
+        for (int i=i1; i<i2; ++i) {
+          const Entry& e = entries[i];
+          int best = 0;
+          int bestDist = std::numeric_limits<int>::max();
+          for (int j=0; j<k; ++j) {
+            const doc::color_t c = colors[j];
+            const int dr = e.r - int(doc::rgba_getr(c));
+            const int dg = e.g - int(doc::rgba_getg(c));
+            const int db = e.b - int(doc::rgba_getb(c));
+            const int da = e.a - int(doc::rgba_geta(c));
+            const int dist = dr*dr + dg*dg + db*db + da*da;
+            if (dist < bestDist) {
+              bestDist = dist;
+              best = j;
+            }
+          }
+
+          if (nearest[i] != best) {
+            nearest[i] = best;
+            ++changes[t];
+          }
+
+          Sum& s = sum[best];
+          s.r += e.r * e.count;
+          s.g += e.g * e.count;
+          s.b += e.b * e.count;
+          s.a += e.a * e.count;
+          s.count += e.count;
+        }
+      };
+
+    for (int iter=0; iter<maxIterations; ++iter) {
+      std::vector<std::thread> threads;
+      for (int t=1; t<nthreads; ++t)
+        threads.push_back(std::thread(worker, t));
+      worker(0);
+      for (auto& thread : threads)
+        thread.join();
+
+      int totalChanges = 0;
+      for (int t=0; t<nthreads; ++t)
+        totalChanges += changes[t];
+      if (totalChanges == 0)
+        break;
+
+      for (int j=0; j<k; ++j) {
+        Sum s;
+        for (int t=0; t<nthreads; ++t) {
+          s.r += sums[t][j].r;
+          s.g += sums[t][j].g;
+          s.b += sums[t][j].b;
+          s.a += sums[t][j].a;
+          s.count += sums[t][j].count;
+        }
+        // Colors without entries are kept as they are
+        if (s.count > 0.0)
+          colors[j] = doc::rgba(int(s.r / s.count + 0.5),
+                                int(s.g / s.count + 0.5),
+                                int(s.b / s.count + 0.5),
+                                int(s.a / s.count + 0.5));
+      }
+    }
+  }
+
+} // namespace render
+
+#endif
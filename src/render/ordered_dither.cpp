@@ -243,6 +243,8 @@ void dither_rgb_image_to_indexed(
   algorithm.start(srcImage, dstImage, dithering.factor());
 
   if (algorithm.dimensions() == 1) {
+    // Dithering::matrix() returns a copy of the matrix
+    const DitheringMatrix matrix = dithering.matrix();
     const doc::LockImageBits<doc::RgbTraits> srcBits(srcImage);
     doc::LockImageBits<doc::IndexedTraits> dstBits(dstImage);
     auto srcIt = srcBits.begin();
@@ -253,7 +255,7 @@ void dither_rgb_image_to_indexed(
         ASSERT(srcIt != srcBits.end());
         ASSERT(dstIt != dstBits.end());
         *dstIt = algorithm.ditherRgbPixelToIndex(
-          dithering.matrix(), *srcIt, x, y, rgbmap, palette);
+          matrix, *srcIt, x, y, rgbmap, palette);
 
         if (delegate) {
           if (!delegate->continueTask())
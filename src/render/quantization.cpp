@@ -15,6 +15,7 @@
 #include "doc/layer.h"
 #include "doc/palette.h"
 #include "doc/primitives.h"
+#include "doc/primitives_fast.h"
 #include "doc/remap.h"
 #include "doc/rgbmap.h"
 #include "doc/sprite.h"
@@ -27,9 +28,13 @@
 #include "render/task_delegate.h"
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
 #include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <thread>
 #include <vector>
 
 namespace render {
@@ -37,6 +42,25 @@ namespace render {
 using namespace doc;
 using namespace gfx;
 
+namespace {
+
+// Number of rows converted in each step with ordered dithering in
+// convert_pixel_format_batch()
+const int kRowsPerBand = 64;
+
+// Delegate used in worker threads to stop converting an image when
+// the task is canceled
+class StopDelegate : public TaskDelegate {
+public:
+  StopDelegate(const std::atomic<bool>& stop) : m_stop(stop) { }
+  void notifyTaskProgress(double progress) override { }
+  bool continueTask() override { return !m_stop; }
+private:
+  const std::atomic<bool>& m_stop;
+};
+
+} // anonymous namespace
+
 Palette* create_palette_from_sprite(
   const Sprite* sprite,
   const frame_t fromFrame,
@@ -44,39 +68,95 @@ Palette* create_palette_from_sprite(
   const bool withAlpha,
   Palette* palette,
   TaskDelegate* delegate,
-  const bool newBlend)
+  const bool newBlend,
+  const QuantizationAlgorithm algorithm)
 {
-  PaletteOptimizer optimizer;
-
   if (!palette)
     palette = new Palette(fromFrame, 256);
 
-  // Add a flat image with the current sprite's frame rendered
-  ImageRef flat_image(Image::create(IMAGE_RGB,
-      sprite->width(), sprite->height()));
-
-  // Feed the optimizer with all rendered frames
-  render::Render render;
-  render.setNewBlend(newBlend);
-  for (frame_t frame=fromFrame; frame<=toFrame; ++frame) {
-    render.renderSprite(flat_image.get(), sprite, frame);
-    optimizer.feedWithImage(flat_image.get(), withAlpha);
-
-    if (delegate) {
+  // Each thread renders and feeds its own optimizer with a
+  // consecutive range of frames, so joining the optimizers in order
+  // gives the same result as feeding one optimizer with all frames.
+  const int nframes = toFrame - fromFrame + 1;
+  const int nthreads =
+    std::max(1, std::min<int>(std::thread::hardware_concurrency(), nframes));
+  std::vector<PaletteOptimizer> optimizers(nthreads);
+  std::mutex mutex;
+  std::condition_variable cv;
+  int framesDone = 0;
+  int threadsDone = 0;
+  std::atomic<bool> stop(false);
+
+  auto checkDelegate =
+    [&]() {
       if (!delegate->continueTask())
-        return nullptr;
+        stop = true;
 
       delegate->notifyTaskProgress(
-        double(frame-fromFrame+1) / double(toFrame-fromFrame+1));
+        double(framesDone) / double(nframes));
+    };
+
+  auto worker =
+    [sprite, withAlpha, newBlend, fromFrame, nframes, nthreads,
+     &optimizers, &mutex, &cv, &framesDone, &threadsDone, &stop,
+     &checkDelegate](const int t, const bool useDelegate) {
+      // Add a flat image with the current sprite's frame rendered
+      ImageRef flat_image(Image::create(IMAGE_RGB,
+          sprite->width(), sprite->height()));
+
+      render::Render render;
+      render.setNewBlend(newBlend);
+
+      const frame_t frame1 = fromFrame + nframes * t / nthreads;
+      const frame_t frame2 = fromFrame + nframes * (t+1) / nthreads;
+      for (frame_t frame=frame1; frame<frame2 && !stop; ++frame) {
+        render.renderSprite(flat_image.get(), sprite, frame);
+        optimizers[t].feedWithImage(flat_image.get(), withAlpha);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        ++framesDone;
+        if (useDelegate)
+          checkDelegate();
+        cv.notify_all();
+      }
+
+      std::unique_lock<std::mutex> lock(mutex);
+      ++threadsDone;
+      cv.notify_all();
+    };
+
+  // Feed the optimizers with all rendered frames
+  std::vector<std::thread> threads;
+  for (int t=1; t<nthreads; ++t)
+    threads.push_back(std::thread(worker, t, false));
+  worker(0, delegate != nullptr);
+
+  // The calling thread keeps checking the delegate (to cancel the
+  // task and report the progress) until all threads finish
+  if (delegate) {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (threadsDone < nthreads) {
+      cv.wait(lock);
+      checkDelegate();
     }
   }
+  for (auto& thread : threads)
+    thread.join();
+
+  if (stop)
+    return nullptr;
+
+  PaletteOptimizer& optimizer = optimizers[0];
+  for (int t=1; t<nthreads; ++t)
+    optimizer.feedWithOptimizer(optimizers[t]);
 
   // Generate an optimized palette
   optimizer.calculate(
     palette,
     // Transparent color is needed if we have transparent layers
     (sprite->backgroundLayer() &&
-     sprite->allLayersCount() == 1 ? -1: sprite->transparentColor()));
+     sprite->allLayersCount() == 1 ? -1: sprite->transparentColor()),
+    algorithm);
 
   return palette;
 }
@@ -342,6 +422,108 @@ Image* convert_pixel_format(
   return new_image;
 }
 
+bool convert_pixel_format_batch(
+  std::vector<PixelFormatJob>& jobs,
+  const PixelFormat pixelFormat,
+  const Dithering& dithering,
+  TaskDelegate* delegate)
+{
+  // Each unit of work is a band of rows of an image (converted with
+  // ordered dithering), or a whole image (y1 = y2 = -1).
+  struct Unit {
+    int job;
+    int y1, y2;
+  };
+
+  const bool orderedDither =
+    (pixelFormat == IMAGE_INDEXED &&
+     (dithering.algorithm() == DitheringAlgorithm::Ordered ||
+      dithering.algorithm() == DitheringAlgorithm::Old));
+
+  std::vector<Unit> units;
+  double totalPixels = 0.0;
+  for (int i=0; i<int(jobs.size()); ++i) {
+    PixelFormatJob& job = jobs[i];
+    const int h = job.src->height();
+    ASSERT(!job.rgbmap || job.rgbmap->mode() != RgbMap::Mode::Lazy);
+
+    if (orderedDither && job.src->pixelFormat() == IMAGE_RGB) {
+      job.dst.reset(Image::create(IMAGE_INDEXED, job.src->width(), h));
+      job.dst->setMaskColor(job.newMaskColor);
+      for (int y=0; y<h; y+=kRowsPerBand)
+        units.push_back(Unit{ i, y, std::min(y+kRowsPerBand, h) });
+    }
+    else
+      units.push_back(Unit{ i, -1, -1 });
+
+    totalPixels += double(job.src->width()) * h;
+  }
+
+  const int nunits = int(units.size());
+  const int nthreads =
+    std::max(1, std::min<int>(std::thread::hardware_concurrency(), nunits));
+  std::atomic<int> nextUnit(0);
+  std::atomic<bool> stop(false);
+  std::atomic<int64_t> pixelsDone(0);
+
+  auto worker =
+    [&jobs, &units, pixelFormat, &dithering, nunits,
+     totalPixels, &nextUnit, &stop, &pixelsDone](TaskDelegate* delegate) {
+      StopDelegate stopDelegate(stop);
+      const DitheringMatrix matrix = dithering.matrix();
+      int u;
+
+      while (!stop && (u = nextUnit++) < nunits) {
+        const Unit& unit = units[u];
+        PixelFormatJob& job = jobs[unit.job];
+
+        if (unit.y1 < 0) {
+          job.dst.reset(
+            convert_pixel_format(job.src, nullptr, pixelFormat,
+                                 dithering, job.rgbmap, job.palette,
+                                 job.isBackground, job.newMaskColor,
+                                 &stopDelegate));
+        }
+        else {
+          const int transparentIndex = (job.isBackground ? -1: job.newMaskColor);
+          std::unique_ptr<DitheringAlgorithmBase> dither;
+          if (dithering.algorithm() == DitheringAlgorithm::Ordered)
+            dither.reset(new OrderedDither2(transparentIndex));
+          else
+            dither.reset(new OrderedDither(transparentIndex));
+
+          const int w = job.src->width();
+          for (int y=unit.y1; y<unit.y2; ++y) {
+            auto srcIt = get_pixel_address_fast<RgbTraits>(job.src, 0, y);
+            auto dstIt = get_pixel_address_fast<IndexedTraits>(job.dst.get(), 0, y);
+            for (int x=0; x<w; ++x, ++srcIt, ++dstIt)
+              *dstIt = dither->ditherRgbPixelToIndex(
+                matrix, *srcIt, x, y, job.rgbmap, job.palette);
+          }
+        }
+
+        pixelsDone += int64_t(job.src->width()) *
+          (unit.y1 < 0 ? job.src->height(): unit.y2 - unit.y1);
+
+        // Only the calling thread uses the delegate
+        if (delegate) {
+          if (!delegate->continueTask())
+            stop = true;
+          delegate->notifyTaskProgress(double(pixelsDone) / totalPixels);
+        }
+      }
+    };
+
+  std::vector<std::thread> threads;
+  for (int t=1; t<nthreads; ++t)
+    threads.push_back(std::thread(worker, nullptr));
+  worker(delegate);
+  for (auto& thread : threads)
+    thread.join();
+
+  return !stop;
+}
+
 //////////////////////////////////////////////////////////////////////
 // Creation of optimized palette for RGB images
 // by David Capello
@@ -406,7 +588,15 @@ void PaletteOptimizer::feedWithRgbaColor(color_t color)
   m_histogram.addSamples(color, 1);
 }
 
-void PaletteOptimizer::calculate(Palette* palette, int maskIndex)
+void PaletteOptimizer::feedWithOptimizer(const PaletteOptimizer& other)
+{
+  m_histogram.addHistogram(other.m_histogram);
+  if (other.m_withAlpha)
+    m_withAlpha = true;
+}
+
+void PaletteOptimizer::calculate(Palette* palette, int maskIndex,
+                                 const QuantizationAlgorithm algorithm)
 {
   bool addMask;
 
@@ -422,7 +612,7 @@ void PaletteOptimizer::calculate(Palette* palette, int maskIndex)
   // used, in other case the 0 indexed will be the mask color, so it
   // will not be used later in the color conversion (from RGB to
   // Indexed).
-  int usedColors = m_histogram.createOptimizedPalette(palette);
+  int usedColors = m_histogram.createOptimizedPalette(palette, algorithm);
 
   if (addMask) {
     palette->resize(usedColors+1);
@@ -10,8 +10,10 @@
 #pragma once
 
 #include "doc/frame.h"
+#include "doc/image_ref.h"
 #include "doc/pixel_format.h"
 #include "render/color_histogram.h"
+#include "render/quantization_algorithm.h"
 
 #include <vector>
 
@@ -30,7 +32,9 @@ namespace render {
   public:
     void feedWithImage(doc::Image* image, bool withAlpha);
     void feedWithRgbaColor(doc::color_t color);
-    void calculate(doc::Palette* palette, int maskIndex);
+    void feedWithOptimizer(const PaletteOptimizer& other);
+    void calculate(doc::Palette* palette, int maskIndex,
+                   const QuantizationAlgorithm algorithm = QuantizationAlgorithm::MedianCut);
 
   private:
     render::ColorHistogram<5, 6, 5, 5> m_histogram;
@@ -45,7 +49,8 @@ namespace render {
     const bool withAlpha,
     doc::Palette* newPalette, // Can be NULL to create a new palette
     TaskDelegate* delegate,
-    const bool newBlend);
+    const bool newBlend,
+    const QuantizationAlgorithm algorithm = QuantizationAlgorithm::MedianCut);
 
   // Changes the image pixel format. The dithering method is used only
   // when you want to convert from RGB to Indexed.
@@ -60,6 +65,28 @@ namespace render {
     doc::color_t new_mask_color,
     TaskDelegate* delegate = nullptr);
 
+  // Image to be converted with convert_pixel_format_batch()
+  struct PixelFormatJob {
+    const doc::Image* src;
+    doc::ImageRef dst;          // Output image
+    const doc::RgbMap* rgbmap;  // Thread-safe RgbMap (not RgbMap::Mode::Lazy) or nullptr
+    const doc::Palette* palette;
+    bool isBackground;
+    doc::color_t newMaskColor;
+  };
+
+  // Converts the images of all jobs (e.g. all cels of a sprite) to
+  // the given pixel format using several threads. Images converted
+  // with ordered dithering are split in bands of rows, and images
+  // converted with other methods (e.g. error diffusion, which must
+  // process the pixels in order) are converted each one in one
+  // thread. Returns false if the delegate canceled the task.
+  bool convert_pixel_format_batch(
+    std::vector<PixelFormatJob>& jobs,
+    const doc::PixelFormat pixelFormat,
+    const render::Dithering& dithering,
+    TaskDelegate* delegate = nullptr);
+
 } // namespace render
 
 #endif
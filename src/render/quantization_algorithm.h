@@ -0,0 +1,21 @@
+// Aseprite Render Library
+// Copyright (c) 2019 Igara Studio S.A.
+//
+// This file is released under the terms of the MIT license.
+// Read LICENSE.txt for more information.
+
+#ifndef RENDER_QUANTIZATION_ALGORITHM_H_INCLUDED
+#define RENDER_QUANTIZATION_ALGORITHM_H_INCLUDED
+#pragma once
+
+namespace render {
+
+  // Algorithms to create a palette from a color histogram
+  enum class QuantizationAlgorithm {
+    MedianCut,
+    KMeans,     // Median-cut palette refined with k-means
+  };
+
+} // namespace render
+
+#endif
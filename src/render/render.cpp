@@ -140,6 +140,54 @@ public:
   }
 };
 
+//////////////////////////////////////////////////////////////////////
+// Row blender
+
+// Blends a span of "n" pixels (dst[i] = blend(dst[i], src[i])) so the
+// composite functions don't need to call the blender for each pixel
+// through image iterators. The inner loop is inlined, and for some
+// RGB blend modes it uses the SIMD row blenders from doc/blend_funcs.h.
+template<class DstTraits, class SrcTraits>
+class RowBlender {
+  BlenderHelper<DstTraits, SrcTraits> m_blender;
+public:
+  RowBlender(const Image* src, const Palette* pal, BlendMode blendMode, const bool newBlend)
+    : m_blender(src, pal, blendMode, newBlend) {
+  }
+  inline void operator()(typename DstTraits::pixel_t* dst,
+                         const typename SrcTraits::pixel_t* src,
+                         const int n,
+                         const int opacity) {
+    for (int i=0; i<n; ++i, ++dst, ++src)
+      *dst = m_blender(*dst, *src, opacity);
+  }
+};
+
+template<>
+class RowBlender<RgbTraits, RgbTraits> {
+  BlenderHelper<RgbTraits, RgbTraits> m_blender;
+  BlendRowFunc m_rowFunc;
+  color_t m_maskColor;
+public:
+  RowBlender(const Image* src, const Palette* pal, BlendMode blendMode, const bool newBlend)
+    : m_blender(src, pal, blendMode, newBlend)
+    , m_rowFunc(get_rgba_row_blender(blendMode, newBlend))
+    , m_maskColor(src->maskColor()) {
+  }
+  inline void operator()(RgbTraits::pixel_t* dst,
+                         const RgbTraits::pixel_t* src,
+                         const int n,
+                         const int opacity) {
+    if (m_rowFunc) {
+      m_rowFunc(dst, src, n, opacity, m_maskColor);
+    }
+    else {
+      for (int i=0; i<n; ++i, ++dst, ++src)
+        *dst = m_blender(*dst, *src, opacity);
+    }
+  }
+};
+
 template<class DstTraits, class SrcTraits>
 void composite_image_without_scale(
   Image* dst, const Image* src, const Palette* pal,
@@ -155,7 +203,7 @@ void composite_image_without_scale(
   ASSERT(DstTraits::pixel_format == dst->pixelFormat());
   ASSERT(SrcTraits::pixel_format == src->pixelFormat());
 
-  BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
+  RowBlender<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
 
   gfx::Clip area(areaF);
   if (!area.clip(dst->width(), dst->height(),
@@ -164,35 +212,16 @@ void composite_image_without_scale(
 
   gfx::Rect srcBounds = area.srcBounds();
   gfx::Rect dstBounds = area.dstBounds();
-  int bottom = dstBounds.y2()-1;
 
   ASSERT(!srcBounds.isEmpty());
-
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
-  typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
+  ASSERT(srcBounds.w == dstBounds.w);
 
   // For each line to draw of the source image...
-  dstBounds.h = 1;
   for (int y=0; y<srcBounds.h; ++y) {
-    dst_it = dstBits.begin_area(dstBounds);
-    dst_end = dstBits.end_area(dstBounds);
-
-    for (int x=0; x<srcBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
-      *dst_it = blender(*dst_it, *src_it, opacity);
-      ++src_it;
-      ++dst_it;
-    }
-
-    if (++dstBounds.y > bottom)
-      break;
+    blender(
+      get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y+y),
+      get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcBounds.y+y),
+      srcBounds.w, opacity);
   }
 }
 
@@ -217,7 +246,7 @@ void composite_image_scale_up(
                  int(sy*double(src->height()))))
     return;
 
-  BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
+  RowBlender<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
   int px_x, px_y;
   int px_w = int(sx);
   int px_h = int(sy);
@@ -247,12 +276,7 @@ void composite_image_scale_up(
 #endif
 
   // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
   LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  typename LockImageBits<SrcTraits>::const_iterator src_it = srcBits.begin();
-#ifdef _DEBUG
-  typename LockImageBits<SrcTraits>::const_iterator src_end = srcBits.end();
-#endif
   typename LockImageBits<DstTraits>::iterator dst_it, dst_end;
 
   // For each line to draw of the source image...
@@ -261,15 +285,14 @@ void composite_image_scale_up(
     dst_it = dstBits.begin_area(dstBounds);
     dst_end = dstBits.end_area(dstBounds);
 
-    // Read 'src' and 'dst' and blend them, put the result in `scanline'
+    // Read the 'dst' pixels that will be blended with each 'src'
+    // pixel, put them in `scanline', and blend the whole row
     scanline_it = scanline.begin();
     for (int x=0; x<srcBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
       ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
       ASSERT(scanline_it >= scanline.begin() && scanline_it < scanline_end);
 
-      *scanline_it = blender(*dst_it, *src_it, opacity);
-      ++src_it;
+      *scanline_it = *dst_it;
 
       int delta;
       if (x == 0)
@@ -283,6 +306,10 @@ void composite_image_scale_up(
       ++scanline_it;
     }
 
+    blender(&scanline[0],
+            get_pixel_address_fast<SrcTraits>(src, srcBounds.x, srcBounds.y+y),
+            srcBounds.w, opacity);
+
     // Get the 'height' of the line to be painted in 'dst'
     if ((y == 0) && (first_px_h > 0))
       line_h = first_px_h;
@@ -357,7 +384,7 @@ void composite_image_scale_down(
                  int(sy*double(src->height()))))
     return;
 
-  BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
+  RowBlender<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
   int step_w = int(1.0 / sx);
   int step_h = int(1.0 / sy);
   if (step_w < 1 || step_h < 1)
@@ -373,34 +400,20 @@ void composite_image_scale_down(
 
   gfx::Rect dstBounds = area.dstBounds();
 
-  // Lock all necessary bits
-  const LockImageBits<SrcTraits> srcBits(src, srcBounds);
-  LockImageBits<DstTraits> dstBits(dst, dstBounds);
-  auto src_it = srcBits.begin();
-  auto dst_it = dstBits.begin();
-#ifdef _DEBUG
-  auto src_end = srcBits.end();
-  auto dst_end = dstBits.end();
-#endif
-
-  // Adjust to src_it for each line
-  int adjust_per_line = (dstBounds.w*step_w)*(step_h-1);
+  // Source pixels (one each step_w pixels) to blend in each row
+  std::vector<typename SrcTraits::pixel_t> srcRow(dstBounds.w);
 
   // For each line to draw of the source image...
   for (int y=0; y<dstBounds.h; ++y) {
-    for (int x=0; x<dstBounds.w; ++x) {
-      ASSERT(src_it >= srcBits.begin() && src_it < src_end);
-      ASSERT(dst_it >= dstBits.begin() && dst_it < dst_end);
+    auto srcPtr = get_pixel_address_fast<SrcTraits>(
+      src, srcBounds.x, srcBounds.y+y*step_h);
 
-      *dst_it = blender(*dst_it, *src_it, opacity);
-
-      // Skip columns
-      src_it += step_w;
-      ++dst_it;
-    }
+    // Skip columns
+    for (int x=0; x<dstBounds.w; ++x, srcPtr += step_w)
+      srcRow[x] = *srcPtr;
 
-    // Skip rows
-    src_it += adjust_per_line;
+    blender(get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstBounds.y+y),
+            &srcRow[0], dstBounds.w, opacity);
   }
 }
 
@@ -424,7 +437,7 @@ void composite_image_general(
                  sx*src->width(), sy*src->height()))
     return;
 
-  BlenderHelper<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
+  RowBlender<DstTraits, SrcTraits> blender(src, pal, blendMode, newBlend);
 
   gfx::Rect dstBounds(
     area.dstBounds().x, area.dstBounds().y,
@@ -433,6 +446,11 @@ void composite_image_general(
   gfx::RectF srcBounds = area.srcBounds();
 
   dstBounds &= dst->bounds();
+  if (dstBounds.isEmpty())
+    return;
+
+  // Source pixels to blend in each row
+  std::vector<typename SrcTraits::pixel_t> srcRow(dstBounds.w);
 
   int dstY = dstBounds.y;
   double srcXStart = srcBounds.x / sx;
@@ -453,15 +471,12 @@ void composite_image_general(
     auto dstPtr = get_pixel_address_fast<DstTraits>(dst, dstBounds.x, dstY);
     auto srcPtr = get_pixel_address_fast<SrcTraits>(src, int(srcX), srcY);
 
-#if _DEBUG
-    int dstX = dstBounds.x;
-#endif
-
-    for (int x=0; x<dstBounds.w; ++dstPtr) {
-      ASSERT(dstX >= 0 && dstX < dst->width());
+    // Collect the source pixels for this row
+    int x = 0;
+    while (x < dstBounds.w) {
       ASSERT(srcX >= 0 && srcX < src->width());
 
-      *dstPtr = blender(*dstPtr, *srcPtr, opacity);
+      srcRow[x] = *srcPtr;
       ++x;
 
       oldSrcX = int(srcX);
@@ -470,11 +485,9 @@ void composite_image_general(
       if (srcX >= srcWidth)
         break;
       srcPtr += int(srcX - oldSrcX);
-
-#if _DEBUG
-      ++dstX;
-#endif
     }
+
+    blender(dstPtr, &srcRow[0], x, opacity);
   }
 }
 
@@ -538,6 +551,10 @@ Render::Render()
   , m_previewImage(nullptr)
   , m_previewBlendMode(BlendMode::NORMAL)
   , m_onionskin(OnionskinType::NONE)
+  , m_layersRange(LayersRange::All)
+  , m_rangeLayer(nullptr)
+  , m_rangeBackdrop(nullptr)
+  , m_rangeLayerReached(false)
 {
 }
 
@@ -642,6 +659,28 @@ void Render::disableOnionskin()
   m_onionskin.type(OnionskinType::NONE);
 }
 
+void Render::setRenderLayersBelow(const Layer* layer)
+{
+  m_layersRange = LayersRange::Below;
+  m_rangeLayer = layer;
+  m_rangeBackdrop = nullptr;
+}
+
+void Render::setRenderLayersFrom(const Layer* layer, const Image* backdrop)
+{
+  ASSERT(backdrop);
+  m_layersRange = LayersRange::From;
+  m_rangeLayer = layer;
+  m_rangeBackdrop = backdrop;
+}
+
+void Render::removeRenderLayersRange()
+{
+  m_layersRange = LayersRange::All;
+  m_rangeLayer = nullptr;
+  m_rangeBackdrop = nullptr;
+}
+
 void Render::renderSprite(
   Image* dstImage,
   const Sprite* sprite,
@@ -716,14 +755,23 @@ void Render::renderSprite(
 
   // New Blending Method:
   if (m_newBlendMethod) {
+    // Start from the already rendered layers below m_rangeLayer
+    if (m_layersRange == LayersRange::From)
+      copy_image(dstImage, m_rangeBackdrop, int(area.dst.x), int(area.dst.y));
     // Clear dstImage with the bg_color (if the background is not a
     // special background pattern like the checked background, this is
     // enough as a base color).
-    fill_rect(dstImage, area.dstBounds(), bg_color);
+    else
+      fill_rect(dstImage, area.dstBounds(), bg_color);
 
     // Draw the Background layer - Onion skin behind the sprite - Transparent Layers
     renderSpriteLayers(dstImage, area, frame, compositeImage);
 
+    // The backdrop doesn't include the background (it's drawn below
+    // all layers at the end)
+    if (m_layersRange == LayersRange::Below)
+      return;
+
     // In case that we need a special background (e.g. like the
     // checked pattern), we can draw the background in a temporal
     // image and then merge this temporal image with the dstImage.
@@ -741,8 +789,15 @@ void Render::renderSprite(
   }
   // Old Blending Method:
   else {
-    renderBackground(dstImage, bgLayer, bg_color, area);
+    if (m_layersRange == LayersRange::From)
+      copy_image(dstImage, m_rangeBackdrop, int(area.dst.x), int(area.dst.y));
+    else
+      renderBackground(dstImage, bgLayer, bg_color, area);
+
     renderSpriteLayers(dstImage, area, frame, compositeImage);
+
+    if (m_layersRange == LayersRange::Below)
+      return;
   }
 
   // Draw onion skin in front of the sprite.
@@ -776,6 +831,7 @@ void Render::renderSpriteLayers(Image* dstImage,
 {
   // Draw the background layer.
   m_globalOpacity = 255;
+  m_rangeLayerReached = false;
   renderLayer(m_sprite->root(), dstImage,
               area, frame, compositeImage,
               true,
@@ -789,6 +845,7 @@ void Render::renderSpriteLayers(Image* dstImage,
 
   // Draw the transparent layers.
   m_globalOpacity = 255;
+  m_rangeLayerReached = false;
   renderLayer(m_sprite->root(), dstImage,
               area, frame, compositeImage,
               false,
@@ -999,6 +1056,20 @@ void Render::renderLayer(
   if (!layer->isVisible())
     return;
 
+  // Skip layers outside the range of layers to render (if we are
+  // rendering a range of layers)
+  if (m_layersRange != LayersRange::All) {
+    if (layer == m_rangeLayer)
+      m_rangeLayerReached = true;
+
+    if (m_layersRange == LayersRange::Below) {
+      if (m_rangeLayerReached)
+        return;
+    }
+    else if (!m_rangeLayerReached && !layer->isGroup())
+      return;
+  }
+
   if (m_selectedLayerForOpacity == layer)
     isSelected = true;
 
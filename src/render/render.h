@@ -50,6 +50,12 @@ namespace render {
       ShowRefLayers = 1,
     };
 
+    enum class LayersRange {
+      All,
+      Below,
+      From,
+    };
+
   public:
     Render();
 
@@ -90,6 +96,16 @@ namespace render {
     void setOnionskin(const OnionskinOptions& options);
     void disableOnionskin();
 
+    // Renders only a part of the stack of layers in renderSprite():
+    // the layers below "layer" (i.e. the backdrop where "layer" is
+    // composited), or "layer" and the layers above it over a
+    // "backdrop" image previously rendered with
+    // setRenderLayersBelow(). The backdrop must have the size of the
+    // rendered area. Onion skinning is not supported in these modes.
+    void setRenderLayersBelow(const Layer* layer);
+    void setRenderLayersFrom(const Layer* layer, const Image* backdrop);
+    void removeRenderLayersRange();
+
     void renderSprite(
       Image* dstImage,
       const Sprite* sprite,
@@ -225,6 +241,10 @@ namespace render {
     BlendMode m_previewBlendMode;
     OnionskinOptions m_onionskin;
     ImageBufferPtr m_tmpBuf;
+    LayersRange m_layersRange;
+    const Layer* m_rangeLayer;
+    const Image* m_rangeBackdrop;
+    bool m_rangeLayerReached;
   };
 
   void composite_image(Image* dst,
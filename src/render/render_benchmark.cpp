@@ -18,40 +18,48 @@
 #include "doc/sprite.h"
 
 #include <benchmark/benchmark.h>
+#include <memory>
 
 using namespace doc;
 using namespace render;
 
-static void Bm_Render(benchmark::State& state)
+// Sprite with "nlayers" layers of w*h pixels (each layer with the
+// given blend mode) used to compare the performance of the
+// composite functions.
+static Sprite* make_sprite(const int w, const int h,
+                           const int nlayers,
+                           const BlendMode blendMode)
 {
-  const int w = state.range(0);
-  const int h = state.range(1);
-
   Sprite* spr = Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, w, h));
-  LayerImage* lay1 = static_cast<LayerImage*>(spr->root()->firstLayer());
-  LayerImage* lay2 = new LayerImage(spr);
-  LayerImage* lay3 = new LayerImage(spr);
-
-  spr->root()->addLayer(lay2);
-  spr->root()->addLayer(lay3);
-
-  Image* img1 = lay1->cel(0)->image();
-  ImageRef img2(Image::create(spr->pixelFormat(), w, h));
-  ImageRef img3(Image::create(spr->pixelFormat(), w, h));
-  Cel* cel2 = new Cel(frame_t(0), img2);
-  Cel* cel3 = new Cel(frame_t(0), img3);
-
-  lay2->addCel(cel2);
-  lay3->addCel(cel3);
-
-  clear_image(img1, 0);
-  clear_image(img2.get(), 0);
-  clear_image(img3.get(), 0);
-  fill_rect(img1, 32, 32, w-64, h-64, rgba(32, 128, 255, 128));
-  fill_rect(img2.get(), 0, 0, w-64, h-64, rgba(255, 100, 32, 128));
-  fill_rect(img3.get(), 64, 64, w-64, h-64, rgba(200, 64, 80, 128));
-
-  std::unique_ptr<Image> dst(Image::create(spr->pixelFormat(), w, h));
+  LayerImage* lay = static_cast<LayerImage*>(spr->root()->firstLayer());
+
+  for (int i=0; i<nlayers; ++i) {
+    if (i > 0) {
+      lay = new LayerImage(spr);
+      lay->setBlendMode(blendMode);
+      spr->root()->addLayer(lay);
+      lay->addCel(new Cel(frame_t(0), ImageRef(Image::create(spr->pixelFormat(), w, h))));
+    }
+
+    Image* img = lay->cel(0)->image();
+    clear_image(img, 0);
+    fill_rect(img, (i*32) % 96, (i*32) % 96, w-64, h-64,
+              rgba((32+i*64) % 256, (128+i*100) % 256, (255+i*32) % 256, 128));
+  }
+  return spr;
+}
+
+static void render_sprite(benchmark::State& state,
+                          const int w, const int h,
+                          const int nlayers,
+                          const BlendMode blendMode,
+                          const Zoom& zoom)
+{
+  std::unique_ptr<Sprite> spr(make_sprite(w, h, nlayers, blendMode));
+
+  const int dw = zoom.apply(w);
+  const int dh = zoom.apply(h);
+  std::unique_ptr<Image> dst(Image::create(spr->pixelFormat(), dw, dh));
   clear_image(dst.get(), 0);
 
   while (state.KeepRunning()) {
@@ -63,12 +71,29 @@ static void Bm_Render(benchmark::State& state)
     render.setBgColor1(rgba(100, 100, 100, 255));
     render.setBgColor2(rgba(200, 200, 200, 255));
     render.setBgCheckedSize(gfx::Size(16, 16));
+    render.setProjection(Projection(PixelRatio(1, 1), zoom));
     render.renderSprite(
-      dst.get(), spr, frame_t(0),
-      gfx::Clip(0, 0, 0, 0, w, h));
+      dst.get(), spr.get(), frame_t(0),
+      gfx::Clip(0, 0, 0, 0, dw, dh));
   }
 }
 
+static void Bm_Render(benchmark::State& state)
+{
+  const int w = state.range(0);
+  const int h = state.range(1);
+  render_sprite(state, w, h, 3, BlendMode::NORMAL, Zoom(1, 1));
+}
+
+// Args: number of layers, blend mode, zoom numerator, zoom denominator
+static void Bm_RenderLayers(benchmark::State& state)
+{
+  const int nlayers = state.range(0);
+  const BlendMode blendMode = BlendMode(state.range(1));
+  const Zoom zoom(state.range(2), state.range(3));
+  render_sprite(state, 1024, 1024, nlayers, blendMode, zoom);
+}
+
 BENCHMARK(Bm_Render)
   ->Args({ 256, 256 })
   ->Args({ 1024, 256 })
@@ -77,4 +102,18 @@ BENCHMARK(Bm_Render)
   ->Args({ 4096, 4096 })
   ->Unit(benchmark::kMicrosecond);
 
+BENCHMARK(Bm_RenderLayers)
+  ->Args({ 1, int(BlendMode::NORMAL), 1, 1 })
+  ->Args({ 4, int(BlendMode::NORMAL), 1, 1 })
+  ->Args({ 16, int(BlendMode::NORMAL), 1, 1 })
+  ->Args({ 4, int(BlendMode::MULTIPLY), 1, 1 })
+  ->Args({ 4, int(BlendMode::SCREEN), 1, 1 })
+  ->Args({ 4, int(BlendMode::OVERLAY), 1, 1 })
+  ->Args({ 4, int(BlendMode::HSL_HUE), 1, 1 })
+  ->Args({ 4, int(BlendMode::NORMAL), 4, 1 })
+  ->Args({ 4, int(BlendMode::MULTIPLY), 4, 1 })
+  ->Args({ 4, int(BlendMode::NORMAL), 1, 4 })
+  ->Args({ 4, int(BlendMode::NORMAL), 3, 2 })
+  ->Unit(benchmark::kMicrosecond);
+
 BENCHMARK_MAIN();
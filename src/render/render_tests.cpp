@@ -265,6 +265,56 @@ TEST(Render, BugWithMultiplesOf3ZoomFactors)
   }
 }
 
+TEST(Render, LayersRange)
+{
+  Document* doc = new Document;
+  Sprite* spr = Sprite::MakeStdSprite(ImageSpec(ColorMode::RGB, 4, 4));
+  doc->sprites().add(spr);
+
+  // Three layers with different blend modes
+  LayerImage* lay[3];
+  lay[0] = static_cast<LayerImage*>(spr->root()->firstLayer());
+  for (int i=1; i<3; ++i) {
+    lay[i] = new LayerImage(spr);
+    spr->root()->addLayer(lay[i]);
+    lay[i]->addCel(new Cel(frame_t(0), ImageRef(Image::create(IMAGE_RGB, 4, 4))));
+  }
+  lay[1]->setBlendMode(BlendMode::MULTIPLY);
+  lay[2]->setBlendMode(BlendMode::SCREEN);
+  for (int i=0; i<3; ++i) {
+    Image* img = lay[i]->cel(0)->image();
+    clear_image(img, 0);
+    fill_rect(img, i, 0, 3, 3, rgba(50+i*80, 200-i*60, 100, 100+i*50));
+  }
+
+  Render render;
+  render.setBgType(BgType::CHECKED);
+  render.setBgColor1(rgba(128, 128, 128, 255));
+  render.setBgColor2(rgba(255, 255, 255, 255));
+  render.setBgCheckedSize(gfx::Size(1, 1));
+
+  for (int newBlend=0; newBlend<2; ++newBlend) {
+    render.setNewBlend(newBlend ? true: false);
+
+    std::unique_ptr<Image> expected(Image::create(IMAGE_RGB, 4, 4));
+    render.renderSprite(expected.get(), spr, frame_t(0));
+
+    for (int i=0; i<3; ++i) {
+      std::unique_ptr<Image> backdrop(Image::create(IMAGE_RGB, 4, 4));
+      std::unique_ptr<Image> dst(Image::create(IMAGE_RGB, 4, 4));
+
+      render.setRenderLayersBelow(lay[i]);
+      render.renderSprite(backdrop.get(), spr, frame_t(0));
+      render.setRenderLayersFrom(lay[i], backdrop.get());
+      render.renderSprite(dst.get(), spr, frame_t(0));
+      render.removeRenderLayersRange();
+
+      EXPECT_EQ(0, count_diff_between_images(expected.get(), dst.get()))
+        << "newBlend=" << newBlend << " layer=" << i;
+    }
+  }
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);